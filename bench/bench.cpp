@@ -0,0 +1,1027 @@
+#include <Aot.hpp>
+#include <Batch.hpp>
+#include <BlockCache.hpp>
+#include <Bus.hpp>
+#include <CPU.hpp>
+#include <Loader.hpp>
+#include <Lockstep.hpp>
+#include <Opcodes.hpp>
+#include <Profile.hpp>
+#include <Replay.hpp>
+#include <Rewind.hpp>
+#include <Scheduler.hpp>
+#include <Snapshot.hpp>
+#include <Types.hpp>
+#ifdef MOS6502_TRACE_FILE
+#include <TraceFile.hpp>
+#endif
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace mos6502;
+
+// Minimal assembler for building benchmark programs: raw bytes plus
+// label fixups for branches and absolute jumps.
+class Assembler {
+  private:
+    mem_t &memory;
+    WORD pc;
+    std::map<std::string, WORD> labels;
+    std::vector<std::pair<WORD, std::string>> rel_fixups;
+    std::vector<std::pair<WORD, std::string>> abs_fixups;
+
+  public:
+    Assembler(mem_t &memory, WORD origin) : memory(memory), pc(origin) {}
+
+    WORD here() const { return pc; }
+
+    Assembler &label(const std::string &name) {
+        labels[name] = pc;
+        return *this;
+    }
+
+    Assembler &emit(BYTE opcode) {
+        memory[pc++] = opcode;
+        return *this;
+    }
+
+    Assembler &emit(BYTE opcode, BYTE operand) {
+        memory[pc++] = opcode;
+        memory[pc++] = operand;
+        return *this;
+    }
+
+    Assembler &emit_abs(BYTE opcode, WORD operand) {
+        memory[pc++] = opcode;
+        memory[pc++] = operand & 0xff;
+        memory[pc++] = (operand >> 8) & 0xff;
+        return *this;
+    }
+
+    Assembler &branch(BYTE opcode, const std::string &target) {
+        memory[pc++] = opcode;
+        rel_fixups.emplace_back(pc++, target);
+        return *this;
+    }
+
+    Assembler &jump(BYTE opcode, const std::string &target) {
+        memory[pc++] = opcode;
+        abs_fixups.emplace_back(pc, target);
+        pc += 2;
+        return *this;
+    }
+
+    void link() {
+        for (auto &[at, name] : rel_fixups) {
+            memory[at] = BYTE(labels.at(name) - (at + 1));
+        }
+        for (auto &[at, name] : abs_fixups) {
+            memory[at] = labels.at(name) & 0xff;
+            memory[at + 1] = (labels.at(name) >> 8) & 0xff;
+        }
+    }
+};
+
+static void set_reset_vector(mem_t &memory, WORD start) {
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+}
+
+// -------------------------------
+// Per-opcode throughput
+// -------------------------------
+
+static constexpr WORD CODE_START = 0x8000;
+static constexpr WORD CODE_SIZE = 0x1000;
+
+// Fill the code region with back-to-back copies of one opcode. Operands
+// are chosen so that every copy falls through to the next: branches
+// have offset 0, jumps and calls target the next copy, the stack page
+// is primed so RTS and RTI return into the region, and BRK vectors to
+// its start.
+static void load_opcode_workload(mem_t &memory, BYTE opcode) {
+    auto [ins, mode, bytes, cycles, mnemonic] = lookup_table[opcode];
+
+    memory.fill(0);
+    set_reset_vector(memory, CODE_START);
+
+    // Indirect pointers: ($20,X) with X=4 and ($20),Y both land in RAM
+    memory[0x0020] = 0x00;
+    memory[0x0021] = 0x40;
+    memory[0x0024] = 0x00;
+    memory[0x0025] = 0x50;
+
+    memory[0xfffe] = CODE_START & 0xff;
+    memory[0xffff] = (CODE_START >> 8) & 0xff;
+    if (ins == INSTRUCTION::RTI) {
+        // Every pull of P, lo and hi reads $80, returning to $8080
+        std::fill(memory.begin() + 0x0100, memory.begin() + 0x0200, 0x80);
+    }
+    if (ins == INSTRUCTION::RTS) {
+        WORD ret = CODE_START - 1;
+        for (int i = 0; i < 0x100; i += 2) {
+            memory[0x0100 + i] = ret & 0xff;
+            memory[0x0100 + i + 1] = (ret >> 8) & 0xff;
+        }
+    }
+
+    int size = bytes;
+    WORD pc = CODE_START;
+    int k = 0;
+    while (pc + size <= CODE_START + CODE_SIZE) {
+        WORD next = pc + size;
+        memory[pc] = opcode;
+        if (mode == ADDRESSING_MODE::RELATIVE) {
+            memory[pc + 1] = 0x00;
+        } else if (ins == INSTRUCTION::JSR ||
+                   (ins == INSTRUCTION::JMP &&
+                    mode == ADDRESSING_MODE::ABSOLUTE)) {
+            memory[pc + 1] = next & 0xff;
+            memory[pc + 2] = (next >> 8) & 0xff;
+        } else if (mode == ADDRESSING_MODE::INDIRECT) {
+            WORD ptr = 0x0300 + 2 * k;
+            memory[ptr] = next & 0xff;
+            memory[ptr + 1] = (next >> 8) & 0xff;
+            memory[pc + 1] = ptr & 0xff;
+            memory[pc + 2] = (ptr >> 8) & 0xff;
+        } else if (size == 2) {
+            bool indirect = mode == ADDRESSING_MODE::INDIRECT_X ||
+                            mode == ADDRESSING_MODE::INDIRECT_Y;
+            memory[pc + 1] = indirect ? 0x20 : 0x10;
+        } else if (size == 3) {
+            memory[pc + 1] = 0x34;
+            memory[pc + 2] = 0x12;
+        }
+        pc = next;
+        k++;
+    }
+}
+
+static void BM_opcode(benchmark::State &state, BYTE opcode) {
+    static mem_t memory;
+    load_opcode_workload(memory, opcode);
+
+    CPU cpu(memory);
+    cpu.reset();
+    cpu.x = 0x04;
+    cpu.y = 0xa0;
+
+    const WORD end = CODE_START + CODE_SIZE - 3;
+    int64_t instructions = 0;
+    for (auto _ : state) {
+        for (int i = 0; i < 1000; i++) {
+            if (cpu.pc < CODE_START || cpu.pc >= end) {
+                cpu.pc = CODE_START;
+            }
+            BYTE opcode = cpu.fetch_opcode();
+            cpu.execute(opcode);
+        }
+        instructions += 1000;
+    }
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["IPS"] =
+        benchmark::Counter(instructions, benchmark::Counter::kIsRate);
+}
+
+static bool benchmarked(INSTRUCTION ins) {
+    return ins != INSTRUCTION::INVALID;
+}
+
+static void register_opcode_benchmarks() {
+    for (int opcode = 0; opcode < 0x100; opcode++) {
+        const Instruction_info &info = lookup_table[opcode];
+        if (!benchmarked(info.ins)) {
+            continue;
+        }
+        std::string name = std::string("BM_opcode/") + info.mnemonic + "/" +
+                           mode_name(info.mode);
+        benchmark::RegisterBenchmark(name.c_str(), BM_opcode, BYTE(opcode));
+    }
+}
+
+// -------------------------------
+// Synthetic programs
+// -------------------------------
+
+// Copy the page at $2000 to $3000, forever
+static void load_memcpy(mem_t &memory) {
+    memory.fill(0);
+    set_reset_vector(memory, CODE_START);
+    for (int i = 0; i < 0x100; i++) {
+        memory[0x2000 + i] = i * 7;
+    }
+
+    Assembler as(memory, CODE_START);
+    as.label("start")
+        .emit(0xa0, 0x00) // LDY #$00
+        .label("loop")
+        .emit_abs(0xb9, 0x2000) // LDA $2000,Y
+        .emit_abs(0x99, 0x3000) // STA $3000,Y
+        .emit(0xc8)             // INY
+        .branch(0xd0, "loop")   // BNE loop
+        .jump(0x4c, "start");   // JMP start
+    as.link();
+}
+
+// 8x8 -> 16 bit shift-and-add multiply of $10 * $11 into $13:$12,
+// stepping the multiplier through every value
+static void load_multiply(mem_t &memory) {
+    memory.fill(0);
+    set_reset_vector(memory, CODE_START);
+    memory[0x0011] = 0xb7;
+
+    Assembler as(memory, CODE_START);
+    as.label("start")
+        .emit(0xa5, 0x14) // LDA $14
+        .emit(0x85, 0x10) // STA $10
+        .emit(0xa9, 0x00) // LDA #$00
+        .emit(0xa2, 0x08) // LDX #$08
+        .emit(0x46, 0x10) // LSR $10
+        .label("loop")
+        .branch(0x90, "no_add") // BCC no_add
+        .emit(0x18)             // CLC
+        .emit(0x65, 0x11)       // ADC $11
+        .label("no_add")
+        .emit(0x6a)           // ROR A
+        .emit(0x66, 0x10)     // ROR $10
+        .emit(0xca)           // DEX
+        .branch(0xd0, "loop") // BNE loop
+        .emit(0x85, 0x13)     // STA $13
+        .emit(0xa5, 0x10)     // LDA $10
+        .emit(0x85, 0x12)     // STA $12
+        .emit(0xe6, 0x14)     // INC $14
+        .jump(0x4c, "start"); // JMP start
+    as.link();
+}
+
+// Classify a page of pseudo-random bytes with data-dependent branches
+static void load_branchy(mem_t &memory) {
+    memory.fill(0);
+    set_reset_vector(memory, CODE_START);
+    uint32_t seed = 0x12345678;
+    for (int i = 0; i < 0x100; i++) {
+        seed = seed * 1103515245 + 12345;
+        memory[0x2000 + i] = (seed >> 16) & 0xff;
+    }
+
+    Assembler as(memory, CODE_START);
+    as.label("start")
+        .emit(0xa2, 0x00) // LDX #$00
+        .label("loop")
+        .emit_abs(0xbd, 0x2000) // LDA $2000,X
+        .branch(0x30, "neg")    // BMI neg
+        .emit(0xc9, 0x40)       // CMP #$40
+        .branch(0x90, "small")  // BCC small
+        .emit(0xc8)             // INY
+        .jump(0x4c, "next")     // JMP next
+        .label("small")
+        .emit(0x88)         // DEY
+        .jump(0x4c, "next") // JMP next
+        .label("neg")
+        .emit(0x29, 0x01)     // AND #$01
+        .branch(0xf0, "next") // BEQ next
+        .emit(0xe6, 0x10)     // INC $10
+        .label("next")
+        .emit(0xe8)           // INX
+        .branch(0xd0, "loop") // BNE loop
+        .jump(0x4c, "start"); // JMP start
+    as.link();
+}
+
+// Chain of flag-setting ALU operations over a page of data
+static void load_alu(mem_t &memory) {
+    memory.fill(0);
+    set_reset_vector(memory, CODE_START);
+    for (int i = 0; i < 0x100; i++) {
+        memory[0x2000 + i] = i * 13;
+    }
+    memory[0x0011] = 0xf7;
+    memory[0x0012] = 0x21;
+
+    Assembler as(memory, CODE_START);
+    as.label("start")
+        .emit(0xa2, 0x00) // LDX #$00
+        .label("loop")
+        .emit_abs(0xbd, 0x2000) // LDA $2000,X
+        .emit(0x65, 0x10)       // ADC $10
+        .emit(0x49, 0x5a)       // EOR #$5A
+        .emit(0x2a)             // ROL A
+        .emit(0x25, 0x11)       // AND $11
+        .emit(0x05, 0x12)       // ORA $12
+        .emit(0xe9, 0x13)       // SBC #$13
+        .emit(0xc9, 0x80)       // CMP #$80
+        .emit(0x0a)             // ASL A
+        .emit(0x85, 0x10)       // STA $10
+        .emit(0xe8)             // INX
+        .branch(0xd0, "loop")   // BNE loop
+        .jump(0x4c, "start");   // JMP start
+    as.link();
+}
+
+static void BM_program(benchmark::State &state, void (*load)(mem_t &)) {
+    static mem_t memory;
+    load(memory);
+
+    CPU cpu(memory);
+    cpu.reset();
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += cpu.run_for_cycles(10000);
+    }
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_program, memcpy, load_memcpy);
+BENCHMARK_CAPTURE(BM_program, multiply, load_multiply);
+BENCHMARK_CAPTURE(BM_program, branchy, load_branchy);
+BENCHMARK_CAPTURE(BM_program, alu, load_alu);
+
+// Same, one execute(BYTE) call per instruction, the dispatch the run
+// loops use when not built with MOS6502_THREADED
+static void BM_program_execute(benchmark::State &state,
+                               void (*load)(mem_t &)) {
+    static mem_t memory;
+    load(memory);
+
+    CPU cpu(memory);
+    cpu.reset();
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        uint64_t end = cpu.cycles + 10000;
+        uint64_t start = cpu.cycles;
+        while (cpu.cycles < end) {
+            cpu.execute(cpu.fetch_opcode());
+        }
+        cycles += cpu.cycles - start;
+    }
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_program_execute, memcpy, load_memcpy);
+BENCHMARK_CAPTURE(BM_program_execute, multiply, load_multiply);
+BENCHMARK_CAPTURE(BM_program_execute, branchy, load_branchy);
+BENCHMARK_CAPTURE(BM_program_execute, alu, load_alu);
+
+// Same, counting every instruction into a Profile
+static void BM_program_profiled(benchmark::State &state,
+                                void (*load)(mem_t &)) {
+    static mem_t memory;
+    load(memory);
+
+    CPU cpu(memory);
+    cpu.reset();
+    Profile profile;
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += cpu.run_for_cycles(10000, profile);
+    }
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_program_profiled, memcpy, load_memcpy);
+BENCHMARK_CAPTURE(BM_program_profiled, multiply, load_multiply);
+BENCHMARK_CAPTURE(BM_program_profiled, branchy, load_branchy);
+BENCHMARK_CAPTURE(BM_program_profiled, alu, load_alu);
+
+#ifdef MOS6502_TRACE
+// Same, recording every instruction into a ring
+static void BM_program_traced(benchmark::State &state,
+                              void (*load)(mem_t &)) {
+    static mem_t memory;
+    load(memory);
+
+    CPU cpu(memory);
+    cpu.reset();
+    Trace_buffer trace(1 << 8);
+    cpu.set_trace(&trace);
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += cpu.run_for_cycles(10000);
+    }
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_program_traced, memcpy, load_memcpy);
+BENCHMARK_CAPTURE(BM_program_traced, alu, load_alu);
+
+#ifdef MOS6502_TRACE_FILE
+// Same, streaming the trace compressed to a file on the spare cores
+static void BM_program_trace_file(benchmark::State &state,
+                                  void (*load)(mem_t &)) {
+    static mem_t memory;
+    load(memory);
+
+    CPU cpu(memory);
+    cpu.reset();
+    Trace_buffer trace(1 << 16);
+    cpu.set_trace(&trace);
+    unsigned n_cores = std::thread::hardware_concurrency();
+    Trace_writer writer("/tmp/mos6502_bench.trace",
+                        n_cores > 1 ? n_cores - 1 : 1);
+    writer.attach(trace);
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += cpu.run_for_cycles(10000);
+    }
+    writer.close();
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_program_trace_file, memcpy, load_memcpy)->UseRealTime();
+BENCHMARK_CAPTURE(BM_program_trace_file, alu, load_alu)->UseRealTime();
+#endif
+#endif
+
+// alu with a device event every state.range(0) cycles
+static void BM_program_events(benchmark::State &state) {
+    static mem_t memory;
+    load_alu(memory);
+
+    CPU cpu(memory);
+    cpu.reset();
+    Scheduler &events = cpu.get_scheduler();
+    uint64_t period = state.range(0);
+    int64_t fired = 0;
+    event_callback_t tick = [&](uint64_t cycle) {
+        fired++;
+        events.schedule(cycle + period, tick);
+    };
+    events.schedule(cpu.cycles + period, tick);
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += cpu.run_for_cycles(10000);
+    }
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+    state.counters["events/s"] =
+        benchmark::Counter(fired, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_program_events)->Arg(100)->Arg(1000)->Arg(100000);
+
+// Polling a device register that changes every 10000 cycles, with and
+// without idle skipping
+static void BM_idle(benchmark::State &state, bool skip) {
+    static mem_t memory;
+    memory.fill(0);
+    set_reset_vector(memory, CODE_START);
+    Assembler as(memory, CODE_START);
+    as.label("wait")
+        .emit_abs(0xad, 0xd012) // LDA $D012
+        .branch(0xd0, "wait")   // BNE wait
+        .jump(0x4c, "wait");    // JMP wait
+    as.link();
+
+    Bus bus(memory);
+    CPU cpu(bus);
+    BYTE line = 0;
+    bus.map_device(
+        0xd0, 1, [&](WORD) { return line; }, [](WORD, BYTE) {});
+    bus.set_idle_safe(0xd0, 1, true);
+    event_callback_t raster = [&](uint64_t cycle) {
+        line++;
+        bus.get_scheduler().schedule(cycle + 10000, raster);
+    };
+    cpu.reset();
+    cpu.set_idle_skip(skip);
+    bus.get_scheduler().schedule(cpu.cycles + 10000, raster);
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += cpu.run_for_cycles(1000000);
+    }
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_idle, polling, false);
+BENCHMARK_CAPTURE(BM_idle, skipped, true);
+
+// Reading a device on every loop, plain and logged for replay
+static void BM_device_reads(benchmark::State &state, bool recorded) {
+    static mem_t memory;
+    memory.fill(0);
+    set_reset_vector(memory, CODE_START);
+    Assembler as(memory, CODE_START);
+    as.label("loop")
+        .emit_abs(0xad, 0xd012) // LDA $D012
+        .emit(0x85, 0x10)       // STA $10
+        .jump(0x4c, "loop");    // JMP loop
+    as.link();
+
+    CPU cpu(memory);
+    BYTE line = 0;
+    Replay_log log;
+    Replay_recorder recorder(cpu, log);
+    read_callback_t read = [&](WORD) { return line++; };
+    if (recorded) {
+        recorder.map_device(0xd0, 1, read, [](WORD, BYTE) {});
+    } else {
+        cpu.get_bus().map_device(0xd0, 1, read, [](WORD, BYTE) {});
+    }
+    cpu.reset();
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        log.clear();
+        cycles += cpu.run_for_cycles(100000);
+    }
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_device_reads, plain, false);
+BENCHMARK_CAPTURE(BM_device_reads, recorded, true);
+
+// Running totals of a page of BCD amounts, added in and subtracted out,
+// in binary (CLD) or decimal (SED) mode
+static void BM_arithmetic(benchmark::State &state, bool decimal) {
+    static mem_t memory;
+    memory.fill(0);
+    set_reset_vector(memory, CODE_START);
+    for (int i = 0; i < 0x100; i++) {
+        memory[0x2000 + i] = ((i % 10) << 4) | ((i * 7) % 10);
+    }
+
+    Assembler as(memory, CODE_START);
+    as.label("start")
+        .emit(decimal ? 0xf8 : 0xd8) // SED or CLD
+        .emit(0xa2, 0x00)            // LDX #$00
+        .label("loop")
+        .emit(0x18)             // CLC
+        .emit(0xa5, 0x10)       // LDA $10
+        .emit_abs(0x7d, 0x2000) // ADC $2000,X
+        .emit(0x85, 0x10)       // STA $10
+        .emit(0xa5, 0x11)       // LDA $11
+        .emit(0x69, 0x00)       // ADC #$00
+        .emit(0x85, 0x11)       // STA $11
+        .emit(0x38)             // SEC
+        .emit(0xa5, 0x12)       // LDA $12
+        .emit_abs(0xfd, 0x2000) // SBC $2000,X
+        .emit(0x85, 0x12)       // STA $12
+        .emit(0xe8)             // INX
+        .branch(0xd0, "loop")   // BNE loop
+        .jump(0x4c, "start");   // JMP start
+    as.link();
+
+    CPU cpu(memory);
+    cpu.reset();
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += cpu.run_for_cycles(10000);
+    }
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_arithmetic, binary, false);
+BENCHMARK_CAPTURE(BM_arithmetic, decimal, true);
+
+static void BM_program_cached(benchmark::State &state,
+                              void (*load)(mem_t &)) {
+    static mem_t memory;
+    load(memory);
+
+    CPU cpu(memory);
+    cpu.reset();
+    Block_cache cache(cpu);
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += cache.run_for_cycles(10000);
+    }
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_program_cached, memcpy, load_memcpy);
+BENCHMARK_CAPTURE(BM_program_cached, multiply, load_multiply);
+BENCHMARK_CAPTURE(BM_program_cached, branchy, load_branchy);
+BENCHMARK_CAPTURE(BM_program_cached, alu, load_alu);
+
+// Same, dispatching every instruction on its own
+static void BM_program_unfused(benchmark::State &state,
+                               void (*load)(mem_t &)) {
+    static mem_t memory;
+    load(memory);
+
+    CPU cpu(memory);
+    cpu.reset();
+    Block_cache cache(cpu);
+    cache.set_fusion(false);
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += cache.run_for_cycles(10000);
+    }
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_program_unfused, memcpy, load_memcpy);
+BENCHMARK_CAPTURE(BM_program_unfused, multiply, load_multiply);
+BENCHMARK_CAPTURE(BM_program_unfused, branchy, load_branchy);
+BENCHMARK_CAPTURE(BM_program_unfused, alu, load_alu);
+
+#ifdef MOS6502_JIT
+static void BM_program_jit(benchmark::State &state, void (*load)(mem_t &)) {
+    static mem_t memory;
+    load(memory);
+
+    CPU cpu(memory);
+    cpu.reset();
+    Block_cache cache(cpu);
+    cache.set_jit(true);
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += cache.run_for_cycles(10000);
+    }
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_program_jit, memcpy, load_memcpy);
+BENCHMARK_CAPTURE(BM_program_jit, multiply, load_multiply);
+BENCHMARK_CAPTURE(BM_program_jit, branchy, load_branchy);
+BENCHMARK_CAPTURE(BM_program_jit, alu, load_alu);
+#endif
+
+// Generated by mos6502_aot from test/aot_rom.hex at build time
+extern const Aot_program aot_test_program;
+
+// The test ROM, interpreted and through its recompiled blocks
+static void BM_program_aot(benchmark::State &state, bool recompiled) {
+    static mem_t memory;
+    memory.fill(0);
+
+    Bus bus(memory);
+    for (std::size_t i = 0; i < aot_test_program.n_pages; i++) {
+        const Aot_page &page = aot_test_program.pages[i];
+        bus.map_rom(page.page, 1, page.data);
+    }
+    CPU cpu(bus);
+    cpu.reset();
+    Aot_runner runner(cpu, aot_test_program);
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += recompiled ? runner.run_for_cycles(10000)
+                             : cpu.run_for_cycles(10000);
+    }
+    benchmark::DoNotOptimize(cpu.a);
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_program_aot, interpreted, false);
+BENCHMARK_CAPTURE(BM_program_aot, recompiled, true);
+
+// -------------------------------
+// Batch runs
+// -------------------------------
+
+// 256 alu instances for 100k cycles each on state.range(0) workers
+static void BM_batch(benchmark::State &state) {
+    mem_t image;
+    load_alu(image);
+    std::vector<mem_t> images(256, image);
+    Batch_runner runner(state.range(0));
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        std::vector<Batch_result> results =
+            runner.run_for_cycles(images, 100000);
+        for (const Batch_result &result : results) {
+            cycles += result.cycles;
+        }
+    }
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_batch)
+    ->RangeMultiplier(2)
+    ->Range(1, 16)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// -------------------------------
+// Lockstep
+// -------------------------------
+
+// 32 copies of a program, one CPU after another
+static void BM_lanes_scalar(benchmark::State &state,
+                            void (*load)(mem_t &)) {
+    std::vector<mem_t> images(Lockstep::MAX_LANES);
+    std::vector<std::unique_ptr<CPU>> cpus;
+    for (mem_t &image : images) {
+        load(image);
+        cpus.push_back(std::make_unique<CPU>(image));
+        cpus.back()->reset();
+    }
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        for (std::unique_ptr<CPU> &cpu : cpus) {
+            cycles += cpu->run_for_cycles(100000);
+        }
+    }
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_lanes_scalar, memcpy, load_memcpy);
+BENCHMARK_CAPTURE(BM_lanes_scalar, multiply, load_multiply);
+BENCHMARK_CAPTURE(BM_lanes_scalar, branchy, load_branchy);
+BENCHMARK_CAPTURE(BM_lanes_scalar, alu, load_alu);
+
+// The same 32 copies in lockstep
+static void BM_lanes_lockstep(benchmark::State &state,
+                              void (*load)(mem_t &)) {
+    Lockstep lockstep;
+    mem_t image;
+    load(image);
+    for (int lane = 0; lane < lockstep.size(); lane++) {
+        lockstep.load(lane, image);
+    }
+    lockstep.reset();
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += lockstep.run_for_cycles(100000);
+    }
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_lanes_lockstep, memcpy, load_memcpy);
+BENCHMARK_CAPTURE(BM_lanes_lockstep, multiply, load_multiply);
+BENCHMARK_CAPTURE(BM_lanes_lockstep, branchy, load_branchy);
+BENCHMARK_CAPTURE(BM_lanes_lockstep, alu, load_alu);
+
+// -------------------------------
+// Snapshots
+// -------------------------------
+
+// Checkpoint after state.range(0) pages were written
+static void BM_snapshot_take(benchmark::State &state) {
+    static mem_t memory;
+    CPU cpu(memory);
+    Bus &bus = cpu.get_bus();
+    Snapshot_tracker tracker(cpu);
+    tracker.take();
+
+    int n_pages = state.range(0);
+    for (auto _ : state) {
+        for (int page = 0; page < n_pages; page++) {
+            bus.write(page << 8, page);
+        }
+        benchmark::DoNotOptimize(tracker.take());
+    }
+}
+BENCHMARK(BM_snapshot_take)->Arg(1)->Arg(16)->Arg(256);
+
+// Flip between two checkpoints that differ in state.range(0) pages
+static void BM_snapshot_restore(benchmark::State &state) {
+    static mem_t memory;
+    memory.fill(0);
+    CPU cpu(memory);
+    Bus &bus = cpu.get_bus();
+    Snapshot_tracker tracker(cpu);
+    Snapshot before = tracker.take();
+    for (int page = 0; page < state.range(0); page++) {
+        bus.write(page << 8, 0xff);
+    }
+    Snapshot after = tracker.take();
+
+    for (auto _ : state) {
+        tracker.restore(before);
+        tracker.restore(after);
+    }
+}
+BENCHMARK(BM_snapshot_restore)->Arg(1)->Arg(16)->Arg(256);
+
+// -------------------------------
+// Rewind
+// -------------------------------
+
+// memcpy recording a frame every state.range(0) cycles
+static void BM_rewind_record(benchmark::State &state) {
+    static mem_t memory;
+    load_memcpy(memory);
+
+    CPU cpu(memory);
+    cpu.reset();
+    Rewind_buffer rewind(cpu, state.range(0), 1 << 20);
+
+    uint64_t cycles = 0;
+    for (auto _ : state) {
+        cycles += cpu.run_for_cycles(100000);
+    }
+
+    state.counters["cycles/s"] =
+        benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+    state.counters["bytes"] = rewind.bytes();
+}
+BENCHMARK(BM_rewind_record)->Arg(10000)->Arg(100000);
+
+// Seek back to a cycle between frames, 10000 cycles apart with a
+// keyframe every 16, and run forward again untimed
+static void BM_rewind_seek(benchmark::State &state) {
+    static mem_t memory;
+    load_memcpy(memory);
+
+    CPU cpu(memory);
+    cpu.reset();
+    Rewind_buffer rewind(cpu, 10000, 16 << 20);
+    cpu.run_for_cycles(1000000);
+    uint64_t end = cpu.cycles;
+
+    for (auto _ : state) {
+        rewind.seek(end - 155000);
+        state.PauseTiming();
+        cpu.run_for_cycles(end - cpu.cycles);
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_rewind_seek)->Unit(benchmark::kMicrosecond);
+
+// -------------------------------
+// Loading
+// -------------------------------
+
+// 16 KiB ROM image written once to a temporary file
+static const std::string &rom_file() {
+    static const std::string path = [] {
+        std::string path = "/tmp/mos6502_bench_rom.bin";
+        std::vector<char> rom(0x4000);
+        for (std::size_t i = 0; i < rom.size(); i++) {
+            rom[i] = i * 13;
+        }
+        std::ofstream(path, std::ios::binary).write(rom.data(), rom.size());
+        return path;
+    }();
+    return path;
+}
+
+// Load the ROM into an instance by copying it into memory
+static void BM_load_copy(benchmark::State &state) {
+    Rom_image image;
+    std::string error;
+    image.load(rom_file(), Image_format::RAW, 0xc000, error);
+    static mem_t memory;
+    Bus bus(memory);
+    for (auto _ : state) {
+        image.copy_to(memory);
+        benchmark::DoNotOptimize(bus.peek(0xfffc));
+    }
+}
+BENCHMARK(BM_load_copy);
+
+// Load the ROM into an instance by mapping the shared pages. Not faster
+// than a copy that stays in cache, but every instance uses the same 16 KiB.
+static void BM_load_map(benchmark::State &state) {
+    Rom_image image;
+    std::string error;
+    image.load(rom_file(), Image_format::RAW, 0xc000, error);
+    static mem_t memory;
+    Bus bus(memory);
+    for (auto _ : state) {
+        image.map(bus);
+        benchmark::DoNotOptimize(bus.peek(0xfffc));
+    }
+}
+BENCHMARK(BM_load_map);
+
+// -------------------------------
+// Construction
+// -------------------------------
+
+static void BM_construct_mem(benchmark::State &state) {
+    static mem_t memory;
+    for (auto _ : state) {
+        CPU cpu(memory);
+        benchmark::DoNotOptimize(&cpu);
+    }
+}
+BENCHMARK(BM_construct_mem);
+
+static void BM_construct_bus(benchmark::State &state) {
+    static mem_t memory;
+    Bus bus(memory);
+    for (auto _ : state) {
+        CPU cpu(bus);
+        benchmark::DoNotOptimize(&cpu);
+    }
+}
+BENCHMARK(BM_construct_bus);
+
+// -------------------------------
+// Functional test suites
+// -------------------------------
+
+// A test image from start to the trap it ends in once every test passed.
+// Reports instructions and cycles per run and MIPS.
+static void BM_functional(benchmark::State &state, const std::string &path,
+                          Image_format format, WORD origin, WORD start,
+                          WORD pass) {
+    Rom_image image;
+    std::string error;
+    if (!image.load(path, format, 0x0000, error) ||
+        (format == Image_format::RAW && image.size() < 0x10000 &&
+         !image.load(path, format, origin, error))) {
+        state.SkipWithError(error.c_str());
+        return;
+    }
+    auto pristine = std::make_unique<mem_t>();
+    pristine->fill(0);
+    image.copy_to(*pristine);
+    auto memory = std::make_unique<mem_t>();
+
+    // Count the instructions up to the trap
+    *memory = *pristine;
+    CPU counted(*memory);
+    counted.reset();
+    counted.pc = start;
+    Profile profile;
+    counted.run_until(pass, 1000000000, profile);
+    if (counted.pc != pass) {
+        state.SkipWithError("no pass trap within 1e9 cycles");
+        return;
+    }
+
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        *memory = *pristine;
+        CPU cpu(*memory);
+        cpu.reset();
+        cpu.pc = start;
+        state.ResumeTiming();
+        cycles += cpu.run_until(pass, 1000000000);
+        instructions += profile.instructions();
+    }
+
+    state.counters["instructions"] = profile.instructions();
+    state.counters["cycles"] = benchmark::Counter(
+        cycles, benchmark::Counter::kAvgIterations);
+    state.counters["MIPS"] = benchmark::Counter(
+        instructions / 1e6, benchmark::Counter::kIsRate);
+}
+#ifdef MOS6502_FUNCTIONAL_TESTS_DIR
+// Klaus Dormann's suite: a full 64 KiB image, or one loading at $000A
+BENCHMARK_CAPTURE(BM_functional, functional,
+                  std::string(MOS6502_FUNCTIONAL_TESTS_DIR) +
+                      "/6502_functional_test.bin",
+                  Image_format::RAW, 0x000a, 0x0400,
+                  MOS6502_FUNCTIONAL_TESTS_SUCCESS)
+    ->Unit(benchmark::kMillisecond);
+#endif
+// Bruce Clark's decimal mode test, see TEST_FUNCTIONAL.DECIMAL
+BENCHMARK_CAPTURE(BM_functional, decimal, MOS6502_DECIMAL_ROM,
+                  Image_format::INTEL_HEX, 0x0000, 0x0200, 0x020a)
+    ->Unit(benchmark::kMillisecond);
+
+int main(int argc, char **argv) {
+    register_opcode_benchmarks();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
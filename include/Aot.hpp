@@ -0,0 +1,492 @@
+// Aot.hpp
+#pragma once
+
+#include <Bus.hpp>
+#include <CPU.hpp>
+#include <Decimal.hpp>
+#include <Opcodes.hpp>
+#include <Types.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mos6502 {
+// CPU registers unpacked for recompiled code. A block copies them into a
+// local on entry, so the compiler can keep them in host registers across
+// stores to memory, and writes them back on exit and around every access
+// that leaves the direct path.
+struct Aot_registers {
+    BYTE a;
+    BYTE x;
+    BYTE y;
+    BYTE sp;
+    WORD pc;
+    uint64_t cycles;
+    // Flags as CPU keeps them, see CPU::get_p()
+    BYTE n_result;
+    BYTE z_result;
+    BYTE c;
+    BYTE v;
+    BYTE id_flags;
+    uint16_t pending;
+};
+
+// What code generated by mos6502_aot runs against: the CPU, the direct
+// page tables of its bus and the instruction semantics. op<OPCODE>()
+// mirrors the interpreter handler for OPCODE step for step, including
+// when cycles are added relative to bus accesses, so device callbacks see
+// the same CPU state either way. With the operands the generator passes
+// as constants, each call folds down to a handful of host instructions.
+class Aot_context {
+  private:
+    friend class Aot_runner;
+
+    CPU &cpu;
+    const BYTE *const *read_pages;
+    BYTE *const *write_pages;
+
+    // Cycle count a block may not pass when running again, and the
+    // run_until() address, or -1
+    uint64_t bound;
+    int until;
+
+    BYTE read_slow(WORD addr);
+    void write_slow(WORD addr, BYTE value);
+
+    static BYTE page_crossed(WORD from, WORD to) {
+        return ((from ^ to) & 0xff00) != 0 ? 1 : 0;
+    }
+
+  public:
+    explicit Aot_context(CPU &cpu);
+
+    Aot_registers load() const {
+        return Aot_registers{cpu.a,        cpu.x,        cpu.y, cpu.sp,
+                             cpu.pc,       cpu.cycles,   cpu.n_result,
+                             cpu.z_result, cpu.c,        cpu.v,
+                             cpu.id_flags, cpu.pending};
+    }
+
+    void store(const Aot_registers &r) {
+        cpu.a = r.a;
+        cpu.x = r.x;
+        cpu.y = r.y;
+        cpu.sp = r.sp;
+        cpu.pc = r.pc;
+        cpu.cycles = r.cycles;
+        cpu.n_result = r.n_result;
+        cpu.z_result = r.z_result;
+        cpu.c = r.c;
+        cpu.v = r.v;
+        cpu.id_flags = r.id_flags;
+        cpu.pending = r.pending;
+    }
+
+    // Bus access with the registers written back around the slow path,
+    // whose callbacks may look at or change the CPU
+    BYTE read(Aot_registers &r, WORD addr) {
+        const BYTE *page = read_pages[addr >> 8];
+        if (page != nullptr) {
+            return page[addr & 0xff];
+        }
+        store(r);
+        BYTE value = read_slow(addr);
+        r = load();
+        return value;
+    }
+
+    void write(Aot_registers &r, WORD addr, BYTE value) {
+        BYTE *page = write_pages[addr >> 8];
+        if (page != nullptr) {
+            page[addr & 0xff] = value;
+            return;
+        }
+        store(r);
+        write_slow(addr, value);
+        r = load();
+    }
+
+    // Write the registers back when an interrupt became due, so the
+    // block can return to the run loop at this boundary
+    bool leave(Aot_registers &r) {
+        if (r.pending != 0 &&
+            (r.pending & ~((r.id_flags & CPU::FLAG_I) ? CPU::PENDING_IRQ
+                                                       : 0)) != 0) {
+            store(r);
+            return true;
+        }
+        return false;
+    }
+
+    // True when a block taking up to max_cycles may run again from pc
+    bool again(const Aot_registers &r, int max_cycles) const {
+        return r.cycles + max_cycles <= bound && r.pc != until;
+    }
+
+    static BYTE get_p(const Aot_registers &r) {
+        return (r.n_result & CPU::FLAG_N) | (r.v << 6) | CPU::FLAG_U |
+               r.id_flags | (r.z_result == 0 ? CPU::FLAG_Z : 0) | r.c;
+    }
+
+    static void set_p(Aot_registers &r, BYTE p) {
+        r.n_result = p & CPU::FLAG_N;
+        r.z_result = (p & CPU::FLAG_Z) ? 0 : 1;
+        r.v = (p >> 6) & 0x1;
+        r.id_flags = p & (CPU::FLAG_I | CPU::FLAG_D);
+        r.c = p & CPU::FLAG_C;
+    }
+
+    static void update_nz(Aot_registers &r, BYTE value) {
+        r.n_result = value;
+        r.z_result = value;
+    }
+
+    static void add(Aot_registers &r, BYTE rhs) {
+        WORD result = rhs + r.a + r.c;
+        BYTE new_a = result & 0xff;
+        r.c = (result > 0xff) ? 1 : 0;
+        r.v = (((r.a ^ new_a) & (rhs ^ new_a)) & 0x80) >> 7;
+        update_nz(r, new_a);
+        r.a = new_a;
+    }
+
+    void add_decimal(Aot_registers &r, BYTE rhs, bool subtract) const {
+        const Decimal_table &table =
+            decimal_tables[static_cast<int>(cpu.decimal_flags)][subtract];
+        Decimal_result result = decimal_lookup(table, r.a, rhs, r.c);
+        r.a = result.a;
+        r.n_result = result.p;
+        r.z_result = ~result.p & CPU::FLAG_Z;
+        r.c = result.p & CPU::FLAG_C;
+        r.v = (result.p >> 6) & 0x1;
+    }
+
+    static void compare(Aot_registers &r, BYTE lhs, BYTE rhs) {
+        r.c = lhs >= rhs ? 1 : 0;
+        update_nz(r, lhs - rhs);
+    }
+
+    void push(Aot_registers &r, BYTE value) {
+        write(r, 0x0100 | r.sp, value);
+        r.sp--;
+    }
+
+    BYTE pull(Aot_registers &r) {
+        r.sp++;
+        return read(r, 0x0100 | r.sp);
+    }
+
+    template <ADDRESSING_MODE M>
+    WORD effective_address(Aot_registers &r, WORD operand) {
+        if constexpr (M == ADDRESSING_MODE::ZEROPAGE_X) {
+            return (operand + r.x) & 0xff;
+        } else if constexpr (M == ADDRESSING_MODE::ZEROPAGE_Y) {
+            return (operand + r.y) & 0xff;
+        } else if constexpr (M == ADDRESSING_MODE::RELATIVE) {
+            return r.pc + static_cast<int8_t>(operand);
+        } else if constexpr (M == ADDRESSING_MODE::ABSOLUTE_X) {
+            return operand + r.x;
+        } else if constexpr (M == ADDRESSING_MODE::ABSOLUTE_Y) {
+            return operand + r.y;
+        } else if constexpr (M == ADDRESSING_MODE::INDIRECT) {
+            WORD hi_addr = (operand & 0xff00) | ((operand + 1) & 0x00ff);
+            BYTE lo = read(r, operand);
+            return lo | (read(r, hi_addr) << 8);
+        } else if constexpr (M == ADDRESSING_MODE::INDIRECT_X) {
+            BYTE ptr = operand + r.x;
+            BYTE lo = read(r, ptr);
+            return lo | (read(r, BYTE(ptr + 1)) << 8);
+        } else if constexpr (M == ADDRESSING_MODE::INDIRECT_Y) {
+            BYTE ptr = operand;
+            BYTE lo = read(r, ptr);
+            WORD base = lo | (read(r, BYTE(ptr + 1)) << 8);
+            return base + r.y;
+        } else {
+            return operand;
+        }
+    }
+
+    template <ADDRESSING_MODE M> BYTE read(Aot_registers &r, WORD addr) {
+        if constexpr (M == ADDRESSING_MODE::IMMEDIATE) {
+            return addr & 0xff;
+        } else if constexpr (M == ADDRESSING_MODE::ACCUMULATOR) {
+            return r.a;
+        } else {
+            return read(r, addr);
+        }
+    }
+
+    template <ADDRESSING_MODE M>
+    void write(Aot_registers &r, WORD addr, BYTE value) {
+        if constexpr (M == ADDRESSING_MODE::ACCUMULATOR) {
+            r.a = value;
+        } else {
+            write(r, addr, value);
+        }
+    }
+
+    template <ADDRESSING_MODE M> BYTE load(Aot_registers &r, WORD operand) {
+        WORD addr = effective_address<M>(r, operand);
+        if constexpr (M == ADDRESSING_MODE::ABSOLUTE_X) {
+            r.cycles += page_crossed(addr - r.x, addr);
+        } else if constexpr (M == ADDRESSING_MODE::ABSOLUTE_Y ||
+                             M == ADDRESSING_MODE::INDIRECT_Y) {
+            r.cycles += page_crossed(addr - r.y, addr);
+        }
+        return read<M>(r, addr);
+    }
+
+    void branch(Aot_registers &r, bool taken, WORD operand) {
+        if (taken) {
+            WORD target =
+                effective_address<ADDRESSING_MODE::RELATIVE>(r, operand);
+            r.cycles += 1 + page_crossed(r.pc, target);
+            r.pc = target;
+        }
+    }
+
+    // Execute the instruction OPCODE with its operand bytes, pc being the
+    // address after it
+    template <BYTE OPCODE> void op(Aot_registers &r, WORD pc, WORD operand) {
+        constexpr INSTRUCTION I = lookup_table[OPCODE].ins;
+        constexpr ADDRESSING_MODE M = lookup_table[OPCODE].mode;
+        static_assert(I != INSTRUCTION::INVALID,
+                      "invalid opcodes are left to the interpreter");
+        r.pc = pc;
+        r.cycles += lookup_table[OPCODE].cycles;
+
+        if constexpr (I == INSTRUCTION::ADC) {
+            BYTE value = load<M>(r, operand);
+            if (r.id_flags & CPU::FLAG_D) {
+                add_decimal(r, value, false);
+            } else {
+                add(r, value);
+            }
+        } else if constexpr (I == INSTRUCTION::SBC) {
+            BYTE value = load<M>(r, operand);
+            if (r.id_flags & CPU::FLAG_D) {
+                add_decimal(r, value, true);
+            } else {
+                add(r, ~value);
+            }
+        } else if constexpr (I == INSTRUCTION::AND) {
+            r.a &= load<M>(r, operand);
+            update_nz(r, r.a);
+        } else if constexpr (I == INSTRUCTION::ORA) {
+            r.a |= load<M>(r, operand);
+            update_nz(r, r.a);
+        } else if constexpr (I == INSTRUCTION::EOR) {
+            r.a ^= load<M>(r, operand);
+            update_nz(r, r.a);
+        } else if constexpr (I == INSTRUCTION::BIT) {
+            BYTE value = load<M>(r, operand);
+            r.n_result = value;
+            r.z_result = r.a & value;
+            r.v = (value >> 6) & 0x1;
+        } else if constexpr (I == INSTRUCTION::CMP) {
+            compare(r, r.a, load<M>(r, operand));
+        } else if constexpr (I == INSTRUCTION::CPX) {
+            compare(r, r.x, load<M>(r, operand));
+        } else if constexpr (I == INSTRUCTION::CPY) {
+            compare(r, r.y, load<M>(r, operand));
+        } else if constexpr (I == INSTRUCTION::LDA) {
+            r.a = load<M>(r, operand);
+            update_nz(r, r.a);
+        } else if constexpr (I == INSTRUCTION::LDX) {
+            r.x = load<M>(r, operand);
+            update_nz(r, r.x);
+        } else if constexpr (I == INSTRUCTION::LDY) {
+            r.y = load<M>(r, operand);
+            update_nz(r, r.y);
+        } else if constexpr (I == INSTRUCTION::STA) {
+            write<M>(r, effective_address<M>(r, operand), r.a);
+        } else if constexpr (I == INSTRUCTION::STX) {
+            write<M>(r, effective_address<M>(r, operand), r.x);
+        } else if constexpr (I == INSTRUCTION::STY) {
+            write<M>(r, effective_address<M>(r, operand), r.y);
+        } else if constexpr (I == INSTRUCTION::ASL ||
+                             I == INSTRUCTION::LSR ||
+                             I == INSTRUCTION::ROL ||
+                             I == INSTRUCTION::ROR ||
+                             I == INSTRUCTION::INC ||
+                             I == INSTRUCTION::DEC) {
+            WORD addr = effective_address<M>(r, operand);
+            BYTE value = read<M>(r, addr);
+            BYTE carry_in = r.c;
+            if constexpr (I == INSTRUCTION::ASL) {
+                r.c = (value >> 7) & 0x1;
+                value = value << 1;
+            } else if constexpr (I == INSTRUCTION::LSR) {
+                r.c = value & 0x1;
+                value = value >> 1;
+            } else if constexpr (I == INSTRUCTION::ROL) {
+                r.c = (value >> 7) & 0x1;
+                value = (value << 1) | carry_in;
+            } else if constexpr (I == INSTRUCTION::ROR) {
+                r.c = value & 0x1;
+                value = (value >> 1) | (carry_in << 7);
+            } else if constexpr (I == INSTRUCTION::INC) {
+                value++;
+            } else {
+                value--;
+            }
+            update_nz(r, value);
+            write<M>(r, addr, value);
+        } else if constexpr (I == INSTRUCTION::INX) {
+            update_nz(r, ++r.x);
+        } else if constexpr (I == INSTRUCTION::INY) {
+            update_nz(r, ++r.y);
+        } else if constexpr (I == INSTRUCTION::DEX) {
+            update_nz(r, --r.x);
+        } else if constexpr (I == INSTRUCTION::DEY) {
+            update_nz(r, --r.y);
+        } else if constexpr (I == INSTRUCTION::TAX) {
+            r.x = r.a;
+            update_nz(r, r.x);
+        } else if constexpr (I == INSTRUCTION::TAY) {
+            r.y = r.a;
+            update_nz(r, r.y);
+        } else if constexpr (I == INSTRUCTION::TSX) {
+            r.x = r.sp;
+            update_nz(r, r.x);
+        } else if constexpr (I == INSTRUCTION::TXA) {
+            r.a = r.x;
+            update_nz(r, r.a);
+        } else if constexpr (I == INSTRUCTION::TYA) {
+            r.a = r.y;
+            update_nz(r, r.a);
+        } else if constexpr (I == INSTRUCTION::TXS) {
+            r.sp = r.x;
+        } else if constexpr (I == INSTRUCTION::CLC) {
+            r.c = 0;
+        } else if constexpr (I == INSTRUCTION::SEC) {
+            r.c = 1;
+        } else if constexpr (I == INSTRUCTION::CLV) {
+            r.v = 0;
+        } else if constexpr (I == INSTRUCTION::CLD) {
+            r.id_flags &= ~CPU::FLAG_D;
+        } else if constexpr (I == INSTRUCTION::SED) {
+            r.id_flags |= CPU::FLAG_D;
+        } else if constexpr (I == INSTRUCTION::CLI) {
+            r.id_flags &= ~CPU::FLAG_I;
+        } else if constexpr (I == INSTRUCTION::SEI) {
+            r.id_flags |= CPU::FLAG_I;
+        } else if constexpr (I == INSTRUCTION::PHA) {
+            push(r, r.a);
+        } else if constexpr (I == INSTRUCTION::PHP) {
+            push(r, get_p(r) | CPU::FLAG_B | CPU::FLAG_U);
+        } else if constexpr (I == INSTRUCTION::PLA) {
+            r.a = pull(r);
+            update_nz(r, r.a);
+        } else if constexpr (I == INSTRUCTION::PLP) {
+            set_p(r, pull(r));
+        } else if constexpr (I == INSTRUCTION::BCC) {
+            branch(r, r.c == 0, operand);
+        } else if constexpr (I == INSTRUCTION::BCS) {
+            branch(r, r.c == 1, operand);
+        } else if constexpr (I == INSTRUCTION::BEQ) {
+            branch(r, r.z_result == 0, operand);
+        } else if constexpr (I == INSTRUCTION::BNE) {
+            branch(r, r.z_result != 0, operand);
+        } else if constexpr (I == INSTRUCTION::BMI) {
+            branch(r, (r.n_result & CPU::FLAG_N) != 0, operand);
+        } else if constexpr (I == INSTRUCTION::BPL) {
+            branch(r, (r.n_result & CPU::FLAG_N) == 0, operand);
+        } else if constexpr (I == INSTRUCTION::BVC) {
+            branch(r, r.v == 0, operand);
+        } else if constexpr (I == INSTRUCTION::BVS) {
+            branch(r, r.v == 1, operand);
+        } else if constexpr (I == INSTRUCTION::JMP) {
+            r.pc = effective_address<M>(r, operand);
+        } else if constexpr (I == INSTRUCTION::JSR) {
+            WORD ret = r.pc - 1;
+            push(r, ret >> 8);
+            push(r, ret & 0xff);
+            r.pc = operand;
+        } else if constexpr (I == INSTRUCTION::RTS) {
+            BYTE lo = pull(r);
+            BYTE hi = pull(r);
+            r.pc = ((hi << 8) | lo) + 1;
+        } else if constexpr (I == INSTRUCTION::RTI) {
+            set_p(r, pull(r));
+            BYTE lo = pull(r);
+            BYTE hi = pull(r);
+            r.pc = (hi << 8) | lo;
+        } else if constexpr (I == INSTRUCTION::BRK) {
+            // The byte after BRK is skipped
+            r.pc++;
+            push(r, r.pc >> 8);
+            push(r, r.pc & 0xff);
+            push(r, get_p(r) | CPU::FLAG_B);
+            r.id_flags |= CPU::FLAG_I;
+            BYTE lo = read(r, 0xfffe);
+            r.pc = lo | (read(r, 0xffff) << 8);
+        }
+    }
+};
+
+// One basic block of recompiled code, entered at pc with the registers
+// in the CPU and leaving them there. last_pc is the address of its last
+// instruction and max_cycles what one pass can take, penalties included.
+struct Aot_block {
+    WORD pc;
+    WORD last_pc;
+    int max_cycles;
+    void (*run)(Aot_context &ctx);
+};
+
+// A page of the ROM a program was compiled from
+struct Aot_page {
+    BYTE page;
+    const BYTE *data;
+};
+
+// Everything mos6502_aot emits for one ROM
+struct Aot_program {
+    const Aot_block *blocks;
+    std::size_t n_blocks;
+    const Aot_page *pages;
+    std::size_t n_pages;
+};
+
+// Runs a CPU through an Aot_program, with the same contracts as
+// CPU::run_for_cycles() and CPU::run_until(): interrupts are taken and
+// events fired at the same instruction boundaries, and a block only
+// starts when it cannot run past the cycle budget, the next event or the
+// run_until() address. Anywhere else, including after an indirect jump
+// to an address the generator could not see, the interpreter takes over
+// until pc lands on a block again.
+//
+// Recompiled code assumes the ROM cannot change, so it is only used
+// while every page it came from is mapped read-only with the same bytes;
+// otherwise, and while a trace is attached, everything is interpreted.
+// Idle loops are run rather than skipped.
+class Aot_runner {
+  private:
+    CPU &cpu;
+    Bus &bus;
+    Aot_context ctx;
+
+    // Block entered at each address, or nullptr
+    std::vector<const Aot_block *> entries;
+
+    const Aot_program &program;
+    uint32_t bus_generation;
+    bool matches;
+
+    void check_mapping();
+
+    template <bool UNTIL> uint64_t run(uint64_t max_cycles, WORD address);
+
+  public:
+    Aot_runner(CPU &cpu, const Aot_program &program);
+
+    uint64_t run_for_cycles(uint64_t n_cycles);
+    uint64_t run_until(WORD address, uint64_t max_cycles);
+
+    // True while the ROM on the bus is the one the program was compiled
+    // from
+    bool active();
+};
+} // namespace mos6502
@@ -0,0 +1,89 @@
+// Batch.hpp
+#pragma once
+
+#include <Types.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mos6502 {
+// Final state of one batch instance. Each result fills its own cache
+// line, so workers storing neighbouring results don't false-share.
+struct alignas(64) Batch_result {
+    BYTE a;
+    WORD pc;
+    BYTE sp;
+    BYTE x;
+    BYTE y;
+    BYTE p;
+    uint64_t cycles;
+    uint64_t instructions;
+
+    // Batch_runner::digest() of the final memory
+    uint64_t memory_digest;
+};
+
+// Runs many independent machines, one per memory image, across a pool of
+// worker threads. Each instance is a CPU over its own image as full RAM,
+// started from reset. Images are run in place and hold the final memory
+// afterwards.
+//
+// Instances are handed out by work stealing: each worker starts with an
+// even share of the instance indices and takes from the front of it;
+// when it runs dry it steals the back half of another worker's share.
+// Shares live on their own cache lines and are claimed with one CAS on a
+// packed (begin, end) word.
+class Batch_runner {
+  private:
+    struct alignas(64) Share {
+        // begin in the low 32 bits, end in the high 32 bits
+        std::atomic<uint64_t> range;
+    };
+
+    std::vector<std::thread> threads;
+    std::unique_ptr<Share[]> shares;
+
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    uint64_t job;
+    unsigned n_busy;
+    bool stopping;
+
+    // Current job, called with each instance index exactly once
+    std::function<void(std::size_t)> task;
+
+    void worker(unsigned id);
+    bool claim(unsigned id, std::size_t &index);
+    bool steal(unsigned id);
+    void run_all(std::size_t n_tasks, std::function<void(std::size_t)> task);
+
+  public:
+    // n_threads 0 uses one worker per hardware thread
+    explicit Batch_runner(unsigned n_threads = 0);
+    ~Batch_runner();
+
+    Batch_runner(const Batch_runner &) = delete;
+    Batch_runner &operator=(const Batch_runner &) = delete;
+
+    unsigned size() const { return threads.size(); }
+
+    // Run each instance for at least n_cycles, as CPU::run_for_cycles()
+    std::vector<Batch_result> run_for_cycles(std::vector<mem_t> &images,
+                                             uint64_t n_cycles);
+
+    // Run each instance for exactly n_instructions instructions
+    std::vector<Batch_result>
+    run_for_instructions(std::vector<mem_t> &images, uint64_t n_instructions);
+
+    // 64-bit hash of a whole memory image
+    static uint64_t digest(const mem_t &memory);
+};
+} // namespace mos6502
@@ -0,0 +1,205 @@
+// BlockCache.hpp
+#pragma once
+
+#include <Bus.hpp>
+#include <CPU.hpp>
+#include <Types.hpp>
+#ifdef MOS6502_JIT
+#include <Jit.hpp>
+#endif
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace mos6502 {
+// Opt-in execution mode that decodes straight-line code once and replays
+// it. A block starts at an entry PC and runs to the first control-flow
+// instruction (or MAX_BLOCK_LENGTH instructions); each entry holds the
+// handler, the fetched operand, the length and the base cycles. Each
+// block remembers the block that last followed it, so hot loops skip the
+// lookup.
+//
+// Only RAM and ROM pages are cached. Bus writes into a page holding
+// cached code invalidate every block overlapping it, including the one
+// running, and remapping the bus drops the whole cache. Writes made
+// directly to backing memory bypass the bus and need a flush().
+//
+// While a trace buffer is attached the cache steps through
+// CPU::execute() instead so every instruction is recorded.
+//
+// Interrupts and scheduled events behave as in CPU::run_for_cycles():
+// a block stops after any instruction that leaves an interrupt due, and
+// never runs past the next event. With CPU::set_idle_skip(), a short
+// block that jumps back to its own start is probed as an idle loop.
+//
+// Sequences listed in the fusion table (see Fusion.hpp) run as one
+// handler when decoded. Only their last instruction can write memory or
+// change I, so the checks between them reduce to whether the sequence
+// fits the cycle budget and steps over no run_until address; where it
+// does not, it runs unfused.
+//
+// When built with MOS6502_JIT, set_jit() adds a native tier: blocks
+// entered JIT_THRESHOLD times are translated to x86-64 code that keeps
+// A, X, Y and the flags in host registers. Blocks using instructions or
+// addressing modes the translator does not cover, or touching device
+// pages at fixed addresses, stay on the decoded path, and a native block
+// leaves after any store that invalidates cached code or raises an
+// interrupt. A translated block only runs when it cannot cross the cycle
+// budget, the next event or the run_until address, so results match the
+// interpreter exactly; set_reference() checks that against a second CPU.
+class Block_cache {
+  public:
+    static constexpr int MAX_BLOCK_LENGTH = 32;
+#ifdef MOS6502_JIT
+    static constexpr uint32_t JIT_THRESHOLD = 64;
+#endif
+
+  private:
+    struct Decoded_instruction {
+        CPU::operate_t handler;
+        WORD operand;
+        BYTE bytes;
+        BYTE cycles;
+        BYTE opcode;
+
+        // On the first instruction of a fused sequence: the number of
+        // instructions it covers, the bytes and worst-case cycles of all
+        // but the last, and its handler and packed operands
+        BYTE fused_length;
+        BYTE prefix_bytes;
+        BYTE prefix_cycles;
+        CPU::fused_t fused;
+        uint64_t fused_operands;
+    };
+
+    struct Block {
+        // Entry PC and PC of the last instruction
+        WORD pc;
+        WORD last_pc;
+
+        int length;
+        std::array<Decoded_instruction, MAX_BLOCK_LENGTH> instructions;
+
+        // Last block entered from here, valid while epoch is unchanged
+        WORD next_pc;
+        Block *next;
+        uint32_t next_epoch;
+
+#ifdef MOS6502_JIT
+        // Entries so far, up to one past JIT_THRESHOLD
+        uint32_t hits;
+        std::unique_ptr<Native_block> native;
+#endif
+    };
+
+    // Blocks indexed by the low byte of their entry PC
+    using Page_blocks = std::array<std::unique_ptr<Block>, 0x100>;
+
+    CPU &cpu;
+    Bus &bus;
+    int watcher;
+    uint32_t bus_generation;
+
+    std::array<std::unique_ptr<Page_blocks>, 0x100> pages;
+
+    // Entry PCs of the blocks overlapping each page
+    std::array<std::vector<WORD>, 0x100> overlapping;
+
+    // Entry PCs that compiled to no block, left to the interpreter until
+    // their page is written or the mapping changes
+    std::array<std::bitset<0x100>, 0x100> uncacheable;
+
+    // Invalidated blocks, kept alive until the running block is left
+    std::vector<std::unique_ptr<Block>> retired;
+
+    // Cycle count at which the running block stops; zeroed to leave it
+    // early after an invalidation
+    uint64_t stop_at;
+
+    std::size_t n_blocks;
+
+    // Bumped whenever a block is retired, invalidating chained links
+    uint32_t epoch;
+
+    Block *lookup(WORD pc);
+    std::unique_ptr<Block> compile(WORD pc);
+
+    bool fusion;
+    std::size_t n_fused;
+
+    // Mark the fusion table sequences in a freshly decoded block
+    void fuse(Block &block);
+    // True when ins, a fusable prefix, reads only RAM or ROM
+    bool reads_direct(const Decoded_instruction &ins) const;
+    void invalidate(BYTE page);
+
+    template <bool UNTIL> uint64_t run(uint64_t max_cycles, WORD address);
+
+#ifdef MOS6502_JIT
+    bool jit;
+    std::size_t n_translated;
+
+    // Interpreter stepped alongside for differential checking
+    CPU *reference;
+    uint64_t n_mismatches;
+
+    // Run the block natively if it is hot, translated and fits the run;
+    // false to take the decoded path
+    bool run_native(Block &block, uint64_t end, bool until, WORD address);
+    std::unique_ptr<Native_block> translate(const Block &block);
+    void sync_reference();
+    void check_reference(const Block &block);
+
+    // Slow paths called from native code, with CPU state written back.
+    // A load zeroes stop_at when it raised an interrupt.
+    static BYTE jit_load(Block_cache *cache, WORD addr);
+    // Returns nonzero when the running block must be left
+    static int jit_store(Block_cache *cache, WORD addr, BYTE value);
+#endif
+
+  public:
+    explicit Block_cache(CPU &cpu);
+    ~Block_cache();
+
+    Block_cache(const Block_cache &) = delete;
+    Block_cache &operator=(const Block_cache &) = delete;
+
+    // Same contracts as CPU::run_for_cycles() and CPU::run_until()
+    uint64_t run_for_cycles(uint64_t n_cycles);
+    uint64_t run_until(WORD address, uint64_t max_cycles);
+
+    // Drop every cached block
+    void flush();
+
+    // Number of cached blocks
+    std::size_t size() const { return n_blocks; }
+
+    // Dispatch fusion table sequences as one handler; on by default.
+    // Changing it flushes the cache.
+    void set_fusion(bool enabled);
+
+    // Fused sequences in blocks decoded so far, including ones since
+    // invalidated
+    std::size_t fusions() const { return n_fused; }
+
+#ifdef MOS6502_JIT
+    // Enable the native tier; off by default
+    void set_jit(bool enabled) { jit = enabled; }
+
+    // Blocks translated so far, including ones since invalidated
+    std::size_t translations() const { return n_translated; }
+
+    // Step reference through CPU::execute() next to every native block
+    // run and compare registers, P, pc, cycles and the pages the block
+    // can write. reference must start in the same state on its own
+    // memory; nullptr disables.
+    void set_reference(CPU *reference) { this->reference = reference; }
+
+    // Native block runs that disagreed with the reference
+    uint64_t mismatches() const { return n_mismatches; }
+#endif
+};
+} // namespace mos6502
@@ -0,0 +1,152 @@
+// Bus.hpp
+#pragma once
+
+#include <Scheduler.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace mos6502 {
+// Callbacks for a memory-mapped device; addr is the full bus address
+using read_callback_t = std::function<BYTE(WORD addr)>;
+using write_callback_t = std::function<void(WORD addr, BYTE value)>;
+
+// Called before a write lands in a watched RAM page
+using watch_callback_t = std::function<void(WORD addr)>;
+
+// 64 KiB address space split into 256 pages of 256 bytes. A page is
+// either backed directly by memory (RAM, or ROM with writes dropped),
+// which costs one indexed load per access, or routed to device
+// callbacks. Unmapped pages read as 0xff and ignore writes.
+class Bus {
+  private:
+    struct Device {
+        read_callback_t read;
+        write_callback_t write;
+        // Pages mapped to it; the slot is released once this drops to 0
+        int n_pages;
+    };
+
+    // Start of each page for direct access, nullptr to take the slow path
+    std::array<const BYTE *, 0x100> read_pages;
+    std::array<BYTE *, 0x100> write_pages;
+
+    // Index into devices for each page, NO_DEVICE if none. A deque, so
+    // adding a device never moves the callbacks of one that is running.
+    static constexpr uint16_t NO_DEVICE = 0xffff;
+    std::array<uint16_t, 0x100> page_device;
+    std::deque<Device> devices;
+
+    // Slots no page maps any more. A released slot may hold the callback
+    // that is running, so it only becomes free for reuse once no device
+    // callback is.
+    std::vector<uint16_t> released_devices;
+    std::vector<uint16_t> free_devices;
+    int running_callbacks;
+
+    // RAM backing of each page, kept while writes to it are trapped
+    std::array<BYTE *, 0x100> ram_pages;
+
+    // Device pages declared safe to poll with set_idle_safe()
+    std::array<bool, 0x100> idle_safe;
+
+    // One bit per watcher that wants to see writes to the page
+    std::array<BYTE, 0x100> watch_mask;
+    std::array<watch_callback_t, 8> watchers;
+
+    // Bumped whenever the page mapping changes
+    uint32_t generation;
+
+    Scheduler scheduler;
+
+    void set_page(BYTE page, const BYTE *read, BYTE *write, uint16_t device);
+    // Free the released slots unless a device callback is running
+    void reclaim_devices();
+    void update_write_page(BYTE page);
+
+    BYTE read_slow(WORD addr);
+    void write_slow(WORD addr, BYTE value);
+
+  public:
+    // Empty bus, every page unmapped
+    Bus();
+
+    // Whole address space mapped as RAM backed by memory
+    explicit Bus(mem_t &memory);
+
+    // Map n_pages pages starting at first_page. backing must hold
+    // n_pages * 256 bytes and outlive the mapping.
+    void map_ram(BYTE first_page, int n_pages, BYTE *backing);
+    void map_rom(BYTE first_page, int n_pages, const BYTE *backing);
+    // A device may remap its own pages from inside its callbacks. Returns
+    // false, mapping nothing, when n_pages is not positive.
+    bool map_device(BYTE first_page, int n_pages, read_callback_t read,
+                    write_callback_t write);
+    void unmap(BYTE first_page, int n_pages);
+
+    // Declare that reads of these device pages have no side effects and
+    // return values that only change from scheduled events, so idle
+    // skipping may fast-forward loops polling them. Remapping a page
+    // clears it.
+    void set_idle_safe(BYTE first_page, int n_pages, bool safe);
+    bool is_idle_safe(BYTE page) const { return idle_safe[page]; }
+
+    // Future events of the devices on this bus, fired by the run loops
+    // of the CPU driving it
+    Scheduler &get_scheduler() { return scheduler; }
+
+    // Page mapping generation, changes on every map_*() and unmap()
+    uint32_t get_generation() const { return generation; }
+
+    // True when the page is RAM or ROM and can be read directly
+    bool is_direct(BYTE page) const { return read_pages[page] != nullptr; }
+
+    // RAM backing of the page, nullptr for ROM, device and unmapped pages
+    const BYTE *ram_page(BYTE page) const { return ram_pages[page]; }
+
+    // Overwrite a whole RAM page, notifying its watchers as one write to
+    // the start of the page. Other pages are left alone.
+    void write_page(BYTE page, const BYTE *data);
+
+    // Per-page direct access pointers, as used by read() and write(), for
+    // generated code that inlines the fast path
+    const BYTE *const *read_page_table() const { return read_pages.data(); }
+    BYTE *const *write_page_table() const { return write_pages.data(); }
+
+    // Write watchers see writes to RAM pages they watch, before the
+    // write lands. Watched pages drop off the direct write path until
+    // every watcher has unwatched them. Returns the watcher id, or -1
+    // when all slots are taken.
+    int add_watcher(watch_callback_t callback);
+    void remove_watcher(int watcher);
+    void watch(int watcher, BYTE page);
+    void unwatch(int watcher, BYTE page);
+
+    BYTE read(WORD addr) {
+        const BYTE *page = read_pages[addr >> 8];
+        if (page != nullptr) {
+            return page[addr & 0xff];
+        }
+        return read_slow(addr);
+    }
+
+    void write(WORD addr, BYTE value) {
+        BYTE *page = write_pages[addr >> 8];
+        if (page != nullptr) {
+            page[addr & 0xff] = value;
+            return;
+        }
+        write_slow(addr, value);
+    }
+
+    // Read without device side effects; device pages read as 0xff
+    BYTE peek(WORD addr) const {
+        const BYTE *page = read_pages[addr >> 8];
+        return page != nullptr ? page[addr & 0xff] : 0xff;
+    }
+};
+} // namespace mos6502
@@ -1,10 +1,16 @@
 // CPU.hpp
 #pragma once
 
+#include <Bus.hpp>
+#include <Decimal.hpp>
+#include <Profile.hpp>
+#include <Trace.hpp>
 #include <Types.hpp>
 
 #include <array>
-#include <unordered_map>
+#include <cstdint>
+#include <memory>
+#include <utility>
 
 namespace mos6502 {
 class CPU {
@@ -12,16 +18,6 @@ class CPU {
     // A: Accumulator
     BYTE a;
 
-    // P: Flag register
-    BYTE n : 1;
-    BYTE v : 1;
-    BYTE u : 1;
-    BYTE b : 1;
-    BYTE d : 1;
-    BYTE i : 1;
-    BYTE z : 1;
-    BYTE c : 1;
-
     // PC: Program counter
     WORD pc;
 
@@ -33,87 +29,319 @@ class CPU {
     BYTE y;
 
   private:
-    // Ref to memory
-    mem_t &memory;
-
-    // Opcode lookup table
-    std::array<Instruction_info, 0x100> lookup_table;
-
-    // Instruction Dispatch table
-    std::unordered_map<INSTRUCTION, instruction_t> dispatch_table;
-
-    void ADC(ADDRESSING_MODE mode, WORD operand);
-    void AND(ADDRESSING_MODE mode, WORD operand);
-    void ASL(ADDRESSING_MODE mode, WORD operand);
-    void BCC(ADDRESSING_MODE mode, WORD operand);
-    void BCS(ADDRESSING_MODE mode, WORD operand);
-    void BEQ(ADDRESSING_MODE mode, WORD operand);
-    void BIT(ADDRESSING_MODE mode, WORD operand);
-    void BMI(ADDRESSING_MODE mode, WORD operand);
-    void BNE(ADDRESSING_MODE mode, WORD operand);
-    void BPL(ADDRESSING_MODE mode, WORD operand);
-    void BRK(ADDRESSING_MODE mode, WORD operand);
-    void BVC(ADDRESSING_MODE mode, WORD operand);
-    void BVS(ADDRESSING_MODE mode, WORD operand);
-    void CLC(ADDRESSING_MODE mode, WORD operand);
-    void CLD(ADDRESSING_MODE mode, WORD operand);
-    void CLI(ADDRESSING_MODE mode, WORD operand);
-    void CLV(ADDRESSING_MODE mode, WORD operand);
-    void CMP(ADDRESSING_MODE mode, WORD operand);
-    void CPX(ADDRESSING_MODE mode, WORD operand);
-    void CPY(ADDRESSING_MODE mode, WORD operand);
-    void DEC(ADDRESSING_MODE mode, WORD operand);
-    void DEX(ADDRESSING_MODE mode, WORD operand);
-    void DEY(ADDRESSING_MODE mode, WORD operand);
-    void EOR(ADDRESSING_MODE mode, WORD operand);
-    void INC(ADDRESSING_MODE mode, WORD operand);
-    void INX(ADDRESSING_MODE mode, WORD operand);
-    void INY(ADDRESSING_MODE mode, WORD operand);
-    void JMP(ADDRESSING_MODE mode, WORD operand);
-    void JSR(ADDRESSING_MODE mode, WORD operand);
-    void LDA(ADDRESSING_MODE mode, WORD operand);
-    void LDX(ADDRESSING_MODE mode, WORD operand);
-    void LDY(ADDRESSING_MODE mode, WORD operand);
-    void LSR(ADDRESSING_MODE mode, WORD operand);
-    void NOP(ADDRESSING_MODE mode, WORD operand);
-    void ORA(ADDRESSING_MODE mode, WORD operand);
-    void PHA(ADDRESSING_MODE mode, WORD operand);
-    void PHP(ADDRESSING_MODE mode, WORD operand);
-    void PLA(ADDRESSING_MODE mode, WORD operand);
-    void PLP(ADDRESSING_MODE mode, WORD operand);
-    void ROL(ADDRESSING_MODE mode, WORD operand);
-    void ROR(ADDRESSING_MODE mode, WORD operand);
-    void RTI(ADDRESSING_MODE mode, WORD operand);
-    void RTS(ADDRESSING_MODE mode, WORD operand);
-    void SBC(ADDRESSING_MODE mode, WORD operand);
-    void SEC(ADDRESSING_MODE mode, WORD operand);
-    void SED(ADDRESSING_MODE mode, WORD operand);
-    void SEI(ADDRESSING_MODE mode, WORD operand);
-    void STA(ADDRESSING_MODE mode, WORD operand);
-    void STX(ADDRESSING_MODE mode, WORD operand);
-    void STY(ADDRESSING_MODE mode, WORD operand);
-    void TAX(ADDRESSING_MODE mode, WORD operand);
-    void TAY(ADDRESSING_MODE mode, WORD operand);
-    void TSX(ADDRESSING_MODE mode, WORD operand);
-    void TXA(ADDRESSING_MODE mode, WORD operand);
-    void TXS(ADDRESSING_MODE mode, WORD operand);
-    void TYA(ADDRESSING_MODE mode, WORD operand);
-    void INVALID(ADDRESSING_MODE mode, WORD operand);
-
-    void init_lookup_table();
-    void init_dispatch_table();
+    // Decimal mode flags, see set_decimal_flags(); fills the padding
+    // before cycles
+    Decimal_flags decimal_flags = Decimal_flags::NMOS;
 
   public:
+    // Elapsed clock cycles
+    uint64_t cycles = 0;
+
+    // P register bits
+    static constexpr BYTE FLAG_C = 0x01;
+    static constexpr BYTE FLAG_Z = 0x02;
+    static constexpr BYTE FLAG_I = 0x04;
+    static constexpr BYTE FLAG_D = 0x08;
+    static constexpr BYTE FLAG_B = 0x10;
+    static constexpr BYTE FLAG_U = 0x20;
+    static constexpr BYTE FLAG_V = 0x40;
+    static constexpr BYTE FLAG_N = 0x80;
+
+    // Independent IRQ sources sharing the level-triggered IRQ line
+    static constexpr int IRQ_SOURCES = 14;
+
+    // Idle skipping looks at loops spanning at most IDLE_LOOP_BYTES bytes
+    // and IDLE_PROBE_LENGTH instructions
+    static constexpr int IDLE_LOOP_BYTES = 16;
+    static constexpr int IDLE_PROBE_LENGTH = 8;
+
+  private:
+    // P: Flag register, read and written as a whole through get_p() and
+    // set_p(). N and Z are evaluated lazily from the last result that set
+    // them: N is bit 7 of n_result, Z is set when z_result is zero. C and
+    // V are kept as 0/1, and I and D sit in their P bit positions.
+    BYTE n_result;
+    BYTE z_result;
+    BYTE c;
+    BYTE v;
+    BYTE id_flags;
+
+    // Fast-forward idle loops, see set_idle_skip()
+    bool idle_skip = false;
+
+    // Pending interrupts in one word, so the run loops test a single
+    // value per instruction: one bit per IRQ source holding the line
+    // low, plus the latched NMI edge and a RESET request. Sits in the
+    // padding after the flags.
+    static constexpr uint16_t PENDING_IRQ = (1u << IRQ_SOURCES) - 1;
+    static constexpr uint16_t PENDING_NMI = 1u << 14;
+    static constexpr uint16_t PENDING_RESET = 1u << 15;
+    uint16_t pending = 0;
+
+    // True when a pending interrupt would be taken now
+    bool interrupt_due() const {
+        return pending != 0 &&
+               (pending & ~((id_flags & FLAG_I) ? PENDING_IRQ : 0)) != 0;
+    }
+
+    // Take the highest-priority interrupt that is due; false if none
+    bool service_interrupts();
+
+    // Push pc and P and continue at the address held in vector
+    void interrupt(WORD vector, bool brk);
+
+    enum class Idle_probe {
+        // Loop skipped up to just short of the limit
+        SKIPPED,
+        // Not an idle loop: it changes state or touches memory it may not
+        BUSY,
+        // Probe cut short by the limit, an interrupt or the run_until
+        // address
+        STOPPED,
+    };
+
+    // True when the instruction at pc can be part of an idle loop: it
+    // stores nothing, leaves the stack alone and only reads RAM, ROM or
+    // idle-safe device pages
+    bool idle_safe_instruction();
+
+    // With pc at the head of a loop just entered backward, run up to two
+    // iterations. Once one leaves the registers and P as they were, every
+    // later iteration is the same until an event or interrupt, so whole
+    // iterations are skipped up to just short of limit and the
+    // interpreter finishes the run exactly as it would have. limit is
+    // re-read, as events scheduled meanwhile lower it.
+    Idle_probe skip_idle(const uint64_t &limit, bool until, WORD address);
+
+    // step(), handing the instruction run to profile
+    template <typename PROFILE> void step(PROFILE &profile);
+
+    // Step until slice_end, or pc reaches address for run_until().
+    // slice_end is the scheduler's bound from Scheduler::begin_slice(),
+    // re-read after every instruction.
+    template <bool UNTIL, typename PROFILE>
+    void run_slice(const uint64_t &slice_end, WORD address,
+                   PROFILE &profile);
+
+#ifdef MOS6502_THREADED
+    // run_slice() without profiling or idle skipping, direct-threaded:
+    // every handler fetches the next opcode and jumps straight to its
+    // handler through a table of label addresses, so each one has its
+    // own indirect branch for the predictor to learn
+    template <bool UNTIL>
+    void run_threaded(const uint64_t &slice_end, WORD address);
+#endif
+
+    // Body of run_for_cycles() and run_until()
+    template <bool UNTIL, typename PROFILE>
+    uint64_t run(uint64_t max_cycles, WORD address, PROFILE &profile);
+
+    // Bus owned by this CPU when constructed from a bare mem_t
+    std::unique_ptr<Bus> own_bus;
+
+    // Memory bus
+    Bus *bus;
+
+    // Trace sink, nullptr when tracing is off
+    Trace_buffer *trace = nullptr;
+
+    void record_trace(BYTE opcode);
+
+    // Handler for one (instruction, addressing mode) pair: fetches its
+    // operand at pc and executes
+    using handler_t = void (*)(CPU &);
+
+    // Same, with the operand already fetched and pc past the instruction
+    using operate_t = void (*)(CPU &, WORD);
+
+    // Opcode dispatch tables, generated at compile time from lookup_table
+    static const std::array<handler_t, 0x100> dispatch_table;
+    static const std::array<operate_t, 0x100> operate_table;
+
+    template <INSTRUCTION I, ADDRESSING_MODE M> static void dispatch(CPU &cpu);
+
+    template <INSTRUCTION I, ADDRESSING_MODE M>
+    static void operate(CPU &cpu, WORD operand);
+
+    template <std::size_t... OPCODE>
+    static constexpr std::array<handler_t, 0x100>
+    make_dispatch_table(std::index_sequence<OPCODE...>);
+
+    template <std::size_t... OPCODE>
+    static constexpr std::array<operate_t, 0x100>
+    make_operate_table(std::index_sequence<OPCODE...>);
+
+    // Handler for one fusion_table sequence: runs its instructions back
+    // to back as execute() would, with their operands packed 16 bits
+    // apiece, first instruction lowest
+    using fused_t = void (*)(CPU &, uint64_t);
+
+    template <BYTE OPCODE> static void fused_step(CPU &cpu, WORD operand);
+    template <std::size_t RULE> static void fused(CPU &cpu, uint64_t operands);
+
+    template <std::size_t... RULE>
+    static constexpr std::array<fused_t, sizeof...(RULE)>
+    make_fused_table(std::index_sequence<RULE...>);
+
+    // Handler for the first length opcodes, nullptr when the fusion
+    // table has no such sequence
+    static fused_t fused_handler(const BYTE *opcodes, int length);
+
+    friend class Aot_context;
+    friend class Aot_runner;
+    friend class Block_cache;
+    friend class Lockstep;
+    friend class Snapshot_tracker;
+
+    // Addressing mode resolution, specialized per mode at compile time.
+    // For IMMEDIATE and ACCUMULATOR the operand passes through unchanged
+    // and read()/write() target the operand value or the accumulator.
+    template <ADDRESSING_MODE M> WORD fetch_operand();
+    template <ADDRESSING_MODE M> WORD effective_address(WORD operand);
+    template <ADDRESSING_MODE M> BYTE read(WORD addr);
+    template <ADDRESSING_MODE M> void write(WORD addr, BYTE value);
+
+    // Read for an instruction that only reads its operand; adds the
+    // page-crossing penalty for indexed modes.
+    template <ADDRESSING_MODE M> BYTE load(WORD operand);
+
+    void update_nz(BYTE value);
+    void add(BYTE rhs);
+    // ADC, or SBC when subtract is set, in decimal mode
+    void add_decimal(BYTE rhs, bool subtract);
+    void compare(BYTE lhs, BYTE rhs);
+    void branch(bool taken, WORD operand);
+    // Stack push, noted in the running instruction's trace record unless
+    // traced is false; the last of several pushes is the one recorded
+    void push(BYTE value, bool traced = true);
+    BYTE pull();
+
+    template <ADDRESSING_MODE M> void ADC(WORD operand);
+    template <ADDRESSING_MODE M> void AND(WORD operand);
+    template <ADDRESSING_MODE M> void ASL(WORD operand);
+    template <ADDRESSING_MODE M> void BCC(WORD operand);
+    template <ADDRESSING_MODE M> void BCS(WORD operand);
+    template <ADDRESSING_MODE M> void BEQ(WORD operand);
+    template <ADDRESSING_MODE M> void BIT(WORD operand);
+    template <ADDRESSING_MODE M> void BMI(WORD operand);
+    template <ADDRESSING_MODE M> void BNE(WORD operand);
+    template <ADDRESSING_MODE M> void BPL(WORD operand);
+    template <ADDRESSING_MODE M> void BRK(WORD operand);
+    template <ADDRESSING_MODE M> void BVC(WORD operand);
+    template <ADDRESSING_MODE M> void BVS(WORD operand);
+    template <ADDRESSING_MODE M> void CLC(WORD operand);
+    template <ADDRESSING_MODE M> void CLD(WORD operand);
+    template <ADDRESSING_MODE M> void CLI(WORD operand);
+    template <ADDRESSING_MODE M> void CLV(WORD operand);
+    template <ADDRESSING_MODE M> void CMP(WORD operand);
+    template <ADDRESSING_MODE M> void CPX(WORD operand);
+    template <ADDRESSING_MODE M> void CPY(WORD operand);
+    template <ADDRESSING_MODE M> void DEC(WORD operand);
+    template <ADDRESSING_MODE M> void DEX(WORD operand);
+    template <ADDRESSING_MODE M> void DEY(WORD operand);
+    template <ADDRESSING_MODE M> void EOR(WORD operand);
+    template <ADDRESSING_MODE M> void INC(WORD operand);
+    template <ADDRESSING_MODE M> void INX(WORD operand);
+    template <ADDRESSING_MODE M> void INY(WORD operand);
+    template <ADDRESSING_MODE M> void JMP(WORD operand);
+    template <ADDRESSING_MODE M> void JSR(WORD operand);
+    template <ADDRESSING_MODE M> void LDA(WORD operand);
+    template <ADDRESSING_MODE M> void LDX(WORD operand);
+    template <ADDRESSING_MODE M> void LDY(WORD operand);
+    template <ADDRESSING_MODE M> void LSR(WORD operand);
+    template <ADDRESSING_MODE M> void NOP(WORD operand);
+    template <ADDRESSING_MODE M> void ORA(WORD operand);
+    template <ADDRESSING_MODE M> void PHA(WORD operand);
+    template <ADDRESSING_MODE M> void PHP(WORD operand);
+    template <ADDRESSING_MODE M> void PLA(WORD operand);
+    template <ADDRESSING_MODE M> void PLP(WORD operand);
+    template <ADDRESSING_MODE M> void ROL(WORD operand);
+    template <ADDRESSING_MODE M> void ROR(WORD operand);
+    template <ADDRESSING_MODE M> void RTI(WORD operand);
+    template <ADDRESSING_MODE M> void RTS(WORD operand);
+    template <ADDRESSING_MODE M> void SBC(WORD operand);
+    template <ADDRESSING_MODE M> void SEC(WORD operand);
+    template <ADDRESSING_MODE M> void SED(WORD operand);
+    template <ADDRESSING_MODE M> void SEI(WORD operand);
+    template <ADDRESSING_MODE M> void STA(WORD operand);
+    template <ADDRESSING_MODE M> void STX(WORD operand);
+    template <ADDRESSING_MODE M> void STY(WORD operand);
+    template <ADDRESSING_MODE M> void TAX(WORD operand);
+    template <ADDRESSING_MODE M> void TAY(WORD operand);
+    template <ADDRESSING_MODE M> void TSX(WORD operand);
+    template <ADDRESSING_MODE M> void TXA(WORD operand);
+    template <ADDRESSING_MODE M> void TXS(WORD operand);
+    template <ADDRESSING_MODE M> void TYA(WORD operand);
+    template <ADDRESSING_MODE M> void INVALID(WORD operand);
+
+  public:
+    CPU(Bus &bus);
+
+    // Maps memory as RAM over the whole address space
     CPU(mem_t &memory);
 
+    Bus &get_bus() { return *bus; }
+
     void reset();
 
     BYTE get_p();
+    void set_p(BYTE p);
 
     BYTE fetch_opcode();
     Instruction_info decode(BYTE opcode);
     WORD fetch_operands(ADDRESSING_MODE mode);
 
     void execute(BYTE opcode);
+
+    // Take a pending interrupt if one is due, otherwise execute the next
+    // instruction. Scheduled events are left to the run loops.
+    void step();
+
+    // Run whole instructions until at least n_cycles have elapsed,
+    // taking interrupts and firing scheduled events as they fall due.
+    // Returns the cycles actually consumed.
+    uint64_t run_for_cycles(uint64_t n_cycles);
+
+    // Run until pc reaches address or max_cycles have elapsed.
+    // Returns the cycles consumed.
+    uint64_t run_until(WORD address, uint64_t max_cycles);
+
+    // Same, counting every instruction into profile. Idle loops are
+    // executed rather than skipped so the profile stays exact; the
+    // loops above compile without any profiling code.
+    void step(Profile &profile);
+    uint64_t run_for_cycles(uint64_t n_cycles, Profile &profile);
+    uint64_t run_until(WORD address, uint64_t max_cycles, Profile &profile);
+
+    // Detect short loops that cannot change state by themselves, such as
+    // JMP * or polling RAM or an idle-safe device until it changes, and
+    // skip straight to the next scheduled event or the end of the run.
+    // Cycles skipped are credited in whole loop iterations, so results
+    // match running the loop; skipped iterations are not traced.
+    void set_idle_skip(bool enabled) { idle_skip = enabled; }
+
+    // Set N, V and Z after decimal ADC and SBC as the NMOS 6502 (the
+    // default) or the 65C02 does. Only the flags change: timing stays
+    // that of the NMOS part.
+    void set_decimal_flags(Decimal_flags flags) { decimal_flags = flags; }
+
+    // Hold the IRQ line low for source (0 to IRQ_SOURCES - 1) or release
+    // it. The line is low while any source holds it, and the interrupt
+    // is taken at an instruction boundary while I is clear.
+    void set_irq(int source, bool asserted);
+    bool irq_asserted() const { return (pending & PENDING_IRQ) != 0; }
+
+    // Signal an NMI edge, taken at the next instruction boundary
+    void nmi();
+
+    // Run reset() at the next instruction boundary
+    void request_reset();
+
+    // The bus's event scheduler, fired by the run loops
+    Scheduler &get_scheduler() { return bus->get_scheduler(); }
+
+    // Record every executed instruction into trace; nullptr disables.
+    // Has no effect unless built with MOS6502_TRACE.
+    void set_trace(Trace_buffer *trace);
 };
 } // namespace mos6502
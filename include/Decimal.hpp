@@ -0,0 +1,176 @@
+// Decimal.hpp
+#pragma once
+
+#include <Types.hpp>
+
+#include <array>
+#include <cstdint>
+
+namespace mos6502 {
+// How ADC and SBC set N, V and Z in decimal mode. The NMOS 6502 takes
+// them from intermediate or binary results; the 65C02 takes N and Z from
+// the decimal result. The accumulator and C agree for valid BCD, and
+// invalid BCD follows each chip.
+enum class Decimal_flags : uint8_t {
+    NMOS,
+    CMOS,
+};
+
+// Accumulator and flags after one decimal ADC or SBC. p holds N, V, Z and
+// C in their P bit positions.
+struct Decimal_result {
+    BYTE a;
+    BYTE p;
+};
+
+// Decimal ADC and SBC as the chips compute them, following Bruce Clark's
+// "Decimal Mode" appendices
+constexpr Decimal_result decimal_add(BYTE a, BYTE b, BYTE carry,
+                                     Decimal_flags flags) {
+    int lo = (a & 0x0f) + (b & 0x0f) + carry;
+    if (lo >= 0x0a) {
+        lo = ((lo + 0x06) & 0x0f) + 0x10;
+    }
+    int sum = (a & 0xf0) + (b & 0xf0) + lo;
+    // N and V come from the sum before the high digit is adjusted
+    int signed_sum = int8_t(a & 0xf0) + int8_t(b & 0xf0) + lo;
+    bool n = (sum & 0x80) != 0;
+    bool v = signed_sum < -128 || signed_sum > 127;
+    if (sum >= 0xa0) {
+        sum += 0x60;
+    }
+    BYTE result = sum & 0xff;
+    bool z = flags == Decimal_flags::NMOS ? BYTE(a + b + carry) == 0
+                                          : result == 0;
+    if (flags == Decimal_flags::CMOS) {
+        n = (result & 0x80) != 0;
+    }
+    return Decimal_result{
+        result, BYTE((n ? 0x80 : 0) | (v ? 0x40 : 0) | (z ? 0x02 : 0) |
+                     (sum >= 0x100 ? 0x01 : 0))};
+}
+
+constexpr Decimal_result decimal_subtract(BYTE a, BYTE b, BYTE carry,
+                                          Decimal_flags flags) {
+    // C and V as in binary, as are N and Z on NMOS
+    int binary = a - b - (1 - carry);
+    BYTE binary_result = binary & 0xff;
+    bool v = ((a ^ b) & (a ^ binary_result) & 0x80) != 0;
+
+    int lo = (a & 0x0f) - (b & 0x0f) - (1 - carry);
+    // The 65C02 adjusts the binary difference, the 6502 digit by digit
+    int difference = binary;
+    if (flags == Decimal_flags::NMOS) {
+        if (lo < 0) {
+            lo = ((lo - 0x06) & 0x0f) - 0x10;
+        }
+        difference = (a & 0xf0) - (b & 0xf0) + lo;
+        if (difference < 0) {
+            difference -= 0x60;
+        }
+    } else {
+        if (difference < 0) {
+            difference -= 0x60;
+        }
+        if (lo < 0) {
+            difference -= 0x06;
+        }
+    }
+    BYTE result = difference & 0xff;
+    BYTE nz = flags == Decimal_flags::NMOS ? binary_result : result;
+    return Decimal_result{
+        result, BYTE((nz & 0x80) | (v ? 0x40 : 0) | (nz == 0 ? 0x02 : 0) |
+                     (binary >= 0 ? 0x01 : 0))};
+}
+
+// One decimal ADC or SBC, split by digit. The low digit depends only on
+// the low nibbles and carry, the high digit only on the high nibbles
+// and how the low digit carried or borrowed, so two small tables replace
+// the whole (a, operand, carry) product.
+struct Decimal_digit {
+    // Result digit in its nibble of the accumulator
+    BYTE digit;
+    // Low digit: carry class indexing high; high digit: N, V and C
+    BYTE info;
+};
+
+struct Decimal_table {
+    // By [carry][a & 0x0f][operand & 0x0f]
+    std::array<std::array<std::array<Decimal_digit, 0x10>, 0x10>, 2> low;
+    // By [carry class][a >> 4][operand >> 4]. Classes: no carry or
+    // borrow out of the low digit, one, and for the 65C02's SBC a borrow
+    // whose -6 adjustment borrows again.
+    std::array<std::array<std::array<Decimal_digit, 0x10>, 0x10>, 3> high;
+    bool subtract;
+    Decimal_flags flags;
+};
+
+// Carry class of the low digit of a op b with carry, see Decimal_table
+constexpr BYTE decimal_carry_class(BYTE a, BYTE b, BYTE carry, bool subtract,
+                                   Decimal_flags flags) {
+    if (!subtract) {
+        return (a & 0x0f) + (b & 0x0f) + carry >= 0x0a ? 1 : 0;
+    }
+    int lo = (a & 0x0f) - (b & 0x0f) - (1 - carry);
+    if (lo >= 0) {
+        return 0;
+    }
+    return flags == Decimal_flags::CMOS && (lo & 0x0f) < 0x06 ? 2 : 1;
+}
+
+constexpr Decimal_table make_decimal_table(bool subtract,
+                                           Decimal_flags flags) {
+    auto op = [subtract, flags](BYTE a, BYTE b, BYTE carry) {
+        return subtract ? decimal_subtract(a, b, carry, flags)
+                        : decimal_add(a, b, carry, flags);
+    };
+    // Operand low nibble and carry giving each class with a low nibble
+    // of zero
+    constexpr BYTE add_b[3] = {0x00, 0x09, 0x00};
+    constexpr BYTE subtract_b[3] = {0x00, 0x00, 0x0f};
+    constexpr BYTE add_carry[3] = {0, 1, 0};
+    constexpr BYTE subtract_carry[3] = {1, 0, 1};
+
+    Decimal_table table = {};
+    table.subtract = subtract;
+    table.flags = flags;
+    for (int carry = 0; carry < 2; carry++) {
+        for (int a = 0; a < 0x10; a++) {
+            for (int b = 0; b < 0x10; b++) {
+                table.low[carry][a][b] = Decimal_digit{
+                    BYTE(op(a, b, carry).a & 0x0f),
+                    decimal_carry_class(a, b, carry, subtract, flags)};
+            }
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        BYTE lo_b = subtract ? subtract_b[k] : add_b[k];
+        BYTE carry = subtract ? subtract_carry[k] : add_carry[k];
+        for (int a = 0; a < 0x10; a++) {
+            for (int b = 0; b < 0x10; b++) {
+                Decimal_result result =
+                    op(BYTE(a << 4), BYTE(b << 4 | lo_b), carry);
+                table.high[k][a][b] =
+                    Decimal_digit{BYTE(result.a & 0xf0), BYTE(result.p & 0xc1)};
+            }
+        }
+    }
+    return table;
+}
+
+// Built at compile time from make_decimal_table(), indexed by
+// [flags][subtract]
+extern const Decimal_table decimal_tables[2][2];
+
+// decimal_add() or decimal_subtract() through table, in two loads
+inline Decimal_result decimal_lookup(const Decimal_table &table, BYTE a,
+                                     BYTE b, BYTE carry) {
+    const Decimal_digit &lo = table.low[carry][a & 0x0f][b & 0x0f];
+    const Decimal_digit &hi = table.high[lo.info][a >> 4][b >> 4];
+    BYTE result = hi.digit | lo.digit;
+    // Z is the one flag that needs the low digit too
+    BYTE binary = table.subtract ? a - b - (1 - carry) : a + b + carry;
+    BYTE z = table.flags == Decimal_flags::NMOS ? binary : result;
+    return Decimal_result{result, BYTE(hi.info | (z == 0 ? 0x02 : 0))};
+}
+} // namespace mos6502
@@ -0,0 +1,108 @@
+// Fusion.hpp
+#pragma once
+
+#include <Bus.hpp>
+#include <Opcodes.hpp>
+#include <Profile.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mos6502 {
+// Straight-line opcode sequence that Block_cache dispatches as a single
+// handler. The handlers are compiled from the fusion table, which is
+// FusionTable.hpp unless the build points MOS6502_FUSION_TABLE at a
+// header written by write_fusion_table().
+struct Fusion_rule {
+    std::array<BYTE, 3> opcodes;
+    // 2 or 3
+    BYTE length;
+};
+
+// True when opcode may come before the last instruction of a fused
+// sequence: it writes nothing, leaves I and the stack alone and reads at
+// most its operand, so nothing inside the sequence can raise an
+// interrupt or invalidate cached code. Block_cache also checks that the
+// operand reads RAM or ROM rather than a device.
+constexpr bool fusable_prefix(BYTE opcode) {
+    const Instruction_info &info = lookup_table[opcode];
+    switch (info.mode) {
+    case ADDRESSING_MODE::IMPLICIT:
+    case ADDRESSING_MODE::ACCUMULATOR:
+    case ADDRESSING_MODE::IMMEDIATE:
+    case ADDRESSING_MODE::ZEROPAGE:
+    case ADDRESSING_MODE::ZEROPAGE_X:
+    case ADDRESSING_MODE::ZEROPAGE_Y:
+    case ADDRESSING_MODE::ABSOLUTE:
+    case ADDRESSING_MODE::ABSOLUTE_X:
+    case ADDRESSING_MODE::ABSOLUTE_Y:
+        break;
+    default:
+        return false;
+    }
+    switch (info.ins) {
+    case INSTRUCTION::ASL:
+    case INSTRUCTION::LSR:
+    case INSTRUCTION::ROL:
+    case INSTRUCTION::ROR:
+        return info.mode == ADDRESSING_MODE::ACCUMULATOR;
+    case INSTRUCTION::ADC:
+    case INSTRUCTION::AND:
+    case INSTRUCTION::BIT:
+    case INSTRUCTION::CLC:
+    case INSTRUCTION::CLD:
+    case INSTRUCTION::CLV:
+    case INSTRUCTION::CMP:
+    case INSTRUCTION::CPX:
+    case INSTRUCTION::CPY:
+    case INSTRUCTION::DEX:
+    case INSTRUCTION::DEY:
+    case INSTRUCTION::EOR:
+    case INSTRUCTION::INX:
+    case INSTRUCTION::INY:
+    case INSTRUCTION::LDA:
+    case INSTRUCTION::LDX:
+    case INSTRUCTION::LDY:
+    case INSTRUCTION::NOP:
+    case INSTRUCTION::ORA:
+    case INSTRUCTION::SBC:
+    case INSTRUCTION::SEC:
+    case INSTRUCTION::SED:
+    case INSTRUCTION::TAX:
+    case INSTRUCTION::TAY:
+    case INSTRUCTION::TSX:
+    case INSTRUCTION::TXA:
+    case INSTRUCTION::TXS:
+    case INSTRUCTION::TYA:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// A sequence and the dispatches fusing it would have saved in a profile
+struct Fusion_candidate {
+    Fusion_rule rule;
+    uint64_t saved;
+};
+
+// Every fusable pair and triple starting at a PC the profile counted,
+// decoded from the code on bus, ranked by dispatches saved: one per run
+// of a pair, two per run of a triple. At most max_rules are returned.
+// Overlapping candidates are each credited in full, while a block fuses
+// greedily, longest rule first.
+std::vector<Fusion_candidate> rank_fusions(const Profile &profile,
+                                           const Bus &bus,
+                                           std::size_t max_rules);
+
+// Write candidates as a fusion table header for MOS6502_FUSION_TABLE,
+// naming source in its banner
+void write_fusion_table(std::ostream &os,
+                        const std::vector<Fusion_candidate> &candidates,
+                        const std::string &source);
+} // namespace mos6502
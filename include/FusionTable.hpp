@@ -0,0 +1,46 @@
+// FusionTable.hpp
+#pragma once
+
+#include <Fusion.hpp>
+
+namespace mos6502 {
+// Default fusion table: loop counters and compares feeding a branch,
+// load/store moves and carry setup for arithmetic, the sequences that
+// dominate most 6502 profiles. For a particular program, profile it,
+// run mos6502_fusion over the profile and the image, and build with
+// MOS6502_FUSION_TABLE pointing at the header it writes.
+inline constexpr std::array<Fusion_rule, 32> fusion_table = {{
+    {{0xc8, 0xc0, 0xd0}, 3}, // INY; CPY IMMEDIATE; BNE RELATIVE
+    {{0xe8, 0xe0, 0xd0}, 3}, // INX; CPX IMMEDIATE; BNE RELATIVE
+    {{0xa5, 0x18, 0x69}, 3}, // LDA ZEROPAGE; CLC; ADC IMMEDIATE
+    {{0xa5, 0x38, 0xe9}, 3}, // LDA ZEROPAGE; SEC; SBC IMMEDIATE
+    {{0xca, 0xd0, 0x00}, 2}, // DEX; BNE RELATIVE
+    {{0x88, 0xd0, 0x00}, 2}, // DEY; BNE RELATIVE
+    {{0xe8, 0xd0, 0x00}, 2}, // INX; BNE RELATIVE
+    {{0xc8, 0xd0, 0x00}, 2}, // INY; BNE RELATIVE
+    {{0xc9, 0xd0, 0x00}, 2}, // CMP IMMEDIATE; BNE RELATIVE
+    {{0xc9, 0xf0, 0x00}, 2}, // CMP IMMEDIATE; BEQ RELATIVE
+    {{0xc9, 0x90, 0x00}, 2}, // CMP IMMEDIATE; BCC RELATIVE
+    {{0xc9, 0xb0, 0x00}, 2}, // CMP IMMEDIATE; BCS RELATIVE
+    {{0xe0, 0xd0, 0x00}, 2}, // CPX IMMEDIATE; BNE RELATIVE
+    {{0xc0, 0xd0, 0x00}, 2}, // CPY IMMEDIATE; BNE RELATIVE
+    {{0x29, 0xd0, 0x00}, 2}, // AND IMMEDIATE; BNE RELATIVE
+    {{0x29, 0xf0, 0x00}, 2}, // AND IMMEDIATE; BEQ RELATIVE
+    {{0xa5, 0xd0, 0x00}, 2}, // LDA ZEROPAGE; BNE RELATIVE
+    {{0xa5, 0xf0, 0x00}, 2}, // LDA ZEROPAGE; BEQ RELATIVE
+    {{0xc8, 0xc0, 0x00}, 2}, // INY; CPY IMMEDIATE
+    {{0xe8, 0xe0, 0x00}, 2}, // INX; CPX IMMEDIATE
+    {{0x18, 0x69, 0x00}, 2}, // CLC; ADC IMMEDIATE
+    {{0x18, 0x65, 0x00}, 2}, // CLC; ADC ZEROPAGE
+    {{0x38, 0xe9, 0x00}, 2}, // SEC; SBC IMMEDIATE
+    {{0x38, 0xe5, 0x00}, 2}, // SEC; SBC ZEROPAGE
+    {{0xa5, 0x85, 0x00}, 2}, // LDA ZEROPAGE; STA ZEROPAGE
+    {{0xa9, 0x85, 0x00}, 2}, // LDA IMMEDIATE; STA ZEROPAGE
+    {{0xad, 0x8d, 0x00}, 2}, // LDA ABSOLUTE; STA ABSOLUTE
+    {{0xa9, 0x8d, 0x00}, 2}, // LDA IMMEDIATE; STA ABSOLUTE
+    {{0xbd, 0x9d, 0x00}, 2}, // LDA ABSOLUTE_X; STA ABSOLUTE_X
+    {{0xb9, 0x99, 0x00}, 2}, // LDA ABSOLUTE_Y; STA ABSOLUTE_Y
+    {{0x0a, 0x0a, 0x00}, 2}, // ASL ACCUMULATOR; ASL ACCUMULATOR
+    {{0xa0, 0xb1, 0x00}, 2}, // LDY IMMEDIATE; LDA INDIRECT_Y
+}};
+} // namespace mos6502
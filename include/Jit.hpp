@@ -0,0 +1,44 @@
+// Jit.hpp
+#pragma once
+
+#include <CPU.hpp>
+#include <Types.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace mos6502 {
+// x86-64 machine code for one translated block, held in its own mapping
+// that is sealed read+execute once the code is copied in. The code takes
+// the CPU and returns 0 when it bailed out before changing any state, or
+// 1 once the block has run and pc, cycles, registers and flags are
+// written back.
+class Native_block {
+  private:
+    using entry_t = int (*)(CPU *);
+
+    void *code;
+    std::size_t code_size;
+
+  public:
+    // Upper bound on the cycles one run can take, penalties included
+    const int max_cycles;
+
+    // Pages the block can write, for differential checking
+    const std::vector<BYTE> written_pages;
+
+    Native_block(const std::vector<BYTE> &bytes, int max_cycles,
+                 std::vector<BYTE> written_pages);
+    ~Native_block();
+
+    Native_block(const Native_block &) = delete;
+    Native_block &operator=(const Native_block &) = delete;
+
+    // False when executable memory could not be set up
+    bool valid() const { return code != nullptr; }
+
+    bool run(CPU &cpu) const {
+        return reinterpret_cast<entry_t>(code)(&cpu) != 0;
+    }
+};
+} // namespace mos6502
@@ -0,0 +1,89 @@
+// Loader.hpp
+#pragma once
+
+#include <Bus.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mos6502 {
+enum class Image_format {
+    // By file extension: .hex and .ihx are Intel HEX, .prg is PRG, and
+    // anything else is raw
+    AUTO,
+    // Flat binary loaded at a given address
+    RAW,
+    // Intel HEX records, 16-bit addresses
+    INTEL_HEX,
+    // Little-endian load address followed by the data
+    PRG,
+};
+
+// A program image loaded from a file. Raw and PRG files are mmap()ed
+// read-only, and every 256-byte page of the address space the image
+// covers completely from one stretch of the file points straight into
+// the mapping. Intel HEX records are decoded once into a buffer that
+// serves the same way, and pages only partly covered are assembled into
+// pages owned by the image.
+//
+// Copies of an image share the mapping and the decoded pages, and
+// separate mappings of one file share the kernel's page cache, so any
+// number of instances cost one set of physical pages.
+class Rom_image {
+  private:
+    struct Storage;
+
+    // One contiguous run of loaded bytes
+    struct Segment {
+        WORD address;
+        uint32_t length;
+        const BYTE *data;
+    };
+
+    std::shared_ptr<const Storage> storage;
+    std::vector<Segment> segments;
+
+    // Start of each covered page, nullptr where the image has no bytes
+    std::array<const BYTE *, 0x100> pages;
+    std::size_t n_decoded_pages;
+
+    bool parse_raw(const BYTE *data, std::size_t size, WORD origin,
+                   std::string &error);
+    bool parse_prg(const BYTE *data, std::size_t size, std::string &error);
+    bool parse_intel_hex(const BYTE *data, std::size_t size,
+                         std::vector<BYTE> &decoded, std::string &error);
+    void build_pages(std::vector<std::array<BYTE, 0x100>> &decoded_pages);
+
+  public:
+    // Empty image
+    Rom_image();
+
+    // Replace the image with the contents of path. origin is the load
+    // address of a raw image. Returns false and leaves the image empty
+    // on failure, with the reason in error.
+    bool load(const std::string &path, Image_format format, WORD origin,
+              std::string &error);
+
+    // Start of page, nullptr when the image does not cover it
+    const BYTE *page(BYTE page) const { return pages[page]; }
+
+    // Pages assembled because no single stretch of data covers them
+    std::size_t decoded_pages() const { return n_decoded_pages; }
+
+    // Bytes loaded, over all segments
+    std::size_t size() const;
+
+    // Map every covered page read-only on bus without copying. Bytes of
+    // a partly covered page outside the image read as zero. The image
+    // (or a copy of it) must outlive the mapping.
+    void map(Bus &bus) const;
+
+    // Copy the loaded bytes into memory, leaving the rest alone
+    void copy_to(mem_t &memory) const;
+};
+} // namespace mos6502
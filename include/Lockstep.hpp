@@ -0,0 +1,126 @@
+// Lockstep.hpp
+#pragma once
+
+#include <Bus.hpp>
+#include <CPU.hpp>
+#include <Types.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace mos6502 {
+// Registers of one lane
+struct Lane_state {
+    BYTE a;
+    WORD pc;
+    BYTE sp;
+    BYTE x;
+    BYTE y;
+    BYTE p;
+    uint64_t cycles;
+};
+
+// Up to MAX_LANES machines running the same program on different data,
+// in structure-of-arrays form. Each lane is a CPU over its own 64 KiB of
+// RAM. Memory is interleaved so one address across every lane is one
+// 32-byte row: uniform accesses (code, zero page, absolute) touch a
+// single row, and only indexed and indirect modes gather per lane.
+//
+// Lanes at the same PC with the same instruction bytes run as a group:
+// each instruction is applied to all members at once with lane-wise
+// blends that compile to AVX2 where available. A group runs until
+// control flow diverges, its code differs, or a member may reach its
+// cycle budget. The next group is the lanes at the lowest PC, which
+// lets lanes that split on a branch meet again further on. A lane
+// running alone, and instructions the vector path does not cover, step
+// through a scalar CPU on that lane's memory.
+class Lockstep {
+  public:
+    static constexpr int MAX_LANES = 32;
+
+    template <typename T> struct alignas(32) Lanes {
+        T lane[MAX_LANES];
+
+        T &operator[](int i) { return lane[i]; }
+        const T &operator[](int i) const { return lane[i]; }
+    };
+
+  private:
+    int n_lanes;
+
+    // memory[addr][lane]
+    std::vector<Lanes<BYTE>> memory;
+
+    // Registers and flag state per lane, as in CPU
+    Lanes<BYTE> a;
+    Lanes<BYTE> x;
+    Lanes<BYTE> y;
+    Lanes<BYTE> sp;
+    Lanes<BYTE> n_result;
+    Lanes<BYTE> z_result;
+    Lanes<BYTE> c;
+    Lanes<BYTE> v;
+    Lanes<BYTE> id_flags;
+    Lanes<WORD> pc;
+    Lanes<uint64_t> cycles;
+
+    // Cycle count each lane stops at in the current run
+    Lanes<uint64_t> end;
+
+    // Running group: 0xff for members. Members sit at group_pc and have
+    // group_cycles base cycles not yet added to cycles.
+    Lanes<BYTE> group;
+    int group_size;
+    int leader;
+    WORD group_pc;
+    uint64_t group_cycles;
+
+    // group_cycles plus the most penalty cycles any member can have
+    // taken, and the fewest cycles any member had left when the group
+    // formed. Every member is known to be short of its end while
+    // group_bound < budget.
+    uint64_t group_bound;
+    uint64_t budget;
+
+    // Scalar fallback: one CPU per lane on a bus routed to its memory
+    std::vector<std::unique_ptr<Bus>> buses;
+    std::vector<std::unique_ptr<CPU>> cpus;
+
+    uint64_t n_vector;
+    uint64_t n_scalar;
+
+    bool form_group();
+
+    // Write back pc and cycles of the members in mask and drop them
+    void release(const Lanes<BYTE> &mask);
+
+    void step_group();
+    void step_scalar(int lane);
+
+  public:
+    explicit Lockstep(int n_lanes = MAX_LANES);
+
+    Lockstep(const Lockstep &) = delete;
+    Lockstep &operator=(const Lockstep &) = delete;
+
+    int size() const { return n_lanes; }
+
+    void load(int lane, const mem_t &image);
+    void save(int lane, mem_t &image) const;
+    BYTE peek(int lane, WORD addr) const { return memory[addr][lane]; }
+
+    // CPU::reset() on every lane
+    void reset();
+
+    Lane_state get_lane(int lane) const;
+
+    // Run each lane for at least n_cycles, as CPU::run_for_cycles().
+    // Returns the cycles consumed summed over all lanes.
+    uint64_t run_for_cycles(uint64_t n_cycles);
+
+    // Lane-instructions executed on the vector and scalar paths
+    uint64_t vector_instructions() const { return n_vector; }
+    uint64_t scalar_instructions() const { return n_scalar; }
+};
+} // namespace mos6502
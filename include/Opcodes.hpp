@@ -0,0 +1,454 @@
+// Opcodes.hpp
+#pragma once
+
+#include <Types.hpp>
+
+#include <array>
+
+namespace mos6502 {
+// Number of operand bytes following the opcode
+constexpr int operand_size(ADDRESSING_MODE mode) {
+    switch (mode) {
+    case ADDRESSING_MODE::IMMEDIATE:
+    case ADDRESSING_MODE::ZEROPAGE:
+    case ADDRESSING_MODE::ZEROPAGE_X:
+    case ADDRESSING_MODE::ZEROPAGE_Y:
+    case ADDRESSING_MODE::RELATIVE:
+    case ADDRESSING_MODE::INDIRECT_X:
+    case ADDRESSING_MODE::INDIRECT_Y:
+        return 1;
+    case ADDRESSING_MODE::ABSOLUTE:
+    case ADDRESSING_MODE::ABSOLUTE_X:
+    case ADDRESSING_MODE::ABSOLUTE_Y:
+    case ADDRESSING_MODE::INDIRECT:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+// Assembler mnemonic of ins
+constexpr const char *instruction_name(INSTRUCTION ins) {
+    switch (ins) {
+    case INSTRUCTION::ADC:
+        return "ADC";
+    case INSTRUCTION::AND:
+        return "AND";
+    case INSTRUCTION::ASL:
+        return "ASL";
+    case INSTRUCTION::BCC:
+        return "BCC";
+    case INSTRUCTION::BCS:
+        return "BCS";
+    case INSTRUCTION::BEQ:
+        return "BEQ";
+    case INSTRUCTION::BIT:
+        return "BIT";
+    case INSTRUCTION::BMI:
+        return "BMI";
+    case INSTRUCTION::BNE:
+        return "BNE";
+    case INSTRUCTION::BPL:
+        return "BPL";
+    case INSTRUCTION::BRK:
+        return "BRK";
+    case INSTRUCTION::BVC:
+        return "BVC";
+    case INSTRUCTION::BVS:
+        return "BVS";
+    case INSTRUCTION::CLC:
+        return "CLC";
+    case INSTRUCTION::CLD:
+        return "CLD";
+    case INSTRUCTION::CLI:
+        return "CLI";
+    case INSTRUCTION::CLV:
+        return "CLV";
+    case INSTRUCTION::CMP:
+        return "CMP";
+    case INSTRUCTION::CPX:
+        return "CPX";
+    case INSTRUCTION::CPY:
+        return "CPY";
+    case INSTRUCTION::DEC:
+        return "DEC";
+    case INSTRUCTION::DEX:
+        return "DEX";
+    case INSTRUCTION::DEY:
+        return "DEY";
+    case INSTRUCTION::EOR:
+        return "EOR";
+    case INSTRUCTION::INC:
+        return "INC";
+    case INSTRUCTION::INX:
+        return "INX";
+    case INSTRUCTION::INY:
+        return "INY";
+    case INSTRUCTION::JMP:
+        return "JMP";
+    case INSTRUCTION::JSR:
+        return "JSR";
+    case INSTRUCTION::LDA:
+        return "LDA";
+    case INSTRUCTION::LDX:
+        return "LDX";
+    case INSTRUCTION::LDY:
+        return "LDY";
+    case INSTRUCTION::LSR:
+        return "LSR";
+    case INSTRUCTION::NOP:
+        return "NOP";
+    case INSTRUCTION::ORA:
+        return "ORA";
+    case INSTRUCTION::PHA:
+        return "PHA";
+    case INSTRUCTION::PHP:
+        return "PHP";
+    case INSTRUCTION::PLA:
+        return "PLA";
+    case INSTRUCTION::PLP:
+        return "PLP";
+    case INSTRUCTION::ROL:
+        return "ROL";
+    case INSTRUCTION::ROR:
+        return "ROR";
+    case INSTRUCTION::RTI:
+        return "RTI";
+    case INSTRUCTION::RTS:
+        return "RTS";
+    case INSTRUCTION::SBC:
+        return "SBC";
+    case INSTRUCTION::SEC:
+        return "SEC";
+    case INSTRUCTION::SED:
+        return "SED";
+    case INSTRUCTION::SEI:
+        return "SEI";
+    case INSTRUCTION::STA:
+        return "STA";
+    case INSTRUCTION::STX:
+        return "STX";
+    case INSTRUCTION::STY:
+        return "STY";
+    case INSTRUCTION::TAX:
+        return "TAX";
+    case INSTRUCTION::TAY:
+        return "TAY";
+    case INSTRUCTION::TSX:
+        return "TSX";
+    case INSTRUCTION::TXA:
+        return "TXA";
+    case INSTRUCTION::TXS:
+        return "TXS";
+    case INSTRUCTION::TYA:
+        return "TYA";
+    case INSTRUCTION::INVALID:
+        break;
+    }
+    return "INVALID";
+}
+
+// Printable name of mode
+constexpr const char *mode_name(ADDRESSING_MODE mode) {
+    switch (mode) {
+    case ADDRESSING_MODE::IMPLICIT:
+        return "IMPLICIT";
+    case ADDRESSING_MODE::ACCUMULATOR:
+        return "ACCUMULATOR";
+    case ADDRESSING_MODE::IMMEDIATE:
+        return "IMMEDIATE";
+    case ADDRESSING_MODE::ZEROPAGE:
+        return "ZEROPAGE";
+    case ADDRESSING_MODE::ZEROPAGE_X:
+        return "ZEROPAGE_X";
+    case ADDRESSING_MODE::ZEROPAGE_Y:
+        return "ZEROPAGE_Y";
+    case ADDRESSING_MODE::RELATIVE:
+        return "RELATIVE";
+    case ADDRESSING_MODE::ABSOLUTE:
+        return "ABSOLUTE";
+    case ADDRESSING_MODE::ABSOLUTE_X:
+        return "ABSOLUTE_X";
+    case ADDRESSING_MODE::ABSOLUTE_Y:
+        return "ABSOLUTE_Y";
+    case ADDRESSING_MODE::INDIRECT:
+        return "INDIRECT";
+    case ADDRESSING_MODE::INDIRECT_X:
+        return "INDIRECT_X";
+    case ADDRESSING_MODE::INDIRECT_Y:
+        return "INDIRECT_Y";
+    case ADDRESSING_MODE::INVALID:
+        break;
+    }
+    return "INVALID";
+}
+
+// Build a table entry; length and mnemonic follow from ins and mode
+constexpr Instruction_info opcode_info(INSTRUCTION ins, ADDRESSING_MODE mode,
+                                       BYTE cycles) {
+    return Instruction_info{ins, mode, BYTE(1 + operand_size(mode)), cycles,
+                            instruction_name(ins)};
+}
+
+// Opcode metadata, indexed by the raw opcode byte and shared by every CPU.
+// Cycle counts are base timings; page-crossing and branch-taken penalties
+// are added by the handlers. Undocumented opcodes keep their NMOS timing.
+inline constexpr std::array<Instruction_info, 0x100> lookup_table = {{
+    opcode_info(INSTRUCTION::BRK, ADDRESSING_MODE::IMPLICIT, 7),
+    opcode_info(INSTRUCTION::ORA, ADDRESSING_MODE::INDIRECT_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 3),
+    opcode_info(INSTRUCTION::ORA, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::ASL, ADDRESSING_MODE::ZEROPAGE, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 5),
+    opcode_info(INSTRUCTION::PHP, ADDRESSING_MODE::IMPLICIT, 3),
+    opcode_info(INSTRUCTION::ORA, ADDRESSING_MODE::IMMEDIATE, 2),
+    opcode_info(INSTRUCTION::ASL, ADDRESSING_MODE::ACCUMULATOR, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::ORA, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::ASL, ADDRESSING_MODE::ABSOLUTE, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::BPL, ADDRESSING_MODE::RELATIVE, 2),
+    opcode_info(INSTRUCTION::ORA, ADDRESSING_MODE::INDIRECT_Y, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::ORA, ADDRESSING_MODE::ZEROPAGE_X, 4),
+    opcode_info(INSTRUCTION::ASL, ADDRESSING_MODE::ZEROPAGE_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::CLC, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::ORA, ADDRESSING_MODE::ABSOLUTE_Y, 4),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::ORA, ADDRESSING_MODE::ABSOLUTE_X, 4),
+    opcode_info(INSTRUCTION::ASL, ADDRESSING_MODE::ABSOLUTE_X, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+    opcode_info(INSTRUCTION::JSR, ADDRESSING_MODE::ABSOLUTE, 6),
+    opcode_info(INSTRUCTION::AND, ADDRESSING_MODE::INDIRECT_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::BIT, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::AND, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::ROL, ADDRESSING_MODE::ZEROPAGE, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 5),
+    opcode_info(INSTRUCTION::PLP, ADDRESSING_MODE::IMPLICIT, 4),
+    opcode_info(INSTRUCTION::AND, ADDRESSING_MODE::IMMEDIATE, 2),
+    opcode_info(INSTRUCTION::ROL, ADDRESSING_MODE::ACCUMULATOR, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::BIT, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::AND, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::ROL, ADDRESSING_MODE::ABSOLUTE, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::BMI, ADDRESSING_MODE::RELATIVE, 2),
+    opcode_info(INSTRUCTION::AND, ADDRESSING_MODE::INDIRECT_Y, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::AND, ADDRESSING_MODE::ZEROPAGE_X, 4),
+    opcode_info(INSTRUCTION::ROL, ADDRESSING_MODE::ZEROPAGE_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::SEC, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::AND, ADDRESSING_MODE::ABSOLUTE_Y, 4),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::AND, ADDRESSING_MODE::ABSOLUTE_X, 4),
+    opcode_info(INSTRUCTION::ROL, ADDRESSING_MODE::ABSOLUTE_X, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+    opcode_info(INSTRUCTION::RTI, ADDRESSING_MODE::IMPLICIT, 6),
+    opcode_info(INSTRUCTION::EOR, ADDRESSING_MODE::INDIRECT_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 3),
+    opcode_info(INSTRUCTION::EOR, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::LSR, ADDRESSING_MODE::ZEROPAGE, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 5),
+    opcode_info(INSTRUCTION::PHA, ADDRESSING_MODE::IMPLICIT, 3),
+    opcode_info(INSTRUCTION::EOR, ADDRESSING_MODE::IMMEDIATE, 2),
+    opcode_info(INSTRUCTION::LSR, ADDRESSING_MODE::ACCUMULATOR, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::JMP, ADDRESSING_MODE::ABSOLUTE, 3),
+    opcode_info(INSTRUCTION::EOR, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::LSR, ADDRESSING_MODE::ABSOLUTE, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::BVC, ADDRESSING_MODE::RELATIVE, 2),
+    opcode_info(INSTRUCTION::EOR, ADDRESSING_MODE::INDIRECT_Y, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::EOR, ADDRESSING_MODE::ZEROPAGE_X, 4),
+    opcode_info(INSTRUCTION::LSR, ADDRESSING_MODE::ZEROPAGE_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::CLI, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::EOR, ADDRESSING_MODE::ABSOLUTE_Y, 4),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::EOR, ADDRESSING_MODE::ABSOLUTE_X, 4),
+    opcode_info(INSTRUCTION::LSR, ADDRESSING_MODE::ABSOLUTE_X, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+    opcode_info(INSTRUCTION::RTS, ADDRESSING_MODE::IMPLICIT, 6),
+    opcode_info(INSTRUCTION::ADC, ADDRESSING_MODE::INDIRECT_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 3),
+    opcode_info(INSTRUCTION::ADC, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::ROR, ADDRESSING_MODE::ZEROPAGE, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 5),
+    opcode_info(INSTRUCTION::PLA, ADDRESSING_MODE::IMPLICIT, 4),
+    opcode_info(INSTRUCTION::ADC, ADDRESSING_MODE::IMMEDIATE, 2),
+    opcode_info(INSTRUCTION::ROR, ADDRESSING_MODE::ACCUMULATOR, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::JMP, ADDRESSING_MODE::INDIRECT, 5),
+    opcode_info(INSTRUCTION::ADC, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::ROR, ADDRESSING_MODE::ABSOLUTE, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::BVS, ADDRESSING_MODE::RELATIVE, 2),
+    opcode_info(INSTRUCTION::ADC, ADDRESSING_MODE::INDIRECT_Y, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::ADC, ADDRESSING_MODE::ZEROPAGE_X, 4),
+    opcode_info(INSTRUCTION::ROR, ADDRESSING_MODE::ZEROPAGE_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::SEI, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::ADC, ADDRESSING_MODE::ABSOLUTE_Y, 4),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::ADC, ADDRESSING_MODE::ABSOLUTE_X, 4),
+    opcode_info(INSTRUCTION::ROR, ADDRESSING_MODE::ABSOLUTE_X, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::STA, ADDRESSING_MODE::INDIRECT_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::STY, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::STA, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::STX, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 3),
+    opcode_info(INSTRUCTION::DEY, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::TXA, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::STY, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::STA, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::STX, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::BCC, ADDRESSING_MODE::RELATIVE, 2),
+    opcode_info(INSTRUCTION::STA, ADDRESSING_MODE::INDIRECT_Y, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::STY, ADDRESSING_MODE::ZEROPAGE_X, 4),
+    opcode_info(INSTRUCTION::STA, ADDRESSING_MODE::ZEROPAGE_X, 4),
+    opcode_info(INSTRUCTION::STX, ADDRESSING_MODE::ZEROPAGE_Y, 4),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::TYA, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::STA, ADDRESSING_MODE::ABSOLUTE_Y, 5),
+    opcode_info(INSTRUCTION::TXS, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 5),
+    opcode_info(INSTRUCTION::STA, ADDRESSING_MODE::ABSOLUTE_X, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 5),
+    opcode_info(INSTRUCTION::LDY, ADDRESSING_MODE::IMMEDIATE, 2),
+    opcode_info(INSTRUCTION::LDA, ADDRESSING_MODE::INDIRECT_X, 6),
+    opcode_info(INSTRUCTION::LDX, ADDRESSING_MODE::IMMEDIATE, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::LDY, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::LDA, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::LDX, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 3),
+    opcode_info(INSTRUCTION::TAY, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::LDA, ADDRESSING_MODE::IMMEDIATE, 2),
+    opcode_info(INSTRUCTION::TAX, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::LDY, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::LDA, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::LDX, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::BCS, ADDRESSING_MODE::RELATIVE, 2),
+    opcode_info(INSTRUCTION::LDA, ADDRESSING_MODE::INDIRECT_Y, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 5),
+    opcode_info(INSTRUCTION::LDY, ADDRESSING_MODE::ZEROPAGE_X, 4),
+    opcode_info(INSTRUCTION::LDA, ADDRESSING_MODE::ZEROPAGE_X, 4),
+    opcode_info(INSTRUCTION::LDX, ADDRESSING_MODE::ZEROPAGE_Y, 4),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::CLV, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::LDA, ADDRESSING_MODE::ABSOLUTE_Y, 4),
+    opcode_info(INSTRUCTION::TSX, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::LDY, ADDRESSING_MODE::ABSOLUTE_X, 4),
+    opcode_info(INSTRUCTION::LDA, ADDRESSING_MODE::ABSOLUTE_X, 4),
+    opcode_info(INSTRUCTION::LDX, ADDRESSING_MODE::ABSOLUTE_Y, 4),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::CPY, ADDRESSING_MODE::IMMEDIATE, 2),
+    opcode_info(INSTRUCTION::CMP, ADDRESSING_MODE::INDIRECT_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::CPY, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::CMP, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::DEC, ADDRESSING_MODE::ZEROPAGE, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 5),
+    opcode_info(INSTRUCTION::INY, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::CMP, ADDRESSING_MODE::IMMEDIATE, 2),
+    opcode_info(INSTRUCTION::DEX, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::CPY, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::CMP, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::DEC, ADDRESSING_MODE::ABSOLUTE, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::BNE, ADDRESSING_MODE::RELATIVE, 2),
+    opcode_info(INSTRUCTION::CMP, ADDRESSING_MODE::INDIRECT_Y, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::CMP, ADDRESSING_MODE::ZEROPAGE_X, 4),
+    opcode_info(INSTRUCTION::DEC, ADDRESSING_MODE::ZEROPAGE_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::CLD, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::CMP, ADDRESSING_MODE::ABSOLUTE_Y, 4),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::CMP, ADDRESSING_MODE::ABSOLUTE_X, 4),
+    opcode_info(INSTRUCTION::DEC, ADDRESSING_MODE::ABSOLUTE_X, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+    opcode_info(INSTRUCTION::CPX, ADDRESSING_MODE::IMMEDIATE, 2),
+    opcode_info(INSTRUCTION::SBC, ADDRESSING_MODE::INDIRECT_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::CPX, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::SBC, ADDRESSING_MODE::ZEROPAGE, 3),
+    opcode_info(INSTRUCTION::INC, ADDRESSING_MODE::ZEROPAGE, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 5),
+    opcode_info(INSTRUCTION::INX, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::SBC, ADDRESSING_MODE::IMMEDIATE, 2),
+    opcode_info(INSTRUCTION::NOP, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::CPX, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::SBC, ADDRESSING_MODE::ABSOLUTE, 4),
+    opcode_info(INSTRUCTION::INC, ADDRESSING_MODE::ABSOLUTE, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::BEQ, ADDRESSING_MODE::RELATIVE, 2),
+    opcode_info(INSTRUCTION::SBC, ADDRESSING_MODE::INDIRECT_Y, 5),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 8),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::SBC, ADDRESSING_MODE::ZEROPAGE_X, 4),
+    opcode_info(INSTRUCTION::INC, ADDRESSING_MODE::ZEROPAGE_X, 6),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 6),
+    opcode_info(INSTRUCTION::SED, ADDRESSING_MODE::IMPLICIT, 2),
+    opcode_info(INSTRUCTION::SBC, ADDRESSING_MODE::ABSOLUTE_Y, 4),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 2),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 4),
+    opcode_info(INSTRUCTION::SBC, ADDRESSING_MODE::ABSOLUTE_X, 4),
+    opcode_info(INSTRUCTION::INC, ADDRESSING_MODE::ABSOLUTE_X, 7),
+    opcode_info(INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID, 7),
+}};
+} // namespace mos6502
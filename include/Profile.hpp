@@ -0,0 +1,89 @@
+// Profile.hpp
+#pragma once
+
+#include <Opcodes.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace mos6502 {
+// Profiling policy of the plain run loops: every hook is empty, so they
+// compile to exactly the code they had before profiling existed
+struct No_profile {
+    static constexpr bool ENABLED = false;
+
+    void record(WORD /*pc*/, BYTE /*opcode*/, uint64_t /*cycles*/,
+                WORD /*next_pc*/) {}
+};
+
+// Exact execution profile: instructions and cycles per PC, executions
+// and cycles per opcode, and taken counts per branch. Filled by the
+// CPU run loops that take one; see CPU::run_for_cycles(). Cycles spent
+// entering interrupts are not attributed to any instruction.
+class Profile {
+  public:
+    static constexpr bool ENABLED = true;
+
+  private:
+    // Per PC of the first byte of an instruction
+    std::vector<uint64_t> pc_hits;
+    std::vector<uint64_t> pc_cycles;
+    std::vector<uint64_t> pc_taken;
+    std::vector<uint64_t> pc_not_taken;
+
+    std::array<uint64_t, 0x100> opcode_hits;
+    std::array<uint64_t, 0x100> opcode_cycles;
+
+  public:
+    Profile();
+
+    // One instruction at pc took cycles and left pc at next_pc
+    void record(WORD pc, BYTE opcode, uint64_t cycles, WORD /*next_pc*/) {
+        pc_hits[pc]++;
+        pc_cycles[pc] += cycles;
+        opcode_hits[opcode]++;
+        opcode_cycles[opcode] += cycles;
+        // A taken branch costs an extra cycle even when its offset is 0
+        if (lookup_table[opcode].mode == ADDRESSING_MODE::RELATIVE) {
+            (cycles > lookup_table[opcode].cycles ? pc_taken
+                                                  : pc_not_taken)[pc]++;
+        }
+    }
+
+    void clear();
+
+    uint64_t hits(WORD pc) const { return pc_hits[pc]; }
+    uint64_t cycles(WORD pc) const { return pc_cycles[pc]; }
+
+    // Branch outcomes at pc; both zero for other instructions
+    uint64_t taken(WORD pc) const { return pc_taken[pc]; }
+    uint64_t not_taken(WORD pc) const { return pc_not_taken[pc]; }
+
+    uint64_t opcode_count(BYTE opcode) const { return opcode_hits[opcode]; }
+    uint64_t opcode_cycle_count(BYTE opcode) const {
+        return opcode_cycles[opcode];
+    }
+
+    // Totals over every instruction recorded
+    uint64_t instructions() const;
+    uint64_t total_cycles() const;
+
+    // Compact little-endian dump: a magic word, then only the PCs and
+    // opcodes that ran. read() accepts what write() produced and returns
+    // false, leaving the profile cleared, on anything else.
+    void write(std::ostream &os) const;
+    bool read(std::istream &is);
+
+    // One line per PC that ran, hottest first:
+    // pc,hits,cycles,taken,not_taken
+    void write_pc_csv(std::ostream &os) const;
+
+    // One line per opcode that ran, by cycles spent:
+    // opcode,mnemonic,mode,count,cycles
+    void write_opcode_csv(std::ostream &os) const;
+};
+} // namespace mos6502
@@ -0,0 +1,123 @@
+// Replay.hpp
+#pragma once
+
+#include <Bus.hpp>
+#include <CPU.hpp>
+#include <Types.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace mos6502 {
+enum class Replay_kind : BYTE {
+    // A device returned value for a read of addr
+    DEVICE_READ,
+    // IRQ source addr asserted (value 1) or released (value 0)
+    IRQ,
+    NMI,
+    RESET,
+};
+
+// One input from outside the emulated machine, tagged with the CPU cycle
+// count when it arrived
+struct Replay_event {
+    uint64_t cycle;
+    Replay_kind kind;
+    WORD addr;
+    BYTE value;
+};
+
+// Every input that made a run what it was. Given the same starting
+// snapshot, the CPU and RAM are a pure function of these, so the log is
+// all a replay needs: a few bytes per device read or interrupt, against
+// a few bytes per instruction for a trace.
+class Replay_log {
+  private:
+    std::vector<Replay_event> events;
+
+  public:
+    void push(const Replay_event &event) { events.push_back(event); }
+    void clear() { events.clear(); }
+
+    std::size_t size() const { return events.size(); }
+    const Replay_event &operator[](std::size_t i) const { return events[i]; }
+
+    // Compact dump: a magic word, then each event as the varint cycle
+    // delta from the one before, a byte for kind and IRQ line, and the
+    // address and value of device reads. read() returns false, leaving
+    // the log empty, on anything write() did not produce.
+    void write(std::ostream &os) const;
+    bool read(std::istream &is);
+};
+
+// Logs the inputs of a running machine. Devices whose reads are not a
+// function of what was written to them are mapped through map_device(),
+// and interrupts raised from outside the CPU go through set_irq(), nmi()
+// and request_reset() here instead of on the CPU. Nothing else changes,
+// so recording costs one log entry per input and nothing per
+// instruction.
+//
+// Replay starts from a snapshot, so take one with Snapshot_tracker when
+// recording starts.
+class Replay_recorder {
+  private:
+    CPU &cpu;
+    Replay_log &log;
+
+  public:
+    Replay_recorder(CPU &cpu, Replay_log &log);
+
+    // As Bus::map_device() on the CPU's bus, logging every value read
+    void map_device(BYTE first_page, int n_pages, read_callback_t read,
+                    write_callback_t write);
+
+    // As the CPU methods of the same name
+    void set_irq(int source, bool asserted);
+    void nmi();
+    void request_reset();
+};
+
+// Feeds a Replay_log back into a machine restored to the snapshot the
+// recording started from. Logged devices are mapped on the bus with reads
+// served from the log, and logged interrupts are raised from the bus
+// scheduler at their cycle, which the run loops deliver at the same
+// instruction boundary as when recorded. The run loops themselves are
+// untouched, so a replay runs at full speed, through the interpreter or
+// the block cache alike.
+//
+// A device read that does not match the next logged read in address and
+// cycle marks the replay diverged and returns 0xff.
+class Replay_player {
+  private:
+    CPU &cpu;
+    const Replay_log &log;
+
+    // Next logged device read and next logged interrupt
+    std::size_t next_read;
+    std::size_t next_signal;
+    bool is_diverged;
+
+    BYTE read(WORD addr);
+    void schedule_signal();
+
+  public:
+    Replay_player(CPU &cpu, const Replay_log &log);
+
+    // Map a logged device. Writes go to write, if any, so output devices
+    // can still be watched.
+    void map_device(BYTE first_page, int n_pages,
+                    write_callback_t write = nullptr);
+
+    // Schedule the logged interrupts. Call once the snapshot is restored.
+    void start();
+
+    // A device read differed from the recording
+    bool diverged() const { return is_diverged; }
+
+    // Every logged input was replayed
+    bool finished() const;
+};
+} // namespace mos6502
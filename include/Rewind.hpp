@@ -0,0 +1,103 @@
+// Rewind.hpp
+#pragma once
+
+#include <CPU.hpp>
+#include <Snapshot.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace mos6502 {
+// Lets a debugger step backwards. Every interval cycles a scheduled event
+// saves a frame: the CPU registers and the RAM pages written since the
+// frame before, stored as the XOR against that frame's contents and
+// run-length encoded, which leaves a few bytes for a page with a few
+// writes. Every keyframe_every frames, and whenever RAM was remapped, the
+// frame is a keyframe holding every RAM page, encoded the same way.
+//
+// seek() rebuilds RAM from the nearest keyframe and the deltas after it,
+// restores the frame at or before the target and runs forward to it, so
+// its cost is bounded by keyframe_every frames and interval cycles.
+// Frames are dropped oldest keyframe group first to keep their encoded
+// size within max_bytes, though the newest group is always kept; on top
+// of that one copy of RAM is kept to diff against.
+//
+// Running forward again repeats the recorded run only where the machine
+// is a function of its state: device inputs and scheduled events other
+// than our own are not saved. Map devices through a Replay_player to
+// seek through a recording exactly.
+class Rewind_buffer {
+  private:
+    struct Frame {
+        uint64_t cycles;
+        WORD pc;
+        BYTE a;
+        BYTE x;
+        BYTE y;
+        BYTE sp;
+        BYTE p;
+        uint16_t pending;
+        bool key;
+        // Each saved page as its number followed by runs of a zero count,
+        // a literal count and the literals, covering 256 bytes. Keyframes
+        // start with a bitmap of the RAM pages and leave out pages of
+        // zeros.
+        std::vector<BYTE> pages;
+    };
+
+    CPU &cpu;
+    Snapshot_tracker tracker;
+    uint64_t interval;
+    std::size_t max_bytes;
+    std::size_t keyframe_every;
+
+    std::deque<Frame> frames;
+    std::size_t n_bytes;
+    // Frames since the newest keyframe, counting it
+    std::size_t since_key;
+    // RAM as of the newest frame
+    Snapshot last;
+
+    uint64_t event;
+
+    void schedule(uint64_t cycle);
+    // Drop the oldest keyframe and its deltas, unless it is the newest
+    bool drop_oldest();
+
+    // Apply frames from the keyframe at or before index up to index
+    void rebuild(std::size_t index, mem_t &image,
+                 std::array<bool, 0x100> &ram) const;
+
+  public:
+    // Start recording with a frame of the current state
+    Rewind_buffer(CPU &cpu, uint64_t interval, std::size_t max_bytes,
+                  std::size_t keyframe_every = 16);
+    ~Rewind_buffer();
+
+    Rewind_buffer(const Rewind_buffer &) = delete;
+    Rewind_buffer &operator=(const Rewind_buffer &) = delete;
+
+    // Save a frame now, outside the schedule
+    void checkpoint();
+
+    // Return to the first instruction boundary at or after cycle, which
+    // must lie between oldest() and the current cycle count. Frames after
+    // the one restored are dropped, and recording carries on from there.
+    bool seek(uint64_t cycle);
+
+    // Return to the instruction boundary before the current one
+    bool step_back();
+
+    // Earliest cycle seek() can reach
+    uint64_t oldest() const { return frames.front().cycles; }
+
+    std::size_t size() const { return frames.size(); }
+
+    // Encoded size of the frames held
+    std::size_t bytes() const { return n_bytes; }
+};
+} // namespace mos6502
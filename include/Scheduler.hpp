@@ -0,0 +1,72 @@
+// Scheduler.hpp
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace mos6502 {
+// Called with the cycle the event was scheduled for, so periodic devices
+// can reschedule without drift
+using event_callback_t = std::function<void(uint64_t cycle)>;
+
+// Future device events ordered by cycle in a binary min-heap. Run loops
+// only compare the cycle count against the bound from begin_slice()
+// between instructions, so a device costs nothing until its event is due.
+// Events are delivered at the first instruction boundary at or after
+// their cycle; events due at the same cycle fire in the order they were
+// scheduled.
+class Scheduler {
+  public:
+    static constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+  private:
+    struct Event {
+        uint64_t cycle;
+        uint64_t id;
+        event_callback_t callback;
+    };
+
+    std::vector<Event> heap;
+    uint64_t next_id;
+
+    // Bound of the running slice, lowered by schedule()
+    uint64_t slice_end;
+
+    // Heap order: earliest cycle, then earliest scheduled, on top
+    static bool later(const Event &lhs, const Event &rhs);
+
+  public:
+    Scheduler();
+
+    // Call callback once the cycle count reaches cycle. Returns an id
+    // for cancel().
+    uint64_t schedule(uint64_t cycle, event_callback_t callback);
+
+    // Drop a scheduled event; false if it already fired or was cancelled
+    bool cancel(uint64_t id);
+
+    // Cycle of the earliest event, NEVER when there is none
+    uint64_t next_cycle() const {
+        return heap.empty() ? NEVER : heap.front().cycle;
+    }
+
+    // Start a run slice ending at end or the next event, whichever is
+    // first. The run loop compares against the returned bound, which
+    // schedule() lowers when a callback adds an earlier event mid-slice.
+    const uint64_t &begin_slice(uint64_t end) {
+        slice_end = std::min(end, next_cycle());
+        return slice_end;
+    }
+
+    // Fire every event due at or before now, including events scheduled
+    // by the callbacks themselves
+    void run_due(uint64_t now);
+
+    std::size_t size() const { return heap.size(); }
+    void clear() { heap.clear(); }
+};
+} // namespace mos6502
@@ -0,0 +1,93 @@
+// Snapshot.hpp
+#pragma once
+
+#include <Bus.hpp>
+#include <CPU.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace mos6502 {
+// Saved CPU registers and RAM. RAM is held as shared, immutable 256-byte
+// pages, so snapshots taken by one tracker share every page that was not
+// written between them, and copying a Snapshot copies no memory.
+class Snapshot {
+  public:
+    using Page = std::array<BYTE, 0x100>;
+
+  private:
+    friend class Rewind_buffer;
+    friend class Snapshot_tracker;
+
+    // nullptr for pages that were not RAM
+    std::array<std::shared_ptr<const Page>, 0x100> pages;
+
+  public:
+    BYTE a;
+    WORD pc;
+    BYTE sp;
+    BYTE x;
+    BYTE y;
+    BYTE p;
+    uint64_t cycles;
+
+    // IRQ sources holding the line and latched NMI and RESET requests
+    uint16_t pending;
+
+    // Saved contents of a RAM page, nullptr if it was not RAM. Equal
+    // pointers mean the page is shared.
+    const BYTE *page(BYTE page) const {
+        return pages[page] != nullptr ? pages[page]->data() : nullptr;
+    }
+};
+
+// Takes and restores snapshots of a CPU and the RAM on its bus, tracking
+// which pages were written since the last take() or restore(). Tracking
+// uses a bus write watcher: after a snapshot every RAM page is watched,
+// and the first write to a page marks it dirty and puts it back on the
+// direct write path. take() copies only dirty pages and restore() only
+// rewrites pages that differ, so both cost in proportion to the pages
+// touched.
+//
+// Writes made directly to backing memory bypass the bus and are not
+// seen. restore() writes through Bus::write_page(), so other watchers
+// such as Block_cache see the change.
+class Snapshot_tracker {
+  private:
+    CPU &cpu;
+    Bus &bus;
+    int watcher;
+    uint32_t bus_generation;
+
+    // Pages matching RAM as of the last take() or restore(), except where
+    // dirty
+    std::array<std::shared_ptr<const Snapshot::Page>, 0x100> base;
+    std::array<bool, 0x100> dirty;
+    std::size_t n_dirty;
+
+    void mark_dirty(BYTE page);
+
+    // Forget base pages after the bus was remapped
+    void sync_generation();
+
+  public:
+    explicit Snapshot_tracker(CPU &cpu);
+    ~Snapshot_tracker();
+
+    Snapshot_tracker(const Snapshot_tracker &) = delete;
+    Snapshot_tracker &operator=(const Snapshot_tracker &) = delete;
+
+    Snapshot take();
+
+    // Return the CPU and RAM to snapshot. Pages that were not RAM when
+    // the snapshot was taken, or are not RAM now, are left alone.
+    void restore(const Snapshot &snapshot);
+
+    // RAM pages written since the last take() or restore()
+    std::size_t dirty_pages() const { return n_dirty; }
+    bool is_dirty(BYTE page) const { return dirty[page]; }
+};
+} // namespace mos6502
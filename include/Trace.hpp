@@ -0,0 +1,109 @@
+// Trace.hpp
+#pragma once
+
+#include <Types.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mos6502 {
+// One executed instruction, with registers captured before it runs and
+// the memory write it made, if any. Stack pushes count as writes: for
+// JSR and BRK, which push several bytes, the last one is recorded and
+// the others lie above it on the stack. Interrupt entry is not an
+// instruction and has no record; its pushes follow from sp.
+struct Trace_record {
+    WORD pc;
+    WORD operand;
+    BYTE opcode;
+    BYTE a;
+    BYTE x;
+    BYTE y;
+    BYTE sp;
+    BYTE p;
+    WORD write_addr;
+    BYTE write_value;
+    bool wrote;
+};
+
+// Receives the records held by a Trace_buffer, oldest first. It may
+// swap the vector's contents for another vector of the same size to
+// keep them without copying.
+using trace_flush_t = std::function<void(std::vector<Trace_record> &records)>;
+
+// Fixed-capacity ring of trace records. Recording only copies the record
+// into preallocated storage; text is produced on demand by format()/dump().
+//
+// With a flush callback set, the buffer streams instead: whenever it is
+// full, the next push() first hands the records over and starts again
+// empty. flush() hands over whatever is held in between.
+class Trace_buffer {
+  private:
+    static constexpr uint64_t NEVER = ~uint64_t(0);
+
+    std::vector<Trace_record> records;
+    std::size_t mask;
+    uint64_t head;
+
+    // While streaming, head when the held records were last handed over,
+    // always at the top of the ring, and the slots passed over to get
+    // back there after a partial flush
+    uint64_t base;
+    uint64_t skipped;
+    trace_flush_t on_flush;
+
+    // head at which push() flushes first, never when not streaming
+    uint64_t flush_at;
+
+  public:
+    // capacity is rounded up to a power of two
+    explicit Trace_buffer(std::size_t capacity);
+
+    // Next slot to fill in, counted as pushed. Filling it in place lets
+    // the compiler store each field once.
+    Trace_record &append() {
+        if (head == flush_at) {
+            flush();
+        }
+        return records[head++ & mask];
+    }
+
+    void push(const Trace_record &record) { append() = record; }
+
+    // Attach a memory write to the last record pushed
+    void note_write(WORD addr, BYTE value) {
+        Trace_record &record = records[(head - 1) & mask];
+        record.write_addr = addr;
+        record.write_value = value;
+        record.wrote = true;
+    }
+
+    // Stream full buffers to callback from now on, or stop for nullptr.
+    // Clears the buffer, so streaming starts with the next record.
+    void set_flush(trace_flush_t callback);
+
+    // Hand the records held since the last flush to the callback
+    void flush();
+
+    void clear();
+
+    // Number of records currently held, at most capacity()
+    std::size_t size() const;
+    std::size_t capacity() const;
+
+    // Total records pushed since construction or clear()
+    uint64_t total() const;
+
+    // i-th held record, oldest first
+    const Trace_record &operator[](std::size_t i) const;
+
+    static std::string format(const Trace_record &record);
+
+    // Write all held records, oldest first, one per line
+    void dump(std::ostream &os) const;
+};
+} // namespace mos6502
@@ -0,0 +1,137 @@
+// TraceFile.hpp
+#pragma once
+
+#include <Trace.hpp>
+#include <Types.hpp>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mos6502 {
+// Streams the records of one Trace_buffer to a file. Each full buffer is
+// swapped out for a spare, so the emulating thread never copies or
+// formats anything. Background threads then XOR every record with the
+// one before it, compress the chunk with zlib and append it, in order.
+// Chunks decode on their own, so Trace_reader can seek to any
+// instruction by decompressing a single chunk.
+//
+// When the background threads fall MAX_PENDING chunks behind, handing
+// over the next one waits for them.
+class Trace_writer {
+  public:
+    static constexpr std::size_t MAX_PENDING = 4;
+
+  private:
+    struct Chunk {
+        uint64_t first;
+        std::vector<Trace_record> records;
+        // Position in the file, in chunks
+        uint64_t sequence;
+    };
+
+    std::FILE *file;
+    bool ok;
+
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable drained;
+    std::condition_variable turn;
+    std::deque<Chunk> pending;
+    std::vector<std::vector<Trace_record>> spares;
+    // Chunks taken by a thread and not yet written
+    std::size_t n_busy;
+    uint64_t next_sequence;
+    uint64_t next_write;
+    bool stopping;
+
+    // Records handed over so far
+    uint64_t n_records;
+
+    Trace_buffer *attached;
+    std::vector<std::thread> threads;
+
+    void submit(std::vector<Trace_record> &records);
+    void worker();
+
+    // Chunk header and zlib stream for chunk, in out
+    static bool compress_chunk(const Chunk &chunk, std::vector<BYTE> &encoded,
+                               std::vector<BYTE> &out);
+
+  public:
+    // Create or truncate path, compressing on n_threads threads. One keeps
+    // up with the interpreter at a fraction of its speed; use more to
+    // trace at full speed.
+    explicit Trace_writer(const std::string &path, unsigned n_threads = 1);
+
+    // detach() and close()
+    ~Trace_writer();
+
+    Trace_writer(const Trace_writer &) = delete;
+    Trace_writer &operator=(const Trace_writer &) = delete;
+
+    // False once opening or writing the file failed
+    bool valid();
+
+    // Stream every record pushed into buffer from now on. The buffer is
+    // cleared; its capacity sets the chunk size.
+    void attach(Trace_buffer &buffer);
+
+    // Hand over the records still held by the attached buffer and stop
+    // streaming it
+    void detach();
+
+    // Wait until every record handed over is in the file
+    void sync();
+
+    // detach(), write out everything and close the file
+    void close();
+
+    // Records handed over to the file so far
+    uint64_t records();
+};
+
+// Random access to a file written by Trace_writer. Opening reads only the
+// chunk headers; records are decompressed a chunk at a time on demand,
+// keeping the last chunk decoded.
+class Trace_reader {
+  private:
+    struct Chunk_info {
+        uint64_t first;
+        uint32_t n_records;
+        uint32_t compressed_size;
+        std::streamoff offset;
+    };
+
+    std::ifstream file;
+    bool ok;
+    std::vector<Chunk_info> chunks;
+    uint64_t n_records;
+
+    // Index into chunks of the decoded chunk, or -1
+    long current;
+    std::vector<Trace_record> decoded;
+
+    bool load(std::size_t chunk);
+
+  public:
+    explicit Trace_reader(const std::string &path);
+
+    // False when the file is missing or not a trace
+    bool valid() const { return ok; }
+
+    // Instructions in the file
+    uint64_t size() const { return n_records; }
+
+    // Record of instruction index, counting from 0 at attach(). False
+    // past the end or when its chunk is corrupt.
+    bool read(uint64_t index, Trace_record &record);
+};
+} // namespace mos6502
@@ -3,7 +3,6 @@
 
 #include <array>
 #include <cstdint>
-#include <functional>
 
 namespace mos6502 {
 using mem_t = std::array<uint8_t, 0x10000>;
@@ -11,7 +10,7 @@ using mem_t = std::array<uint8_t, 0x10000>;
 using BYTE = uint8_t;
 using WORD = uint16_t;
 
-enum class ADDRESSING_MODE {
+enum class ADDRESSING_MODE : uint8_t {
     IMPLICIT,
     ACCUMULATOR,
     IMMEDIATE,
@@ -28,7 +27,7 @@ enum class ADDRESSING_MODE {
     INVALID,
 };
 
-enum class INSTRUCTION {
+enum class INSTRUCTION : uint8_t {
     ADC,
     AND,
     ASL,
@@ -91,7 +90,10 @@ enum class INSTRUCTION {
 struct Instruction_info {
     INSTRUCTION ins;
     ADDRESSING_MODE mode;
+    // Length in bytes, opcode included
+    BYTE bytes;
+    // Base cycle count
+    BYTE cycles;
+    const char *mnemonic;
 };
-
-using instruction_t = std::function<void(ADDRESSING_MODE, WORD)>;
 } // namespace mos6502
@@ -0,0 +1,94 @@
+#include <Aot.hpp>
+#include <Scheduler.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+
+using namespace mos6502;
+
+Aot_context::Aot_context(CPU &cpu)
+    : cpu(cpu), read_pages(cpu.get_bus().read_page_table()),
+      write_pages(cpu.get_bus().write_page_table()), bound(0), until(-1) {}
+
+BYTE Aot_context::read_slow(WORD addr) { return cpu.bus->read(addr); }
+
+void Aot_context::write_slow(WORD addr, BYTE value) {
+    cpu.bus->write(addr, value);
+}
+
+Aot_runner::Aot_runner(CPU &cpu, const Aot_program &program)
+    : cpu(cpu), bus(*cpu.bus), ctx(cpu), entries(0x10000, nullptr),
+      program(program), bus_generation(bus.get_generation()),
+      matches(false) {
+    for (std::size_t i = 0; i < program.n_blocks; i++) {
+        entries[program.blocks[i].pc] = &program.blocks[i];
+    }
+    check_mapping();
+}
+
+void Aot_runner::check_mapping() {
+    bus_generation = bus.get_generation();
+    matches = true;
+    for (std::size_t i = 0; i < program.n_pages && matches; i++) {
+        const Aot_page &page = program.pages[i];
+        // Direct but not RAM means ROM
+        matches = bus.is_direct(page.page) &&
+                  bus.ram_page(page.page) == nullptr;
+        for (int offset = 0; offset < 0x100 && matches; offset++) {
+            matches = bus.peek((page.page << 8) | offset) == page.data[offset];
+        }
+    }
+}
+
+bool Aot_runner::active() {
+    if (bus.get_generation() != bus_generation) {
+        check_mapping();
+    }
+    return matches;
+}
+
+template <bool UNTIL>
+uint64_t Aot_runner::run(uint64_t max_cycles, WORD address) {
+    uint64_t start = cpu.cycles;
+    uint64_t end = start + max_cycles;
+    Scheduler &events = bus.get_scheduler();
+    ctx.until = UNTIL ? address : -1;
+    while (cpu.cycles < end && !(UNTIL && cpu.pc == address)) {
+        uint64_t next_event = events.next_cycle();
+        if (next_event <= cpu.cycles) {
+            events.run_due(cpu.cycles);
+            continue;
+        }
+        if (cpu.pending != 0 && cpu.service_interrupts()) {
+            continue;
+        }
+        uint64_t bound = std::min(end, next_event);
+
+        const Aot_block *block = entries[cpu.pc];
+#ifdef MOS6502_TRACE
+        if (cpu.trace != nullptr) {
+            block = nullptr;
+        }
+#endif
+        // Blocks cannot stop halfway through
+        if (block != nullptr && cpu.cycles + block->max_cycles <= bound &&
+            !(UNTIL && address > block->pc && address <= block->last_pc) &&
+            active()) {
+            ctx.bound = bound;
+            block->run(ctx);
+        } else {
+            cpu.execute(cpu.fetch_opcode());
+        }
+    }
+    // As CPU::run_for_cycles(), events due by the last instruction fire
+    events.run_due(cpu.cycles);
+    return cpu.cycles - start;
+}
+
+uint64_t Aot_runner::run_for_cycles(uint64_t n_cycles) {
+    return run<false>(n_cycles, 0x0000);
+}
+
+uint64_t Aot_runner::run_until(WORD address, uint64_t max_cycles) {
+    return run<true>(max_cycles, address);
+}
@@ -0,0 +1,185 @@
+#include <Batch.hpp>
+#include <CPU.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace mos6502;
+
+static uint64_t pack(uint64_t begin, uint64_t end) { return begin | end << 32; }
+
+Batch_runner::Batch_runner(unsigned n_threads)
+    : job(0), n_busy(0), stopping(false) {
+    if (n_threads == 0) {
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    shares = std::make_unique<Share[]>(n_threads);
+    for (unsigned id = 0; id < n_threads; id++) {
+        shares[id].range.store(0, std::memory_order_relaxed);
+    }
+    for (unsigned id = 0; id < n_threads; id++) {
+        threads.emplace_back(&Batch_runner::worker, this, id);
+    }
+}
+
+Batch_runner::~Batch_runner() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start.notify_all();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+bool Batch_runner::claim(unsigned id, std::size_t &index) {
+    std::atomic<uint64_t> &range = shares[id].range;
+    uint64_t current = range.load(std::memory_order_relaxed);
+    for (;;) {
+        uint32_t begin = current;
+        uint32_t end = current >> 32;
+        if (begin >= end) {
+            return false;
+        }
+        if (range.compare_exchange_weak(current, current + 1,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_relaxed)) {
+            index = begin;
+            return true;
+        }
+    }
+}
+
+bool Batch_runner::steal(unsigned id) {
+    unsigned n = threads.size();
+    for (unsigned k = 1; k < n; k++) {
+        std::atomic<uint64_t> &range = shares[(id + k) % n].range;
+        uint64_t current = range.load(std::memory_order_relaxed);
+        for (;;) {
+            uint32_t begin = current;
+            uint32_t end = current >> 32;
+            if (begin >= end) {
+                break;
+            }
+            // Take the back half, or the last index
+            uint32_t middle = begin + (end - begin) / 2;
+            if (range.compare_exchange_weak(current, pack(begin, middle),
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_relaxed)) {
+                shares[id].range.store(pack(middle, end),
+                                       std::memory_order_release);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void Batch_runner::worker(unsigned id) {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start.wait(lock, [&] { return stopping || job != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = job;
+        }
+
+        // Work is only ever moved, never dropped, so once this worker
+        // finds nothing left to steal it is done
+        for (;;) {
+            std::size_t index;
+            if (claim(id, index)) {
+                task(index);
+            } else if (!steal(id)) {
+                break;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--n_busy == 0) {
+            done.notify_all();
+        }
+    }
+}
+
+void Batch_runner::run_all(std::size_t n_tasks,
+                           std::function<void(std::size_t)> task) {
+    unsigned n = threads.size();
+    this->task = std::move(task);
+    for (unsigned id = 0; id < n; id++) {
+        shares[id].range.store(
+            pack(n_tasks * id / n, n_tasks * (id + 1) / n),
+            std::memory_order_relaxed);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    n_busy = n;
+    job++;
+    start.notify_all();
+    done.wait(lock, [&] { return n_busy == 0; });
+}
+
+static Batch_result result_of(CPU &cpu, uint64_t instructions,
+                              const mem_t &memory) {
+    Batch_result result;
+    result.a = cpu.a;
+    result.pc = cpu.pc;
+    result.sp = cpu.sp;
+    result.x = cpu.x;
+    result.y = cpu.y;
+    result.p = cpu.get_p();
+    result.cycles = cpu.cycles;
+    result.instructions = instructions;
+    result.memory_digest = Batch_runner::digest(memory);
+    return result;
+}
+
+std::vector<Batch_result>
+Batch_runner::run_for_cycles(std::vector<mem_t> &images, uint64_t n_cycles) {
+    std::vector<Batch_result> results(images.size());
+    run_all(images.size(), [&](std::size_t i) {
+        alignas(64) CPU cpu(images[i]);
+        cpu.reset();
+        uint64_t end = cpu.cycles + n_cycles;
+        uint64_t instructions = 0;
+        while (cpu.cycles < end) {
+            cpu.execute(cpu.fetch_opcode());
+            instructions++;
+        }
+        results[i] = result_of(cpu, instructions, images[i]);
+    });
+    return results;
+}
+
+std::vector<Batch_result>
+Batch_runner::run_for_instructions(std::vector<mem_t> &images,
+                                   uint64_t n_instructions) {
+    std::vector<Batch_result> results(images.size());
+    run_all(images.size(), [&](std::size_t i) {
+        alignas(64) CPU cpu(images[i]);
+        cpu.reset();
+        for (uint64_t n = 0; n < n_instructions; n++) {
+            cpu.execute(cpu.fetch_opcode());
+        }
+        results[i] = result_of(cpu, n_instructions, images[i]);
+    });
+    return results;
+}
+
+uint64_t Batch_runner::digest(const mem_t &memory) {
+    // FNV-1a over 64-bit words, folding the high bits back in at each
+    // step; not cryptographic
+    uint64_t hash = 0xcbf29ce484222325;
+    for (std::size_t i = 0; i < memory.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, &memory[i], sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
@@ -0,0 +1,400 @@
+#include <BlockCache.hpp>
+#include <Fusion.hpp>
+#include <Opcodes.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+
+using namespace mos6502;
+
+// Instructions that can leave straight-line code
+static bool ends_block(INSTRUCTION ins) {
+    switch (ins) {
+    case INSTRUCTION::BCC:
+    case INSTRUCTION::BCS:
+    case INSTRUCTION::BEQ:
+    case INSTRUCTION::BMI:
+    case INSTRUCTION::BNE:
+    case INSTRUCTION::BPL:
+    case INSTRUCTION::BVC:
+    case INSTRUCTION::BVS:
+    case INSTRUCTION::BRK:
+    case INSTRUCTION::JMP:
+    case INSTRUCTION::JSR:
+    case INSTRUCTION::RTI:
+    case INSTRUCTION::RTS:
+    case INSTRUCTION::INVALID:
+        return true;
+    default:
+        return false;
+    }
+}
+
+Block_cache::Block_cache(CPU &cpu)
+    : cpu(cpu), bus(*cpu.bus), bus_generation(cpu.bus->get_generation()),
+      stop_at(0), n_blocks(0), epoch(0), fusion(true), n_fused(0) {
+#ifdef MOS6502_JIT
+    jit = false;
+    n_translated = 0;
+    reference = nullptr;
+    n_mismatches = 0;
+#endif
+    watcher = bus.add_watcher([this](WORD addr) { invalidate(addr >> 8); });
+}
+
+Block_cache::~Block_cache() {
+    if (watcher >= 0) {
+        bus.remove_watcher(watcher);
+    }
+}
+
+void Block_cache::flush() {
+    for (int page = 0; page < 0x100; page++) {
+        if (pages[page] != nullptr) {
+            for (auto &block : *pages[page]) {
+                if (block != nullptr) {
+                    retired.push_back(std::move(block));
+                }
+            }
+        }
+        overlapping[page].clear();
+        uncacheable[page].reset();
+        if (watcher >= 0) {
+            bus.unwatch(watcher, page);
+        }
+    }
+    n_blocks = 0;
+    stop_at = 0;
+    epoch++;
+    bus_generation = bus.get_generation();
+}
+
+void Block_cache::invalidate(BYTE page) {
+    for (WORD entry : overlapping[page]) {
+        std::unique_ptr<Block> &block = (*pages[entry >> 8])[entry & 0xff];
+        if (block != nullptr) {
+            retired.push_back(std::move(block));
+            n_blocks--;
+        }
+    }
+    overlapping[page].clear();
+    uncacheable[page].reset();
+    bus.unwatch(watcher, page);
+    stop_at = 0;
+    epoch++;
+}
+
+std::unique_ptr<Block_cache::Block> Block_cache::compile(WORD pc) {
+    auto block = std::make_unique<Block>();
+    block->pc = pc;
+    block->length = 0;
+    block->next = nullptr;
+#ifdef MOS6502_JIT
+    block->hits = 0;
+#endif
+
+    uint32_t addr = pc;
+    while (block->length < MAX_BLOCK_LENGTH) {
+        BYTE opcode = bus.peek(addr);
+        const Instruction_info &info = lookup_table[opcode];
+
+        // The whole instruction must sit in directly readable memory
+        uint32_t last = addr + info.bytes - 1;
+        if (last > 0xffff || !bus.is_direct(addr >> 8) ||
+            !bus.is_direct(last >> 8)) {
+            break;
+        }
+
+        WORD operand = 0x0000;
+        if (info.bytes == 2) {
+            operand = bus.peek(addr + 1);
+        } else if (info.bytes == 3) {
+            operand = bus.peek(addr + 1) | (bus.peek(addr + 2) << 8);
+        }
+        block->last_pc = addr;
+        block->instructions[block->length++] = Decoded_instruction{
+            CPU::operate_table[opcode], operand, info.bytes, info.cycles,
+            opcode, 0, 0, 0, nullptr, 0};
+
+        addr += info.bytes;
+        if (ends_block(info.ins)) {
+            break;
+        }
+    }
+
+    if (block->length == 0) {
+        return nullptr;
+    }
+    if (fusion) {
+        fuse(*block);
+    }
+
+    BYTE first_page = pc >> 8;
+    BYTE last_page = (addr - 1) >> 8;
+    for (int page = first_page; page <= last_page; page++) {
+        overlapping[page].push_back(pc);
+        if (watcher >= 0) {
+            bus.watch(watcher, page);
+        }
+    }
+    return block;
+}
+
+void Block_cache::set_fusion(bool enabled) {
+    fusion = enabled;
+    flush();
+}
+
+bool Block_cache::reads_direct(const Decoded_instruction &ins) const {
+    switch (lookup_table[ins.opcode].mode) {
+    case ADDRESSING_MODE::ZEROPAGE:
+    case ADDRESSING_MODE::ZEROPAGE_X:
+    case ADDRESSING_MODE::ZEROPAGE_Y:
+        return bus.is_direct(0x00);
+    case ADDRESSING_MODE::ABSOLUTE:
+        return bus.is_direct(ins.operand >> 8);
+    case ADDRESSING_MODE::ABSOLUTE_X:
+    case ADDRESSING_MODE::ABSOLUTE_Y:
+        return bus.is_direct(ins.operand >> 8) &&
+               bus.is_direct(WORD(ins.operand + 0xff) >> 8);
+    default:
+        return true;
+    }
+}
+
+void Block_cache::fuse(Block &block) {
+    int i = 0;
+    while (i < block.length) {
+        Decoded_instruction &first = block.instructions[i];
+        // Longest sequence first
+        int length = std::min(3, block.length - i);
+        for (; length >= 2; length--) {
+            BYTE opcodes[3];
+            bool prefix_ok = true;
+            for (int j = 0; j < length; j++) {
+                const Decoded_instruction &ins = block.instructions[i + j];
+                opcodes[j] = ins.opcode;
+                if (j < length - 1) {
+                    prefix_ok &= fusable_prefix(ins.opcode) &&
+                                 reads_direct(ins);
+                }
+            }
+            if (prefix_ok) {
+                first.fused = CPU::fused_handler(opcodes, length);
+            }
+            if (first.fused != nullptr) {
+                break;
+            }
+        }
+        if (first.fused == nullptr) {
+            i++;
+            continue;
+        }
+
+        first.fused_length = length;
+        for (int j = 0; j < length; j++) {
+            const Decoded_instruction &ins = block.instructions[i + j];
+            first.fused_operands |= uint64_t(ins.operand) << (16 * j);
+            if (j < length - 1) {
+                // Indexed loads may cross a page
+                ADDRESSING_MODE mode = lookup_table[ins.opcode].mode;
+                bool indexed = mode == ADDRESSING_MODE::ABSOLUTE_X ||
+                               mode == ADDRESSING_MODE::ABSOLUTE_Y;
+                first.prefix_bytes += ins.bytes;
+                first.prefix_cycles += ins.cycles + (indexed ? 1 : 0);
+            }
+        }
+        n_fused++;
+        i += length;
+    }
+}
+
+Block_cache::Block *Block_cache::lookup(WORD pc) {
+    std::unique_ptr<Page_blocks> &page = pages[pc >> 8];
+    if (page == nullptr) {
+        page = std::make_unique<Page_blocks>();
+    }
+    std::unique_ptr<Block> &block = (*page)[pc & 0xff];
+    if (block == nullptr) {
+        // Without a watcher, RAM code could change under the cache
+        if (watcher < 0 || uncacheable[pc >> 8][pc & 0xff]) {
+            return nullptr;
+        }
+        block = compile(pc);
+        if (block != nullptr) {
+            n_blocks++;
+        } else {
+            // Rewriting the opcode may make it cacheable
+            uncacheable[pc >> 8][pc & 0xff] = true;
+            bus.watch(watcher, pc >> 8);
+        }
+    }
+    return block.get();
+}
+
+template <bool UNTIL>
+uint64_t Block_cache::run(uint64_t max_cycles, WORD address) {
+    uint64_t start = cpu.cycles;
+    uint64_t end = start + max_cycles;
+    // Previous block, for chaining; dropped once anything is retired
+    Block *prev = nullptr;
+    // Head of the last loop found busy by idle skipping
+    int busy_head = -1;
+    Scheduler &events = bus.get_scheduler();
+    while (cpu.cycles < end && !(UNTIL && cpu.pc == address)) {
+        uint64_t next_event = events.next_cycle();
+        if (next_event <= cpu.cycles) {
+            events.run_due(cpu.cycles);
+            continue;
+        }
+        if (cpu.pending != 0 && cpu.service_interrupts()) {
+            continue;
+        }
+        // Blocks stop at the next event as well as at the end of the run.
+        // Idle skipping re-reads the bound, which an event scheduled
+        // meanwhile lowers.
+        const uint64_t &bound = events.begin_slice(end);
+
+        if (bus.get_generation() != bus_generation) {
+            flush();
+        }
+        if (!retired.empty()) {
+            prev = nullptr;
+            retired.clear();
+        }
+
+        Block *block;
+        if (prev != nullptr && prev->next_pc == cpu.pc &&
+            prev->next_epoch == epoch) {
+            block = prev->next;
+        } else {
+            block = lookup(cpu.pc);
+            if (prev != nullptr) {
+                prev->next_pc = cpu.pc;
+                prev->next = block;
+                prev->next_epoch = epoch;
+            }
+        }
+        prev = block;
+#ifdef MOS6502_TRACE
+        if (cpu.trace != nullptr) {
+            block = nullptr;
+        }
+#endif
+        if (block == nullptr) {
+            cpu.execute(cpu.fetch_opcode());
+            continue;
+        }
+#ifdef MOS6502_JIT
+        bool native = jit && run_native(*block, bound, UNTIL, address);
+#else
+        bool native = false;
+#endif
+
+        if (!native) {
+            stop_at = bound;
+            for (int i = 0; i < block->length; i++) {
+                const Decoded_instruction &ins = block->instructions[i];
+                // A fused sequence must not end early
+                if (ins.fused != nullptr &&
+                    cpu.cycles + ins.prefix_cycles < stop_at &&
+                    !(UNTIL &&
+                      WORD(address - cpu.pc - 1) < ins.prefix_bytes)) {
+                    ins.fused(cpu, ins.fused_operands);
+                    i += ins.fused_length - 1;
+                } else {
+                    cpu.pc += ins.bytes;
+                    cpu.cycles += ins.cycles;
+                    ins.handler(cpu, ins.operand);
+                }
+                if (cpu.cycles >= stop_at || cpu.interrupt_due() ||
+                    (UNTIL && cpu.pc == address)) {
+                    break;
+                }
+            }
+        }
+
+        // A short block jumping back to its own start may be an idle loop
+        WORD head = block->pc;
+        if (cpu.idle_skip && cpu.pc == head && head != busy_head &&
+            WORD(block->last_pc - head) < CPU::IDLE_LOOP_BYTES &&
+            !(UNTIL && head == address)) {
+            if (cpu.skip_idle(bound, UNTIL, address) ==
+                CPU::Idle_probe::BUSY) {
+                busy_head = head;
+            }
+        }
+    }
+    // As CPU::run_for_cycles(), events due by the last instruction fire
+    events.run_due(cpu.cycles);
+    return cpu.cycles - start;
+}
+
+#ifdef MOS6502_JIT
+bool Block_cache::run_native(Block &block, uint64_t end, bool until,
+                             WORD address) {
+    if (block.native == nullptr) {
+        // Translate once on reaching the threshold; failures stay failed
+        if (block.hits > JIT_THRESHOLD || ++block.hits < JIT_THRESHOLD) {
+            return false;
+        }
+        block.hits++;
+        block.native = translate(block);
+        if (block.native == nullptr) {
+            return false;
+        }
+        n_translated++;
+    }
+
+    // Native code cannot stop mid-block
+    if (cpu.cycles + block.native->max_cycles > end ||
+        (until && address > block.pc && address <= block.last_pc)) {
+        return false;
+    }
+
+    if (reference != nullptr) {
+        sync_reference();
+    }
+    stop_at = end;
+    if (!block.native->run(cpu)) {
+        return false;
+    }
+    if (reference != nullptr) {
+        check_reference(block);
+    }
+    return true;
+}
+
+void Block_cache::sync_reference() {
+    while (reference->cycles < cpu.cycles) {
+        reference->execute(reference->fetch_opcode());
+    }
+}
+
+void Block_cache::check_reference(const Block &block) {
+    sync_reference();
+    bool match = reference->cycles == cpu.cycles &&
+                 reference->pc == cpu.pc && reference->a == cpu.a &&
+                 reference->x == cpu.x && reference->y == cpu.y &&
+                 reference->sp == cpu.sp &&
+                 reference->get_p() == cpu.get_p();
+    Bus &reference_bus = reference->get_bus();
+    for (BYTE page : block.native->written_pages) {
+        for (int offset = 0; offset < 0x100 && match; offset++) {
+            WORD addr = (page << 8) | offset;
+            match = reference_bus.peek(addr) == bus.peek(addr);
+        }
+    }
+    if (!match) {
+        n_mismatches++;
+    }
+}
+#endif
+
+uint64_t Block_cache::run_for_cycles(uint64_t n_cycles) {
+    return run<false>(n_cycles, 0x0000);
+}
+
+uint64_t Block_cache::run_until(WORD address, uint64_t max_cycles) {
+    return run<true>(max_cycles, address);
+}
@@ -0,0 +1,172 @@
+#include <Bus.hpp>
+#include <Types.hpp>
+
+#include <cstring>
+
+using namespace mos6502;
+
+Bus::Bus() : running_callbacks(0), generation(0) {
+    read_pages.fill(nullptr);
+    write_pages.fill(nullptr);
+    ram_pages.fill(nullptr);
+    page_device.fill(NO_DEVICE);
+    idle_safe.fill(false);
+    watch_mask.fill(0);
+}
+
+Bus::Bus(mem_t &memory) : Bus() { map_ram(0x00, 0x100, memory.data()); }
+
+void Bus::set_page(BYTE page, const BYTE *read, BYTE *write,
+                   uint16_t device) {
+    uint16_t old = page_device[page];
+    if (device != NO_DEVICE) {
+        devices[device].n_pages++;
+    }
+    // The callbacks live on until the slot is reused, so a device may
+    // remap its own page from inside one of them
+    if (old != NO_DEVICE && --devices[old].n_pages == 0) {
+        released_devices.push_back(old);
+        reclaim_devices();
+    }
+    read_pages[page] = read;
+    ram_pages[page] = write;
+    page_device[page] = device;
+    idle_safe[page] = false;
+    update_write_page(page);
+}
+
+void Bus::reclaim_devices() {
+    if (running_callbacks == 0) {
+        free_devices.insert(free_devices.end(), released_devices.begin(),
+                            released_devices.end());
+        released_devices.clear();
+    }
+}
+
+void Bus::update_write_page(BYTE page) {
+    write_pages[page] = watch_mask[page] == 0 ? ram_pages[page] : nullptr;
+}
+
+void Bus::map_ram(BYTE first_page, int n_pages, BYTE *backing) {
+    for (int i = 0; i < n_pages; i++) {
+        BYTE *page = backing + i * 0x100;
+        set_page(first_page + i, page, page, NO_DEVICE);
+    }
+    generation++;
+}
+
+void Bus::map_rom(BYTE first_page, int n_pages, const BYTE *backing) {
+    for (int i = 0; i < n_pages; i++) {
+        set_page(first_page + i, backing + i * 0x100, nullptr, NO_DEVICE);
+    }
+    generation++;
+}
+
+bool Bus::map_device(BYTE first_page, int n_pages, read_callback_t read,
+                     write_callback_t write) {
+    // A device on no page would hold its slot forever
+    if (n_pages <= 0) {
+        return false;
+    }
+    uint16_t index;
+    if (!free_devices.empty()) {
+        index = free_devices.back();
+        free_devices.pop_back();
+        devices[index] = Device{std::move(read), std::move(write), 0};
+    } else {
+        index = devices.size();
+        devices.push_back(Device{std::move(read), std::move(write), 0});
+    }
+    for (int i = 0; i < n_pages; i++) {
+        set_page(first_page + i, nullptr, nullptr, index);
+    }
+    generation++;
+    return true;
+}
+
+void Bus::unmap(BYTE first_page, int n_pages) {
+    for (int i = 0; i < n_pages; i++) {
+        set_page(first_page + i, nullptr, nullptr, NO_DEVICE);
+    }
+    generation++;
+}
+
+void Bus::set_idle_safe(BYTE first_page, int n_pages, bool safe) {
+    for (int i = 0; i < n_pages; i++) {
+        BYTE page = first_page + i;
+        idle_safe[page] = safe && page_device[page] != NO_DEVICE;
+    }
+}
+
+int Bus::add_watcher(watch_callback_t callback) {
+    for (std::size_t id = 0; id < watchers.size(); id++) {
+        if (!watchers[id]) {
+            watchers[id] = std::move(callback);
+            return id;
+        }
+    }
+    return -1;
+}
+
+void Bus::remove_watcher(int watcher) {
+    for (int page = 0; page < 0x100; page++) {
+        unwatch(watcher, page);
+    }
+    watchers[watcher] = nullptr;
+}
+
+void Bus::watch(int watcher, BYTE page) {
+    watch_mask[page] |= 1 << watcher;
+    update_write_page(page);
+}
+
+void Bus::unwatch(int watcher, BYTE page) {
+    watch_mask[page] &= ~(1 << watcher);
+    update_write_page(page);
+}
+
+void Bus::write_page(BYTE page, const BYTE *data) {
+    BYTE *ram = ram_pages[page];
+    if (ram == nullptr) {
+        return;
+    }
+    for (int id = 0; id < 8; id++) {
+        if (watch_mask[page] & (1 << id)) {
+            watchers[id](page << 8);
+        }
+    }
+    std::memcpy(ram, data, 0x100);
+}
+
+BYTE Bus::read_slow(WORD addr) {
+    uint16_t index = page_device[addr >> 8];
+    if (index != NO_DEVICE && devices[index].read) {
+        running_callbacks++;
+        BYTE value = devices[index].read(addr);
+        running_callbacks--;
+        reclaim_devices();
+        return value;
+    }
+    return 0xff;
+}
+
+void Bus::write_slow(WORD addr, BYTE value) {
+    BYTE page = addr >> 8;
+    if (BYTE *ram = ram_pages[page]) {
+        // Watchers may unwatch the page from inside their callback
+        for (int id = 0; id < 8; id++) {
+            if (watch_mask[page] & (1 << id)) {
+                watchers[id](addr);
+            }
+        }
+        ram[addr & 0xff] = value;
+        return;
+    }
+    uint16_t index = page_device[page];
+    if (index != NO_DEVICE && devices[index].write) {
+        running_callbacks++;
+        devices[index].write(addr, value);
+        running_callbacks--;
+        reclaim_devices();
+    }
+}
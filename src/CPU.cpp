@@ -1,470 +1,240 @@
 #include <CPU.hpp>
+#include <Decimal.hpp>
+#include <Fusion.hpp>
+#include <Opcodes.hpp>
 #include <Types.hpp>
+#ifdef MOS6502_FUSION_TABLE
+#include MOS6502_FUSION_TABLE
+#else
+#include <FusionTable.hpp>
+#endif
 
-#include <iomanip>
+#include <algorithm>
 #include <iostream>
-#include <sstream>
-#include <string>
 
 using namespace mos6502;
 
-CPU::CPU(mem_t &memory) : memory(memory) {
-    init_lookup_table();
-    init_dispatch_table();
+static inline BYTE page_crossed(WORD from, WORD to) {
+    return ((from ^ to) & 0xff00) != 0 ? 1 : 0;
+}
+
+CPU::CPU(Bus &bus) : bus(&bus) {}
+
+CPU::CPU(mem_t &memory)
+    : own_bus(std::make_unique<Bus>(memory)), bus(own_bus.get()) {}
+
+template <INSTRUCTION I, ADDRESSING_MODE M>
+void CPU::operate(CPU &cpu, WORD operand) {
+    if constexpr (I == INSTRUCTION::ADC) {
+        cpu.ADC<M>(operand);
+    } else if constexpr (I == INSTRUCTION::AND) {
+        cpu.AND<M>(operand);
+    } else if constexpr (I == INSTRUCTION::ASL) {
+        cpu.ASL<M>(operand);
+    } else if constexpr (I == INSTRUCTION::BCC) {
+        cpu.BCC<M>(operand);
+    } else if constexpr (I == INSTRUCTION::BCS) {
+        cpu.BCS<M>(operand);
+    } else if constexpr (I == INSTRUCTION::BEQ) {
+        cpu.BEQ<M>(operand);
+    } else if constexpr (I == INSTRUCTION::BIT) {
+        cpu.BIT<M>(operand);
+    } else if constexpr (I == INSTRUCTION::BMI) {
+        cpu.BMI<M>(operand);
+    } else if constexpr (I == INSTRUCTION::BNE) {
+        cpu.BNE<M>(operand);
+    } else if constexpr (I == INSTRUCTION::BPL) {
+        cpu.BPL<M>(operand);
+    } else if constexpr (I == INSTRUCTION::BRK) {
+        cpu.BRK<M>(operand);
+    } else if constexpr (I == INSTRUCTION::BVC) {
+        cpu.BVC<M>(operand);
+    } else if constexpr (I == INSTRUCTION::BVS) {
+        cpu.BVS<M>(operand);
+    } else if constexpr (I == INSTRUCTION::CLC) {
+        cpu.CLC<M>(operand);
+    } else if constexpr (I == INSTRUCTION::CLD) {
+        cpu.CLD<M>(operand);
+    } else if constexpr (I == INSTRUCTION::CLI) {
+        cpu.CLI<M>(operand);
+    } else if constexpr (I == INSTRUCTION::CLV) {
+        cpu.CLV<M>(operand);
+    } else if constexpr (I == INSTRUCTION::CMP) {
+        cpu.CMP<M>(operand);
+    } else if constexpr (I == INSTRUCTION::CPX) {
+        cpu.CPX<M>(operand);
+    } else if constexpr (I == INSTRUCTION::CPY) {
+        cpu.CPY<M>(operand);
+    } else if constexpr (I == INSTRUCTION::DEC) {
+        cpu.DEC<M>(operand);
+    } else if constexpr (I == INSTRUCTION::DEX) {
+        cpu.DEX<M>(operand);
+    } else if constexpr (I == INSTRUCTION::DEY) {
+        cpu.DEY<M>(operand);
+    } else if constexpr (I == INSTRUCTION::EOR) {
+        cpu.EOR<M>(operand);
+    } else if constexpr (I == INSTRUCTION::INC) {
+        cpu.INC<M>(operand);
+    } else if constexpr (I == INSTRUCTION::INX) {
+        cpu.INX<M>(operand);
+    } else if constexpr (I == INSTRUCTION::INY) {
+        cpu.INY<M>(operand);
+    } else if constexpr (I == INSTRUCTION::JMP) {
+        cpu.JMP<M>(operand);
+    } else if constexpr (I == INSTRUCTION::JSR) {
+        cpu.JSR<M>(operand);
+    } else if constexpr (I == INSTRUCTION::LDA) {
+        cpu.LDA<M>(operand);
+    } else if constexpr (I == INSTRUCTION::LDX) {
+        cpu.LDX<M>(operand);
+    } else if constexpr (I == INSTRUCTION::LDY) {
+        cpu.LDY<M>(operand);
+    } else if constexpr (I == INSTRUCTION::LSR) {
+        cpu.LSR<M>(operand);
+    } else if constexpr (I == INSTRUCTION::NOP) {
+        cpu.NOP<M>(operand);
+    } else if constexpr (I == INSTRUCTION::ORA) {
+        cpu.ORA<M>(operand);
+    } else if constexpr (I == INSTRUCTION::PHA) {
+        cpu.PHA<M>(operand);
+    } else if constexpr (I == INSTRUCTION::PHP) {
+        cpu.PHP<M>(operand);
+    } else if constexpr (I == INSTRUCTION::PLA) {
+        cpu.PLA<M>(operand);
+    } else if constexpr (I == INSTRUCTION::PLP) {
+        cpu.PLP<M>(operand);
+    } else if constexpr (I == INSTRUCTION::ROL) {
+        cpu.ROL<M>(operand);
+    } else if constexpr (I == INSTRUCTION::ROR) {
+        cpu.ROR<M>(operand);
+    } else if constexpr (I == INSTRUCTION::RTI) {
+        cpu.RTI<M>(operand);
+    } else if constexpr (I == INSTRUCTION::RTS) {
+        cpu.RTS<M>(operand);
+    } else if constexpr (I == INSTRUCTION::SBC) {
+        cpu.SBC<M>(operand);
+    } else if constexpr (I == INSTRUCTION::SEC) {
+        cpu.SEC<M>(operand);
+    } else if constexpr (I == INSTRUCTION::SED) {
+        cpu.SED<M>(operand);
+    } else if constexpr (I == INSTRUCTION::SEI) {
+        cpu.SEI<M>(operand);
+    } else if constexpr (I == INSTRUCTION::STA) {
+        cpu.STA<M>(operand);
+    } else if constexpr (I == INSTRUCTION::STX) {
+        cpu.STX<M>(operand);
+    } else if constexpr (I == INSTRUCTION::STY) {
+        cpu.STY<M>(operand);
+    } else if constexpr (I == INSTRUCTION::TAX) {
+        cpu.TAX<M>(operand);
+    } else if constexpr (I == INSTRUCTION::TAY) {
+        cpu.TAY<M>(operand);
+    } else if constexpr (I == INSTRUCTION::TSX) {
+        cpu.TSX<M>(operand);
+    } else if constexpr (I == INSTRUCTION::TXA) {
+        cpu.TXA<M>(operand);
+    } else if constexpr (I == INSTRUCTION::TXS) {
+        cpu.TXS<M>(operand);
+    } else if constexpr (I == INSTRUCTION::TYA) {
+        cpu.TYA<M>(operand);
+    } else {
+        cpu.INVALID<M>(operand);
+    }
+}
+
+template <INSTRUCTION I, ADDRESSING_MODE M> void CPU::dispatch(CPU &cpu) {
+    operate<I, M>(cpu, cpu.fetch_operand<M>());
+}
+
+template <std::size_t... OPCODE>
+constexpr std::array<CPU::handler_t, 0x100>
+CPU::make_dispatch_table(std::index_sequence<OPCODE...>) {
+    return {{&CPU::dispatch<lookup_table[OPCODE].ins,
+                           lookup_table[OPCODE].mode>...}};
+}
+
+template <std::size_t... OPCODE>
+constexpr std::array<CPU::operate_t, 0x100>
+CPU::make_operate_table(std::index_sequence<OPCODE...>) {
+    return {{&CPU::operate<lookup_table[OPCODE].ins,
+                          lookup_table[OPCODE].mode>...}};
+}
+
+constexpr std::array<CPU::handler_t, 0x100> CPU::dispatch_table =
+    CPU::make_dispatch_table(std::make_index_sequence<0x100>{});
+
+constexpr std::array<CPU::operate_t, 0x100> CPU::operate_table =
+    CPU::make_operate_table(std::make_index_sequence<0x100>{});
+
+template <BYTE OPCODE> void CPU::fused_step(CPU &cpu, WORD operand) {
+    constexpr Instruction_info info = lookup_table[OPCODE];
+    cpu.pc += info.bytes;
+    cpu.cycles += info.cycles;
+    operate<info.ins, info.mode>(cpu, operand);
+}
+
+template <std::size_t RULE> void CPU::fused(CPU &cpu, uint64_t operands) {
+    constexpr Fusion_rule rule = fusion_table[RULE];
+    static_assert(rule.length == 2 || rule.length == 3,
+                  "fused sequences are pairs or triples");
+    static_assert(fusable_prefix(rule.opcodes[0]) &&
+                      (rule.length == 2 || fusable_prefix(rule.opcodes[1])),
+                  "only the last instruction of a fused sequence may write, "
+                  "branch or touch I");
+    static_assert(lookup_table[rule.opcodes[rule.length - 1]].ins !=
+                      INSTRUCTION::INVALID,
+                  "fused sequences hold documented opcodes");
+    fused_step<rule.opcodes[0]>(cpu, operands & 0xffff);
+    fused_step<rule.opcodes[1]>(cpu, (operands >> 16) & 0xffff);
+    if constexpr (rule.length == 3) {
+        fused_step<rule.opcodes[2]>(cpu, (operands >> 32) & 0xffff);
+    }
+}
+
+template <std::size_t... RULE>
+constexpr std::array<CPU::fused_t, sizeof...(RULE)>
+CPU::make_fused_table(std::index_sequence<RULE...>) {
+    return {{&CPU::fused<RULE>...}};
+}
+
+CPU::fused_t CPU::fused_handler(const BYTE *opcodes, int length) {
+    static constexpr auto fused_table = make_fused_table(
+        std::make_index_sequence<fusion_table.size()>{});
+    for (std::size_t i = 0; i < fusion_table.size(); i++) {
+        const Fusion_rule &rule = fusion_table[i];
+        if (rule.length == length &&
+            std::equal(opcodes, opcodes + length, rule.opcodes.begin())) {
+            return fused_table[i];
+        }
+    }
+    return nullptr;
 }
 
 void CPU::reset() {
-    pc = memory[0xfffc] | (memory[0xfffd] << 8);
-    n = v = b = d = z = c = 0;
-    u = i = 1;
+    pc = bus->read(0xfffc) | (bus->read(0xfffd) << 8);
+    set_p(FLAG_I);
     sp = 0xfd;
     a = 0;
     x = y = 0;
-}
-
-void CPU::init_lookup_table() {
-    lookup_table = {
-        Instruction_info{INSTRUCTION::BRK, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::ORA, ADDRESSING_MODE::INDIRECT_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::ORA, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::ASL, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::PHP, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::ORA, ADDRESSING_MODE::IMMEDIATE},
-        Instruction_info{INSTRUCTION::ASL, ADDRESSING_MODE::ACCUMULATOR},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::ORA, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::ASL, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::BPL, ADDRESSING_MODE::RELATIVE},
-        Instruction_info{INSTRUCTION::ORA, ADDRESSING_MODE::INDIRECT_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::ORA, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::ASL, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CLC, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::ORA, ADDRESSING_MODE::ABSOLUTE_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::ORA, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::ASL, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::JSR, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::AND, ADDRESSING_MODE::INDIRECT_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::BIT, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::AND, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::ROL, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::PLP, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::AND, ADDRESSING_MODE::IMMEDIATE},
-        Instruction_info{INSTRUCTION::ROL, ADDRESSING_MODE::ACCUMULATOR},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::BIT, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::AND, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::ROL, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::BMI, ADDRESSING_MODE::RELATIVE},
-        Instruction_info{INSTRUCTION::AND, ADDRESSING_MODE::INDIRECT_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::AND, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::ROL, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::SEC, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::AND, ADDRESSING_MODE::ABSOLUTE_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::AND, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::ROL, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::RTI, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::EOR, ADDRESSING_MODE::INDIRECT_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::EOR, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::LSR, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::PHA, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::EOR, ADDRESSING_MODE::IMMEDIATE},
-        Instruction_info{INSTRUCTION::LSR, ADDRESSING_MODE::ACCUMULATOR},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::JMP, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::EOR, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::LSR, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::BVC, ADDRESSING_MODE::RELATIVE},
-        Instruction_info{INSTRUCTION::EOR, ADDRESSING_MODE::INDIRECT_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::EOR, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::LSR, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CLI, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::EOR, ADDRESSING_MODE::ABSOLUTE_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::EOR, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::LSR, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::RTS, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::ADC, ADDRESSING_MODE::INDIRECT_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::ADC, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::ROR, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::PLA, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::ADC, ADDRESSING_MODE::IMMEDIATE},
-        Instruction_info{INSTRUCTION::ROR, ADDRESSING_MODE::ACCUMULATOR},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::JMP, ADDRESSING_MODE::INDIRECT},
-        Instruction_info{INSTRUCTION::ADC, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::ROR, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::BVS, ADDRESSING_MODE::RELATIVE},
-        Instruction_info{INSTRUCTION::ADC, ADDRESSING_MODE::INDIRECT_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::ADC, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::ROR, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::SEI, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::ADC, ADDRESSING_MODE::ABSOLUTE_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::ADC, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::ROR, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::STA, ADDRESSING_MODE::INDIRECT_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::STY, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::STA, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::STX, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::DEY, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::TXA, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::STY, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::STA, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::STX, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::BCC, ADDRESSING_MODE::RELATIVE},
-        Instruction_info{INSTRUCTION::STA, ADDRESSING_MODE::INDIRECT_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::STY, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::STA, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::STX, ADDRESSING_MODE::ZEROPAGE_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::TYA, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::STA, ADDRESSING_MODE::ABSOLUTE_Y},
-        Instruction_info{INSTRUCTION::TXS, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::STA, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::LDY, ADDRESSING_MODE::IMMEDIATE},
-        Instruction_info{INSTRUCTION::LDA, ADDRESSING_MODE::INDIRECT_X},
-        Instruction_info{INSTRUCTION::LDX, ADDRESSING_MODE::IMMEDIATE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::LDY, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::LDA, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::LDX, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::TAY, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::LDA, ADDRESSING_MODE::IMMEDIATE},
-        Instruction_info{INSTRUCTION::TAX, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::LDY, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::LDA, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::LDX, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::BCS, ADDRESSING_MODE::RELATIVE},
-        Instruction_info{INSTRUCTION::LDA, ADDRESSING_MODE::INDIRECT_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::LDY, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::LDA, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::LDX, ADDRESSING_MODE::ZEROPAGE_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CLV, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::LDA, ADDRESSING_MODE::ABSOLUTE_Y},
-        Instruction_info{INSTRUCTION::TSX, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::LDY, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::LDA, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::LDX, ADDRESSING_MODE::ABSOLUTE_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CPY, ADDRESSING_MODE::IMMEDIATE},
-        Instruction_info{INSTRUCTION::CMP, ADDRESSING_MODE::INDIRECT_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CPY, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::CMP, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::DEC, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INY, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::CMP, ADDRESSING_MODE::IMMEDIATE},
-        Instruction_info{INSTRUCTION::DEX, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CPY, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::CMP, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::DEC, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::BNE, ADDRESSING_MODE::RELATIVE},
-        Instruction_info{INSTRUCTION::CMP, ADDRESSING_MODE::INDIRECT_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CMP, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::DEC, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CLD, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::CMP, ADDRESSING_MODE::ABSOLUTE_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CMP, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::DEC, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CPX, ADDRESSING_MODE::IMMEDIATE},
-        Instruction_info{INSTRUCTION::SBC, ADDRESSING_MODE::INDIRECT_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CPX, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::SBC, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::INC, ADDRESSING_MODE::ZEROPAGE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INX, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::SBC, ADDRESSING_MODE::IMMEDIATE},
-        Instruction_info{INSTRUCTION::NOP, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::CPX, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::SBC, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::INC, ADDRESSING_MODE::ABSOLUTE},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::BEQ, ADDRESSING_MODE::RELATIVE},
-        Instruction_info{INSTRUCTION::SBC, ADDRESSING_MODE::INDIRECT_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::SBC, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::INC, ADDRESSING_MODE::ZEROPAGE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::SED, ADDRESSING_MODE::IMPLICIT},
-        Instruction_info{INSTRUCTION::SBC, ADDRESSING_MODE::ABSOLUTE_Y},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-        Instruction_info{INSTRUCTION::SBC, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::INC, ADDRESSING_MODE::ABSOLUTE_X},
-        Instruction_info{INSTRUCTION::INVALID, ADDRESSING_MODE::INVALID},
-    };
-}
-
-void CPU::init_dispatch_table() {
-    dispatch_table[INSTRUCTION::ADC] = [this](ADDRESSING_MODE m, WORD o) {
-        ADC(m, o);
-    };
-    dispatch_table[INSTRUCTION::AND] = [this](ADDRESSING_MODE m, WORD o) {
-        AND(m, o);
-    };
-    dispatch_table[INSTRUCTION::ASL] = [this](ADDRESSING_MODE m, WORD o) {
-        ASL(m, o);
-    };
-    dispatch_table[INSTRUCTION::BCC] = [this](ADDRESSING_MODE m, WORD o) {
-        BCC(m, o);
-    };
-    dispatch_table[INSTRUCTION::BCS] = [this](ADDRESSING_MODE m, WORD o) {
-        BCS(m, o);
-    };
-    dispatch_table[INSTRUCTION::BEQ] = [this](ADDRESSING_MODE m, WORD o) {
-        BEQ(m, o);
-    };
-    dispatch_table[INSTRUCTION::BIT] = [this](ADDRESSING_MODE m, WORD o) {
-        BIT(m, o);
-    };
-    dispatch_table[INSTRUCTION::BMI] = [this](ADDRESSING_MODE m, WORD o) {
-        BMI(m, o);
-    };
-    dispatch_table[INSTRUCTION::BNE] = [this](ADDRESSING_MODE m, WORD o) {
-        BNE(m, o);
-    };
-    dispatch_table[INSTRUCTION::BPL] = [this](ADDRESSING_MODE m, WORD o) {
-        BPL(m, o);
-    };
-    dispatch_table[INSTRUCTION::BRK] = [this](ADDRESSING_MODE m, WORD o) {
-        BRK(m, o);
-    };
-    dispatch_table[INSTRUCTION::BVC] = [this](ADDRESSING_MODE m, WORD o) {
-        BVC(m, o);
-    };
-    dispatch_table[INSTRUCTION::BVS] = [this](ADDRESSING_MODE m, WORD o) {
-        BVS(m, o);
-    };
-    dispatch_table[INSTRUCTION::CLC] = [this](ADDRESSING_MODE m, WORD o) {
-        CLC(m, o);
-    };
-    dispatch_table[INSTRUCTION::CLD] = [this](ADDRESSING_MODE m, WORD o) {
-        CLD(m, o);
-    };
-    dispatch_table[INSTRUCTION::CLI] = [this](ADDRESSING_MODE m, WORD o) {
-        CLI(m, o);
-    };
-    dispatch_table[INSTRUCTION::CLV] = [this](ADDRESSING_MODE m, WORD o) {
-        CLV(m, o);
-    };
-    dispatch_table[INSTRUCTION::CMP] = [this](ADDRESSING_MODE m, WORD o) {
-        CMP(m, o);
-    };
-    dispatch_table[INSTRUCTION::CPX] = [this](ADDRESSING_MODE m, WORD o) {
-        CPX(m, o);
-    };
-    dispatch_table[INSTRUCTION::CPY] = [this](ADDRESSING_MODE m, WORD o) {
-        CPY(m, o);
-    };
-    dispatch_table[INSTRUCTION::DEC] = [this](ADDRESSING_MODE m, WORD o) {
-        DEC(m, o);
-    };
-    dispatch_table[INSTRUCTION::DEX] = [this](ADDRESSING_MODE m, WORD o) {
-        DEX(m, o);
-    };
-    dispatch_table[INSTRUCTION::DEY] = [this](ADDRESSING_MODE m, WORD o) {
-        DEY(m, o);
-    };
-    dispatch_table[INSTRUCTION::EOR] = [this](ADDRESSING_MODE m, WORD o) {
-        EOR(m, o);
-    };
-    dispatch_table[INSTRUCTION::INC] = [this](ADDRESSING_MODE m, WORD o) {
-        INC(m, o);
-    };
-    dispatch_table[INSTRUCTION::INX] = [this](ADDRESSING_MODE m, WORD o) {
-        INX(m, o);
-    };
-    dispatch_table[INSTRUCTION::INY] = [this](ADDRESSING_MODE m, WORD o) {
-        INY(m, o);
-    };
-    dispatch_table[INSTRUCTION::JMP] = [this](ADDRESSING_MODE m, WORD o) {
-        JMP(m, o);
-    };
-    dispatch_table[INSTRUCTION::JSR] = [this](ADDRESSING_MODE m, WORD o) {
-        JSR(m, o);
-    };
-    dispatch_table[INSTRUCTION::LDA] = [this](ADDRESSING_MODE m, WORD o) {
-        LDA(m, o);
-    };
-    dispatch_table[INSTRUCTION::LDX] = [this](ADDRESSING_MODE m, WORD o) {
-        LDX(m, o);
-    };
-    dispatch_table[INSTRUCTION::LDY] = [this](ADDRESSING_MODE m, WORD o) {
-        LDY(m, o);
-    };
-    dispatch_table[INSTRUCTION::LSR] = [this](ADDRESSING_MODE m, WORD o) {
-        LSR(m, o);
-    };
-    dispatch_table[INSTRUCTION::NOP] = [this](ADDRESSING_MODE m, WORD o) {
-        NOP(m, o);
-    };
-    dispatch_table[INSTRUCTION::ORA] = [this](ADDRESSING_MODE m, WORD o) {
-        ORA(m, o);
-    };
-    dispatch_table[INSTRUCTION::PHA] = [this](ADDRESSING_MODE m, WORD o) {
-        PHA(m, o);
-    };
-    dispatch_table[INSTRUCTION::PHP] = [this](ADDRESSING_MODE m, WORD o) {
-        PHP(m, o);
-    };
-    dispatch_table[INSTRUCTION::PLA] = [this](ADDRESSING_MODE m, WORD o) {
-        PLA(m, o);
-    };
-    dispatch_table[INSTRUCTION::PLP] = [this](ADDRESSING_MODE m, WORD o) {
-        PLP(m, o);
-    };
-    dispatch_table[INSTRUCTION::ROL] = [this](ADDRESSING_MODE m, WORD o) {
-        ROL(m, o);
-    };
-    dispatch_table[INSTRUCTION::ROR] = [this](ADDRESSING_MODE m, WORD o) {
-        ROR(m, o);
-    };
-    dispatch_table[INSTRUCTION::RTI] = [this](ADDRESSING_MODE m, WORD o) {
-        RTI(m, o);
-    };
-    dispatch_table[INSTRUCTION::RTS] = [this](ADDRESSING_MODE m, WORD o) {
-        RTS(m, o);
-    };
-    dispatch_table[INSTRUCTION::SBC] = [this](ADDRESSING_MODE m, WORD o) {
-        SBC(m, o);
-    };
-    dispatch_table[INSTRUCTION::SEC] = [this](ADDRESSING_MODE m, WORD o) {
-        SEC(m, o);
-    };
-    dispatch_table[INSTRUCTION::SED] = [this](ADDRESSING_MODE m, WORD o) {
-        SED(m, o);
-    };
-    dispatch_table[INSTRUCTION::SEI] = [this](ADDRESSING_MODE m, WORD o) {
-        SEI(m, o);
-    };
-    dispatch_table[INSTRUCTION::STA] = [this](ADDRESSING_MODE m, WORD o) {
-        STA(m, o);
-    };
-    dispatch_table[INSTRUCTION::STX] = [this](ADDRESSING_MODE m, WORD o) {
-        STX(m, o);
-    };
-    dispatch_table[INSTRUCTION::STY] = [this](ADDRESSING_MODE m, WORD o) {
-        STY(m, o);
-    };
-    dispatch_table[INSTRUCTION::TAX] = [this](ADDRESSING_MODE m, WORD o) {
-        TAX(m, o);
-    };
-    dispatch_table[INSTRUCTION::TAY] = [this](ADDRESSING_MODE m, WORD o) {
-        TAY(m, o);
-    };
-    dispatch_table[INSTRUCTION::TSX] = [this](ADDRESSING_MODE m, WORD o) {
-        TSX(m, o);
-    };
-    dispatch_table[INSTRUCTION::TXA] = [this](ADDRESSING_MODE m, WORD o) {
-        TXA(m, o);
-    };
-    dispatch_table[INSTRUCTION::TXS] = [this](ADDRESSING_MODE m, WORD o) {
-        TXS(m, o);
-    };
-    dispatch_table[INSTRUCTION::TYA] = [this](ADDRESSING_MODE m, WORD o) {
-        TYA(m, o);
-    };
-    dispatch_table[INSTRUCTION::INVALID] = [this](ADDRESSING_MODE m, WORD o) {
-        INVALID(m, o);
-    };
+    cycles += 7;
 }
 
 BYTE CPU::get_p() {
-    BYTE p = (n << 7) | (v << 6) | (u << 5) | (b << 4) | (d << 3) | (i << 2) |
-             (z << 1) | c;
+    BYTE p = (n_result & FLAG_N) | (v << 6) | FLAG_U | id_flags |
+             (z_result == 0 ? FLAG_Z : 0) | c;
     return p;
 }
 
+void CPU::set_p(BYTE p) {
+    n_result = p & FLAG_N;
+    z_result = (p & FLAG_Z) ? 0 : 1;
+    v = (p >> 6) & 0x1;
+    id_flags = p & (FLAG_I | FLAG_D);
+    c = p & FLAG_C;
+}
+
 BYTE CPU::fetch_opcode() {
-    BYTE opcode = memory[pc];
+    BYTE opcode = bus->read(pc);
     pc++;
     return opcode;
 }
@@ -479,45 +249,45 @@ WORD CPU::fetch_operands(ADDRESSING_MODE mode) {
     case ADDRESSING_MODE::ACCUMULATOR: {
     } break;
     case ADDRESSING_MODE::IMMEDIATE: {
-        operand = memory[pc++];
+        operand = bus->read(pc++);
     } break;
     case ADDRESSING_MODE::ZEROPAGE: {
-        operand = memory[pc++];
+        operand = bus->read(pc++);
     } break;
     case ADDRESSING_MODE::ZEROPAGE_X: {
-        operand = memory[pc++];
+        operand = bus->read(pc++);
     } break;
     case ADDRESSING_MODE::ZEROPAGE_Y: {
-        operand = memory[pc++];
+        operand = bus->read(pc++);
     } break;
     case ADDRESSING_MODE::RELATIVE: {
-        operand = memory[pc++];
+        operand = bus->read(pc++);
     } break;
     case ADDRESSING_MODE::ABSOLUTE: {
-        BYTE lo = memory[pc++];
-        BYTE hi = memory[pc++];
+        BYTE lo = bus->read(pc++);
+        BYTE hi = bus->read(pc++);
         operand = (hi << 8) | lo;
     } break;
     case ADDRESSING_MODE::ABSOLUTE_X: {
-        BYTE lo = memory[pc++];
-        BYTE hi = memory[pc++];
+        BYTE lo = bus->read(pc++);
+        BYTE hi = bus->read(pc++);
         operand = (hi << 8) | lo;
     } break;
     case ADDRESSING_MODE::ABSOLUTE_Y: {
-        BYTE lo = memory[pc++];
-        BYTE hi = memory[pc++];
+        BYTE lo = bus->read(pc++);
+        BYTE hi = bus->read(pc++);
         operand = (hi << 8) | lo;
     } break;
     case ADDRESSING_MODE::INDIRECT: {
-        BYTE lo = memory[pc++];
-        BYTE hi = memory[pc++];
+        BYTE lo = bus->read(pc++);
+        BYTE hi = bus->read(pc++);
         operand = (hi << 8) | lo;
     } break;
     case ADDRESSING_MODE::INDIRECT_X: {
-        operand = memory[pc++];
+        operand = bus->read(pc++);
     } break;
     case ADDRESSING_MODE::INDIRECT_Y: {
-        operand = memory[pc++];
+        operand = bus->read(pc++);
     } break;
     case ADDRESSING_MODE::INVALID: {
     } break;
@@ -527,606 +297,811 @@ WORD CPU::fetch_operands(ADDRESSING_MODE mode) {
     return operand;
 }
 
-static std::string print_info(INSTRUCTION ins, ADDRESSING_MODE mode) {
-    std::string i = "INVALID";
-    switch (ins) {
-    case INSTRUCTION::ADC: {
-        i = "ADC";
-    } break;
-    case INSTRUCTION::AND: {
-        i = "AND";
-    } break;
-    case INSTRUCTION::ASL: {
-        i = "ASL";
-    } break;
-    case INSTRUCTION::BCC: {
-        i = "BCC";
-    } break;
-    case INSTRUCTION::BCS: {
-        i = "BCS";
-    } break;
-    case INSTRUCTION::BEQ: {
-        i = "BEQ";
-    } break;
-    case INSTRUCTION::BIT: {
-        i = "BIT";
-    } break;
-    case INSTRUCTION::BMI: {
-        i = "BMI";
-    } break;
-    case INSTRUCTION::BNE: {
-        i = "BNE";
-    } break;
-    case INSTRUCTION::BPL: {
-        i = "BPL";
-    } break;
-    case INSTRUCTION::BRK: {
-        i = "BRK";
-    } break;
-    case INSTRUCTION::BVC: {
-        i = "BVC";
-    } break;
-    case INSTRUCTION::BVS: {
-        i = "BVS";
-    } break;
-    case INSTRUCTION::CLC: {
-        i = "CLC";
-    } break;
-    case INSTRUCTION::CLD: {
-        i = "CLD";
-    } break;
-    case INSTRUCTION::CLI: {
-        i = "CLI";
-    } break;
-    case INSTRUCTION::CLV: {
-        i = "CLV";
-    } break;
-    case INSTRUCTION::CMP: {
-        i = "CMP";
-    } break;
-    case INSTRUCTION::CPX: {
-        i = "CPX";
-    } break;
-    case INSTRUCTION::CPY: {
-        i = "CPY";
-    } break;
-    case INSTRUCTION::DEC: {
-        i = "DEC";
-    } break;
-    case INSTRUCTION::DEX: {
-        i = "DEX";
-    } break;
-    case INSTRUCTION::DEY: {
-        i = "DEY";
-    } break;
-    case INSTRUCTION::EOR: {
-        i = "EOR";
-    } break;
-    case INSTRUCTION::INC: {
-        i = "INC";
-    } break;
-    case INSTRUCTION::INX: {
-        i = "INX";
-    } break;
-    case INSTRUCTION::INY: {
-        i = "INY";
-    } break;
-    case INSTRUCTION::JMP: {
-        i = "JMP";
-    } break;
-    case INSTRUCTION::JSR: {
-        i = "JSR";
-    } break;
-    case INSTRUCTION::LDA: {
-        i = "LDA";
-    } break;
-    case INSTRUCTION::LDX: {
-        i = "LDX";
-    } break;
-    case INSTRUCTION::LDY: {
-        i = "LDY";
-    } break;
-    case INSTRUCTION::LSR: {
-        i = "LSR";
-    } break;
-    case INSTRUCTION::NOP: {
-        i = "NOP";
-    } break;
-    case INSTRUCTION::ORA: {
-        i = "ORA";
-    } break;
-    case INSTRUCTION::PHA: {
-        i = "PHA";
-    } break;
-    case INSTRUCTION::PHP: {
-        i = "PHP";
-    } break;
-    case INSTRUCTION::PLA: {
-        i = "PLA";
-    } break;
-    case INSTRUCTION::PLP: {
-        i = "PLP";
-    } break;
-    case INSTRUCTION::ROL: {
-        i = "ROL";
-    } break;
-    case INSTRUCTION::ROR: {
-        i = "ROR";
-    } break;
-    case INSTRUCTION::RTI: {
-        i = "RTI";
-    } break;
-    case INSTRUCTION::RTS: {
-        i = "RTS";
-    } break;
-    case INSTRUCTION::SBC: {
-        i = "SBC";
-    } break;
-    case INSTRUCTION::SEC: {
-        i = "SEC";
-    } break;
-    case INSTRUCTION::SED: {
-        i = "SED";
-    } break;
-    case INSTRUCTION::SEI: {
-        i = "SEI";
-    } break;
-    case INSTRUCTION::STA: {
-        i = "STA";
-    } break;
-    case INSTRUCTION::STX: {
-        i = "STX";
-    } break;
-    case INSTRUCTION::STY: {
-        i = "STY";
-    } break;
-    case INSTRUCTION::TAX: {
-        i = "TAX";
-    } break;
-    case INSTRUCTION::TAY: {
-        i = "TAY";
-    } break;
-    case INSTRUCTION::TSX: {
-        i = "TSX";
-    } break;
-    case INSTRUCTION::TXA: {
-        i = "TXA";
-    } break;
-    case INSTRUCTION::TXS: {
-        i = "TXS";
-    } break;
-    case INSTRUCTION::TYA: {
-        i = "TYA";
-    } break;
-    case INSTRUCTION::INVALID:
-        break;
-    }
-    std::string m = "INVALID";
-    switch (mode) {
-    case ADDRESSING_MODE::IMPLICIT: {
-        m = "IMPLICIT";
-    } break;
-    case ADDRESSING_MODE::ACCUMULATOR: {
-        m = "ACCUMULATOR";
-    } break;
-    case ADDRESSING_MODE::IMMEDIATE: {
-        m = "IMMEDIATE";
-    } break;
-    case ADDRESSING_MODE::ZEROPAGE: {
-        m = "ZEROPAGE";
-    } break;
-    case ADDRESSING_MODE::ZEROPAGE_X: {
-        m = "ZEROPAGE_X";
-    } break;
-    case ADDRESSING_MODE::ZEROPAGE_Y: {
-        m = "ZEROPAGE_Y";
-    } break;
-    case ADDRESSING_MODE::RELATIVE: {
-        m = "RELATIVE";
-    } break;
-    case ADDRESSING_MODE::ABSOLUTE: {
-        m = "ABSOLUTE";
-    } break;
-    case ADDRESSING_MODE::ABSOLUTE_X: {
-        m = "ABSOLUTE_X";
-    } break;
-    case ADDRESSING_MODE::ABSOLUTE_Y: {
-        m = "ABSOLUTE_Y";
-    } break;
-    case ADDRESSING_MODE::INDIRECT: {
-        m = "INDIRECT";
+void CPU::set_trace(Trace_buffer *trace) { this->trace = trace; }
+
+void CPU::record_trace(BYTE opcode) {
+    Trace_record &record = trace->append();
+    record.pc = pc - 1;
+    record.operand = 0x0000;
+    switch (lookup_table[opcode].bytes) {
+    case 3: {
+        record.operand = bus->peek(pc) | (bus->peek(pc + 1) << 8);
     } break;
-    case ADDRESSING_MODE::INDIRECT_X: {
-        m = "INDIRECT_X";
-    } break;
-    case ADDRESSING_MODE::INDIRECT_Y: {
-        m = "INDIRECT_Y";
-    } break;
-    case ADDRESSING_MODE::INVALID: {
-        m = "INVALID";
+    case 2: {
+        record.operand = bus->peek(pc);
     } break;
+    default:
         break;
     }
-    return i + "\t" + m;
+    record.opcode = opcode;
+    record.a = a;
+    record.x = x;
+    record.y = y;
+    record.sp = sp;
+    record.p = get_p();
+    record.write_addr = 0x0000;
+    record.write_value = 0x00;
+    record.wrote = false;
 }
 
 void CPU::execute(BYTE opcode) {
-    WORD orig_pc = pc - 1;
+#ifdef MOS6502_TRACE
+    if (trace != nullptr) {
+        record_trace(opcode);
+    }
+#endif
+    cycles += lookup_table[opcode].cycles;
+    dispatch_table[opcode](*this);
+}
 
-    auto [ins, mode] = decode(opcode);
-    WORD operand = fetch_operands(mode);
+void CPU::step() {
+    No_profile profile;
+    step(profile);
+}
 
-    instruction_t to_execute = dispatch_table[ins];
+void CPU::step(Profile &profile) { step<Profile>(profile); }
 
-    to_execute(mode, operand);
+template <typename PROFILE> void CPU::step(PROFILE &profile) {
+    if (pending != 0 && service_interrupts()) {
+        return;
+    }
+    if constexpr (PROFILE::ENABLED) {
+        WORD at = pc;
+        uint64_t before = cycles;
+        BYTE opcode = fetch_opcode();
+        execute(opcode);
+        profile.record(at, opcode, cycles - before, pc);
+    } else {
+        execute(fetch_opcode());
+    }
+}
 
-    std::stringstream ss;
-    ss << "0x" << std::uppercase << std::setw(4) << std::setfill('0')
-       << std::hex << static_cast<int>(orig_pc) << std::dec << ":\t";
-    ss << "0x" << std::setw(2) << std::setfill('0') << std::hex
-       << static_cast<int>(opcode) << std::dec << "\t";
-    ss << "0x" << std::setw(4) << std::setfill('0') << std::hex
-       << static_cast<int>(operand) << std::dec << "\t";
-    ss << print_info(ins, mode);
-    // std::cerr << ss.str() << "\n";
+bool CPU::service_interrupts() {
+    if (pending & PENDING_RESET) {
+        pending &= ~PENDING_RESET;
+        reset();
+        return true;
+    }
+    if (pending & PENDING_NMI) {
+        pending &= ~PENDING_NMI;
+        interrupt(0xfffa, false);
+        cycles += 7;
+        return true;
+    }
+    if ((pending & PENDING_IRQ) && !(id_flags & FLAG_I)) {
+        interrupt(0xfffe, false);
+        cycles += 7;
+        return true;
+    }
+    return false;
 }
 
-void CPU::ADC(ADDRESSING_MODE mode, WORD operand) {
-    BYTE rhs = 0x00;
-    switch (mode) {
-    case ADDRESSING_MODE::IMMEDIATE: {
-        rhs = operand & 0xff;
-    } break;
-    case ADDRESSING_MODE::ZEROPAGE: {
-        rhs = memory[operand];
-    } break;
-    case ADDRESSING_MODE::ZEROPAGE_X: {
-        WORD addr = (operand + x) & 0xff;
-        rhs = memory[addr];
-    } break;
-    case ADDRESSING_MODE::ABSOLUTE: {
-        rhs = memory[operand];
-    } break;
-    case ADDRESSING_MODE::ABSOLUTE_X: {
-        rhs = memory[operand + x];
-    } break;
-    case ADDRESSING_MODE::ABSOLUTE_Y: {
-        rhs = memory[operand + y];
-    } break;
-    case ADDRESSING_MODE::INDIRECT_X: {
-        WORD addr = (operand + x) & 0xff;
-        addr = memory[addr] | (memory[addr + 1] << 8);
-        rhs = memory[addr];
-    } break;
-    case ADDRESSING_MODE::INDIRECT_Y: {
-        WORD addr = operand;
-        addr = memory[addr] | (memory[addr + 1] << 8);
-        addr = addr + y;
-        rhs = memory[addr];
-    } break;
-    case ADDRESSING_MODE::ACCUMULATOR:
-    case ADDRESSING_MODE::IMPLICIT:
-    case ADDRESSING_MODE::RELATIVE:
-    case ADDRESSING_MODE::INVALID: {
-        // TODO: add assert
-    } break;
+void CPU::interrupt(WORD vector, bool brk) {
+    // BRK's pushes belong to its trace record. Interrupt entry has no
+    // record of its own, and must not attach them to the instruction
+    // before it.
+    push(pc >> 8, brk);
+    push(pc & 0xff, brk);
+    push(get_p() | (brk ? FLAG_B : 0), brk);
+    id_flags |= FLAG_I;
+    pc = bus->read(vector) | (bus->read(vector + 1) << 8);
+}
+
+void CPU::set_irq(int source, bool asserted) {
+    uint16_t bit = 1u << source;
+    pending = asserted ? pending | bit : pending & ~bit;
+}
+
+void CPU::nmi() { pending |= PENDING_NMI; }
+
+void CPU::request_reset() { pending |= PENDING_RESET; }
+
+bool CPU::idle_safe_instruction() {
+    if (!bus->is_direct(pc >> 8) || !bus->is_direct(WORD(pc + 2) >> 8)) {
+        return false;
+    }
+    const Instruction_info &info = lookup_table[bus->peek(pc)];
+    WORD operand = bus->peek(pc + 1) | (bus->peek(pc + 2) << 8);
+    if (info.bytes == 2) {
+        operand &= 0xff;
+    }
+
+    switch (info.ins) {
+    case INSTRUCTION::ADC:
+    case INSTRUCTION::AND:
+    case INSTRUCTION::BIT:
+    case INSTRUCTION::CMP:
+    case INSTRUCTION::CPX:
+    case INSTRUCTION::CPY:
+    case INSTRUCTION::EOR:
+    case INSTRUCTION::LDA:
+    case INSTRUCTION::LDX:
+    case INSTRUCTION::LDY:
+    case INSTRUCTION::ORA:
+    case INSTRUCTION::SBC:
+        break;
+    case INSTRUCTION::ASL:
+    case INSTRUCTION::LSR:
+    case INSTRUCTION::ROL:
+    case INSTRUCTION::ROR:
+        return info.mode == ADDRESSING_MODE::ACCUMULATOR;
+    case INSTRUCTION::JMP:
+        // The pointer of JMP (ind) is read with peek() below
+        if (info.mode == ADDRESSING_MODE::INDIRECT) {
+            return bus->is_direct(operand >> 8);
+        }
+        return true;
+    case INSTRUCTION::BCC:
+    case INSTRUCTION::BCS:
+    case INSTRUCTION::BEQ:
+    case INSTRUCTION::BMI:
+    case INSTRUCTION::BNE:
+    case INSTRUCTION::BPL:
+    case INSTRUCTION::BVC:
+    case INSTRUCTION::BVS:
+    case INSTRUCTION::CLC:
+    case INSTRUCTION::CLD:
+    case INSTRUCTION::CLI:
+    case INSTRUCTION::CLV:
+    case INSTRUCTION::SEC:
+    case INSTRUCTION::SED:
+    case INSTRUCTION::SEI:
+    case INSTRUCTION::DEX:
+    case INSTRUCTION::DEY:
+    case INSTRUCTION::INX:
+    case INSTRUCTION::INY:
+    case INSTRUCTION::NOP:
+    case INSTRUCTION::TAX:
+    case INSTRUCTION::TAY:
+    case INSTRUCTION::TSX:
+    case INSTRUCTION::TXA:
+    case INSTRUCTION::TXS:
+    case INSTRUCTION::TYA:
+        return true;
     default:
+        return false;
+    }
+
+    // Address the instruction reads
+    WORD addr;
+    switch (info.mode) {
+    case ADDRESSING_MODE::IMMEDIATE:
+        return true;
+    case ADDRESSING_MODE::ZEROPAGE:
+    case ADDRESSING_MODE::ABSOLUTE:
+        addr = operand;
+        break;
+    case ADDRESSING_MODE::ZEROPAGE_X:
+        addr = (operand + x) & 0xff;
+        break;
+    case ADDRESSING_MODE::ZEROPAGE_Y:
+        addr = (operand + y) & 0xff;
+        break;
+    case ADDRESSING_MODE::ABSOLUTE_X:
+        addr = operand + x;
+        break;
+    case ADDRESSING_MODE::ABSOLUTE_Y:
+        addr = operand + y;
+        break;
+    case ADDRESSING_MODE::INDIRECT_X:
+    case ADDRESSING_MODE::INDIRECT_Y: {
+        if (!bus->is_direct(0x00)) {
+            return false;
+        }
+        BYTE ptr = info.mode == ADDRESSING_MODE::INDIRECT_X ? operand + x
+                                                            : operand;
+        addr = bus->peek(ptr) | (bus->peek(BYTE(ptr + 1)) << 8);
+        if (info.mode == ADDRESSING_MODE::INDIRECT_Y) {
+            addr += y;
+        }
         break;
     }
-    WORD result = rhs + a + c;
-    BYTE new_a = result & 0xff;
+    default:
+        return false;
+    }
+    return bus->is_direct(addr >> 8) || bus->is_idle_safe(addr >> 8);
+}
+
+CPU::Idle_probe CPU::skip_idle(const uint64_t &limit, bool until,
+                                WORD address) {
+    WORD head = pc;
+    // The first iteration may still see a value that changed since the
+    // last one, so the second gets a chance to reach a fixed point
+    for (int iteration = 0; iteration < 2; iteration++) {
+        BYTE start_a = a;
+        BYTE start_x = x;
+        BYTE start_y = y;
+        BYTE start_sp = sp;
+        BYTE start_p = get_p();
+        uint64_t start = cycles;
+
+        for (int n = 0; n < IDLE_PROBE_LENGTH; n++) {
+            if (cycles >= limit || interrupt_due()) {
+                return Idle_probe::STOPPED;
+            }
+            if (!idle_safe_instruction()) {
+                return Idle_probe::BUSY;
+            }
+            execute(fetch_opcode());
+            if (until && pc == address) {
+                return Idle_probe::STOPPED;
+            }
+            if (pc == head || WORD(pc - head) >= IDLE_LOOP_BYTES) {
+                break;
+            }
+        }
+        if (pc != head) {
+            return Idle_probe::BUSY;
+        }
+        if (a != start_a || x != start_x || y != start_y || sp != start_sp ||
+            get_p() != start_p) {
+            continue;
+        }
+        if (cycles >= limit) {
+            return Idle_probe::STOPPED;
+        }
+
+        uint64_t period = cycles - start;
+        cycles += (limit - cycles - 1) / period * period;
+        return Idle_probe::SKIPPED;
+    }
+    return Idle_probe::BUSY;
+}
+
+#ifdef MOS6502_THREADED
+// Invoke X on every opcode, 0x00 to 0xff
+#define MOS6502_OPCODE_ROW(X, HI)                                         \
+    X(HI##0) X(HI##1) X(HI##2) X(HI##3) X(HI##4) X(HI##5) X(HI##6)         \
+    X(HI##7) X(HI##8) X(HI##9) X(HI##a) X(HI##b) X(HI##c) X(HI##d)         \
+    X(HI##e) X(HI##f)
+#define MOS6502_OPCODES(X)                                                 \
+    MOS6502_OPCODE_ROW(X, 0x0) MOS6502_OPCODE_ROW(X, 0x1)                  \
+    MOS6502_OPCODE_ROW(X, 0x2) MOS6502_OPCODE_ROW(X, 0x3)                  \
+    MOS6502_OPCODE_ROW(X, 0x4) MOS6502_OPCODE_ROW(X, 0x5)                  \
+    MOS6502_OPCODE_ROW(X, 0x6) MOS6502_OPCODE_ROW(X, 0x7)                  \
+    MOS6502_OPCODE_ROW(X, 0x8) MOS6502_OPCODE_ROW(X, 0x9)                  \
+    MOS6502_OPCODE_ROW(X, 0xa) MOS6502_OPCODE_ROW(X, 0xb)                  \
+    MOS6502_OPCODE_ROW(X, 0xc) MOS6502_OPCODE_ROW(X, 0xd)                  \
+    MOS6502_OPCODE_ROW(X, 0xe) MOS6502_OPCODE_ROW(X, 0xf)
+
+#ifdef MOS6502_TRACE
+#define MOS6502_TRACING() (trace != nullptr)
+#else
+#define MOS6502_TRACING() false
+#endif
+
+// Flattened: 256 handlers are past what the inliner takes on by itself,
+// and each must inline its body and the bus fast paths
+template <bool UNTIL>
+__attribute__((flatten)) void CPU::run_threaded(const uint64_t &slice_end,
+                                                WORD address) {
+#define MOS6502_LABEL(OPCODE) &&op_##OPCODE,
+    static const void *const labels[0x100] = {MOS6502_OPCODES(MOS6502_LABEL)};
+#undef MOS6502_LABEL
+
+    for (;;) {
+        if ((UNTIL && pc == address) || cycles >= slice_end) {
+            return;
+        }
+        // Interrupts and tracing take the step() path
+        if (pending != 0 && service_interrupts()) {
+            continue;
+        }
+        if (MOS6502_TRACING()) {
+            execute(fetch_opcode());
+            continue;
+        }
+        goto *labels[fetch_opcode()];
+
+        // As execute(), then straight on to the next handler while
+        // nothing needs the loop above
+#define MOS6502_HANDLER(OPCODE)                                            \
+    op_##OPCODE : cycles += lookup_table[OPCODE].cycles;                   \
+    dispatch<lookup_table[OPCODE].ins, lookup_table[OPCODE].mode>(*this);  \
+    if ((UNTIL && pc == address) || cycles >= slice_end ||                 \
+        interrupt_due() || MOS6502_TRACING()) {                            \
+        continue;                                                          \
+    }                                                                      \
+    goto *labels[fetch_opcode()];
+        MOS6502_OPCODES(MOS6502_HANDLER)
+#undef MOS6502_HANDLER
+    }
+}
 
-    c = (result > 0xff) ? 1 : 0;
-    z = new_a == 0 ? 1 : 0;
-    v = (((a ^ new_a) & (rhs ^ new_a)) & 0x80) >> 7;
-    n = (new_a >> 7) & 0x1;
+#undef MOS6502_TRACING
+#undef MOS6502_OPCODES
+#undef MOS6502_OPCODE_ROW
+#endif
+
+template <bool UNTIL, typename PROFILE>
+void CPU::run_slice(const uint64_t &slice_end, WORD address,
+                    PROFILE &profile) {
+    if (!idle_skip || PROFILE::ENABLED) {
+#ifdef MOS6502_THREADED
+        if constexpr (!PROFILE::ENABLED) {
+            run_threaded<UNTIL>(slice_end, address);
+            return;
+        }
+#endif
+        while (!(UNTIL && pc == address) && cycles < slice_end) {
+            step(profile);
+        }
+        return;
+    }
 
-    a = new_a;
+    // Head of the last loop found busy, not probed again this slice
+    int busy_head = -1;
+    while (!(UNTIL && pc == address) && cycles < slice_end) {
+        WORD from = pc;
+        step(profile);
+        // A short backward jump may have entered an idle loop
+        if (WORD(from - pc) < IDLE_LOOP_BYTES && pc != busy_head &&
+            !(UNTIL && pc == address)) {
+            WORD head = pc;
+            if (skip_idle(slice_end, UNTIL, address) == Idle_probe::BUSY) {
+                busy_head = head;
+            }
+        }
+    }
 }
 
-void CPU::AND(ADDRESSING_MODE mode, WORD operand) {
-    BYTE rhs = 0x00;
-    switch (mode) {
-    case ADDRESSING_MODE::IMMEDIATE: {
-        rhs = operand & 0xff;
-    } break;
-    case ADDRESSING_MODE::ZEROPAGE: {
-        rhs = memory[operand];
-    } break;
-    case ADDRESSING_MODE::ZEROPAGE_X: {
-        WORD addr = (operand + x) & 0xff;
-        rhs = memory[addr];
-    } break;
-    case ADDRESSING_MODE::ABSOLUTE: {
-        rhs = memory[operand];
-    } break;
-    case ADDRESSING_MODE::ABSOLUTE_X: {
-        rhs = memory[operand + x];
-    } break;
-    case ADDRESSING_MODE::ABSOLUTE_Y: {
-        rhs = memory[operand + y];
-    } break;
-    case ADDRESSING_MODE::INDIRECT_X: {
-        WORD addr = (operand + x) & 0xff;
-        addr = memory[addr] | (memory[addr + 1] << 8);
-        rhs = memory[addr];
-    } break;
-    case ADDRESSING_MODE::INDIRECT_Y: {
-        WORD addr = operand;
-        addr = memory[addr] | (memory[addr + 1] << 8);
-        addr = addr + y;
-        rhs = memory[addr];
-    } break;
-    case ADDRESSING_MODE::ACCUMULATOR:
-    case ADDRESSING_MODE::IMPLICIT:
-    case ADDRESSING_MODE::RELATIVE:
-    case ADDRESSING_MODE::INVALID: {
-        // TODO: add assert
-    } break;
-    default:
-        break;
+template <bool UNTIL, typename PROFILE>
+uint64_t CPU::run(uint64_t max_cycles, WORD address, PROFILE &profile) {
+    uint64_t start = cycles;
+    uint64_t end = start + max_cycles;
+    Scheduler &events = bus->get_scheduler();
+    while (!(UNTIL && pc == address) && cycles < end) {
+        // Run up to the next event without looking at the scheduler; an
+        // event scheduled meanwhile lowers the bound instead
+        run_slice<UNTIL>(events.begin_slice(end), address, profile);
+        events.run_due(cycles);
     }
+    return cycles - start;
+}
+
+uint64_t CPU::run_for_cycles(uint64_t n_cycles) {
+    No_profile profile;
+    return run<false>(n_cycles, 0x0000, profile);
+}
 
-    BYTE new_a = rhs & a;
+uint64_t CPU::run_until(WORD address, uint64_t max_cycles) {
+    No_profile profile;
+    return run<true>(max_cycles, address, profile);
+}
 
-    z = new_a == 0 ? 1 : 0;
-    n = (new_a >> 7) & 0x1;
+uint64_t CPU::run_for_cycles(uint64_t n_cycles, Profile &profile) {
+    return run<false>(n_cycles, 0x0000, profile);
+}
 
-    a = new_a;
+uint64_t CPU::run_until(WORD address, uint64_t max_cycles,
+                        Profile &profile) {
+    return run<true>(max_cycles, address, profile);
 }
 
-void CPU::ASL(ADDRESSING_MODE mode, WORD operand) {
-    BYTE *rhs = nullptr;
-    switch (mode) {
-    case ADDRESSING_MODE::ACCUMULATOR: {
-        rhs = &a;
-    } break;
-    case ADDRESSING_MODE::ZEROPAGE: {
-        rhs = &memory[operand];
-    } break;
-    case ADDRESSING_MODE::ZEROPAGE_X: {
-        WORD addr = (operand + x) & 0xff;
-        rhs = &memory[addr];
-    } break;
-    case ADDRESSING_MODE::ABSOLUTE: {
-        rhs = &memory[operand];
-    } break;
-    case ADDRESSING_MODE::ABSOLUTE_X: {
-        rhs = &memory[operand + x];
-    } break;
-    case ADDRESSING_MODE::IMMEDIATE:
-    case ADDRESSING_MODE::ABSOLUTE_Y:
-    case ADDRESSING_MODE::INDIRECT_X:
-    case ADDRESSING_MODE::INDIRECT_Y:
-    case ADDRESSING_MODE::IMPLICIT:
-    case ADDRESSING_MODE::RELATIVE:
-    case ADDRESSING_MODE::INVALID: {
-        // TODO: add assert
-    } break;
-    default:
-        break;
+template <ADDRESSING_MODE M> WORD CPU::fetch_operand() {
+    if constexpr (M == ADDRESSING_MODE::IMPLICIT ||
+                  M == ADDRESSING_MODE::ACCUMULATOR ||
+                  M == ADDRESSING_MODE::INVALID) {
+        return 0x0000;
+    } else if constexpr (M == ADDRESSING_MODE::ABSOLUTE ||
+                         M == ADDRESSING_MODE::ABSOLUTE_X ||
+                         M == ADDRESSING_MODE::ABSOLUTE_Y ||
+                         M == ADDRESSING_MODE::INDIRECT) {
+        BYTE lo = bus->read(pc++);
+        BYTE hi = bus->read(pc++);
+        return (hi << 8) | lo;
+    } else {
+        return bus->read(pc++);
     }
+}
 
-    if (rhs != nullptr) {
-        c = (*rhs >> 7) & 0x1;
-        *rhs = *rhs << 1;
-        z = (*rhs == 0) ? 1 : 0;
-        n = (*rhs >> 7) & 0x1;
+template <ADDRESSING_MODE M> WORD CPU::effective_address(WORD operand) {
+    if constexpr (M == ADDRESSING_MODE::IMMEDIATE ||
+                  M == ADDRESSING_MODE::ACCUMULATOR ||
+                  M == ADDRESSING_MODE::ZEROPAGE ||
+                  M == ADDRESSING_MODE::ABSOLUTE) {
+        return operand;
+    } else if constexpr (M == ADDRESSING_MODE::ZEROPAGE_X) {
+        return (operand + x) & 0xff;
+    } else if constexpr (M == ADDRESSING_MODE::ZEROPAGE_Y) {
+        return (operand + y) & 0xff;
+    } else if constexpr (M == ADDRESSING_MODE::RELATIVE) {
+        return pc + static_cast<int8_t>(operand);
+    } else if constexpr (M == ADDRESSING_MODE::ABSOLUTE_X) {
+        return operand + x;
+    } else if constexpr (M == ADDRESSING_MODE::ABSOLUTE_Y) {
+        return operand + y;
+    } else if constexpr (M == ADDRESSING_MODE::INDIRECT) {
+        // The high byte is fetched without carrying into the page
+        WORD hi_addr = (operand & 0xff00) | ((operand + 1) & 0x00ff);
+        return bus->read(operand) | (bus->read(hi_addr) << 8);
+    } else if constexpr (M == ADDRESSING_MODE::INDIRECT_X) {
+        BYTE ptr = operand + x;
+        return bus->read(ptr) | (bus->read(BYTE(ptr + 1)) << 8);
+    } else if constexpr (M == ADDRESSING_MODE::INDIRECT_Y) {
+        BYTE ptr = operand;
+        WORD base = bus->read(ptr) | (bus->read(BYTE(ptr + 1)) << 8);
+        return base + y;
+    } else {
+        static_assert(M == ADDRESSING_MODE::IMMEDIATE,
+                      "addressing mode has no effective address");
+        return operand;
     }
 }
 
-void CPU::BCC(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> BYTE CPU::read(WORD addr) {
+    if constexpr (M == ADDRESSING_MODE::IMMEDIATE) {
+        return addr & 0xff;
+    } else if constexpr (M == ADDRESSING_MODE::ACCUMULATOR) {
+        return a;
+    } else {
+        return bus->read(addr);
+    }
 }
 
-void CPU::BCS(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::write(WORD addr, BYTE value) {
+    if constexpr (M == ADDRESSING_MODE::ACCUMULATOR) {
+        a = value;
+    } else {
+        static_assert(M != ADDRESSING_MODE::IMMEDIATE,
+                      "cannot write to an immediate operand");
+#ifdef MOS6502_TRACE
+        if (trace != nullptr) {
+            trace->note_write(addr, value);
+        }
+#endif
+        bus->write(addr, value);
+    }
 }
 
-void CPU::BEQ(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> BYTE CPU::load(WORD operand) {
+    WORD addr = effective_address<M>(operand);
+    if constexpr (M == ADDRESSING_MODE::ABSOLUTE_X) {
+        cycles += page_crossed(addr - x, addr);
+    } else if constexpr (M == ADDRESSING_MODE::ABSOLUTE_Y ||
+                         M == ADDRESSING_MODE::INDIRECT_Y) {
+        cycles += page_crossed(addr - y, addr);
+    }
+    return read<M>(addr);
 }
 
-void CPU::BIT(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+void CPU::update_nz(BYTE value) {
+    n_result = value;
+    z_result = value;
 }
 
-void CPU::BMI(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+void CPU::add(BYTE rhs) {
+    WORD result = rhs + a + c;
+    BYTE new_a = result & 0xff;
+
+    c = (result > 0xff) ? 1 : 0;
+    v = (((a ^ new_a) & (rhs ^ new_a)) & 0x80) >> 7;
+    update_nz(new_a);
+
+    a = new_a;
 }
 
-void CPU::BNE(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+void CPU::add_decimal(BYTE rhs, bool subtract) {
+    const Decimal_table &table =
+        decimal_tables[static_cast<int>(decimal_flags)][subtract];
+    Decimal_result result = decimal_lookup(table, a, rhs, c);
+    a = result.a;
+    n_result = result.p;
+    z_result = ~result.p & FLAG_Z;
+    c = result.p & FLAG_C;
+    v = (result.p >> 6) & 0x1;
 }
 
-void CPU::BPL(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+void CPU::compare(BYTE lhs, BYTE rhs) {
+    c = lhs >= rhs ? 1 : 0;
+    update_nz(lhs - rhs);
 }
 
-void CPU::BRK(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+void CPU::branch(bool taken, WORD operand) {
+    if (taken) {
+        WORD target = effective_address<ADDRESSING_MODE::RELATIVE>(operand);
+        cycles += 1 + page_crossed(pc, target);
+        pc = target;
+    }
 }
 
-void CPU::BVC(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+void CPU::push(BYTE value, [[maybe_unused]] bool traced) {
+#ifdef MOS6502_TRACE
+    if (traced && trace != nullptr) {
+        trace->note_write(0x0100 | sp, value);
+    }
+#endif
+    bus->write(0x0100 | sp, value);
+    sp--;
 }
 
-void CPU::BVS(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+BYTE CPU::pull() {
+    sp++;
+    return bus->read(0x0100 | sp);
 }
 
-void CPU::CLC(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::ADC(WORD operand) {
+    BYTE value = load<M>(operand);
+    if (id_flags & FLAG_D) {
+        add_decimal(value, false);
+    } else {
+        add(value);
+    }
 }
 
-void CPU::CLD(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::AND(WORD operand) {
+    a = a & load<M>(operand);
+    update_nz(a);
 }
 
-void CPU::CLI(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::ASL(WORD operand) {
+    WORD addr = effective_address<M>(operand);
+    BYTE value = read<M>(addr);
+
+    c = (value >> 7) & 0x1;
+    value = value << 1;
+    update_nz(value);
+
+    write<M>(addr, value);
 }
 
-void CPU::CLV(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::BCC(WORD operand) {
+    branch(c == 0, operand);
 }
 
-void CPU::CMP(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::BCS(WORD operand) {
+    branch(c == 1, operand);
 }
 
-void CPU::CPX(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::BEQ(WORD operand) {
+    branch(z_result == 0, operand);
 }
 
-void CPU::CPY(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::BIT(WORD operand) {
+    BYTE value = load<M>(operand);
+    n_result = value;
+    z_result = a & value;
+    v = (value >> 6) & 0x1;
 }
 
-void CPU::DEC(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::BMI(WORD operand) {
+    branch((n_result & FLAG_N) != 0, operand);
 }
 
-void CPU::DEX(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::BNE(WORD operand) {
+    branch(z_result != 0, operand);
 }
 
-void CPU::DEY(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::BPL(WORD operand) {
+    branch((n_result & FLAG_N) == 0, operand);
 }
 
-void CPU::EOR(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::BRK(WORD operand) {
+    // The byte after BRK is skipped
+    pc++;
+    interrupt(0xfffe, true);
 }
 
-void CPU::INC(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::BVC(WORD operand) {
+    branch(v == 0, operand);
 }
 
-void CPU::INX(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::BVS(WORD operand) {
+    branch(v == 1, operand);
 }
 
-void CPU::INY(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::CLC(WORD operand) { c = 0; }
+
+template <ADDRESSING_MODE M> void CPU::CLD(WORD operand) {
+    id_flags &= ~FLAG_D;
 }
 
-void CPU::JMP(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::CLI(WORD operand) {
+    id_flags &= ~FLAG_I;
 }
 
-void CPU::JSR(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::CLV(WORD operand) { v = 0; }
+
+template <ADDRESSING_MODE M> void CPU::CMP(WORD operand) {
+    compare(a, load<M>(operand));
 }
 
-void CPU::LDA(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::CPX(WORD operand) {
+    compare(x, load<M>(operand));
 }
 
-void CPU::LDX(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::CPY(WORD operand) {
+    compare(y, load<M>(operand));
 }
 
-void CPU::LDY(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::DEC(WORD operand) {
+    WORD addr = effective_address<M>(operand);
+    BYTE value = read<M>(addr) - 1;
+    update_nz(value);
+    write<M>(addr, value);
 }
 
-void CPU::LSR(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::DEX(WORD operand) {
+    x--;
+    update_nz(x);
 }
 
-void CPU::NOP(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::DEY(WORD operand) {
+    y--;
+    update_nz(y);
 }
 
-void CPU::ORA(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::EOR(WORD operand) {
+    a = a ^ load<M>(operand);
+    update_nz(a);
 }
 
-void CPU::PHA(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::INC(WORD operand) {
+    WORD addr = effective_address<M>(operand);
+    BYTE value = read<M>(addr) + 1;
+    update_nz(value);
+    write<M>(addr, value);
 }
 
-void CPU::PHP(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::INX(WORD operand) {
+    x++;
+    update_nz(x);
 }
 
-void CPU::PLA(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::INY(WORD operand) {
+    y++;
+    update_nz(y);
 }
 
-void CPU::PLP(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::JMP(WORD operand) {
+    pc = effective_address<M>(operand);
 }
 
-void CPU::ROL(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::JSR(WORD operand) {
+    WORD ret = pc - 1;
+    push(ret >> 8);
+    push(ret & 0xff);
+    pc = operand;
 }
 
-void CPU::ROR(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::LDA(WORD operand) {
+    a = load<M>(operand);
+    update_nz(a);
 }
 
-void CPU::RTI(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::LDX(WORD operand) {
+    x = load<M>(operand);
+    update_nz(x);
 }
 
-void CPU::RTS(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::LDY(WORD operand) {
+    y = load<M>(operand);
+    update_nz(y);
 }
 
-void CPU::SBC(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::LSR(WORD operand) {
+    WORD addr = effective_address<M>(operand);
+    BYTE value = read<M>(addr);
+
+    c = value & 0x1;
+    value = value >> 1;
+    update_nz(value);
+
+    write<M>(addr, value);
 }
 
-void CPU::SEC(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::NOP(WORD operand) {}
+
+template <ADDRESSING_MODE M> void CPU::ORA(WORD operand) {
+    a = a | load<M>(operand);
+    update_nz(a);
 }
 
-void CPU::SED(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::PHA(WORD operand) { push(a); }
+
+template <ADDRESSING_MODE M> void CPU::PHP(WORD operand) {
+    // B and U always read as set in the pushed copy
+    push(get_p() | FLAG_B | FLAG_U);
 }
 
-void CPU::SEI(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::PLA(WORD operand) {
+    a = pull();
+    update_nz(a);
 }
 
-void CPU::STA(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::PLP(WORD operand) { set_p(pull()); }
+
+template <ADDRESSING_MODE M> void CPU::ROL(WORD operand) {
+    WORD addr = effective_address<M>(operand);
+    BYTE value = read<M>(addr);
+
+    BYTE carry_in = c;
+    c = (value >> 7) & 0x1;
+    value = (value << 1) | carry_in;
+    update_nz(value);
+
+    write<M>(addr, value);
 }
 
-void CPU::STX(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::ROR(WORD operand) {
+    WORD addr = effective_address<M>(operand);
+    BYTE value = read<M>(addr);
+
+    BYTE carry_in = c;
+    c = value & 0x1;
+    value = (value >> 1) | (carry_in << 7);
+    update_nz(value);
+
+    write<M>(addr, value);
 }
 
-void CPU::STY(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::RTI(WORD operand) {
+    set_p(pull());
+    BYTE lo = pull();
+    BYTE hi = pull();
+    pc = (hi << 8) | lo;
 }
 
-void CPU::TAX(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::RTS(WORD operand) {
+    BYTE lo = pull();
+    BYTE hi = pull();
+    pc = ((hi << 8) | lo) + 1;
 }
 
-void CPU::TAY(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::SBC(WORD operand) {
+    BYTE value = load<M>(operand);
+    if (id_flags & FLAG_D) {
+        add_decimal(value, true);
+    } else {
+        add(~value);
+    }
 }
 
-void CPU::TSX(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::SEC(WORD operand) { c = 1; }
+
+template <ADDRESSING_MODE M> void CPU::SED(WORD operand) { id_flags |= FLAG_D; }
+
+template <ADDRESSING_MODE M> void CPU::SEI(WORD operand) { id_flags |= FLAG_I; }
+
+template <ADDRESSING_MODE M> void CPU::STA(WORD operand) {
+    write<M>(effective_address<M>(operand), a);
 }
 
-void CPU::TXA(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::STX(WORD operand) {
+    write<M>(effective_address<M>(operand), x);
 }
 
-void CPU::TXS(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::STY(WORD operand) {
+    write<M>(effective_address<M>(operand), y);
 }
 
-void CPU::TYA(ADDRESSING_MODE mode, WORD operand) {
-    std::cerr << "Not Implemented\n";
+template <ADDRESSING_MODE M> void CPU::TAX(WORD operand) {
+    x = a;
+    update_nz(x);
+}
+
+template <ADDRESSING_MODE M> void CPU::TAY(WORD operand) {
+    y = a;
+    update_nz(y);
+}
+
+template <ADDRESSING_MODE M> void CPU::TSX(WORD operand) {
+    x = sp;
+    update_nz(x);
+}
+
+template <ADDRESSING_MODE M> void CPU::TXA(WORD operand) {
+    a = x;
+    update_nz(a);
+}
+
+template <ADDRESSING_MODE M> void CPU::TXS(WORD operand) { sp = x; }
+
+template <ADDRESSING_MODE M> void CPU::TYA(WORD operand) {
+    a = y;
+    update_nz(a);
 }
 
-void CPU::INVALID(ADDRESSING_MODE mode, WORD operand) {
+template <ADDRESSING_MODE M> void CPU::INVALID(WORD operand) {
     std::cerr << "Not Implemented\n";
 }
@@ -0,0 +1,11 @@
+#include <Decimal.hpp>
+
+using namespace mos6502;
+
+// constexpr, so the tables are built by the compiler rather than at startup
+constexpr Decimal_table mos6502::decimal_tables[2][2] = {
+    {make_decimal_table(false, Decimal_flags::NMOS),
+     make_decimal_table(true, Decimal_flags::NMOS)},
+    {make_decimal_table(false, Decimal_flags::CMOS),
+     make_decimal_table(true, Decimal_flags::CMOS)},
+};
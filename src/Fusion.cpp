@@ -0,0 +1,89 @@
+#include <Fusion.hpp>
+#include <Opcodes.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <utility>
+
+using namespace mos6502;
+
+std::vector<Fusion_candidate> mos6502::rank_fusions(const Profile &profile,
+                                                    const Bus &bus,
+                                                    std::size_t max_rules) {
+    // Keyed by length then opcodes, so ties come out in a stable order
+    std::map<std::pair<BYTE, std::array<BYTE, 3>>, uint64_t> saved;
+    for (uint32_t pc = 0; pc < 0x10000; pc++) {
+        uint64_t hits = profile.hits(pc);
+        if (hits == 0) {
+            continue;
+        }
+        // A prefix never branches, so whatever follows it ran as often
+        std::array<BYTE, 3> opcodes = {bus.peek(pc), 0x00, 0x00};
+        WORD at = pc;
+        for (int length = 2; length <= 3; length++) {
+            BYTE prefix = opcodes[length - 2];
+            if (!fusable_prefix(prefix)) {
+                break;
+            }
+            at += lookup_table[prefix].bytes;
+            opcodes[length - 1] = bus.peek(at);
+            if (lookup_table[opcodes[length - 1]].ins ==
+                INSTRUCTION::INVALID) {
+                break;
+            }
+            std::array<BYTE, 3> key = {};
+            std::copy(opcodes.begin(), opcodes.begin() + length, key.begin());
+            saved[{BYTE(length), key}] += hits * (length - 1);
+        }
+    }
+
+    std::vector<Fusion_candidate> candidates;
+    for (const auto &entry : saved) {
+        candidates.push_back(Fusion_candidate{
+            Fusion_rule{entry.first.second, entry.first.first},
+            entry.second});
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const Fusion_candidate &a, const Fusion_candidate &b) {
+                         return a.saved > b.saved;
+                     });
+    if (candidates.size() > max_rules) {
+        candidates.resize(max_rules);
+    }
+    return candidates;
+}
+
+void mos6502::write_fusion_table(
+    std::ostream &os, const std::vector<Fusion_candidate> &candidates,
+    const std::string &source) {
+    os << "// Generated by mos6502_fusion from " << source
+       << "; do not edit.\n"
+       << "#pragma once\n\n"
+       << "#include <Fusion.hpp>\n\n"
+       << "namespace mos6502 {\n"
+       << "inline constexpr std::array<Fusion_rule, " << candidates.size()
+       << "> fusion_table = {{\n";
+    os << std::hex << std::setfill('0');
+    for (const Fusion_candidate &candidate : candidates) {
+        const Fusion_rule &rule = candidate.rule;
+        os << "    {{";
+        for (int i = 0; i < 3; i++) {
+            os << (i > 0 ? ", " : "") << "0x" << std::setw(2)
+               << int(rule.opcodes[i]);
+        }
+        os << "}, " << int(rule.length) << "}, //";
+        for (int i = 0; i < rule.length; i++) {
+            const Instruction_info &info = lookup_table[rule.opcodes[i]];
+            os << (i > 0 ? "; " : " ") << info.mnemonic;
+            if (info.mode != ADDRESSING_MODE::IMPLICIT) {
+                os << " " << mode_name(info.mode);
+            }
+        }
+        os << "\n";
+    }
+    os << "}};\n"
+       << "} // namespace mos6502\n";
+    os << std::dec << std::setfill(' ');
+}
@@ -0,0 +1,1051 @@
+#include <BlockCache.hpp>
+#include <Jit.hpp>
+#include <Opcodes.hpp>
+#include <Types.hpp>
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+
+using namespace mos6502;
+
+Native_block::Native_block(const std::vector<BYTE> &bytes, int max_cycles,
+                           std::vector<BYTE> written_pages)
+    : code(nullptr), code_size(bytes.size()), max_cycles(max_cycles),
+      written_pages(std::move(written_pages)) {
+    void *mapping = mmap(nullptr, code_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return;
+    }
+    std::memcpy(mapping, bytes.data(), code_size);
+    if (mprotect(mapping, code_size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mapping, code_size);
+        return;
+    }
+    code = mapping;
+}
+
+Native_block::~Native_block() {
+    if (code != nullptr) {
+        munmap(code, code_size);
+    }
+}
+
+namespace {
+// -------------------------------
+// x86-64 encoder
+// -------------------------------
+enum Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// Condition codes, as in the low nibble of Jcc/SETcc
+enum Cond { CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5 };
+
+// Group 1 ALU operations, as in the /digit of 81 /r
+enum Alu { ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+
+// [base + index * (1 << scale) + disp]; index < 0 for none
+struct Mem {
+    int base;
+    int index;
+    int scale;
+    int32_t disp;
+};
+
+Mem at(int base, int32_t disp = 0) { return Mem{base, -1, 0, disp}; }
+Mem at(int base, int index, int scale) { return Mem{base, index, scale, 0}; }
+
+// Registers whose low byte needs a REX prefix (SPL, BPL, SIL, DIL)
+bool needs_rex_byte(int reg) { return reg >= RSP && reg <= RDI; }
+
+// Only the instructions the translator needs. 32-bit operations zero the
+// upper half of the destination, so guest values are kept zero-extended.
+class Emitter {
+  private:
+    std::vector<BYTE> code;
+    std::vector<int> labels;
+    // Offsets of rel32 fields and the labels they target
+    std::vector<std::pair<std::size_t, int>> fixups;
+
+    void byte(BYTE b) { code.push_back(b); }
+
+    void bytes(std::initializer_list<BYTE> op) {
+        code.insert(code.end(), op.begin(), op.end());
+    }
+
+    void imm32(uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            byte(value >> (8 * i));
+        }
+    }
+
+    void rex(bool w, int reg, int index, int base, bool force) {
+        BYTE prefix = 0x40 | (w << 3) | ((reg >> 3) << 2) |
+                      ((index >> 3) << 1) | (base >> 3);
+        if (prefix != 0x40 || force) {
+            byte(prefix);
+        }
+    }
+
+    // Register-direct ModRM form
+    void rr(std::initializer_list<BYTE> op, int reg, int rm, bool w = false,
+            bool byte_regs = false) {
+        rex(w, reg, 0, rm,
+            byte_regs && (needs_rex_byte(reg) || needs_rex_byte(rm)));
+        bytes(op);
+        byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    // Memory ModRM form
+    void rm(std::initializer_list<BYTE> op, int reg, Mem mem, bool w = false,
+            bool byte_reg = false) {
+        rex(w, reg, mem.index < 0 ? 0 : mem.index, mem.base,
+            byte_reg && needs_rex_byte(reg));
+        bytes(op);
+
+        int mod;
+        if (mem.disp == 0 && (mem.base & 7) != RBP) {
+            mod = 0;
+        } else if (mem.disp >= -128 && mem.disp <= 127) {
+            mod = 1;
+        } else {
+            mod = 2;
+        }
+        if (mem.index < 0 && (mem.base & 7) != RSP) {
+            byte((mod << 6) | ((reg & 7) << 3) | (mem.base & 7));
+        } else {
+            int index = mem.index < 0 ? RSP : mem.index & 7;
+            byte((mod << 6) | ((reg & 7) << 3) | RSP);
+            byte((mem.scale << 6) | (index << 3) | (mem.base & 7));
+        }
+        if (mod == 1) {
+            byte(mem.disp);
+        } else if (mod == 2) {
+            imm32(mem.disp);
+        }
+    }
+
+    void rel32(int label) {
+        fixups.emplace_back(code.size(), label);
+        imm32(0);
+    }
+
+  public:
+    int label() {
+        labels.push_back(-1);
+        return labels.size() - 1;
+    }
+
+    void bind(int label) { labels[label] = code.size(); }
+
+    void mov(int dst, int src) { rr({0x89}, src, dst); }
+
+    void mov64(int dst, int src) { rr({0x89}, src, dst, true); }
+
+    void mov_imm(int dst, uint32_t value) {
+        rex(false, 0, 0, dst, false);
+        byte(0xb8 | (dst & 7));
+        imm32(value);
+    }
+
+    void mov_imm64(int dst, uint64_t value) {
+        rex(true, 0, 0, dst, false);
+        byte(0xb8 | (dst & 7));
+        imm32(value);
+        imm32(value >> 32);
+    }
+
+    void alu(Alu op, int dst, int src) { rr({BYTE(op << 3 | 1)}, src, dst); }
+
+    void alu_imm(Alu op, int dst, uint32_t value, bool w = false) {
+        rr({0x81}, op, dst, w);
+        imm32(value);
+    }
+
+    void shl(int dst, BYTE count) {
+        rr({0xc1}, 4, dst);
+        byte(count);
+    }
+
+    void shr(int dst, BYTE count) {
+        rr({0xc1}, 5, dst);
+        byte(count);
+    }
+
+    void test(int dst, int src, bool w = false) { rr({0x85}, src, dst, w); }
+
+    void test_imm(int dst, uint32_t value) {
+        rr({0xf7}, 0, dst);
+        imm32(value);
+    }
+
+    void test_imm8(Mem mem, BYTE value) {
+        rm({0xf6}, 0, mem);
+        byte(value);
+    }
+
+    // movzx r32, r8
+    void movzx(int dst, int src) { rr({0x0f, 0xb6}, dst, src, false, true); }
+
+    // movzx r32, byte [mem]
+    void load8(int dst, Mem mem) { rm({0x0f, 0xb6}, dst, mem); }
+
+    void store8(Mem mem, int src) { rm({0x88}, src, mem, false, true); }
+
+    void load32(int dst, Mem mem) { rm({0x8b}, dst, mem); }
+
+    void store32(Mem mem, int src) { rm({0x89}, src, mem); }
+
+    void load64(int dst, Mem mem) { rm({0x8b}, dst, mem, true); }
+
+    void store16_imm(Mem mem, WORD value) {
+        byte(0x66);
+        rm({0xc7}, 0, mem);
+        byte(value);
+        byte(value >> 8);
+    }
+
+    void add64(Mem mem, int src) { rm({0x01}, src, mem, true); }
+
+    void alu64_imm(Alu op, Mem mem, uint32_t value) {
+        rm({0x81}, op, mem, true);
+        imm32(value);
+    }
+
+    void setcc(Cond cond, int dst) {
+        rr({0x0f, BYTE(0x90 | cond)}, 0, dst, false, true);
+    }
+
+    void jcc(Cond cond, int label) {
+        bytes({0x0f, BYTE(0x80 | cond)});
+        rel32(label);
+    }
+
+    void jmp(int label) {
+        byte(0xe9);
+        rel32(label);
+    }
+
+    void call(int reg) { rr({0xff}, 2, reg); }
+
+    void push(int reg) {
+        rex(false, 0, 0, reg, false);
+        byte(0x50 | (reg & 7));
+    }
+
+    void pop(int reg) {
+        rex(false, 0, 0, reg, false);
+        byte(0x58 | (reg & 7));
+    }
+
+    void ret() { byte(0xc3); }
+
+    std::vector<BYTE> finish() {
+        for (auto [offset, label] : fixups) {
+            uint32_t rel = labels[label] - (offset + 4);
+            std::memcpy(&code[offset], &rel, sizeof(rel));
+        }
+        return code;
+    }
+};
+
+// -------------------------------
+// Block translation
+// -------------------------------
+
+// Guest state in host registers, zero-extended to 32 bits. C and V are
+// 0/1 and the lazy N/Z results are kept as in CPU. rbx holds the CPU.
+constexpr int CPU_REG = RBX;
+constexpr int A = R12;
+constexpr int X = R13;
+constexpr int Y = R14;
+constexpr int N = RBP;
+constexpr int Z = R15;
+constexpr int C = R8;
+constexpr int V = R9;
+
+// Offsets of the CPU fields the generated code touches
+struct Cpu_layout {
+    int32_t a, x, y, sp, pc, cycles;
+    int32_t n_result, z_result, c, v, id_flags;
+};
+
+// Where generated code calls out to
+struct Jit_context {
+    Cpu_layout layout;
+    const BYTE *const *read_pages;
+    BYTE *const *write_pages;
+    uint64_t load;
+    uint64_t store;
+    uint64_t cache;
+    // Address of Block_cache::stop_at
+    uint64_t stop_at;
+};
+
+bool is_branch(INSTRUCTION ins) {
+    switch (ins) {
+    case INSTRUCTION::BCC:
+    case INSTRUCTION::BCS:
+    case INSTRUCTION::BEQ:
+    case INSTRUCTION::BMI:
+    case INSTRUCTION::BNE:
+    case INSTRUCTION::BPL:
+    case INSTRUCTION::BVC:
+    case INSTRUCTION::BVS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Instructions translated inside a block
+bool is_supported(INSTRUCTION ins) {
+    switch (ins) {
+    case INSTRUCTION::ADC:
+    case INSTRUCTION::AND:
+    case INSTRUCTION::ASL:
+    case INSTRUCTION::BIT:
+    case INSTRUCTION::CLC:
+    case INSTRUCTION::CLV:
+    case INSTRUCTION::CMP:
+    case INSTRUCTION::CPX:
+    case INSTRUCTION::CPY:
+    case INSTRUCTION::DEC:
+    case INSTRUCTION::DEX:
+    case INSTRUCTION::DEY:
+    case INSTRUCTION::EOR:
+    case INSTRUCTION::INC:
+    case INSTRUCTION::INX:
+    case INSTRUCTION::INY:
+    case INSTRUCTION::LDA:
+    case INSTRUCTION::LDX:
+    case INSTRUCTION::LDY:
+    case INSTRUCTION::LSR:
+    case INSTRUCTION::NOP:
+    case INSTRUCTION::ORA:
+    case INSTRUCTION::ROL:
+    case INSTRUCTION::ROR:
+    case INSTRUCTION::SBC:
+    case INSTRUCTION::SEC:
+    case INSTRUCTION::STA:
+    case INSTRUCTION::STX:
+    case INSTRUCTION::STY:
+    case INSTRUCTION::TAX:
+    case INSTRUCTION::TAY:
+    case INSTRUCTION::TSX:
+    case INSTRUCTION::TXA:
+    case INSTRUCTION::TXS:
+    case INSTRUCTION::TYA:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool is_supported(ADDRESSING_MODE mode) {
+    switch (mode) {
+    case ADDRESSING_MODE::IMPLICIT:
+    case ADDRESSING_MODE::ACCUMULATOR:
+    case ADDRESSING_MODE::IMMEDIATE:
+    case ADDRESSING_MODE::ZEROPAGE:
+    case ADDRESSING_MODE::ZEROPAGE_X:
+    case ADDRESSING_MODE::ZEROPAGE_Y:
+    case ADDRESSING_MODE::ABSOLUTE:
+    case ADDRESSING_MODE::ABSOLUTE_X:
+    case ADDRESSING_MODE::ABSOLUTE_Y:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool is_indexed(ADDRESSING_MODE mode) {
+    return mode == ADDRESSING_MODE::ZEROPAGE_X ||
+           mode == ADDRESSING_MODE::ZEROPAGE_Y ||
+           mode == ADDRESSING_MODE::ABSOLUTE_X ||
+           mode == ADDRESSING_MODE::ABSOLUTE_Y;
+}
+
+class Translator {
+  private:
+    const Jit_context &context;
+    const Cpu_layout &layout;
+    Emitter e;
+
+    // Exits: state written back (leave) or untouched (bail)
+    int leave;
+    int bail;
+
+    // Out-of-line slow paths, emitted after the block body
+    std::vector<std::function<void()>> stubs;
+
+    // Per instruction being translated: PC after it and the block's
+    // base cycles up to and including it
+    WORD next_pc;
+    uint32_t cycles_so_far;
+
+    Mem field(int32_t offset) { return at(CPU_REG, offset); }
+
+    void spill() {
+        e.store8(field(layout.a), A);
+        e.store8(field(layout.x), X);
+        e.store8(field(layout.y), Y);
+        e.store8(field(layout.n_result), N);
+        e.store8(field(layout.z_result), Z);
+        e.store8(field(layout.c), C);
+        e.store8(field(layout.v), V);
+    }
+
+    void reload() {
+        e.load8(A, field(layout.a));
+        e.load8(X, field(layout.x));
+        e.load8(Y, field(layout.y));
+        e.load8(N, field(layout.n_result));
+        e.load8(Z, field(layout.z_result));
+        e.load8(C, field(layout.c));
+        e.load8(V, field(layout.v));
+    }
+
+    void set_nz(int reg) {
+        e.mov(N, reg);
+        e.mov(Z, reg);
+    }
+
+    // Write state back as the interpreter has it inside an instruction,
+    // before calling out
+    void sync_out(WORD pc, uint32_t cycles) {
+        spill();
+        e.store16_imm(field(layout.pc), pc);
+        e.alu64_imm(ADD, field(layout.cycles), cycles);
+    }
+
+    // Address of an indexed mode into ecx
+    void index_address(ADDRESSING_MODE mode, WORD operand) {
+        bool zeropage = mode == ADDRESSING_MODE::ZEROPAGE_X ||
+                        mode == ADDRESSING_MODE::ZEROPAGE_Y;
+        bool use_x = mode == ADDRESSING_MODE::ZEROPAGE_X ||
+                     mode == ADDRESSING_MODE::ABSOLUTE_X;
+        e.mov(RCX, use_x ? X : Y);
+        e.alu_imm(ADD, RCX, operand);
+        e.alu_imm(AND, RCX, zeropage ? 0xff : 0xffff);
+    }
+
+    // Page pointer for the address in ecx into rax, jumping to slow when
+    // the page is not direct; leaves the offset in edx
+    void page_lookup(const void *table, int slow) {
+        e.mov(RDX, RCX);
+        e.shr(RDX, 8);
+        e.mov_imm64(RAX, reinterpret_cast<uint64_t>(table));
+        e.load64(RAX, at(RAX, RDX, 3));
+        e.test(RAX, RAX, true);
+        e.jcc(CC_E, slow);
+        e.movzx(RDX, RCX);
+    }
+
+    // Same for a fixed address; the offset is folded into the access
+    void page_lookup_fixed(const void *entry, int slow) {
+        e.mov_imm64(RAX, reinterpret_cast<uint64_t>(entry));
+        e.load64(RAX, at(RAX));
+        e.test(RAX, RAX, true);
+        e.jcc(CC_E, slow);
+    }
+
+    // Bus read of the operand into eax. The address of indexed modes is
+    // left in ecx for a following write.
+    void read(ADDRESSING_MODE mode, WORD operand, bool penalty) {
+        if (mode == ADDRESSING_MODE::IMMEDIATE) {
+            e.mov_imm(RAX, operand & 0xff);
+            return;
+        }
+        if (mode == ADDRESSING_MODE::ACCUMULATOR) {
+            e.mov(RAX, A);
+            return;
+        }
+
+        int slow = e.label();
+        int back = e.label();
+        bool indexed = is_indexed(mode);
+        if (indexed) {
+            index_address(mode, operand);
+            if (penalty && (mode == ADDRESSING_MODE::ABSOLUTE_X ||
+                            mode == ADDRESSING_MODE::ABSOLUTE_Y)) {
+                // One cycle when indexing crosses into the next page
+                e.mov(RDX, RCX);
+                e.shr(RDX, 8);
+                e.alu_imm(CMP, RDX, operand >> 8);
+                e.setcc(CC_NE, RDX);
+                e.movzx(RDX, RDX);
+                e.add64(field(layout.cycles), RDX);
+            }
+            page_lookup(context.read_pages, slow);
+            e.load8(RAX, at(RAX, RDX, 0));
+        } else {
+            page_lookup_fixed(&context.read_pages[operand >> 8], slow);
+            e.load8(RAX, at(RAX, operand & 0xff));
+        }
+        e.bind(back);
+
+        stubs.push_back([this, slow, back, indexed, operand,
+                         pc = next_pc, cycles = cycles_so_far] {
+            e.bind(slow);
+            if (!indexed) {
+                e.mov_imm(RCX, operand);
+            }
+            sync_out(pc, cycles);
+            e.store32(at(RSP), RCX);
+            e.mov_imm64(RDI, context.cache);
+            e.mov(RSI, RCX);
+            e.mov_imm64(RAX, context.load);
+            e.call(RAX);
+            e.movzx(RAX, RAX);
+            e.alu64_imm(SUB, field(layout.cycles), cycles);
+            e.load32(RCX, at(RSP));
+            reload();
+            e.jmp(back);
+        });
+    }
+
+    // Bus write of esi to the operand; the address of indexed modes must
+    // already be in ecx. Leaves the block when the store invalidated it.
+    void write(ADDRESSING_MODE mode, WORD operand) {
+        if (mode == ADDRESSING_MODE::ACCUMULATOR) {
+            e.mov(A, RSI);
+            return;
+        }
+
+        int slow = e.label();
+        int back = e.label();
+        bool indexed = is_indexed(mode);
+        if (indexed) {
+            page_lookup(context.write_pages, slow);
+            e.store8(at(RAX, RDX, 0), RSI);
+        } else {
+            page_lookup_fixed(&context.write_pages[operand >> 8], slow);
+            e.store8(at(RAX, operand & 0xff), RSI);
+        }
+        e.bind(back);
+
+        stubs.push_back([this, slow, back, indexed, operand,
+                         pc = next_pc, cycles = cycles_so_far] {
+            e.bind(slow);
+            if (!indexed) {
+                e.mov_imm(RCX, operand);
+            }
+            sync_out(pc, cycles);
+            e.mov(RDX, RSI);
+            e.mov(RSI, RCX);
+            e.mov_imm64(RDI, context.cache);
+            e.mov_imm64(RAX, context.store);
+            e.call(RAX);
+            // The store is the last thing the instruction does, so the
+            // state written back is already final
+            e.test(RAX, RAX);
+            e.jcc(CC_NE, leave);
+            e.alu64_imm(SUB, field(layout.cycles), cycles);
+            reload();
+            e.jmp(back);
+        });
+    }
+
+    void add() {
+        // edx = a + rhs + c, at most 0x1ff
+        e.mov(RDX, A);
+        e.alu(ADD, RDX, RAX);
+        e.alu(ADD, RDX, C);
+        e.mov(C, RDX);
+        e.shr(C, 8);
+        e.alu_imm(AND, RDX, 0xff);
+        // v = ((a ^ result) & (rhs ^ result)) >> 7
+        e.mov(RCX, A);
+        e.alu(XOR, RCX, RDX);
+        e.alu(XOR, RAX, RDX);
+        e.alu(AND, RCX, RAX);
+        e.shr(RCX, 7);
+        e.alu_imm(AND, RCX, 1);
+        e.mov(V, RCX);
+        e.mov(A, RDX);
+        set_nz(A);
+    }
+
+    void compare(int lhs) {
+        e.mov_imm(C, 0);
+        e.alu(CMP, lhs, RAX);
+        e.setcc(CC_AE, C);
+        e.mov(RDX, lhs);
+        e.alu(SUB, RDX, RAX);
+        e.alu_imm(AND, RDX, 0xff);
+        set_nz(RDX);
+    }
+
+    // Shift or rotate eax, updating C
+    void shift(INSTRUCTION ins) {
+        switch (ins) {
+        case INSTRUCTION::ASL:
+            e.mov(C, RAX);
+            e.shr(C, 7);
+            e.shl(RAX, 1);
+            e.alu_imm(AND, RAX, 0xff);
+            break;
+        case INSTRUCTION::LSR:
+            e.mov(C, RAX);
+            e.alu_imm(AND, C, 1);
+            e.shr(RAX, 1);
+            break;
+        case INSTRUCTION::ROL:
+            e.mov(RDX, C);
+            e.mov(C, RAX);
+            e.shr(C, 7);
+            e.shl(RAX, 1);
+            e.alu(OR, RAX, RDX);
+            e.alu_imm(AND, RAX, 0xff);
+            break;
+        default:
+            e.mov(RDX, C);
+            e.shl(RDX, 7);
+            e.mov(C, RAX);
+            e.alu_imm(AND, C, 1);
+            e.shr(RAX, 1);
+            e.alu(OR, RAX, RDX);
+            break;
+        }
+    }
+
+    void step(int reg, int delta) {
+        e.alu_imm(delta > 0 ? ADD : SUB, reg, 1);
+        e.alu_imm(AND, reg, 0xff);
+        set_nz(reg);
+    }
+
+    void transfer(int dst, int src) {
+        e.mov(dst, src);
+        set_nz(dst);
+    }
+
+    void instruction(INSTRUCTION ins, ADDRESSING_MODE mode, WORD operand) {
+        switch (ins) {
+        case INSTRUCTION::ADC:
+            read(mode, operand, true);
+            add();
+            break;
+        case INSTRUCTION::SBC:
+            read(mode, operand, true);
+            e.alu_imm(XOR, RAX, 0xff);
+            add();
+            break;
+        case INSTRUCTION::AND:
+        case INSTRUCTION::EOR:
+        case INSTRUCTION::ORA:
+            read(mode, operand, true);
+            e.alu(ins == INSTRUCTION::AND   ? AND
+                  : ins == INSTRUCTION::EOR ? XOR
+                                            : OR,
+                  A, RAX);
+            set_nz(A);
+            break;
+        case INSTRUCTION::BIT:
+            read(mode, operand, true);
+            e.mov(N, RAX);
+            e.mov(Z, A);
+            e.alu(AND, Z, RAX);
+            e.mov(V, RAX);
+            e.shr(V, 6);
+            e.alu_imm(AND, V, 1);
+            break;
+        case INSTRUCTION::CMP:
+            read(mode, operand, true);
+            compare(A);
+            break;
+        case INSTRUCTION::CPX:
+            read(mode, operand, true);
+            compare(X);
+            break;
+        case INSTRUCTION::CPY:
+            read(mode, operand, true);
+            compare(Y);
+            break;
+        case INSTRUCTION::LDA:
+            read(mode, operand, true);
+            transfer(A, RAX);
+            break;
+        case INSTRUCTION::LDX:
+            read(mode, operand, true);
+            transfer(X, RAX);
+            break;
+        case INSTRUCTION::LDY:
+            read(mode, operand, true);
+            transfer(Y, RAX);
+            break;
+        case INSTRUCTION::STA:
+        case INSTRUCTION::STX:
+        case INSTRUCTION::STY:
+            if (is_indexed(mode)) {
+                index_address(mode, operand);
+            }
+            e.mov(RSI, ins == INSTRUCTION::STA   ? A
+                       : ins == INSTRUCTION::STX ? X
+                                                 : Y);
+            write(mode, operand);
+            break;
+        case INSTRUCTION::ASL:
+        case INSTRUCTION::LSR:
+        case INSTRUCTION::ROL:
+        case INSTRUCTION::ROR:
+            read(mode, operand, false);
+            shift(ins);
+            set_nz(RAX);
+            e.mov(RSI, RAX);
+            write(mode, operand);
+            break;
+        case INSTRUCTION::INC:
+        case INSTRUCTION::DEC:
+            read(mode, operand, false);
+            e.alu_imm(ins == INSTRUCTION::INC ? ADD : SUB, RAX, 1);
+            e.alu_imm(AND, RAX, 0xff);
+            set_nz(RAX);
+            e.mov(RSI, RAX);
+            write(mode, operand);
+            break;
+        case INSTRUCTION::INX:
+            step(X, 1);
+            break;
+        case INSTRUCTION::INY:
+            step(Y, 1);
+            break;
+        case INSTRUCTION::DEX:
+            step(X, -1);
+            break;
+        case INSTRUCTION::DEY:
+            step(Y, -1);
+            break;
+        case INSTRUCTION::TAX:
+            transfer(X, A);
+            break;
+        case INSTRUCTION::TAY:
+            transfer(Y, A);
+            break;
+        case INSTRUCTION::TXA:
+            transfer(A, X);
+            break;
+        case INSTRUCTION::TYA:
+            transfer(A, Y);
+            break;
+        case INSTRUCTION::TSX:
+            e.load8(X, field(layout.sp));
+            set_nz(X);
+            break;
+        case INSTRUCTION::TXS:
+            e.store8(field(layout.sp), X);
+            break;
+        case INSTRUCTION::CLC:
+            e.mov_imm(C, 0);
+            break;
+        case INSTRUCTION::SEC:
+            e.mov_imm(C, 1);
+            break;
+        case INSTRUCTION::CLV:
+            e.mov_imm(V, 0);
+            break;
+        default: // NOP
+            break;
+        }
+    }
+
+    // True when every address the operand can reach is RAM or ROM. The
+    // mapping cannot change under a translated block: remapping flushes
+    // the cache.
+    static bool reaches_direct(ADDRESSING_MODE mode, WORD operand,
+                               const Bus &bus) {
+        switch (mode) {
+        case ADDRESSING_MODE::ZEROPAGE:
+        case ADDRESSING_MODE::ZEROPAGE_X:
+        case ADDRESSING_MODE::ZEROPAGE_Y:
+            return bus.is_direct(0x00);
+        case ADDRESSING_MODE::ABSOLUTE:
+            return bus.is_direct(operand >> 8);
+        case ADDRESSING_MODE::ABSOLUTE_X:
+        case ADDRESSING_MODE::ABSOLUTE_Y:
+            return bus.is_direct(operand >> 8) &&
+                   bus.is_direct(WORD(operand + 0xff) >> 8);
+        default:
+            return true;
+        }
+    }
+
+    // Leave after the current instruction if a device read in it raised
+    // an interrupt; jit_load() zeroes stop_at for that
+    void check_device_read() {
+        int stop = e.label();
+        e.mov_imm64(RAX, context.stop_at);
+        e.load64(RAX, at(RAX));
+        e.test(RAX, RAX, true);
+        e.jcc(CC_E, stop);
+        stubs.push_back([this, stop, pc = next_pc, cycles = cycles_so_far] {
+            e.bind(stop);
+            spill();
+            exit_to(pc, cycles);
+        });
+    }
+
+    // Write back pc and the block's cycles and leave
+    void exit_to(WORD pc, uint32_t cycles) {
+        e.store16_imm(field(layout.pc), pc);
+        e.alu64_imm(ADD, field(layout.cycles), cycles);
+        e.jmp(leave);
+    }
+
+    void branch_exit(INSTRUCTION ins, WORD operand) {
+        int reg;
+        Cond taken;
+        switch (ins) {
+        case INSTRUCTION::BCC:
+            reg = C, taken = CC_E;
+            break;
+        case INSTRUCTION::BCS:
+            reg = C, taken = CC_NE;
+            break;
+        case INSTRUCTION::BEQ:
+            reg = Z, taken = CC_E;
+            break;
+        case INSTRUCTION::BNE:
+            reg = Z, taken = CC_NE;
+            break;
+        case INSTRUCTION::BMI:
+            reg = N, taken = CC_NE;
+            break;
+        case INSTRUCTION::BPL:
+            reg = N, taken = CC_E;
+            break;
+        case INSTRUCTION::BVC:
+            reg = V, taken = CC_E;
+            break;
+        default: // BVS
+            reg = V, taken = CC_NE;
+            break;
+        }
+
+        int target_label = e.label();
+        if (reg == N) {
+            e.test_imm(N, CPU::FLAG_N);
+        } else {
+            e.test(reg, reg);
+        }
+        e.jcc(taken, target_label);
+        exit_to(next_pc, cycles_so_far);
+
+        e.bind(target_label);
+        WORD target = next_pc + static_cast<int8_t>(operand);
+        uint32_t penalty = 1 + (((next_pc ^ target) & 0xff00) != 0 ? 1 : 0);
+        exit_to(target, cycles_so_far + penalty);
+    }
+
+  public:
+    Translator(const Jit_context &context)
+        : context(context), layout(context.layout) {}
+
+    // Machine code for the instructions, or empty if any is not covered.
+    // written_pages and max_cycles are filled in along the way.
+    std::vector<BYTE> translate(WORD pc, const BYTE *opcodes,
+                                const WORD *operands, int length,
+                                const Bus &bus,
+                                std::vector<BYTE> &written_pages,
+                                int &max_cycles) {
+        max_cycles = 0;
+
+        // Check coverage first
+        bool uses_adder = false;
+        for (int i = 0; i < length; i++) {
+            const Instruction_info &info = lookup_table[opcodes[i]];
+            bool last = i == length - 1;
+            if (last && is_branch(info.ins)) {
+                continue;
+            }
+            if (last && info.ins == INSTRUCTION::JMP &&
+                info.mode == ADDRESSING_MODE::ABSOLUTE) {
+                continue;
+            }
+            if (!is_supported(info.ins) || !is_supported(info.mode)) {
+                return {};
+            }
+            // Fixed addresses on device pages go through the interpreter
+            if ((info.mode == ADDRESSING_MODE::ZEROPAGE ||
+                 info.mode == ADDRESSING_MODE::ABSOLUTE) &&
+                !bus.is_direct(operands[i] >> 8)) {
+                return {};
+            }
+            uses_adder |= info.ins == INSTRUCTION::ADC ||
+                          info.ins == INSTRUCTION::SBC;
+        }
+
+        leave = e.label();
+        bail = e.label();
+
+        // Prologue: save callee-saved registers, keep rsp 16-byte aligned
+        // with a spare slot at [rsp]
+        for (int reg : {RBX, RBP, R12, R13, R14, R15}) {
+            e.push(reg);
+        }
+        e.alu_imm(SUB, RSP, 8, true);
+        e.mov64(CPU_REG, RDI);
+
+        // Decimal mode arithmetic stays in the interpreter
+        if (uses_adder) {
+            e.test_imm8(field(layout.id_flags), CPU::FLAG_D);
+            e.jcc(CC_NE, bail);
+        }
+        reload();
+
+        cycles_so_far = 0;
+        next_pc = pc;
+        for (int i = 0; i < length; i++) {
+            const Instruction_info &info = lookup_table[opcodes[i]];
+            next_pc += info.bytes;
+            cycles_so_far += info.cycles;
+            max_cycles += info.cycles;
+
+            if (is_branch(info.ins)) {
+                spill();
+                branch_exit(info.ins, operands[i]);
+                max_cycles += 2;
+                break;
+            }
+            if (info.ins == INSTRUCTION::JMP) {
+                spill();
+                exit_to(operands[i], cycles_so_far);
+                break;
+            }
+
+            instruction(info.ins, info.mode, operands[i]);
+
+            bool loads = info.ins != INSTRUCTION::STA &&
+                         info.ins != INSTRUCTION::STX &&
+                         info.ins != INSTRUCTION::STY;
+            if (loads && (info.mode == ADDRESSING_MODE::ABSOLUTE_X ||
+                          info.mode == ADDRESSING_MODE::ABSOLUTE_Y)) {
+                max_cycles += 1;
+            }
+
+            bool stores = info.ins == INSTRUCTION::STA ||
+                          info.ins == INSTRUCTION::STX ||
+                          info.ins == INSTRUCTION::STY ||
+                          info.ins == INSTRUCTION::INC ||
+                          info.ins == INSTRUCTION::DEC ||
+                          info.ins == INSTRUCTION::ASL ||
+                          info.ins == INSTRUCTION::LSR ||
+                          info.ins == INSTRUCTION::ROL ||
+                          info.ins == INSTRUCTION::ROR;
+            // A device read may raise an interrupt, taken before the next
+            // instruction; a store checks for it in jit_store()
+            if (!stores && i != length - 1 &&
+                !reaches_direct(info.mode, operands[i], bus)) {
+                check_device_read();
+            }
+
+            if (stores && info.mode != ADDRESSING_MODE::ACCUMULATOR) {
+                WORD first = operands[i];
+                WORD last = first;
+                if (info.mode == ADDRESSING_MODE::ZEROPAGE_X ||
+                    info.mode == ADDRESSING_MODE::ZEROPAGE_Y) {
+                    first = last = 0x0000;
+                } else if (is_indexed(info.mode)) {
+                    last = first + 0xff;
+                }
+                for (BYTE page : {BYTE(first >> 8), BYTE(last >> 8)}) {
+                    if (std::find(written_pages.begin(), written_pages.end(),
+                                  page) == written_pages.end()) {
+                        written_pages.push_back(page);
+                    }
+                }
+            }
+
+            if (i == length - 1) {
+                spill();
+                exit_to(next_pc, cycles_so_far);
+            }
+        }
+
+        for (auto &stub : stubs) {
+            stub();
+        }
+
+        e.bind(leave);
+        e.mov_imm(RAX, 1);
+        int epilogue = e.label();
+        e.jmp(epilogue);
+        e.bind(bail);
+        e.mov_imm(RAX, 0);
+        e.bind(epilogue);
+        e.alu_imm(ADD, RSP, 8, true);
+        for (int reg : {R15, R14, R13, R12, RBP, RBX}) {
+            e.pop(reg);
+        }
+        e.ret();
+        return e.finish();
+    }
+};
+} // namespace
+
+std::unique_ptr<Native_block> Block_cache::translate(const Block &block) {
+    auto offset = [this](const void *field) {
+        return static_cast<int32_t>(reinterpret_cast<const char *>(field) -
+                                    reinterpret_cast<const char *>(&cpu));
+    };
+
+    Jit_context context;
+    context.layout = Cpu_layout{
+        offset(&cpu.a),        offset(&cpu.x),        offset(&cpu.y),
+        offset(&cpu.sp),       offset(&cpu.pc),       offset(&cpu.cycles),
+        offset(&cpu.n_result), offset(&cpu.z_result), offset(&cpu.c),
+        offset(&cpu.v),        offset(&cpu.id_flags),
+    };
+    context.read_pages = bus.read_page_table();
+    context.write_pages = bus.write_page_table();
+    context.load = reinterpret_cast<uint64_t>(&Block_cache::jit_load);
+    context.store = reinterpret_cast<uint64_t>(&Block_cache::jit_store);
+    context.cache = reinterpret_cast<uint64_t>(this);
+    context.stop_at = reinterpret_cast<uint64_t>(&stop_at);
+
+    std::array<BYTE, MAX_BLOCK_LENGTH> opcodes;
+    std::array<WORD, MAX_BLOCK_LENGTH> operands;
+    for (int i = 0; i < block.length; i++) {
+        opcodes[i] = block.instructions[i].opcode;
+        operands[i] = block.instructions[i].operand;
+    }
+
+    std::vector<BYTE> written_pages;
+    int max_cycles = 0;
+    std::vector<BYTE> code =
+        Translator(context).translate(block.pc, opcodes.data(),
+                                      operands.data(), block.length, bus,
+                                      written_pages, max_cycles);
+    if (code.empty()) {
+        return nullptr;
+    }
+
+    auto native = std::make_unique<Native_block>(code, max_cycles,
+                                                 std::move(written_pages));
+    if (!native->valid()) {
+        return nullptr;
+    }
+    return native;
+}
+
+BYTE Block_cache::jit_load(Block_cache *cache, WORD addr) {
+    BYTE value = cache->bus.read(addr);
+    // Device reads can raise an interrupt
+    if (cache->cpu.interrupt_due()) {
+        cache->stop_at = 0;
+    }
+    return value;
+}
+
+int Block_cache::jit_store(Block_cache *cache, WORD addr, BYTE value) {
+    cache->bus.write(addr, value);
+    // Leave on invalidated code, or a device raising an interrupt
+    return cache->stop_at == 0 || cache->cpu.interrupt_due() ? 1 : 0;
+}
@@ -0,0 +1,372 @@
+#include <Loader.hpp>
+#include <Types.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+
+using namespace mos6502;
+
+struct Rom_image::Storage {
+    // Read-only mapping of the whole file, nullptr for an empty file
+    void *mapping = nullptr;
+    std::size_t mapping_size = 0;
+
+    // Intel HEX data bytes, in record order
+    std::vector<BYTE> decoded;
+    std::vector<std::array<BYTE, 0x100>> decoded_pages;
+
+    Storage() = default;
+    Storage(const Storage &) = delete;
+    Storage &operator=(const Storage &) = delete;
+
+    ~Storage() {
+        if (mapping != nullptr) {
+            munmap(mapping, mapping_size);
+        }
+    }
+};
+
+namespace {
+Image_format detect_format(const std::string &path) {
+    std::size_t dot = path.find_last_of('.');
+    std::size_t slash = path.find_last_of('/');
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash)) {
+        return Image_format::RAW;
+    }
+    std::string extension = path.substr(dot + 1);
+    for (char &c : extension) {
+        c = std::tolower(static_cast<unsigned char>(c));
+    }
+    if (extension == "hex" || extension == "ihx") {
+        return Image_format::INTEL_HEX;
+    }
+    if (extension == "prg") {
+        return Image_format::PRG;
+    }
+    return Image_format::RAW;
+}
+
+int hex_digit(BYTE c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = std::tolower(c);
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+} // namespace
+
+Rom_image::Rom_image() : n_decoded_pages(0) { pages.fill(nullptr); }
+
+std::size_t Rom_image::size() const {
+    std::size_t total = 0;
+    for (const Segment &segment : segments) {
+        total += segment.length;
+    }
+    return total;
+}
+
+bool Rom_image::load(const std::string &path, Image_format format,
+                     WORD origin, std::string &error) {
+    storage.reset();
+    segments.clear();
+    pages.fill(nullptr);
+    n_decoded_pages = 0;
+
+    if (format == Image_format::AUTO) {
+        format = detect_format(path);
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = path + ": " + std::strerror(errno);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        error = path + ": " + std::strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    auto loaded = std::make_shared<Storage>();
+    if (info.st_size > 0) {
+        void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE,
+                             fd, 0);
+        if (mapping == MAP_FAILED) {
+            error = path + ": " + std::strerror(errno);
+            close(fd);
+            return false;
+        }
+        loaded->mapping = mapping;
+        loaded->mapping_size = info.st_size;
+    }
+    // The mapping keeps the file referenced
+    close(fd);
+
+    const BYTE *data = static_cast<const BYTE *>(loaded->mapping);
+    std::size_t size = loaded->mapping_size;
+    bool ok = false;
+    switch (format) {
+    case Image_format::AUTO:
+    case Image_format::RAW:
+        ok = parse_raw(data, size, origin, error);
+        break;
+    case Image_format::PRG:
+        ok = parse_prg(data, size, error);
+        break;
+    case Image_format::INTEL_HEX:
+        ok = parse_intel_hex(data, size, loaded->decoded, error);
+        break;
+    }
+    if (!ok) {
+        error = path + ": " + error;
+        segments.clear();
+        return false;
+    }
+
+    build_pages(loaded->decoded_pages);
+    // Nothing points into an Intel HEX file once it is decoded
+    if (format == Image_format::INTEL_HEX && loaded->mapping != nullptr) {
+        munmap(loaded->mapping, loaded->mapping_size);
+        loaded->mapping = nullptr;
+    }
+    storage = std::move(loaded);
+    return true;
+}
+
+bool Rom_image::parse_raw(const BYTE *data, std::size_t size, WORD origin,
+                          std::string &error) {
+    if (size > 0x10000u - origin) {
+        error = "image of " + std::to_string(size) +
+                " bytes does not fit at the load address";
+        return false;
+    }
+    if (size > 0) {
+        segments.push_back(Segment{origin, static_cast<uint32_t>(size), data});
+    }
+    return true;
+}
+
+bool Rom_image::parse_prg(const BYTE *data, std::size_t size,
+                          std::string &error) {
+    if (size < 2) {
+        error = "missing load address";
+        return false;
+    }
+    WORD address = data[0] | data[1] << 8;
+    if (size - 2 > 0x10000u - address) {
+        error = "data runs past the end of the address space";
+        return false;
+    }
+    if (size > 2) {
+        segments.push_back(
+            Segment{address, static_cast<uint32_t>(size - 2), data + 2});
+    }
+    return true;
+}
+
+bool Rom_image::parse_intel_hex(const BYTE *data, std::size_t size,
+                                std::vector<BYTE> &decoded,
+                                std::string &error) {
+    struct Run {
+        WORD address;
+        uint32_t length;
+        std::size_t offset;
+    };
+    std::vector<Run> runs;
+
+    // Set by extended segment and extended linear address records
+    uint32_t base = 0;
+    int line = 1;
+    std::size_t i = 0;
+    bool end_of_file = false;
+
+    while (i < size && !end_of_file) {
+        if (data[i] == '\n') {
+            line++;
+            i++;
+            continue;
+        }
+        if (std::isspace(data[i])) {
+            i++;
+            continue;
+        }
+        std::string where = "line " + std::to_string(line) + ": ";
+        if (data[i] != ':') {
+            error = where + "expected ':'";
+            return false;
+        }
+        i++;
+
+        // Record bytes: count, address hi, address lo, type, data, checksum
+        BYTE record[5 + 0xff];
+        std::size_t n_bytes = 1;
+        for (std::size_t j = 0; j < n_bytes; j++) {
+            int hi = i + 1 < size ? hex_digit(data[i]) : -1;
+            int lo = i + 1 < size ? hex_digit(data[i + 1]) : -1;
+            if (hi < 0 || lo < 0) {
+                error = where + "bad hex digit";
+                return false;
+            }
+            record[j] = hi << 4 | lo;
+            i += 2;
+            if (j == 0) {
+                n_bytes = 5 + record[0];
+            }
+        }
+
+        BYTE checksum = 0;
+        for (std::size_t j = 0; j < n_bytes; j++) {
+            checksum += record[j];
+        }
+        if (checksum != 0) {
+            error = where + "bad checksum";
+            return false;
+        }
+
+        BYTE length = record[0];
+        WORD offset = record[1] << 8 | record[2];
+        const BYTE *payload = record + 4;
+        switch (record[3]) {
+        case 0x00: {
+            // 64-bit, so a large extended base cannot wrap into range
+            uint64_t address = uint64_t(base) + offset;
+            if (address + length > 0x10000) {
+                error = where + "data outside the 16-bit address space";
+                return false;
+            }
+            if (length == 0) {
+                break;
+            }
+            if (!runs.empty() &&
+                runs.back().address + runs.back().length == address) {
+                runs.back().length += length;
+            } else {
+                runs.push_back(
+                    Run{static_cast<WORD>(address), length, decoded.size()});
+            }
+            decoded.insert(decoded.end(), payload, payload + length);
+            break;
+        }
+        case 0x01:
+            end_of_file = true;
+            break;
+        case 0x02:
+            if (length != 2) {
+                error = where + "bad extended segment address";
+                return false;
+            }
+            base = (payload[0] << 8 | payload[1]) << 4;
+            break;
+        case 0x04:
+            if (length != 2) {
+                error = where + "bad extended linear address";
+                return false;
+            }
+            base = static_cast<uint32_t>(payload[0] << 8 | payload[1]) << 16;
+            break;
+        case 0x03:
+        case 0x05:
+            // Start addresses; the reset vector decides where to start
+            break;
+        default:
+            error = where + "unknown record type";
+            return false;
+        }
+    }
+
+    // decoded no longer grows, so its bytes stay put
+    for (const Run &run : runs) {
+        segments.push_back(
+            Segment{run.address, run.length, decoded.data() + run.offset});
+    }
+    return true;
+}
+
+void Rom_image::build_pages(
+    std::vector<std::array<BYTE, 0x100>> &decoded_pages) {
+    // Segments touching each page, saturated at 2, and the page's bytes
+    // inside a segment covering all of it
+    std::array<BYTE, 0x100> touching;
+    std::array<const BYTE *, 0x100> direct;
+    touching.fill(0);
+    direct.fill(nullptr);
+
+    for (const Segment &segment : segments) {
+        uint32_t end = segment.address + segment.length;
+        for (uint32_t page = segment.address >> 8; page << 8 < end; page++) {
+            touching[page] = std::min(touching[page] + 1, 2);
+            uint32_t start = page << 8;
+            if (start >= segment.address && start + 0x100 <= end) {
+                direct[page] = segment.data + (start - segment.address);
+            }
+        }
+    }
+
+    // Everything else is assembled in pages of its own
+    std::array<int, 0x100> decoded_index;
+    int n_decoded = 0;
+    for (int page = 0; page < 0x100; page++) {
+        if (touching[page] == 1 && direct[page] != nullptr) {
+            pages[page] = direct[page];
+            decoded_index[page] = -1;
+        } else if (touching[page] != 0) {
+            decoded_index[page] = n_decoded++;
+        } else {
+            decoded_index[page] = -1;
+        }
+    }
+    decoded_pages.assign(n_decoded, std::array<BYTE, 0x100>{});
+    n_decoded_pages = n_decoded;
+
+    // Later segments win where they overlap, as later records would
+    for (const Segment &segment : segments) {
+        for (uint32_t i = 0; i < segment.length; i++) {
+            uint32_t addr = segment.address + i;
+            int index = decoded_index[addr >> 8];
+            if (index >= 0) {
+                decoded_pages[index][addr & 0xff] = segment.data[i];
+            }
+        }
+    }
+    for (int page = 0; page < 0x100; page++) {
+        if (decoded_index[page] >= 0) {
+            pages[page] = decoded_pages[decoded_index[page]].data();
+        }
+    }
+}
+
+void Rom_image::map(Bus &bus) const {
+    int page = 0;
+    while (page < 0x100) {
+        if (pages[page] == nullptr) {
+            page++;
+            continue;
+        }
+        // Pages contiguous in memory go in one call
+        int n_pages = 1;
+        while (page + n_pages < 0x100 &&
+               pages[page + n_pages] == pages[page] + n_pages * 0x100) {
+            n_pages++;
+        }
+        bus.map_rom(page, n_pages, pages[page]);
+        page += n_pages;
+    }
+}
+
+void Rom_image::copy_to(mem_t &memory) const {
+    for (const Segment &segment : segments) {
+        std::memcpy(&memory[segment.address], segment.data, segment.length);
+    }
+}
@@ -0,0 +1,739 @@
+#include <Lockstep.hpp>
+#include <Opcodes.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+#include <limits>
+
+using namespace mos6502;
+
+// The lane loops are plain C++ written to vectorize. The group step is
+// also built for AVX2, where one 32-byte register holds a whole row, and
+// the widest version the host supports is picked at load time.
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__linux__)
+#define LANE_CLONES __attribute__((target_clones("avx2", "default"), flatten))
+#else
+#define LANE_CLONES
+#endif
+
+namespace {
+constexpr int LANES = Lockstep::MAX_LANES;
+template <typename T> using Lanes = Lockstep::Lanes<T>;
+
+template <typename T> void fill(Lanes<T> &lanes, T value) {
+    for (int i = 0; i < LANES; i++) {
+        lanes[i] = value;
+    }
+}
+
+// Masks are 0xff or 0x00 per lane. Selects are done with bitwise ops
+// rather than ?: so that GCC if-converts and vectorizes the loops.
+template <typename T> T select(BYTE mask, T yes, T no) {
+    T bits = T(0) - T(mask & 1);
+    return T((yes & bits) | (no & ~bits));
+}
+
+// dst = src in the lanes set in mask
+template <typename T>
+void blend(Lanes<T> &dst, const Lanes<T> &src, const Lanes<BYTE> &mask) {
+    for (int i = 0; i < LANES; i++) {
+        dst[i] = select(mask[i], src[i], dst[i]);
+    }
+}
+
+bool any(const Lanes<BYTE> &mask) {
+    BYTE set = 0;
+    for (int i = 0; i < LANES; i++) {
+        set |= mask[i];
+    }
+    return set != 0;
+}
+} // namespace
+
+Lockstep::Lockstep(int n_lanes)
+    : n_lanes(std::clamp(n_lanes, 1, MAX_LANES)), memory(0x10000),
+      group_size(0), leader(0), group_pc(0), group_cycles(0),
+      group_bound(0), budget(0), n_vector(0), n_scalar(0) {
+    for (Lanes<BYTE> *lanes : {&a, &x, &y, &sp, &n_result, &z_result, &c, &v,
+                               &id_flags, &group}) {
+        fill<BYTE>(*lanes, 0);
+    }
+    fill<WORD>(pc, 0);
+    fill<uint64_t>(cycles, 0);
+    fill<uint64_t>(end, 0);
+
+    for (int lane = 0; lane < this->n_lanes; lane++) {
+        auto bus = std::make_unique<Bus>();
+        bus->map_device(
+            0x00, 0x100,
+            [this, lane](WORD addr) { return memory[addr][lane]; },
+            [this, lane](WORD addr, BYTE value) {
+                memory[addr][lane] = value;
+            });
+        cpus.push_back(std::make_unique<CPU>(*bus));
+        buses.push_back(std::move(bus));
+    }
+}
+
+void Lockstep::load(int lane, const mem_t &image) {
+    for (std::size_t addr = 0; addr < image.size(); addr++) {
+        memory[addr][lane] = image[addr];
+    }
+}
+
+void Lockstep::save(int lane, mem_t &image) const {
+    for (std::size_t addr = 0; addr < image.size(); addr++) {
+        image[addr] = memory[addr][lane];
+    }
+}
+
+void Lockstep::reset() {
+    for (int lane = 0; lane < n_lanes; lane++) {
+        pc[lane] = memory[0xfffc][lane] | (memory[0xfffd][lane] << 8);
+        // As CPU::set_p(FLAG_I)
+        n_result[lane] = 0;
+        z_result[lane] = 1;
+        c[lane] = 0;
+        v[lane] = 0;
+        id_flags[lane] = CPU::FLAG_I;
+        sp[lane] = 0xfd;
+        a[lane] = 0;
+        x[lane] = 0;
+        y[lane] = 0;
+        cycles[lane] += 7;
+    }
+}
+
+Lane_state Lockstep::get_lane(int lane) const {
+    BYTE p = (n_result[lane] & CPU::FLAG_N) | (v[lane] << 6) | CPU::FLAG_U |
+             id_flags[lane] | (z_result[lane] == 0 ? CPU::FLAG_Z : 0) |
+             c[lane];
+    return Lane_state{a[lane], pc[lane], sp[lane],    x[lane],
+                      y[lane], p,       cycles[lane]};
+}
+
+bool Lockstep::form_group() {
+    leader = -1;
+    for (int i = 0; i < n_lanes; i++) {
+        if (cycles[i] < end[i] && (leader < 0 || pc[i] < pc[leader])) {
+            leader = i;
+        }
+    }
+    if (leader < 0) {
+        return false;
+    }
+
+    group_pc = pc[leader];
+    group_size = 0;
+    group_cycles = 0;
+    group_bound = 0;
+    budget = std::numeric_limits<uint64_t>::max();
+    for (int i = 0; i < LANES; i++) {
+        bool member = i < n_lanes && cycles[i] < end[i] && pc[i] == group_pc;
+        group[i] = member ? 0xff : 0x00;
+        if (member) {
+            group_size++;
+            budget = std::min(budget, end[i] - cycles[i]);
+        }
+    }
+    return true;
+}
+
+void Lockstep::release(const Lanes<BYTE> &mask) {
+    for (int i = 0; i < LANES; i++) {
+        if (mask[i] & group[i]) {
+            pc[i] = group_pc;
+            cycles[i] += group_cycles;
+            group[i] = 0x00;
+            group_size--;
+        }
+    }
+    if (group_size > 0 && !group[leader]) {
+        leader = std::find(group.lane, group.lane + LANES, 0xff) - group.lane;
+    }
+}
+
+void Lockstep::step_scalar(int lane) {
+    CPU &cpu = *cpus[lane];
+    cpu.a = a[lane];
+    cpu.pc = pc[lane];
+    cpu.sp = sp[lane];
+    cpu.x = x[lane];
+    cpu.y = y[lane];
+    cpu.n_result = n_result[lane];
+    cpu.z_result = z_result[lane];
+    cpu.c = c[lane];
+    cpu.v = v[lane];
+    cpu.id_flags = id_flags[lane];
+    cpu.cycles = cycles[lane];
+
+    cpu.execute(cpu.fetch_opcode());
+
+    a[lane] = cpu.a;
+    pc[lane] = cpu.pc;
+    sp[lane] = cpu.sp;
+    x[lane] = cpu.x;
+    y[lane] = cpu.y;
+    n_result[lane] = cpu.n_result;
+    z_result[lane] = cpu.z_result;
+    c[lane] = cpu.c;
+    v[lane] = cpu.v;
+    id_flags[lane] = cpu.id_flags;
+    cycles[lane] = cpu.cycles;
+    n_scalar++;
+}
+
+LANE_CLONES void Lockstep::step_group() {
+    BYTE opcode = memory[group_pc][leader];
+    const Instruction_info &info = lookup_table[opcode];
+
+    // Members whose instruction bytes differ from the leader's wait for
+    // a group of their own
+    Lanes<BYTE> differs;
+    fill<BYTE>(differs, 0);
+    for (int k = 0; k < info.bytes; k++) {
+        const Lanes<BYTE> &row = memory[WORD(group_pc + k)];
+        BYTE expected = row[leader];
+        for (int i = 0; i < LANES; i++) {
+            differs[i] |= row[i] != expected ? 0xff : 0x00;
+        }
+    }
+    if (any(differs)) {
+        release(differs);
+    }
+
+    // Left to the scalar path: BRK, RTI, invalid opcodes, and decimal
+    // arithmetic
+    bool scalar = info.ins == INSTRUCTION::BRK ||
+                  info.ins == INSTRUCTION::RTI ||
+                  info.ins == INSTRUCTION::INVALID;
+    if (info.ins == INSTRUCTION::ADC || info.ins == INSTRUCTION::SBC) {
+        for (int i = 0; i < LANES; i++) {
+            scalar |= group[i] && (id_flags[i] & CPU::FLAG_D);
+        }
+    }
+    if (scalar) {
+        Lanes<BYTE> members = group;
+        release(group);
+        for (int i = 0; i < LANES; i++) {
+            if (members[i]) {
+                step_scalar(i);
+            }
+        }
+        return;
+    }
+
+    WORD operand = 0x0000;
+    if (info.bytes == 2) {
+        operand = memory[WORD(group_pc + 1)][leader];
+    } else if (info.bytes == 3) {
+        operand = memory[WORD(group_pc + 1)][leader] |
+                  (memory[WORD(group_pc + 2)][leader] << 8);
+    }
+    WORD next = group_pc + info.bytes;
+
+    n_vector += group_size;
+    group_pc = next;
+    group_cycles += info.cycles;
+    group_bound += info.cycles;
+
+    const Lanes<BYTE> &m = group;
+    Lanes<BYTE> value;
+
+    // Effective address: one for every lane, or one per lane
+    bool uniform = true;
+    Lanes<WORD> addr;
+
+    auto resolve = [&]() {
+        switch (info.mode) {
+        case ADDRESSING_MODE::ZEROPAGE_X:
+        case ADDRESSING_MODE::ZEROPAGE_Y: {
+            const Lanes<BYTE> &index =
+                info.mode == ADDRESSING_MODE::ZEROPAGE_X ? x : y;
+            for (int i = 0; i < LANES; i++) {
+                addr[i] = BYTE(operand + index[i]);
+            }
+            uniform = false;
+            break;
+        }
+        case ADDRESSING_MODE::ABSOLUTE_X:
+        case ADDRESSING_MODE::ABSOLUTE_Y: {
+            const Lanes<BYTE> &index =
+                info.mode == ADDRESSING_MODE::ABSOLUTE_X ? x : y;
+            for (int i = 0; i < LANES; i++) {
+                addr[i] = WORD(operand + index[i]);
+            }
+            uniform = false;
+            break;
+        }
+        case ADDRESSING_MODE::INDIRECT_X:
+            for (int i = 0; i < LANES; i++) {
+                BYTE ptr = operand + x[i];
+                addr[i] = memory[ptr][i] | (memory[BYTE(ptr + 1)][i] << 8);
+            }
+            uniform = false;
+            break;
+        case ADDRESSING_MODE::INDIRECT_Y: {
+            const Lanes<BYTE> &lo = memory[BYTE(operand)];
+            const Lanes<BYTE> &hi = memory[BYTE(operand + 1)];
+            for (int i = 0; i < LANES; i++) {
+                addr[i] = WORD((lo[i] | (hi[i] << 8)) + y[i]);
+            }
+            uniform = false;
+            break;
+        }
+        default:
+            break;
+        }
+    };
+
+    auto read = [&]() {
+        if (info.mode == ADDRESSING_MODE::IMMEDIATE) {
+            fill<BYTE>(value, operand);
+        } else if (info.mode == ADDRESSING_MODE::ACCUMULATOR) {
+            value = a;
+        } else if (uniform) {
+            value = memory[operand];
+        } else {
+            for (int i = 0; i < LANES; i++) {
+                value[i] = memory[addr[i]][i];
+            }
+        }
+    };
+
+    // Read for an instruction that only reads its operand, with the
+    // page-crossing penalty of indexed modes
+    auto load = [&]() {
+        resolve();
+        read();
+        if (info.mode == ADDRESSING_MODE::ABSOLUTE_X ||
+            info.mode == ADDRESSING_MODE::ABSOLUTE_Y ||
+            info.mode == ADDRESSING_MODE::INDIRECT_Y) {
+            const Lanes<BYTE> &index =
+                info.mode == ADDRESSING_MODE::ABSOLUTE_X ? x : y;
+            for (int i = 0; i < LANES; i++) {
+                WORD base = addr[i] - index[i];
+                cycles[i] += (m[i] & 1) & (((base ^ addr[i]) & 0xff00) != 0);
+            }
+            group_bound += 1;
+        }
+    };
+
+    auto write = [&](const Lanes<BYTE> &result) {
+        if (info.mode == ADDRESSING_MODE::ACCUMULATOR) {
+            blend(a, result, m);
+        } else if (uniform) {
+            blend(memory[operand], result, m);
+        } else {
+            for (int i = 0; i < LANES; i++) {
+                if (m[i]) {
+                    memory[addr[i]][i] = result[i];
+                }
+            }
+        }
+    };
+
+    auto set_nz = [&](const Lanes<BYTE> &result) {
+        blend(n_result, result, m);
+        blend(z_result, result, m);
+    };
+
+    auto set_flag = [&](Lanes<BYTE> &flag, BYTE set) {
+        for (int i = 0; i < LANES; i++) {
+            flag[i] = select<BYTE>(m[i], set, flag[i]);
+        }
+    };
+
+    auto add = [&]() {
+        for (int i = 0; i < LANES; i++) {
+            unsigned sum = a[i] + value[i] + c[i];
+            BYTE result = sum;
+            BYTE overflow = (((a[i] ^ result) & (value[i] ^ result)) >> 7) & 1;
+            c[i] = select<BYTE>(m[i], BYTE(sum >> 8), c[i]);
+            v[i] = select<BYTE>(m[i], overflow, v[i]);
+            a[i] = select<BYTE>(m[i], result, a[i]);
+        }
+        set_nz(a);
+    };
+
+    auto logic = [&](INSTRUCTION ins) {
+        Lanes<BYTE> result;
+        for (int i = 0; i < LANES; i++) {
+            result[i] = ins == INSTRUCTION::AND   ? a[i] & value[i]
+                        : ins == INSTRUCTION::ORA ? a[i] | value[i]
+                                                  : a[i] ^ value[i];
+        }
+        blend(a, result, m);
+        set_nz(a);
+    };
+
+    auto compare = [&](const Lanes<BYTE> &lhs) {
+        Lanes<BYTE> result;
+        for (int i = 0; i < LANES; i++) {
+            result[i] = lhs[i] - value[i];
+            c[i] = select<BYTE>(m[i], BYTE(lhs[i] >= value[i]), c[i]);
+        }
+        set_nz(result);
+    };
+
+    auto transfer = [&](Lanes<BYTE> &dst, const Lanes<BYTE> &src) {
+        blend(dst, src, m);
+        set_nz(dst);
+    };
+
+    auto step = [&](Lanes<BYTE> &reg, BYTE delta) {
+        for (int i = 0; i < LANES; i++) {
+            reg[i] += m[i] & delta;
+        }
+        set_nz(reg);
+    };
+
+    auto push = [&](const Lanes<BYTE> &pushed) {
+        for (int i = 0; i < LANES; i++) {
+            if (m[i]) {
+                memory[0x0100 | sp[i]][i] = pushed[i];
+                sp[i]--;
+            }
+        }
+    };
+
+    auto pull = [&](Lanes<BYTE> &pulled) {
+        for (int i = 0; i < LANES; i++) {
+            sp[i] += m[i] & 1;
+            pulled[i] = memory[0x0100 | sp[i]][i];
+        }
+    };
+
+    // Continue at per-lane targets, splitting the group if they differ
+    auto jump = [&](const Lanes<WORD> &target) {
+        bool same = true;
+        for (int i = 0; i < LANES; i++) {
+            same &= !m[i] || target[i] == target[leader];
+        }
+        if (same) {
+            group_pc = target[leader];
+            return;
+        }
+        Lanes<BYTE> members = group;
+        release(group);
+        blend(pc, target, members);
+    };
+
+    auto branch = [&](const Lanes<BYTE> &flag, BYTE mask, bool set) {
+        WORD target = next + static_cast<int8_t>(operand);
+        uint64_t penalty = 1 + (((next ^ target) & 0xff00) != 0 ? 1 : 0);
+        Lanes<BYTE> taken;
+        bool all = true;
+        bool none = true;
+        for (int i = 0; i < LANES; i++) {
+            taken[i] = ((flag[i] & mask) != 0) == set ? m[i] : 0x00;
+            all &= !m[i] || taken[i];
+            none &= !taken[i];
+        }
+        if (none) {
+            return;
+        }
+        if (all) {
+            group_pc = target;
+            group_cycles += penalty;
+            group_bound += penalty;
+            return;
+        }
+        release(group);
+        for (int i = 0; i < LANES; i++) {
+            if (taken[i]) {
+                pc[i] = target;
+                cycles[i] += penalty;
+            }
+        }
+    };
+
+    switch (info.ins) {
+    case INSTRUCTION::ADC:
+        load();
+        add();
+        break;
+    case INSTRUCTION::SBC:
+        load();
+        for (int i = 0; i < LANES; i++) {
+            value[i] = ~value[i];
+        }
+        add();
+        break;
+    case INSTRUCTION::AND:
+    case INSTRUCTION::ORA:
+    case INSTRUCTION::EOR:
+        load();
+        logic(info.ins);
+        break;
+    case INSTRUCTION::BIT:
+        load();
+        for (int i = 0; i < LANES; i++) {
+            n_result[i] = select<BYTE>(m[i], value[i], n_result[i]);
+            z_result[i] =
+                select<BYTE>(m[i], BYTE(a[i] & value[i]), z_result[i]);
+            v[i] = select<BYTE>(m[i], BYTE((value[i] >> 6) & 1), v[i]);
+        }
+        break;
+    case INSTRUCTION::CMP:
+        load();
+        compare(a);
+        break;
+    case INSTRUCTION::CPX:
+        load();
+        compare(x);
+        break;
+    case INSTRUCTION::CPY:
+        load();
+        compare(y);
+        break;
+    case INSTRUCTION::LDA:
+        load();
+        transfer(a, value);
+        break;
+    case INSTRUCTION::LDX:
+        load();
+        transfer(x, value);
+        break;
+    case INSTRUCTION::LDY:
+        load();
+        transfer(y, value);
+        break;
+    case INSTRUCTION::STA:
+        resolve();
+        write(a);
+        break;
+    case INSTRUCTION::STX:
+        resolve();
+        write(x);
+        break;
+    case INSTRUCTION::STY:
+        resolve();
+        write(y);
+        break;
+    case INSTRUCTION::ASL:
+    case INSTRUCTION::LSR:
+    case INSTRUCTION::ROL:
+    case INSTRUCTION::ROR: {
+        resolve();
+        read();
+        Lanes<BYTE> result;
+        for (int i = 0; i < LANES; i++) {
+            BYTE carry;
+            switch (info.ins) {
+            case INSTRUCTION::ASL:
+                carry = value[i] >> 7;
+                result[i] = value[i] << 1;
+                break;
+            case INSTRUCTION::LSR:
+                carry = value[i] & 1;
+                result[i] = value[i] >> 1;
+                break;
+            case INSTRUCTION::ROL:
+                carry = value[i] >> 7;
+                result[i] = (value[i] << 1) | c[i];
+                break;
+            default:
+                carry = value[i] & 1;
+                result[i] = (value[i] >> 1) | (c[i] << 7);
+                break;
+            }
+            c[i] = select<BYTE>(m[i], carry, c[i]);
+        }
+        set_nz(result);
+        write(result);
+        break;
+    }
+    case INSTRUCTION::INC:
+    case INSTRUCTION::DEC: {
+        resolve();
+        read();
+        BYTE delta = info.ins == INSTRUCTION::INC ? 1 : 0xff;
+        for (int i = 0; i < LANES; i++) {
+            value[i] += delta;
+        }
+        set_nz(value);
+        write(value);
+        break;
+    }
+    case INSTRUCTION::INX:
+        step(x, 1);
+        break;
+    case INSTRUCTION::INY:
+        step(y, 1);
+        break;
+    case INSTRUCTION::DEX:
+        step(x, 0xff);
+        break;
+    case INSTRUCTION::DEY:
+        step(y, 0xff);
+        break;
+    case INSTRUCTION::TAX:
+        transfer(x, a);
+        break;
+    case INSTRUCTION::TAY:
+        transfer(y, a);
+        break;
+    case INSTRUCTION::TXA:
+        transfer(a, x);
+        break;
+    case INSTRUCTION::TYA:
+        transfer(a, y);
+        break;
+    case INSTRUCTION::TSX:
+        transfer(x, sp);
+        break;
+    case INSTRUCTION::TXS:
+        blend(sp, x, m);
+        break;
+    case INSTRUCTION::CLC:
+        set_flag(c, 0);
+        break;
+    case INSTRUCTION::SEC:
+        set_flag(c, 1);
+        break;
+    case INSTRUCTION::CLV:
+        set_flag(v, 0);
+        break;
+    case INSTRUCTION::CLD:
+    case INSTRUCTION::SED:
+    case INSTRUCTION::CLI:
+    case INSTRUCTION::SEI: {
+        bool decimal =
+            info.ins == INSTRUCTION::CLD || info.ins == INSTRUCTION::SED;
+        BYTE bit = decimal ? CPU::FLAG_D : CPU::FLAG_I;
+        bool set = info.ins == INSTRUCTION::SED || info.ins == INSTRUCTION::SEI;
+        for (int i = 0; i < LANES; i++) {
+            BYTE flags = set ? id_flags[i] | bit : id_flags[i] & ~bit;
+            id_flags[i] = select<BYTE>(m[i], flags, id_flags[i]);
+        }
+        break;
+    }
+    case INSTRUCTION::PHA:
+        push(a);
+        break;
+    case INSTRUCTION::PHP:
+        for (int i = 0; i < LANES; i++) {
+            value[i] = (n_result[i] & CPU::FLAG_N) | (v[i] << 6) |
+                       CPU::FLAG_U | CPU::FLAG_B | id_flags[i] |
+                       (z_result[i] == 0 ? CPU::FLAG_Z : 0) | c[i];
+        }
+        push(value);
+        break;
+    case INSTRUCTION::PLA:
+        pull(value);
+        transfer(a, value);
+        break;
+    case INSTRUCTION::PLP:
+        pull(value);
+        // As CPU::set_p()
+        for (int i = 0; i < LANES; i++) {
+            BYTE p = value[i];
+            BYTE z = (p & CPU::FLAG_Z) ? 0 : 1;
+            BYTE id = p & (CPU::FLAG_I | CPU::FLAG_D);
+            n_result[i] = select<BYTE>(m[i], p & CPU::FLAG_N, n_result[i]);
+            z_result[i] = select<BYTE>(m[i], z, z_result[i]);
+            v[i] = select<BYTE>(m[i], (p >> 6) & 1, v[i]);
+            id_flags[i] = select<BYTE>(m[i], id, id_flags[i]);
+            c[i] = select<BYTE>(m[i], p & CPU::FLAG_C, c[i]);
+        }
+        break;
+    case INSTRUCTION::JSR: {
+        WORD ret = next - 1;
+        fill<BYTE>(value, ret >> 8);
+        push(value);
+        fill<BYTE>(value, ret & 0xff);
+        push(value);
+        group_pc = operand;
+        break;
+    }
+    case INSTRUCTION::RTS: {
+        Lanes<BYTE> lo;
+        Lanes<BYTE> hi;
+        pull(lo);
+        pull(hi);
+        Lanes<WORD> target;
+        for (int i = 0; i < LANES; i++) {
+            target[i] = ((hi[i] << 8) | lo[i]) + 1;
+        }
+        jump(target);
+        break;
+    }
+    case INSTRUCTION::JMP:
+        if (info.mode == ADDRESSING_MODE::INDIRECT) {
+            // The high byte is fetched without carrying into the page
+            WORD hi_addr = (operand & 0xff00) | ((operand + 1) & 0x00ff);
+            const Lanes<BYTE> &lo = memory[operand];
+            const Lanes<BYTE> &hi = memory[hi_addr];
+            Lanes<WORD> target;
+            for (int i = 0; i < LANES; i++) {
+                target[i] = lo[i] | (hi[i] << 8);
+            }
+            jump(target);
+        } else {
+            group_pc = operand;
+        }
+        break;
+    case INSTRUCTION::BCC:
+        branch(c, 1, false);
+        break;
+    case INSTRUCTION::BCS:
+        branch(c, 1, true);
+        break;
+    case INSTRUCTION::BNE:
+        branch(z_result, 0xff, true);
+        break;
+    case INSTRUCTION::BEQ:
+        branch(z_result, 0xff, false);
+        break;
+    case INSTRUCTION::BMI:
+        branch(n_result, CPU::FLAG_N, true);
+        break;
+    case INSTRUCTION::BPL:
+        branch(n_result, CPU::FLAG_N, false);
+        break;
+    case INSTRUCTION::BVS:
+        branch(v, 1, true);
+        break;
+    case INSTRUCTION::BVC:
+        branch(v, 1, false);
+        break;
+    default: // NOP
+        break;
+    }
+}
+
+uint64_t Lockstep::run_for_cycles(uint64_t n_cycles) {
+    uint64_t start = 0;
+    for (int i = 0; i < LANES; i++) {
+        end[i] = i < n_lanes ? cycles[i] + n_cycles : 0;
+        start += cycles[i];
+    }
+
+    group_size = 0;
+    for (;;) {
+        if (group_size > 0 && group_bound >= budget) {
+            // A member may be about to reach its end
+            release(group);
+        }
+        if (group_size == 0) {
+            if (!form_group()) {
+                break;
+            }
+            if (group_size == 1) {
+                // A lane on its own gains nothing from the vector path
+                int lane = leader;
+                release(group);
+                step_scalar(lane);
+                continue;
+            }
+        }
+        step_group();
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < LANES; i++) {
+        total += cycles[i];
+    }
+    return total - start;
+}
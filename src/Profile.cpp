@@ -0,0 +1,175 @@
+#include <Opcodes.hpp>
+#include <Profile.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <iomanip>
+
+using namespace mos6502;
+
+namespace {
+constexpr char MAGIC[8] = {'6', '5', '0', '2', 'P', 'R', 'O', 'F'};
+
+void put(std::ostream &os, uint64_t value, int n_bytes) {
+    char bytes[8];
+    for (int i = 0; i < n_bytes; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xff;
+    }
+    os.write(bytes, n_bytes);
+}
+
+bool get(std::istream &is, uint64_t &value, int n_bytes) {
+    unsigned char bytes[8];
+    if (!is.read(reinterpret_cast<char *>(bytes), n_bytes)) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < n_bytes; i++) {
+        value |= uint64_t(bytes[i]) << (8 * i);
+    }
+    return true;
+}
+} // namespace
+
+Profile::Profile()
+    : pc_hits(0x10000), pc_cycles(0x10000), pc_taken(0x10000),
+      pc_not_taken(0x10000) {
+    opcode_hits.fill(0);
+    opcode_cycles.fill(0);
+}
+
+void Profile::clear() {
+    for (std::vector<uint64_t> *counts :
+         {&pc_hits, &pc_cycles, &pc_taken, &pc_not_taken}) {
+        std::fill(counts->begin(), counts->end(), 0);
+    }
+    opcode_hits.fill(0);
+    opcode_cycles.fill(0);
+}
+
+uint64_t Profile::instructions() const {
+    uint64_t total = 0;
+    for (uint64_t count : opcode_hits) {
+        total += count;
+    }
+    return total;
+}
+
+uint64_t Profile::total_cycles() const {
+    uint64_t total = 0;
+    for (uint64_t count : opcode_cycles) {
+        total += count;
+    }
+    return total;
+}
+
+void Profile::write(std::ostream &os) const {
+    os.write(MAGIC, sizeof(MAGIC));
+
+    uint64_t n_pcs = std::count_if(pc_hits.begin(), pc_hits.end(),
+                                   [](uint64_t hits) { return hits != 0; });
+    put(os, n_pcs, 4);
+    for (uint32_t pc = 0; pc < 0x10000; pc++) {
+        if (pc_hits[pc] != 0) {
+            put(os, pc, 2);
+            put(os, pc_hits[pc], 8);
+            put(os, pc_cycles[pc], 8);
+            put(os, pc_taken[pc], 8);
+            put(os, pc_not_taken[pc], 8);
+        }
+    }
+
+    uint64_t n_opcodes =
+        std::count_if(opcode_hits.begin(), opcode_hits.end(),
+                      [](uint64_t hits) { return hits != 0; });
+    put(os, n_opcodes, 2);
+    for (int opcode = 0; opcode < 0x100; opcode++) {
+        if (opcode_hits[opcode] != 0) {
+            put(os, opcode, 1);
+            put(os, opcode_hits[opcode], 8);
+            put(os, opcode_cycles[opcode], 8);
+        }
+    }
+}
+
+bool Profile::read(std::istream &is) {
+    clear();
+
+    char magic[sizeof(MAGIC)];
+    if (!is.read(magic, sizeof(magic)) ||
+        std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+    }
+
+    uint64_t n_pcs;
+    if (!get(is, n_pcs, 4) || n_pcs > 0x10000) {
+        return false;
+    }
+    for (uint64_t i = 0; i < n_pcs; i++) {
+        uint64_t pc;
+        if (!get(is, pc, 2) || !get(is, pc_hits[pc], 8) ||
+            !get(is, pc_cycles[pc], 8) || !get(is, pc_taken[pc], 8) ||
+            !get(is, pc_not_taken[pc], 8)) {
+            clear();
+            return false;
+        }
+    }
+
+    uint64_t n_opcodes;
+    if (!get(is, n_opcodes, 2) || n_opcodes > 0x100) {
+        clear();
+        return false;
+    }
+    for (uint64_t i = 0; i < n_opcodes; i++) {
+        uint64_t opcode;
+        if (!get(is, opcode, 1) || !get(is, opcode_hits[opcode], 8) ||
+            !get(is, opcode_cycles[opcode], 8)) {
+            clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+void Profile::write_pc_csv(std::ostream &os) const {
+    std::vector<WORD> pcs;
+    for (uint32_t pc = 0; pc < 0x10000; pc++) {
+        if (pc_hits[pc] != 0) {
+            pcs.push_back(pc);
+        }
+    }
+    std::stable_sort(pcs.begin(), pcs.end(), [this](WORD lhs, WORD rhs) {
+        return pc_cycles[lhs] > pc_cycles[rhs];
+    });
+
+    os << "pc,hits,cycles,taken,not_taken\n";
+    for (WORD pc : pcs) {
+        os << "0x" << std::uppercase << std::hex << std::setfill('0')
+           << std::setw(4) << static_cast<int>(pc) << std::dec << ","
+           << pc_hits[pc] << "," << pc_cycles[pc] << "," << pc_taken[pc]
+           << "," << pc_not_taken[pc] << "\n";
+    }
+}
+
+void Profile::write_opcode_csv(std::ostream &os) const {
+    std::vector<int> opcodes;
+    for (int opcode = 0; opcode < 0x100; opcode++) {
+        if (opcode_hits[opcode] != 0) {
+            opcodes.push_back(opcode);
+        }
+    }
+    std::stable_sort(opcodes.begin(), opcodes.end(), [this](int lhs, int rhs) {
+        return opcode_cycles[lhs] > opcode_cycles[rhs];
+    });
+
+    os << "opcode,mnemonic,mode,count,cycles\n";
+    for (int opcode : opcodes) {
+        const Instruction_info &info = lookup_table[opcode];
+        os << "0x" << std::uppercase << std::hex << std::setfill('0')
+           << std::setw(2) << opcode << std::dec << "," << info.mnemonic
+           << "," << mode_name(info.mode) << "," << opcode_hits[opcode] << ","
+           << opcode_cycles[opcode] << "\n";
+    }
+}
@@ -0,0 +1,206 @@
+#include <Replay.hpp>
+#include <Scheduler.hpp>
+#include <Types.hpp>
+
+#include <cstring>
+#include <utility>
+
+using namespace mos6502;
+
+namespace {
+constexpr char MAGIC[8] = {'6', '5', '0', '2', 'R', 'P', 'L', 'Y'};
+
+void put_varint(std::ostream &os, uint64_t value) {
+    char bytes[10];
+    int n = 0;
+    while (value >= 0x80) {
+        bytes[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    bytes[n++] = value;
+    os.write(bytes, n);
+}
+
+bool get_varint(std::istream &is, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = is.get();
+        if (byte == std::char_traits<char>::eof()) {
+            return false;
+        }
+        value |= uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+} // namespace
+
+void Replay_log::write(std::ostream &os) const {
+    os.write(MAGIC, sizeof(MAGIC));
+    put_varint(os, events.size());
+    uint64_t cycle = 0;
+    for (const Replay_event &event : events) {
+        // Cycles only go back after a restore, where wrapping is fine
+        put_varint(os, event.cycle - cycle);
+        cycle = event.cycle;
+
+        // Kind in the low bits; an IRQ adds its source and line state
+        BYTE tag = static_cast<BYTE>(event.kind);
+        if (event.kind == Replay_kind::IRQ) {
+            tag |= event.addr << 2 | (event.value != 0 ? 0x80 : 0);
+        }
+        os.put(tag);
+        if (event.kind == Replay_kind::DEVICE_READ) {
+            os.put(event.addr & 0xff);
+            os.put(event.addr >> 8);
+            os.put(event.value);
+        }
+    }
+}
+
+bool Replay_log::read(std::istream &is) {
+    events.clear();
+
+    char magic[sizeof(MAGIC)];
+    uint64_t n_events;
+    if (!is.read(magic, sizeof(magic)) ||
+        std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        !get_varint(is, n_events)) {
+        return false;
+    }
+
+    uint64_t cycle = 0;
+    for (uint64_t i = 0; i < n_events; i++) {
+        uint64_t delta;
+        int tag = get_varint(is, delta) ? is.get() : -1;
+        if (tag < 0) {
+            events.clear();
+            return false;
+        }
+        cycle += delta;
+
+        Replay_event event{cycle, static_cast<Replay_kind>(tag & 0x03), 0, 0};
+        if (event.kind == Replay_kind::IRQ) {
+            event.addr = (tag >> 2) & 0x1f;
+            event.value = tag >> 7;
+            if (event.addr >= CPU::IRQ_SOURCES) {
+                events.clear();
+                return false;
+            }
+        } else if (event.kind == Replay_kind::DEVICE_READ) {
+            char bytes[3];
+            if (!is.read(bytes, sizeof(bytes))) {
+                events.clear();
+                return false;
+            }
+            event.addr = BYTE(bytes[0]) | BYTE(bytes[1]) << 8;
+            event.value = bytes[2];
+        }
+        events.push_back(event);
+    }
+    return true;
+}
+
+Replay_recorder::Replay_recorder(CPU &cpu, Replay_log &log)
+    : cpu(cpu), log(log) {}
+
+void Replay_recorder::map_device(BYTE first_page, int n_pages,
+                                 read_callback_t read,
+                                 write_callback_t write) {
+    cpu.get_bus().map_device(
+        first_page, n_pages,
+        [this, read = std::move(read)](WORD addr) {
+            BYTE value = read(addr);
+            log.push(Replay_event{cpu.cycles, Replay_kind::DEVICE_READ, addr,
+                                  value});
+            return value;
+        },
+        std::move(write));
+}
+
+void Replay_recorder::set_irq(int source, bool asserted) {
+    log.push(Replay_event{cpu.cycles, Replay_kind::IRQ, WORD(source),
+                          BYTE(asserted ? 1 : 0)});
+    cpu.set_irq(source, asserted);
+}
+
+void Replay_recorder::nmi() {
+    log.push(Replay_event{cpu.cycles, Replay_kind::NMI, 0, 0});
+    cpu.nmi();
+}
+
+void Replay_recorder::request_reset() {
+    log.push(Replay_event{cpu.cycles, Replay_kind::RESET, 0, 0});
+    cpu.request_reset();
+}
+
+Replay_player::Replay_player(CPU &cpu, const Replay_log &log)
+    : cpu(cpu), log(log), next_read(0), next_signal(0), is_diverged(false) {}
+
+void Replay_player::map_device(BYTE first_page, int n_pages,
+                               write_callback_t write) {
+    if (!write) {
+        write = [](WORD, BYTE) {};
+    }
+    cpu.get_bus().map_device(
+        first_page, n_pages, [this](WORD addr) { return read(addr); },
+        std::move(write));
+}
+
+BYTE Replay_player::read(WORD addr) {
+    while (next_read < log.size() &&
+           log[next_read].kind != Replay_kind::DEVICE_READ) {
+        next_read++;
+    }
+    if (next_read == log.size() || log[next_read].addr != addr ||
+        log[next_read].cycle != cpu.cycles) {
+        is_diverged = true;
+        return 0xff;
+    }
+    return log[next_read++].value;
+}
+
+void Replay_player::start() { schedule_signal(); }
+
+void Replay_player::schedule_signal() {
+    while (next_signal < log.size() &&
+           log[next_signal].kind == Replay_kind::DEVICE_READ) {
+        next_signal++;
+    }
+    if (next_signal == log.size()) {
+        return;
+    }
+    cpu.get_scheduler().schedule(log[next_signal].cycle, [this](uint64_t) {
+        const Replay_event &event = log[next_signal++];
+        switch (event.kind) {
+        case Replay_kind::IRQ:
+            cpu.set_irq(event.addr, event.value != 0);
+            break;
+        case Replay_kind::NMI:
+            cpu.nmi();
+            break;
+        case Replay_kind::RESET:
+            cpu.request_reset();
+            break;
+        case Replay_kind::DEVICE_READ:
+            break;
+        }
+        schedule_signal();
+    });
+}
+
+bool Replay_player::finished() const {
+    for (std::size_t i = next_read; i < log.size(); i++) {
+        if (log[i].kind == Replay_kind::DEVICE_READ) {
+            return false;
+        }
+    }
+    for (std::size_t i = next_signal; i < log.size(); i++) {
+        if (log[i].kind != Replay_kind::DEVICE_READ) {
+            return false;
+        }
+    }
+    return true;
+}
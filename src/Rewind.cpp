@@ -0,0 +1,246 @@
+#include <Rewind.hpp>
+#include <Scheduler.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+using namespace mos6502;
+
+namespace {
+// Append page ^ before, or page itself for nullptr, as runs of zeros and
+// literals. Counts are single bytes, so long stretches take several runs.
+void encode_page(const BYTE *page, const BYTE *before,
+                 std::vector<BYTE> &out) {
+    BYTE delta[0x100];
+    for (int i = 0; i < 0x100; i++) {
+        delta[i] = page[i] ^ (before != nullptr ? before[i] : 0);
+    }
+    int i = 0;
+    while (i < 0x100) {
+        int zeros = 0;
+        while (i + zeros < 0x100 && zeros < 0xff && delta[i + zeros] == 0) {
+            zeros++;
+        }
+        i += zeros;
+        int literals = 0;
+        while (i + literals < 0x100 && literals < 0xff &&
+               delta[i + literals] != 0) {
+            literals++;
+        }
+        out.push_back(zeros);
+        out.push_back(literals);
+        out.insert(out.end(), delta + i, delta + i + literals);
+        i += literals;
+    }
+}
+
+// XOR one page encoded by encode_page() into page; returns the position
+// after it in in
+const BYTE *decode_page(const BYTE *in, BYTE *page) {
+    int i = 0;
+    while (i < 0x100) {
+        i += in[0];
+        int literals = in[1];
+        in += 2;
+        for (int j = 0; j < literals; j++) {
+            page[i++] ^= in[j];
+        }
+        in += literals;
+    }
+    return in;
+}
+} // namespace
+
+Rewind_buffer::Rewind_buffer(CPU &cpu, uint64_t interval,
+                             std::size_t max_bytes, std::size_t keyframe_every)
+    : cpu(cpu), tracker(cpu), interval(std::max<uint64_t>(1, interval)),
+      max_bytes(max_bytes),
+      keyframe_every(std::max<std::size_t>(1, keyframe_every)), n_bytes(0),
+      since_key(0) {
+    checkpoint();
+    schedule(cpu.cycles + this->interval);
+}
+
+Rewind_buffer::~Rewind_buffer() { cpu.get_scheduler().cancel(event); }
+
+void Rewind_buffer::schedule(uint64_t cycle) {
+    event = cpu.get_scheduler().schedule(cycle, [this](uint64_t) {
+        checkpoint();
+        schedule(cpu.cycles + interval);
+    });
+}
+
+void Rewind_buffer::checkpoint() {
+    Snapshot now = tracker.take();
+
+    // Pages that became or stopped being RAM have nothing to diff against
+    bool remapped = false;
+    for (int page = 0; page < 0x100; page++) {
+        remapped |=
+            (now.pages[page] == nullptr) != (last.pages[page] == nullptr);
+    }
+
+    Frame frame{now.cycles, now.pc, now.a, now.x, now.y, now.sp, now.p,
+                now.pending, frames.empty() || remapped ||
+                                 since_key >= keyframe_every,
+                {}};
+    if (frame.key) {
+        frame.pages.assign(0x100 / 8, 0);
+    }
+    for (int page = 0; page < 0x100; page++) {
+        const std::shared_ptr<const Snapshot::Page> &saved = now.pages[page];
+        if (saved == nullptr) {
+            continue;
+        }
+        if (frame.key) {
+            frame.pages[page >> 3] |= 1 << (page & 7);
+            if (std::any_of(saved->begin(), saved->end(),
+                            [](BYTE byte) { return byte != 0; })) {
+                frame.pages.push_back(page);
+                encode_page(saved->data(), nullptr, frame.pages);
+            }
+        } else if (saved != last.pages[page] &&
+                   *saved != *last.pages[page]) {
+            frame.pages.push_back(page);
+            encode_page(saved->data(), last.pages[page]->data(),
+                        frame.pages);
+        }
+    }
+    frame.pages.shrink_to_fit();
+
+    since_key = frame.key ? 1 : since_key + 1;
+    n_bytes += sizeof(Frame) + frame.pages.size();
+    frames.push_back(std::move(frame));
+    last = std::move(now);
+
+    while (n_bytes > max_bytes && drop_oldest()) {
+    }
+}
+
+bool Rewind_buffer::drop_oldest() {
+    // Deltas need their keyframe, so a whole group goes at once, but
+    // never the newest
+    auto next_key = std::find_if(frames.begin() + 1, frames.end(),
+                                 [](const Frame &frame) { return frame.key; });
+    if (next_key == frames.end()) {
+        return false;
+    }
+    for (auto it = frames.begin(); it != next_key; ++it) {
+        n_bytes -= sizeof(Frame) + it->pages.size();
+    }
+    frames.erase(frames.begin(), next_key);
+    return true;
+}
+
+void Rewind_buffer::rebuild(std::size_t index, mem_t &image,
+                            std::array<bool, 0x100> &ram) const {
+    std::size_t first = index;
+    while (!frames[first].key) {
+        first--;
+    }
+    image.fill(0);
+    ram.fill(false);
+    for (std::size_t i = first; i <= index; i++) {
+        const std::vector<BYTE> &pages = frames[i].pages;
+        const BYTE *in = pages.data();
+        const BYTE *end = in + pages.size();
+        if (frames[i].key) {
+            for (int page = 0; page < 0x100; page++) {
+                ram[page] = (in[page >> 3] >> (page & 7)) & 1;
+            }
+            in += 0x100 / 8;
+        }
+        while (in != end) {
+            BYTE page = *in++;
+            in = decode_page(in, &image[page << 8]);
+        }
+    }
+}
+
+bool Rewind_buffer::seek(uint64_t cycle) {
+    if (frames.empty() || cycle < oldest() || cycle > cpu.cycles) {
+        return false;
+    }
+    // Newest frame at or before cycle
+    auto it = std::upper_bound(
+        frames.begin(), frames.end(), cycle,
+        [](uint64_t cycle, const Frame &frame) {
+            return cycle < frame.cycles;
+        });
+    std::size_t index = (it - frames.begin()) - 1;
+
+    auto image = std::make_unique<mem_t>();
+    std::array<bool, 0x100> ram;
+    rebuild(index, *image, ram);
+
+    // Pages unchanged since the newest frame keep its copy, so restore()
+    // only rewrites pages that differ
+    Snapshot target;
+    for (int page = 0; page < 0x100; page++) {
+        if (!ram[page]) {
+            continue;
+        }
+        const BYTE *data = &(*image)[page << 8];
+        const std::shared_ptr<const Snapshot::Page> &newest =
+            last.pages[page];
+        if (newest != nullptr &&
+            std::memcmp(newest->data(), data, newest->size()) == 0) {
+            target.pages[page] = newest;
+        } else {
+            auto copy = std::make_shared<Snapshot::Page>();
+            std::copy(data, data + 0x100, copy->begin());
+            target.pages[page] = std::move(copy);
+        }
+    }
+    const Frame &frame = frames[index];
+    target.a = frame.a;
+    target.pc = frame.pc;
+    target.sp = frame.sp;
+    target.x = frame.x;
+    target.y = frame.y;
+    target.p = frame.p;
+    target.cycles = frame.cycles;
+    target.pending = frame.pending;
+    tracker.restore(target);
+
+    for (std::size_t i = index + 1; i < frames.size(); i++) {
+        n_bytes -= sizeof(Frame) + frames[i].pages.size();
+    }
+    frames.erase(frames.begin() + index + 1, frames.end());
+    since_key = 1;
+    while (!frames[index + 1 - since_key].key) {
+        since_key++;
+    }
+    last = std::move(target);
+
+    cpu.get_scheduler().cancel(event);
+    schedule(frame.cycles + interval);
+    if (cycle > cpu.cycles) {
+        cpu.run_for_cycles(cycle - cpu.cycles);
+    }
+    return true;
+}
+
+bool Rewind_buffer::step_back() {
+    uint64_t target = cpu.cycles;
+    if (frames.empty() || target <= oldest()) {
+        return false;
+    }
+    // Replay from the newest frame before here to find the boundary
+    // before this one
+    auto it = std::lower_bound(
+        frames.begin(), frames.end(), target,
+        [](const Frame &frame, uint64_t cycle) {
+            return frame.cycles < cycle;
+        });
+    seek((it - 1)->cycles);
+    uint64_t previous = cpu.cycles;
+    while (cpu.cycles < target) {
+        previous = cpu.cycles;
+        cpu.run_for_cycles(1);
+    }
+    return seek(previous);
+}
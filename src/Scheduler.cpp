@@ -0,0 +1,42 @@
+#include <Scheduler.hpp>
+
+#include <algorithm>
+#include <utility>
+
+using namespace mos6502;
+
+Scheduler::Scheduler() : next_id(0), slice_end(NEVER) {}
+
+bool Scheduler::later(const Event &lhs, const Event &rhs) {
+    return lhs.cycle != rhs.cycle ? lhs.cycle > rhs.cycle : lhs.id > rhs.id;
+}
+
+uint64_t Scheduler::schedule(uint64_t cycle, event_callback_t callback) {
+    uint64_t id = next_id++;
+    heap.push_back(Event{cycle, id, std::move(callback)});
+    std::push_heap(heap.begin(), heap.end(), later);
+    slice_end = std::min(slice_end, cycle);
+    return id;
+}
+
+bool Scheduler::cancel(uint64_t id) {
+    auto it = std::find_if(heap.begin(), heap.end(),
+                           [id](const Event &event) { return event.id == id; });
+    if (it == heap.end()) {
+        return false;
+    }
+    // Few events are ever pending, so rebuilding the heap is cheap
+    *it = std::move(heap.back());
+    heap.pop_back();
+    std::make_heap(heap.begin(), heap.end(), later);
+    return true;
+}
+
+void Scheduler::run_due(uint64_t now) {
+    while (!heap.empty() && heap.front().cycle <= now) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        Event event = std::move(heap.back());
+        heap.pop_back();
+        event.callback(event.cycle);
+    }
+}
@@ -0,0 +1,116 @@
+#include <Snapshot.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+
+using namespace mos6502;
+
+Snapshot_tracker::Snapshot_tracker(CPU &cpu)
+    : cpu(cpu), bus(cpu.get_bus()), bus_generation(bus.get_generation()),
+      n_dirty(0) {
+    dirty.fill(false);
+    watcher = bus.add_watcher([this](WORD addr) { mark_dirty(addr >> 8); });
+    // Nothing is saved yet, so every RAM page starts out dirty
+    for (int page = 0; page < 0x100; page++) {
+        if (bus.ram_page(page) != nullptr) {
+            mark_dirty(page);
+        }
+    }
+}
+
+Snapshot_tracker::~Snapshot_tracker() {
+    if (watcher >= 0) {
+        bus.remove_watcher(watcher);
+    }
+}
+
+void Snapshot_tracker::mark_dirty(BYTE page) {
+    if (!dirty[page]) {
+        dirty[page] = true;
+        n_dirty++;
+    }
+    if (watcher >= 0) {
+        bus.unwatch(watcher, page);
+    }
+}
+
+void Snapshot_tracker::sync_generation() {
+    if (bus.get_generation() == bus_generation) {
+        return;
+    }
+    for (int page = 0; page < 0x100; page++) {
+        base[page] = nullptr;
+        if (bus.ram_page(page) != nullptr) {
+            mark_dirty(page);
+        }
+    }
+    bus_generation = bus.get_generation();
+}
+
+Snapshot Snapshot_tracker::take() {
+    sync_generation();
+    for (int page = 0; page < 0x100; page++) {
+        const BYTE *ram = bus.ram_page(page);
+        if (ram == nullptr) {
+            base[page] = nullptr;
+            dirty[page] = false;
+            continue;
+        }
+        // Without a watcher every page has to be copied each time
+        if (dirty[page] || base[page] == nullptr || watcher < 0) {
+            auto copy = std::make_shared<Snapshot::Page>();
+            std::copy(ram, ram + 0x100, copy->begin());
+            base[page] = std::move(copy);
+            dirty[page] = false;
+            if (watcher >= 0) {
+                bus.watch(watcher, page);
+            }
+        }
+    }
+    n_dirty = 0;
+
+    Snapshot snapshot;
+    snapshot.pages = base;
+    snapshot.a = cpu.a;
+    snapshot.pc = cpu.pc;
+    snapshot.sp = cpu.sp;
+    snapshot.x = cpu.x;
+    snapshot.y = cpu.y;
+    snapshot.p = cpu.get_p();
+    snapshot.cycles = cpu.cycles;
+    snapshot.pending = cpu.pending;
+    return snapshot;
+}
+
+void Snapshot_tracker::restore(const Snapshot &snapshot) {
+    sync_generation();
+    for (int page = 0; page < 0x100; page++) {
+        const std::shared_ptr<const Snapshot::Page> &saved =
+            snapshot.pages[page];
+        if (saved == nullptr || bus.ram_page(page) == nullptr) {
+            continue;
+        }
+        if (dirty[page] || base[page] != saved || watcher < 0) {
+            // Our own watcher sees this write too; the page is clean after
+            bus.write_page(page, saved->data());
+            base[page] = saved;
+            dirty[page] = false;
+            if (watcher >= 0) {
+                bus.watch(watcher, page);
+            }
+        }
+    }
+    n_dirty = 0;
+    for (int page = 0; page < 0x100; page++) {
+        n_dirty += dirty[page] ? 1 : 0;
+    }
+
+    cpu.a = snapshot.a;
+    cpu.pc = snapshot.pc;
+    cpu.sp = snapshot.sp;
+    cpu.x = snapshot.x;
+    cpu.y = snapshot.y;
+    cpu.set_p(snapshot.p);
+    cpu.cycles = snapshot.cycles;
+    cpu.pending = snapshot.pending;
+}
@@ -0,0 +1,89 @@
+#include <Opcodes.hpp>
+#include <Trace.hpp>
+#include <Types.hpp>
+
+#include <iomanip>
+#include <sstream>
+#include <utility>
+
+using namespace mos6502;
+
+Trace_buffer::Trace_buffer(std::size_t capacity)
+    : head(0), base(0), skipped(0), flush_at(NEVER) {
+    std::size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    records.resize(size);
+    mask = size - 1;
+}
+
+void Trace_buffer::set_flush(trace_flush_t callback) {
+    on_flush = std::move(callback);
+    clear();
+}
+
+void Trace_buffer::flush() {
+    std::size_t n = head - base;
+    if (!on_flush || n == 0) {
+        return;
+    }
+    // base sits at the top of the ring, so the held records are in order
+    if (n == records.size()) {
+        on_flush(records);
+        records.resize(mask + 1);
+    } else {
+        std::vector<Trace_record> held(records.begin(), records.begin() + n);
+        on_flush(held);
+        // Start the next chunk at the top of the ring again
+        skipped += records.size() - n;
+        head += records.size() - n;
+    }
+    base = head;
+    flush_at = head + records.size();
+}
+
+void Trace_buffer::clear() {
+    head = base = skipped = 0;
+    flush_at = on_flush ? records.size() : NEVER;
+}
+
+std::size_t Trace_buffer::size() const {
+    uint64_t held = head - base;
+    return held < records.size() ? held : records.size();
+}
+
+std::size_t Trace_buffer::capacity() const { return records.size(); }
+
+uint64_t Trace_buffer::total() const { return head - skipped; }
+
+const Trace_record &Trace_buffer::operator[](std::size_t i) const {
+    return records[(head - size() + i) & mask];
+}
+
+std::string Trace_buffer::format(const Trace_record &record) {
+    const Instruction_info &info = lookup_table[record.opcode];
+
+    std::stringstream ss;
+    ss << std::uppercase << std::hex << std::setfill('0');
+    ss << "0x" << std::setw(4) << static_cast<int>(record.pc) << ":\t";
+    ss << "0x" << std::setw(2) << static_cast<int>(record.opcode) << "\t";
+    ss << "0x" << std::setw(4) << static_cast<int>(record.operand) << "\t";
+    ss << info.mnemonic << "\t" << mode_name(info.mode) << "\t";
+    ss << "A:" << std::setw(2) << static_cast<int>(record.a) << " ";
+    ss << "X:" << std::setw(2) << static_cast<int>(record.x) << " ";
+    ss << "Y:" << std::setw(2) << static_cast<int>(record.y) << " ";
+    ss << "P:" << std::setw(2) << static_cast<int>(record.p) << " ";
+    ss << "SP:" << std::setw(2) << static_cast<int>(record.sp);
+    if (record.wrote) {
+        ss << " W:" << std::setw(4) << static_cast<int>(record.write_addr)
+           << "=" << std::setw(2) << static_cast<int>(record.write_value);
+    }
+    return ss.str();
+}
+
+void Trace_buffer::dump(std::ostream &os) const {
+    for (std::size_t i = 0; i < size(); i++) {
+        os << format((*this)[i]) << "\n";
+    }
+}
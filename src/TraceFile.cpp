@@ -0,0 +1,306 @@
+#include <Trace.hpp>
+#include <TraceFile.hpp>
+#include <Types.hpp>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+using namespace mos6502;
+
+namespace {
+constexpr char MAGIC[8] = {'6', '5', '0', '2', 'T', 'R', 'C', 'E'};
+
+// Bytes per record on disk, and per chunk header: first index, record
+// count and compressed size
+constexpr std::size_t RECORD_BYTES = 14;
+constexpr std::size_t CHUNK_HEADER_BYTES = 16;
+
+void put(BYTE *out, uint64_t value, int n_bytes) {
+    for (int i = 0; i < n_bytes; i++) {
+        out[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+uint64_t get(const BYTE *in, int n_bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < n_bytes; i++) {
+        value |= uint64_t(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+void encode(const Trace_record &record, BYTE *out) {
+    put(out, record.pc, 2);
+    put(out + 2, record.operand, 2);
+    out[4] = record.opcode;
+    out[5] = record.a;
+    out[6] = record.x;
+    out[7] = record.y;
+    out[8] = record.sp;
+    out[9] = record.p;
+    put(out + 10, record.write_addr, 2);
+    out[12] = record.write_value;
+    out[13] = record.wrote;
+}
+
+Trace_record decode(const BYTE *in) {
+    return Trace_record{WORD(get(in, 2)),
+                        WORD(get(in + 2, 2)),
+                        in[4],
+                        in[5],
+                        in[6],
+                        in[7],
+                        in[8],
+                        in[9],
+                        WORD(get(in + 10, 2)),
+                        in[12],
+                        in[13] != 0};
+}
+} // namespace
+
+Trace_writer::Trace_writer(const std::string &path, unsigned n_threads)
+    : file(std::fopen(path.c_str(), "wb")), ok(file != nullptr), n_busy(0),
+      next_sequence(0), next_write(0), stopping(false), n_records(0),
+      attached(nullptr) {
+    if (ok) {
+        BYTE header[sizeof(MAGIC) + 4];
+        std::memcpy(header, MAGIC, sizeof(MAGIC));
+        put(header + sizeof(MAGIC), RECORD_BYTES, 4);
+        ok = std::fwrite(header, sizeof(header), 1, file) == 1;
+    }
+    for (unsigned i = 0; i < std::max(1u, n_threads); i++) {
+        threads.emplace_back(&Trace_writer::worker, this);
+    }
+}
+
+Trace_writer::~Trace_writer() { close(); }
+
+bool Trace_writer::valid() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ok;
+}
+
+uint64_t Trace_writer::records() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return n_records;
+}
+
+void Trace_writer::attach(Trace_buffer &buffer) {
+    detach();
+    attached = &buffer;
+    buffer.set_flush(
+        [this](std::vector<Trace_record> &records) { submit(records); });
+}
+
+void Trace_writer::detach() {
+    if (attached == nullptr) {
+        return;
+    }
+    attached->flush();
+    attached->set_flush(nullptr);
+    attached = nullptr;
+}
+
+void Trace_writer::submit(std::vector<Trace_record> &records) {
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [this] { return pending.size() < MAX_PENDING; });
+
+    std::vector<Trace_record> spare;
+    if (!spares.empty()) {
+        spare = std::move(spares.back());
+        spares.pop_back();
+    }
+    spare.resize(records.size());
+
+    pending.push_back(Chunk{n_records, std::move(records), next_sequence++});
+    n_records += pending.back().records.size();
+    records = std::move(spare);
+    queued.notify_one();
+}
+
+void Trace_writer::worker() {
+    std::vector<BYTE> encoded;
+    std::vector<BYTE> out;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        queued.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty()) {
+            return;
+        }
+        Chunk chunk = std::move(pending.front());
+        pending.pop_front();
+        n_busy++;
+        drained.notify_all();
+
+        lock.unlock();
+        bool compressed = compress_chunk(chunk, encoded, out);
+        lock.lock();
+
+        // Chunks go to the file in the order they were handed over; only
+        // the thread whose turn it is touches the file
+        turn.wait(lock, [&] { return next_write == chunk.sequence; });
+        lock.unlock();
+        bool written = compressed && file != nullptr &&
+                       std::fwrite(out.data(), out.size(), 1, file) == 1;
+        lock.lock();
+
+        ok = ok && written;
+        next_write++;
+        n_busy--;
+        if (spares.size() <= MAX_PENDING) {
+            spares.push_back(std::move(chunk.records));
+        }
+        turn.notify_all();
+        drained.notify_all();
+    }
+}
+
+bool Trace_writer::compress_chunk(const Chunk &chunk,
+                                  std::vector<BYTE> &encoded,
+                                  std::vector<BYTE> &out) {
+    std::size_t n = chunk.records.size();
+    encoded.resize(n * RECORD_BYTES);
+
+    // Consecutive records share most of their bytes, so XORing each with
+    // the one before leaves mostly zeros for zlib
+    BYTE previous[RECORD_BYTES] = {0};
+    for (std::size_t i = 0; i < n; i++) {
+        BYTE *bytes = &encoded[i * RECORD_BYTES];
+        BYTE current[RECORD_BYTES];
+        encode(chunk.records[i], current);
+        for (std::size_t j = 0; j < RECORD_BYTES; j++) {
+            bytes[j] = current[j] ^ previous[j];
+        }
+        std::memcpy(previous, current, RECORD_BYTES);
+    }
+
+    uLongf size = compressBound(encoded.size());
+    out.resize(CHUNK_HEADER_BYTES + size);
+    if (compress2(out.data() + CHUNK_HEADER_BYTES, &size, encoded.data(),
+                  encoded.size(), Z_BEST_SPEED) != Z_OK) {
+        return false;
+    }
+    out.resize(CHUNK_HEADER_BYTES + size);
+    put(out.data(), chunk.first, 8);
+    put(out.data() + 8, n, 4);
+    put(out.data() + 12, size, 4);
+    return true;
+}
+
+void Trace_writer::sync() {
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [this] { return pending.empty() && n_busy == 0; });
+    // The workers are idle and cannot pick up anything while we hold the
+    // lock
+    if (file != nullptr && std::fflush(file) != 0) {
+        ok = false;
+    }
+}
+
+void Trace_writer::close() {
+    detach();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queued.notify_all();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    if (file != nullptr) {
+        ok = std::fclose(file) == 0 && ok;
+        file = nullptr;
+    }
+}
+
+Trace_reader::Trace_reader(const std::string &path)
+    : file(path, std::ios::binary), ok(false), n_records(0), current(-1) {
+    BYTE header[sizeof(MAGIC) + 4];
+    if (!file.read(reinterpret_cast<char *>(header), sizeof(header)) ||
+        std::memcmp(header, MAGIC, sizeof(MAGIC)) != 0 ||
+        get(header + sizeof(MAGIC), 4) != RECORD_BYTES) {
+        return;
+    }
+
+    file.seekg(0, std::ios::end);
+    std::streamoff end = file.tellg();
+    std::streamoff offset = sizeof(header);
+
+    // A chunk cut short by a crash ends the trace
+    while (offset + std::streamoff(CHUNK_HEADER_BYTES) <= end) {
+        BYTE chunk_header[CHUNK_HEADER_BYTES];
+        file.seekg(offset);
+        if (!file.read(reinterpret_cast<char *>(chunk_header),
+                       sizeof(chunk_header))) {
+            break;
+        }
+        Chunk_info info{get(chunk_header, 8),
+                        static_cast<uint32_t>(get(chunk_header + 8, 4)),
+                        static_cast<uint32_t>(get(chunk_header + 12, 4)),
+                        offset + std::streamoff(CHUNK_HEADER_BYTES)};
+        if (info.first != n_records ||
+            info.offset + std::streamoff(info.compressed_size) > end) {
+            break;
+        }
+        chunks.push_back(info);
+        n_records += info.n_records;
+        offset = info.offset + info.compressed_size;
+    }
+    file.clear();
+    ok = true;
+}
+
+bool Trace_reader::load(std::size_t chunk) {
+    const Chunk_info &info = chunks[chunk];
+    std::vector<BYTE> compressed(info.compressed_size);
+    std::vector<BYTE> encoded(std::size_t(info.n_records) * RECORD_BYTES);
+
+    file.clear();
+    file.seekg(info.offset);
+    if (!file.read(reinterpret_cast<char *>(compressed.data()),
+                   compressed.size())) {
+        return false;
+    }
+    uLongf size = encoded.size();
+    if (uncompress(encoded.data(), &size, compressed.data(),
+                   compressed.size()) != Z_OK ||
+        size != encoded.size()) {
+        return false;
+    }
+
+    decoded.resize(info.n_records);
+    BYTE previous[RECORD_BYTES] = {0};
+    for (std::size_t i = 0; i < decoded.size(); i++) {
+        BYTE *in = &encoded[i * RECORD_BYTES];
+        for (std::size_t j = 0; j < RECORD_BYTES; j++) {
+            previous[j] ^= in[j];
+        }
+        decoded[i] = decode(previous);
+    }
+    current = chunk;
+    return true;
+}
+
+bool Trace_reader::read(uint64_t index, Trace_record &record) {
+    if (index >= n_records) {
+        return false;
+    }
+    // Last chunk starting at or before index
+    auto it = std::upper_bound(
+        chunks.begin(), chunks.end(), index,
+        [](uint64_t index, const Chunk_info &info) {
+            return index < info.first;
+        });
+    std::size_t chunk = (it - chunks.begin()) - 1;
+    if (long(chunk) != current && !load(chunk)) {
+        current = -1;
+        return false;
+    }
+    record = decoded[index - chunks[chunk].first];
+    return true;
+}
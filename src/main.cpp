@@ -1,31 +1,82 @@
+#include <Bus.hpp>
 #include <CPU.hpp>
+#include <Loader.hpp>
 #include <Types.hpp>
 
-#include <fstream>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 
+namespace {
+void usage(const char *program) {
+    std::cerr << "Usage: " << program
+              << " [--format raw|hex|prg] [--origin ADDR] [--rom] <rom_file>\n"
+              << "  --origin  load address of a raw image, default 0\n"
+              << "  --rom     map the image read-only instead of copying it "
+                 "into RAM\n";
+}
+} // namespace
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <rom_file>\n";
+    mos6502::Image_format format = mos6502::Image_format::AUTO;
+    mos6502::WORD origin = 0;
+    bool rom = false;
+    std::string rom_path;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--rom") {
+            rom = true;
+        } else if (arg == "--format" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "raw") {
+                format = mos6502::Image_format::RAW;
+            } else if (name == "hex") {
+                format = mos6502::Image_format::INTEL_HEX;
+            } else if (name == "prg") {
+                format = mos6502::Image_format::PRG;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--origin" && i + 1 < argc) {
+            char *end;
+            unsigned long value = std::strtoul(argv[++i], &end, 0);
+            if (*end != '\0' || value > 0xffff) {
+                usage(argv[0]);
+                return 1;
+            }
+            origin = value;
+        } else if (rom_path.empty() && arg[0] != '-') {
+            rom_path = arg;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (rom_path.empty()) {
+        usage(argv[0]);
         return 1;
     }
 
-    std::string rom_path = argv[1];
-
     std::cout << "Rom path: " << rom_path << "\n";
 
-    std::ifstream rom(rom_path, std::ios::binary);
-
-    if (!rom.is_open()) {
-        std::cerr << "Failed to open rom: " << rom_path << "\n";
+    mos6502::Rom_image image;
+    std::string error;
+    if (!image.load(rom_path, format, origin, error)) {
+        std::cerr << "Failed to load rom: " << error << "\n";
         return 1;
     }
 
     mos6502::mem_t memory = {0};
-    rom.read(reinterpret_cast<char *>(&memory[0]), 0x10000);
+    mos6502::Bus bus(memory);
+    if (rom) {
+        image.map(bus);
+    } else {
+        image.copy_to(memory);
+    }
 
-    mos6502::CPU cpu(memory);
+    mos6502::CPU cpu(bus);
 
     cpu.reset();
 
@@ -34,7 +85,5 @@ int main(int argc, char *argv[]) {
         cpu.execute(opcode);
     }
 
-    rom.close();
-
     return 9;
 }
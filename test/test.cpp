@@ -1,11 +1,44 @@
+#include <Aot.hpp>
+#include <Batch.hpp>
+#include <BlockCache.hpp>
 #include <CPU.hpp>
+#include <Fusion.hpp>
+#include <Loader.hpp>
+#include <Lockstep.hpp>
+#include <Opcodes.hpp>
+#include <Profile.hpp>
+#include <Replay.hpp>
+#include <Rewind.hpp>
+#include <Scheduler.hpp>
+#include <Snapshot.hpp>
 #include <Types.hpp>
+#ifdef MOS6502_TRACE_FILE
+#include <TraceFile.hpp>
+#endif
 
+#include <algorithm>
 #include <array>
+#include <fstream>
+#include <functional>
 #include <gtest/gtest.h>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
 
 using namespace mos6502;
 
+// Zeroed memory behind a bus and a CPU, for tests that add devices and
+// events to a machine of their own. memory is initialized before the
+// bus maps it.
+struct Test_machine {
+    mem_t memory{};
+    Bus bus{memory};
+    CPU cpu{bus};
+};
+
 TEST(TEST_INSTRUCTIONS, ADC) {
     mem_t memory;
 
@@ -398,3 +431,2845 @@ LDA $1234,X
         EXPECT_EQ(p & 0x82, P[i] & 0x82);
     }
 }
+
+TEST(TEST_TRACE, RING_BUFFER) {
+    mem_t memory;
+
+    WORD start = 0x8000;
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+
+    WORD pc = start;
+
+    // ADC #$01 x6
+    for (int i = 0; i < 6; i++) {
+        memory[pc++] = 0x69;
+        memory[pc++] = 0x01;
+    }
+
+    Trace_buffer trace(4);
+    EXPECT_EQ(trace.capacity(), 4);
+
+    CPU cpu(memory);
+    cpu.reset();
+    cpu.set_trace(&trace);
+
+    for (int i = 0; i < 6; i++) {
+        BYTE opcode = cpu.fetch_opcode();
+        cpu.execute(opcode);
+    }
+
+#ifdef MOS6502_TRACE
+    EXPECT_EQ(trace.total(), 6);
+    ASSERT_EQ(trace.size(), 4);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(trace[i].pc, start + 2 * (i + 2));
+        EXPECT_EQ(trace[i].opcode, 0x69);
+        EXPECT_EQ(trace[i].operand, 0x01);
+        EXPECT_EQ(trace[i].a, i + 2);
+    }
+    std::string line = "0x8004:\t0x69\t0x0001\tADC\tIMMEDIATE\tA:02";
+    EXPECT_EQ(Trace_buffer::format(trace[0]).substr(0, line.size()), line);
+#else
+    EXPECT_EQ(trace.total(), 0);
+#endif
+}
+
+#ifdef MOS6502_TRACE
+TEST(TEST_TRACE, STACK_WRITES) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested, with an IRQ taken after the STA
+        LDX #$FF
+        TXS
+        LDA #$42
+        PHA
+        JSR sub
+sub:    CLI             ; $8009
+        STA $10
+        NOP
+irq:    RTI             ; $9000
+     */
+    std::array<BYTE, 13> program = {
+        0xa2, 0xff,       // LDX #$FF
+        0x9a,             // TXS
+        0xa9, 0x42,       // LDA #$42
+        0x48,             // PHA
+        0x20, 0x09, 0x80, // JSR sub
+        0x58,             // CLI
+        0x85, 0x10,       // STA $10
+        0xea,             // NOP
+    };
+
+    mem_t memory = {0};
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+    memory[0xfffe] = 0x00;
+    memory[0xffff] = 0x90;
+    memory[0x9000] = 0x40;
+    std::copy(program.begin(), program.end(), memory.begin() + start);
+
+    Trace_buffer trace(16);
+    CPU cpu(memory);
+    cpu.reset();
+    cpu.set_trace(&trace);
+    for (int i = 0; i < 7; i++) {
+        cpu.step();
+    }
+    cpu.set_irq(0, true);
+    cpu.step();
+    cpu.set_irq(0, false);
+    cpu.step();
+    EXPECT_EQ(cpu.pc, 0x800c);
+
+    ASSERT_EQ(trace.size(), 8);
+    // PHA
+    EXPECT_TRUE(trace[3].wrote);
+    EXPECT_EQ(trace[3].write_addr, 0x01ff);
+    EXPECT_EQ(trace[3].write_value, 0x42);
+    // JSR: the low byte of the return address, pushed last
+    EXPECT_TRUE(trace[4].wrote);
+    EXPECT_EQ(trace[4].write_addr, 0x01fd);
+    EXPECT_EQ(trace[4].write_value, 0x08);
+    EXPECT_FALSE(trace[5].wrote);
+    // Interrupt entry leaves the STA before it alone
+    EXPECT_EQ(trace[6].opcode, 0x85);
+    EXPECT_EQ(trace[6].write_addr, 0x0010);
+    EXPECT_EQ(trace[6].write_value, 0x42);
+    EXPECT_EQ(trace[7].opcode, 0x40);
+    EXPECT_FALSE(trace[7].wrote);
+}
+#endif
+
+#if defined(MOS6502_TRACE) && defined(MOS6502_TRACE_FILE)
+TEST(TEST_TRACE, STREAM_TO_FILE) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested
+start:  LDX #$00
+loop:   TXA
+        STA $0200,X
+        INX
+        BNE loop
+        JMP start
+     */
+    std::array<BYTE, 12> program = {
+        0xa2, 0x00,       // LDX #$00
+        0x8a,             // TXA
+        0x9d, 0x00, 0x02, // STA $0200,X
+        0xe8,             // INX
+        0xd0, 0xf9,       // BNE loop
+        0x4c, 0x00, 0x80, // JMP start
+    };
+
+    mem_t memory = {0};
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+    std::copy(program.begin(), program.end(), memory.begin() + start);
+    mem_t reference_memory = memory;
+
+    // Everything in one ring for comparison
+    Trace_buffer expected(4096);
+    CPU reference(reference_memory);
+    reference.reset();
+    reference.set_trace(&expected);
+
+    std::string path = ::testing::TempDir() + "stream.trace";
+    Trace_buffer buffer(64);
+    CPU cpu(memory);
+    cpu.reset();
+    cpu.set_trace(&buffer);
+    {
+        // Several compressing threads, still written in order
+        Trace_writer writer(path, 3);
+        ASSERT_TRUE(writer.valid());
+        writer.attach(buffer);
+        for (int i = 0; i < 3000; i++) {
+            reference.step();
+            cpu.step();
+            // A partial chunk in the middle
+            if (i == 1000) {
+                buffer.flush();
+            }
+        }
+        EXPECT_EQ(buffer.total(), 3000);
+        writer.close();
+        EXPECT_TRUE(writer.valid());
+        EXPECT_EQ(writer.records(), 3000);
+    }
+    ASSERT_EQ(expected.total(), 3000);
+
+    // STA $0200,X with X = 1
+    const Trace_record &store = expected[6];
+    EXPECT_EQ(store.opcode, 0x9d);
+    EXPECT_TRUE(store.wrote);
+    EXPECT_EQ(store.write_addr, 0x0201);
+    EXPECT_EQ(store.write_value, 0x01);
+    EXPECT_FALSE(expected[5].wrote);
+
+    Trace_reader reader(path);
+    ASSERT_TRUE(reader.valid());
+    ASSERT_EQ(reader.size(), 3000);
+    for (uint64_t index : {2999, 5, 1500, 1000, 1001, 0, 64, 63}) {
+        Trace_record record;
+        ASSERT_TRUE(reader.read(index, record)) << index;
+        EXPECT_EQ(Trace_buffer::format(record),
+                  Trace_buffer::format(expected[index]))
+            << index;
+    }
+    for (uint64_t index = 0; index < 3000; index++) {
+        Trace_record record;
+        ASSERT_TRUE(reader.read(index, record));
+        ASSERT_EQ(record.wrote, expected[index].wrote) << index;
+        ASSERT_EQ(record.write_addr, expected[index].write_addr) << index;
+        ASSERT_EQ(record.pc, expected[index].pc) << index;
+    }
+    Trace_record record;
+    EXPECT_FALSE(reader.read(3000, record));
+
+    // A file cut short keeps the chunks that are whole
+    std::ifstream in(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+    std::string cut_path = ::testing::TempDir() + "cut.trace";
+    std::ofstream(cut_path, std::ios::binary)
+        .write(bytes.data(), bytes.size() - 5);
+    Trace_reader cut(cut_path);
+    ASSERT_TRUE(cut.valid());
+    EXPECT_LT(cut.size(), 3000);
+    EXPECT_GT(cut.size(), 2900);
+    EXPECT_TRUE(cut.read(cut.size() - 1, record));
+
+    EXPECT_FALSE(Trace_reader(::testing::TempDir() + "missing.trace").valid());
+}
+#endif
+
+TEST(TEST_CYCLES, LOOP) {
+    mem_t memory = {0};
+
+    WORD start = 0x8000;
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+
+    WORD pc = start;
+
+    /* Assembly to be tested
+        LDX #$05
+        LDA #$00
+loop:   CLC
+        ADC #$03
+        DEX
+        BNE loop
+        STA $0200
+done:   JMP done
+     */
+
+    // LDX #$05
+    memory[pc++] = 0xa2;
+    memory[pc++] = 0x05;
+    // LDA #$00
+    memory[pc++] = 0xa9;
+    memory[pc++] = 0x00;
+    // CLC
+    memory[pc++] = 0x18;
+    // ADC #$03
+    memory[pc++] = 0x69;
+    memory[pc++] = 0x03;
+    // DEX
+    memory[pc++] = 0xca;
+    // BNE loop
+    memory[pc++] = 0xd0;
+    memory[pc++] = 0xfa;
+    // STA $0200
+    memory[pc++] = 0x8d;
+    memory[pc++] = 0x00;
+    memory[pc++] = 0x02;
+    // JMP done
+    WORD done = pc;
+    memory[pc++] = 0x4c;
+    memory[pc++] = done & 0xff;
+    memory[pc++] = (done >> 8) & 0xff;
+
+    CPU cpu(memory);
+    cpu.reset();
+
+    // 2 + 2 + 5 * (2 + 2 + 2) + 4 * 3 + 2 + 4
+    EXPECT_EQ(cpu.run_until(done, 1000), 52);
+    EXPECT_EQ(cpu.pc, done);
+    EXPECT_EQ(cpu.a, 0x0f);
+    EXPECT_EQ(cpu.x, 0x00);
+    EXPECT_EQ(memory[0x0200], 0x0f);
+
+    // JMP done: whole instructions only, so 10 cycles runs 4 of them
+    EXPECT_EQ(cpu.run_for_cycles(10), 12);
+    EXPECT_EQ(cpu.pc, done);
+}
+
+TEST(TEST_CYCLES, PAGE_CROSSING) {
+    mem_t memory = {0};
+
+    WORD start = 0x80f0;
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+
+    WORD pc = start;
+
+    /* Assembly to be tested
+LDX #$01
+LDA $12FE,X
+LDA $12FF,X
+STA $12FF,X
+BNE $8109
+     */
+
+    // LDX #$01
+    memory[pc++] = 0xa2;
+    memory[pc++] = 0x01;
+    // LDA $12FE,X
+    memory[0x12ff] = 0x11;
+    memory[pc++] = 0xbd;
+    memory[pc++] = 0xfe;
+    memory[pc++] = 0x12;
+    // LDA $12FF,X
+    memory[0x1300] = 0x22;
+    memory[pc++] = 0xbd;
+    memory[pc++] = 0xff;
+    memory[pc++] = 0x12;
+    // STA $12FF,X
+    memory[pc++] = 0x9d;
+    memory[pc++] = 0xff;
+    memory[pc++] = 0x12;
+    // BNE $8109
+    memory[pc++] = 0xd0;
+    memory[pc++] = 0x0c;
+
+    std::array<uint64_t, 5> cycles = {2, 4, 5, 5, 4};
+
+    CPU cpu(memory);
+    cpu.reset();
+
+    for (int i = 0; i < 5; i++) {
+        uint64_t before = cpu.cycles;
+        BYTE opcode = cpu.fetch_opcode();
+        cpu.execute(opcode);
+        EXPECT_EQ(cpu.cycles - before, cycles[i]);
+    }
+    EXPECT_EQ(cpu.a, 0x22);
+    EXPECT_EQ(cpu.pc, 0x8109);
+}
+
+TEST(TEST_BUS, PAGE_TABLE) {
+    mem_t ram = {0};
+    std::array<BYTE, 0x100> rom;
+    rom.fill(0xea);
+
+    WORD start = 0x0200;
+    ram[0xfffc] = start & 0xff;
+    ram[0xfffd] = (start >> 8) & 0xff;
+
+    BYTE io_value = 0x42;
+    std::array<BYTE, 2> io_writes = {0, 0};
+    int io_reads = 0;
+
+    Bus bus(ram);
+    bus.map_rom(0x30, 1, rom.data());
+    bus.map_device(
+        0xd0, 1,
+        [&](WORD addr) {
+            io_reads++;
+            return BYTE(io_value + (addr & 0xff));
+        },
+        [&](WORD addr, BYTE value) { io_writes[addr & 0x1] = value; });
+
+    WORD pc = start;
+
+    /* Assembly to be tested
+LDA $D001
+STA $D000
+STA $3000
+LDA $3000
+STA $0010
+     */
+
+    // LDA $D001
+    ram[pc++] = 0xad;
+    ram[pc++] = 0x01;
+    ram[pc++] = 0xd0;
+    // STA $D000
+    ram[pc++] = 0x8d;
+    ram[pc++] = 0x00;
+    ram[pc++] = 0xd0;
+    // STA $3000
+    ram[pc++] = 0x8d;
+    ram[pc++] = 0x00;
+    ram[pc++] = 0x30;
+    // LDA $3000
+    ram[pc++] = 0xad;
+    ram[pc++] = 0x00;
+    ram[pc++] = 0x30;
+    // STA $0010
+    ram[pc++] = 0x85;
+    ram[pc++] = 0x10;
+
+    CPU cpu(bus);
+    cpu.reset();
+
+    for (int i = 0; i < 5; i++) {
+        BYTE opcode = cpu.fetch_opcode();
+        cpu.execute(opcode);
+    }
+
+    EXPECT_EQ(io_reads, 1);
+    EXPECT_EQ(io_writes[0], 0x43);
+    EXPECT_EQ(rom[0x00], 0xea);
+    EXPECT_EQ(cpu.a, 0xea);
+    EXPECT_EQ(ram[0x0010], 0xea);
+    EXPECT_EQ(bus.peek(0xd001), 0xff);
+    EXPECT_EQ(io_reads, 1);
+}
+
+TEST(TEST_BUS, DEVICE_REMAP) {
+    mem_t ram = {0};
+    Bus bus(ram);
+
+    // A bank register that remaps its own page on every write, far more
+    // often than there are device slots
+    auto state = std::make_shared<int>(0);
+    std::function<void(BYTE)> map_bank = [&](BYTE bank) {
+        bus.map_device(
+            0xd0, 1, [bank, state](WORD) { return bank; },
+            [&, state](WORD, BYTE value) { map_bank(value); });
+    };
+    map_bank(0);
+    for (int i = 1; i <= 100000; i++) {
+        bus.write(0xd000, BYTE(i));
+        ASSERT_EQ(bus.read(0xd000), BYTE(i));
+    }
+    // Replaced callbacks are freed as their slots are reused
+    EXPECT_LE(state.use_count(), 7);
+
+    bus.unmap(0xd0, 1);
+    EXPECT_EQ(bus.read(0xd000), 0xff);
+
+    // A callback that unmaps its page and maps it twice over keeps its
+    // own captures until it returns. Only statics are touched after the
+    // remap, as they need no capture.
+    static std::weak_ptr<int> token_observer;
+    static bool token_alive;
+    auto token = std::make_shared<int>(0);
+    token_observer = token;
+    token_alive = false;
+    bus.map_device(
+        0xd0, 1, [](WORD) { return BYTE(0); },
+        [&bus, token](WORD, BYTE) {
+            Bus &self = bus;
+            self.unmap(0xd0, 1);
+            self.map_device(
+                0xd0, 1, [](WORD) { return BYTE(1); }, [](WORD, BYTE) {});
+            self.map_device(
+                0xd0, 1, [](WORD) { return BYTE(2); }, [](WORD, BYTE) {});
+            token_alive = !token_observer.expired();
+        });
+    token.reset();
+    bus.write(0xd000, 0);
+    EXPECT_TRUE(token_alive);
+    EXPECT_EQ(bus.read(0xd000), 2);
+
+    // Nothing to map
+    EXPECT_FALSE(bus.map_device(
+        0xe0, 0, [](WORD) { return BYTE(0); }, [](WORD, BYTE) {}));
+    EXPECT_EQ(bus.read(0xe000), 0);
+}
+
+TEST(TEST_OPCODES, SHARED_METADATA) {
+    // Opcode metadata is static; a CPU is just registers and pointers
+    EXPECT_LE(sizeof(CPU), 48);
+
+    EXPECT_EQ(lookup_table[0x6d].ins, INSTRUCTION::ADC);
+    EXPECT_EQ(lookup_table[0x6d].mode, ADDRESSING_MODE::ABSOLUTE);
+    EXPECT_EQ(lookup_table[0x6d].bytes, 3);
+    EXPECT_EQ(lookup_table[0x6d].cycles, 4);
+    EXPECT_STREQ(lookup_table[0x6d].mnemonic, "ADC");
+
+    EXPECT_EQ(lookup_table[0xd0].bytes, 2);
+    EXPECT_EQ(lookup_table[0xea].bytes, 1);
+    EXPECT_EQ(lookup_table[0x00].cycles, 7);
+}
+
+TEST(TEST_FLAGS, LAZY_P) {
+    mem_t memory = {0};
+
+    WORD start = 0x8000;
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+
+    WORD pc = start;
+
+    /* Assembly to be tested
+LDA #$01
+BIT $10     ; memory[$10] = $C0: N and V from memory, Z from A & M
+PHP
+LDA #$80
+PLP
+     */
+
+    // LDA #$01
+    memory[pc++] = 0xa9;
+    memory[pc++] = 0x01;
+    // BIT $10
+    memory[0x0010] = 0xc0;
+    memory[pc++] = 0x24;
+    memory[pc++] = 0x10;
+    // PHP
+    memory[pc++] = 0x08;
+    // LDA #$80
+    memory[pc++] = 0xa9;
+    memory[pc++] = 0x80;
+    // PLP
+    memory[pc++] = 0x28;
+
+    // Results
+    std::array<BYTE, 5> P = {0x24, 0xe6, 0xe6, 0xe4, 0xe6};
+
+    CPU cpu(memory);
+    cpu.reset();
+
+    for (int i = 0; i < 5; i++) {
+        BYTE opcode = cpu.fetch_opcode();
+        cpu.execute(opcode);
+        EXPECT_EQ(cpu.get_p(), P[i]);
+    }
+    // PHP pushes B and U set
+    EXPECT_EQ(memory[0x01fd], 0xf6);
+
+    // B is not a stored flag and U always reads as set
+    cpu.set_p(0xff);
+    EXPECT_EQ(cpu.get_p(), 0xef);
+    cpu.set_p(0x00);
+    EXPECT_EQ(cpu.get_p(), 0x20);
+}
+
+TEST(TEST_DECIMAL, ADC_SBC) {
+    mem_t memory = {0};
+
+    WORD start = 0x8000;
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+
+    /* Assembly to be tested, operands patched per case
+SED
+ADC #$00
+SBC #$00
+     */
+    memory[0x8000] = 0xf8;
+    memory[0x8001] = 0x69;
+    memory[0x8003] = 0xe9;
+
+    CPU cpu(memory);
+    cpu.reset();
+    cpu.execute(cpu.fetch_opcode());
+
+    // Run ADC (at $8001) or SBC (at $8003) on a, b and carry
+    auto run = [&](WORD at, BYTE a, BYTE b, BYTE carry) {
+        cpu.pc = at;
+        cpu.a = a;
+        cpu.set_p(CPU::FLAG_D | carry);
+        memory[at + 1] = b;
+        cpu.execute(cpu.fetch_opcode());
+        return cpu.get_p();
+    };
+    auto bcd = [](int value) { return BYTE(((value / 10) << 4) | value % 10); };
+
+    // Every valid BCD operand pair: the sum or difference and C on both
+    // chips, N and Z from the result on the 65C02 and from the binary
+    // result on the 6502
+    for (Decimal_flags flags : {Decimal_flags::NMOS, Decimal_flags::CMOS}) {
+        cpu.set_decimal_flags(flags);
+        bool cmos = flags == Decimal_flags::CMOS;
+        for (int a = 0; a < 100; a++) {
+            for (int b = 0; b < 100; b++) {
+                for (BYTE carry = 0; carry < 2; carry++) {
+                    int sum = a + b + carry;
+                    BYTE p = run(0x8001, bcd(a), bcd(b), carry);
+                    ASSERT_EQ(cpu.a, bcd(sum % 100));
+                    ASSERT_EQ(p & CPU::FLAG_C, sum >= 100 ? 1 : 0);
+                    if (cmos) {
+                        ASSERT_EQ(p & CPU::FLAG_N, cpu.a & 0x80);
+                        ASSERT_EQ((p & CPU::FLAG_Z) != 0, cpu.a == 0);
+                    } else {
+                        BYTE binary = bcd(a) + bcd(b) + carry;
+                        ASSERT_EQ((p & CPU::FLAG_Z) != 0, binary == 0);
+                    }
+
+                    int difference = a - b - (1 - carry);
+                    BYTE binary = bcd(a) - bcd(b) - (1 - carry);
+                    p = run(0x8003, bcd(a), bcd(b), carry);
+                    ASSERT_EQ(cpu.a, bcd((difference + 100) % 100));
+                    ASSERT_EQ(p & CPU::FLAG_C, difference >= 0 ? 1 : 0);
+                    BYTE nz = cmos ? cpu.a : binary;
+                    ASSERT_EQ(p & CPU::FLAG_N, nz & 0x80);
+                    ASSERT_EQ((p & CPU::FLAG_Z) != 0, nz == 0);
+                    bool v = ((bcd(a) ^ bcd(b)) & (bcd(a) ^ binary) & 0x80);
+                    ASSERT_EQ((p & CPU::FLAG_V) != 0, v);
+                }
+            }
+        }
+    }
+
+    // Every operand pair, valid BCD or not: the per-digit tables agree
+    // with decimal_add() and decimal_subtract()
+    for (Decimal_flags flags : {Decimal_flags::NMOS, Decimal_flags::CMOS}) {
+        cpu.set_decimal_flags(flags);
+        for (int a = 0; a < 0x100; a++) {
+            for (int b = 0; b < 0x100; b++) {
+                for (BYTE carry = 0; carry < 2; carry++) {
+                    Decimal_result sum = decimal_add(a, b, carry, flags);
+                    BYTE p = run(0x8001, a, b, carry);
+                    ASSERT_EQ(cpu.a, sum.a) << a << " + " << b;
+                    ASSERT_EQ(p & 0xc3, sum.p) << a << " + " << b;
+
+                    Decimal_result difference =
+                        decimal_subtract(a, b, carry, flags);
+                    p = run(0x8003, a, b, carry);
+                    ASSERT_EQ(cpu.a, difference.a) << a << " - " << b;
+                    ASSERT_EQ(p & 0xc3, difference.p) << a << " - " << b;
+                }
+            }
+        }
+    }
+
+    // $99 + $01: Z from the binary sum $9A on the 6502, N from $A0
+    // before the high digit is adjusted
+    cpu.set_decimal_flags(Decimal_flags::NMOS);
+    EXPECT_EQ(run(0x8001, 0x99, 0x01, 0), 0xa9);
+    EXPECT_EQ(cpu.a, 0x00);
+    cpu.set_decimal_flags(Decimal_flags::CMOS);
+    EXPECT_EQ(run(0x8001, 0x99, 0x01, 0), 0x2b);
+    EXPECT_EQ(cpu.a, 0x00);
+
+    // $79 + $00 + 1 overflows into the sign on both
+    for (Decimal_flags flags : {Decimal_flags::NMOS, Decimal_flags::CMOS}) {
+        cpu.set_decimal_flags(flags);
+        EXPECT_EQ(run(0x8001, 0x79, 0x00, 1), 0xe8);
+        EXPECT_EQ(cpu.a, 0x80);
+    }
+
+    // Invalid BCD: $20 - $0F, adjusted per digit on the 6502 and from the
+    // binary difference on the 65C02
+    cpu.set_decimal_flags(Decimal_flags::NMOS);
+    run(0x8003, 0x20, 0x0f, 1);
+    EXPECT_EQ(cpu.a, 0x1b);
+    cpu.set_decimal_flags(Decimal_flags::CMOS);
+    run(0x8003, 0x20, 0x0f, 1);
+    EXPECT_EQ(cpu.a, 0x0b);
+
+    // Binary mode is untouched
+    cpu.pc = 0x8001;
+    cpu.a = 0x99;
+    cpu.set_p(0x00);
+    memory[0x8002] = 0x01;
+    cpu.execute(cpu.fetch_opcode());
+    EXPECT_EQ(cpu.a, 0x9a);
+}
+
+TEST(TEST_BLOCK_CACHE, SELF_MODIFYING) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested
+        LDX #$00
+loop:   LDA #$00        ; immediate operand is rewritten below
+        CLC
+        ADC #$01
+        STA loop+1
+        INX
+        CPX #$10
+        BNE loop
+done:   JMP done
+     */
+    std::array<BYTE, 19> program = {
+        0xa2, 0x00,       // LDX #$00
+        0xa9, 0x00,       // LDA #$00
+        0x18,             // CLC
+        0x69, 0x01,       // ADC #$01
+        0x8d, 0x03, 0x80, // STA $8003
+        0xe8,             // INX
+        0xe0, 0x10,       // CPX #$10
+        0xd0, 0xf3,       // BNE loop
+        0x4c, 0x0f, 0x80, // JMP done
+    };
+    WORD done = 0x800f;
+
+    mem_t expected = {0};
+    mem_t memory = {0};
+    for (mem_t *m : {&expected, &memory}) {
+        (*m)[0xfffc] = start & 0xff;
+        (*m)[0xfffd] = (start >> 8) & 0xff;
+        std::copy(program.begin(), program.end(), m->begin() + start);
+    }
+
+    CPU reference(expected);
+    reference.reset();
+    uint64_t reference_cycles = reference.run_until(done, 10000);
+
+    CPU cpu(memory);
+    cpu.reset();
+    Block_cache cache(cpu);
+    uint64_t cycles = cache.run_until(done, 10000);
+
+    EXPECT_EQ(cpu.a, 0x10);
+    EXPECT_EQ(cpu.a, reference.a);
+    EXPECT_EQ(cpu.x, reference.x);
+    EXPECT_EQ(cpu.get_p(), reference.get_p());
+    EXPECT_EQ(cycles, reference_cycles);
+    EXPECT_TRUE(memory == expected);
+    EXPECT_GT(cache.size(), 0);
+
+    // Remapping the bus drops every block
+    std::array<BYTE, 0x100> rom;
+    rom.fill(0xea);
+    cpu.get_bus().map_rom(0x90, 1, rom.data());
+    cache.run_for_cycles(10);
+    EXPECT_EQ(cache.size(), 1);
+}
+
+TEST(TEST_BLOCK_CACHE, UNCACHEABLE_START) {
+    mem_t memory = {0};
+    Bus bus(memory);
+    // Page $21 is a device serving the bytes below
+    std::array<BYTE, 4> device = {0xea, 0x4c, 0xf0, 0x20};
+    bus.map_device(
+        0x21, 1, [&](WORD addr) { return device[addr & 0x3]; },
+        [](WORD, BYTE) {});
+
+    /* Assembly to be tested
+$20F0: INX
+       JMP $20FE
+$20FE: LDA $EAFF    ; last operand byte on the device page
+$2101: JMP $20F0    ; from the device page
+     */
+    memory[0x20f0] = 0xe8;
+    memory[0x20f1] = 0x4c;
+    memory[0x20f2] = 0xfe;
+    memory[0x20f3] = 0x20;
+    memory[0x20fe] = 0xad;
+    memory[0x20ff] = 0xff;
+
+    CPU cpu(bus);
+    cpu.reset();
+    cpu.pc = 0x20f0;
+    Block_cache cache(cpu);
+
+    // Only $20F0 compiles; the other starts run interpreted every time
+    cache.run_for_cycles(1000);
+    EXPECT_EQ(cache.size(), 1);
+    BYTE x = cpu.x;
+
+    // As LDA $FF the instruction fits its page, so it compiles now:
+    // $20FE: LDA $FF, then NOP and JMP $20F0 from the device page
+    bus.write(0x20fe, 0xa5);
+    cache.run_for_cycles(1000);
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_NE(cpu.x, x);
+}
+
+TEST(TEST_INTERRUPTS, BRK_RTI_NMI_RESET) {
+    mem_t memory;
+    memory.fill(0xea);
+    memory[0xfffc] = 0x00;
+    memory[0xfffd] = 0x80;
+    memory[0xfffe] = 0x00;
+    memory[0xffff] = 0x90;
+    memory[0xfffa] = 0x00;
+    memory[0xfffb] = 0x91;
+
+    /* Assembly to be tested:
+        LDA #$01
+        BRK #$ff
+        LDX #$07
+        SEI
+        NOP
+irq:    LDY #$42        ; $9000
+        RTI
+nmi:    RTI             ; $9100
+     */
+    std::array<BYTE, 7> program = {
+        0xa9, 0x01, // LDA #$01
+        0x00, 0xff, // BRK #$ff
+        0xa2, 0x07, // LDX #$07
+        0x78,       // SEI
+    };
+    std::copy(program.begin(), program.end(), memory.begin() + 0x8000);
+    memory[0x9000] = 0xa0; // LDY #$42
+    memory[0x9001] = 0x42;
+    memory[0x9002] = 0x40; // RTI
+    memory[0x9100] = 0x40; // RTI
+
+    CPU cpu(memory);
+    cpu.reset();
+    cpu.run_until(0x8006, 1000);
+    EXPECT_EQ(cpu.a, 0x01);
+    EXPECT_EQ(cpu.x, 0x07);
+    EXPECT_EQ(cpu.y, 0x42);
+    EXPECT_EQ(cpu.sp, 0xfd);
+    EXPECT_EQ(cpu.cycles, 7 + 2 + 7 + 2 + 6 + 2);
+    // BRK pushed the address past its signature byte, then P with B set
+    EXPECT_EQ(memory[0x01fd], 0x80);
+    EXPECT_EQ(memory[0x01fc], 0x04);
+    EXPECT_EQ(memory[0x01fb], CPU::FLAG_B | CPU::FLAG_U | CPU::FLAG_I);
+    EXPECT_EQ(cpu.get_p() & CPU::FLAG_I, CPU::FLAG_I);
+
+    // IRQ is masked by I, and stays pending while the line is held
+    cpu.step();
+    cpu.set_irq(3, true);
+    cpu.step();
+    EXPECT_EQ(cpu.pc, 0x8008);
+    EXPECT_TRUE(cpu.irq_asserted());
+
+    // NMI is not
+    uint64_t cycles = cpu.cycles;
+    cpu.nmi();
+    cpu.step();
+    EXPECT_EQ(cpu.pc, 0x9100);
+    EXPECT_EQ(cpu.cycles, cycles + 7);
+    EXPECT_EQ(memory[0x01fb] & CPU::FLAG_B, 0);
+    cpu.step();
+    EXPECT_EQ(cpu.pc, 0x8008);
+
+    // Released lines and reset
+    cpu.set_irq(3, false);
+    EXPECT_FALSE(cpu.irq_asserted());
+    cpu.request_reset();
+    cpu.step();
+    EXPECT_EQ(cpu.pc, 0x8000);
+    EXPECT_EQ(cpu.sp, 0xfd);
+}
+
+TEST(TEST_INTERRUPTS, SCHEDULED_TIMER) {
+    /* Assembly to be tested: count in $10 until a timer interrupts,
+       count interrupts in $11 and NMIs in $12
+        CLI
+loop:   INC $10
+        JMP loop
+irq:    PHA             ; $9000
+        LDA $D000       ; acknowledge the timer
+        INC $11
+        PLA
+        RTI
+nmi:    INC $12         ; $9100
+        RTI
+     */
+    std::array<BYTE, 6> program = {
+        0x58,             // CLI
+        0xe6, 0x10,       // INC $10
+        0x4c, 0x01, 0x80, // JMP loop
+    };
+    std::array<BYTE, 8> irq = {
+        0x48,             // PHA
+        0xad, 0x00, 0xd0, // LDA $D000
+        0xe6, 0x11,       // INC $11
+        0x68,             // PLA
+        0x40,             // RTI
+    };
+    std::array<BYTE, 3> nmi = {
+        0xe6, 0x12, // INC $12
+        0x40,       // RTI
+    };
+
+    // A timer on page $D0 raising IRQ every 250 cycles, plus one NMI
+    struct Machine : Test_machine {
+        int fired;
+        event_callback_t tick;
+
+        Machine() : fired(0) {
+            bus.map_device(
+                0xd0, 1,
+                [this](WORD) {
+                    cpu.set_irq(0, false);
+                    return BYTE(0);
+                },
+                [](WORD, BYTE) {});
+            tick = [this](uint64_t cycle) {
+                cpu.set_irq(0, true);
+                fired++;
+                bus.get_scheduler().schedule(cycle + 250, tick);
+            };
+        }
+    };
+
+    auto load = [&](Machine &machine) {
+        mem_t &memory = machine.memory;
+        memory.fill(0);
+        memory[0xfffc] = 0x00;
+        memory[0xfffd] = 0x80;
+        memory[0xfffe] = 0x00;
+        memory[0xffff] = 0x90;
+        memory[0xfffa] = 0x00;
+        memory[0xfffb] = 0x91;
+        std::copy(program.begin(), program.end(), memory.begin() + 0x8000);
+        std::copy(irq.begin(), irq.end(), memory.begin() + 0x9000);
+        std::copy(nmi.begin(), nmi.end(), memory.begin() + 0x9100);
+        machine.cpu.reset();
+        Scheduler &events = machine.bus.get_scheduler();
+        events.schedule(machine.cpu.cycles + 250, machine.tick);
+        events.schedule(5003, [&machine](uint64_t) { machine.cpu.nmi(); });
+        // Cancelled events never fire
+        uint64_t id =
+            events.schedule(6000, [&machine](uint64_t) { machine.fired = -1; });
+        EXPECT_TRUE(events.cancel(id));
+        EXPECT_FALSE(events.cancel(id));
+    };
+
+    Machine interpreted;
+    load(interpreted);
+    EXPECT_GE(interpreted.cpu.run_for_cycles(20000), 20000);
+    CPU &cpu = interpreted.cpu;
+    mem_t &memory = interpreted.memory;
+    EXPECT_EQ(interpreted.fired, 80);
+    EXPECT_EQ(memory[0x11] + (cpu.irq_asserted() ? 1 : 0), 80);
+    EXPECT_EQ(memory[0x12], 1);
+    EXPECT_GT(memory[0x10], 0);
+    EXPECT_EQ(interpreted.bus.get_scheduler().size(), 1);
+
+    // The block cache, and its native tier, take them at the same points
+    std::vector<bool> tiers = {false};
+#ifdef MOS6502_JIT
+    tiers.push_back(true);
+#endif
+    for (bool jit : tiers) {
+        Machine cached;
+        load(cached);
+        Block_cache cache(cached.cpu);
+#ifdef MOS6502_JIT
+        cache.set_jit(jit);
+#endif
+        cache.run_for_cycles(20000);
+        EXPECT_EQ(cached.cpu.cycles, cpu.cycles) << jit;
+        EXPECT_EQ(cached.cpu.pc, cpu.pc) << jit;
+        EXPECT_EQ(cached.cpu.a, cpu.a) << jit;
+        EXPECT_EQ(cached.cpu.sp, cpu.sp) << jit;
+        EXPECT_EQ(cached.cpu.get_p(), cpu.get_p()) << jit;
+        EXPECT_EQ(cached.fired, interpreted.fired) << jit;
+        EXPECT_TRUE(cached.memory == memory) << jit;
+#ifdef MOS6502_JIT
+        EXPECT_EQ(cache.translations() > 0, jit);
+#endif
+    }
+}
+
+TEST(TEST_INTERRUPTS, EVENT_SCHEDULED_MID_RUN) {
+    /* Assembly to be tested: start a one-shot timer, then spin
+        LDA #$01
+        STA $D000
+loop:   JMP loop
+     */
+    std::array<BYTE, 8> program = {
+        0xa9, 0x01,       // LDA #$01
+        0x8d, 0x00, 0xd0, // STA $D000
+        0x4c, 0x05, 0x80, // JMP loop
+    };
+
+    // Writing the timer schedules an event 15 cycles after reset, well
+    // inside the run that wrote it
+    struct Machine : Test_machine {
+        uint64_t reset_at;
+        uint64_t fired_at;
+
+        Machine() : fired_at(0) {
+            memory[0xfffc] = 0x00;
+            memory[0xfffd] = 0x80;
+            bus.map_device(
+                0xd0, 1, [](WORD) { return BYTE(0); },
+                [this](WORD, BYTE) {
+                    bus.get_scheduler().schedule(
+                        reset_at + 15,
+                        [this](uint64_t) { fired_at = cpu.cycles; });
+                });
+        }
+
+        void load(const std::array<BYTE, 8> &program) {
+            std::copy(program.begin(), program.end(), memory.begin() + 0x8000);
+            cpu.reset();
+            reset_at = cpu.cycles;
+        }
+    };
+
+    // Threaded where built in, stepped with a profile, and idle skipping
+    Machine threaded;
+    threaded.load(program);
+    threaded.cpu.run_for_cycles(100000);
+    EXPECT_GE(threaded.fired_at, threaded.reset_at + 15);
+    EXPECT_LT(threaded.fired_at, threaded.reset_at + 15 + 3);
+
+    Machine stepped;
+    stepped.load(program);
+    Profile profile;
+    stepped.cpu.run_for_cycles(100000, profile);
+    EXPECT_EQ(stepped.fired_at, threaded.fired_at);
+
+    Machine idle;
+    idle.load(program);
+    idle.cpu.set_idle_skip(true);
+    idle.cpu.run_for_cycles(100000);
+    EXPECT_EQ(idle.fired_at, threaded.fired_at);
+
+    Machine cached;
+    cached.load(program);
+    Block_cache cache(cached.cpu);
+    cache.run_for_cycles(100000);
+    EXPECT_EQ(cached.fired_at, threaded.fired_at);
+}
+
+TEST(TEST_IDLE, FAST_FORWARD) {
+    /* Assembly to be tested: wait for raster line 0 on a device, count
+       it in $10, then spin until an interrupt sets $20; halt after five
+       rounds
+        CLI
+wait:   LDA $D012
+        BNE wait
+        INC $10
+        LDA $10
+        CMP #$05
+        BEQ halt
+spin:   LDA $20
+        BEQ spin
+        LDA #$00
+        STA $20
+        JMP wait
+        NOP
+        NOP
+halt:   JMP halt
+irq:    PHA             ; $9000
+        LDA $D100       ; acknowledge the timer
+        INC $20
+        PLA
+        RTI
+     */
+    std::array<BYTE, 30> program = {
+        0x58,             // CLI
+        0xad, 0x12, 0xd0, // LDA $D012
+        0xd0, 0xfb,       // BNE wait
+        0xe6, 0x10,       // INC $10
+        0xa5, 0x10,       // LDA $10
+        0xc9, 0x05,       // CMP #$05
+        0xf0, 0x0d,       // BEQ halt
+        0xa5, 0x20,       // LDA $20
+        0xf0, 0xfc,       // BEQ spin
+        0xa9, 0x00,       // LDA #$00
+        0x85, 0x20,       // STA $20
+        0x4c, 0x01, 0x80, // JMP wait
+        0xea,             // NOP
+        0xea,             // NOP
+        0x4c, 0x1b, 0x80, // JMP halt
+    };
+    std::array<BYTE, 8> irq = {
+        0x48,             // PHA
+        0xad, 0x00, 0xd1, // LDA $D100
+        0xe6, 0x20,       // INC $20
+        0x68,             // PLA
+        0x40,             // RTI
+    };
+
+    // A raster counter on page $D0 stepping every 10000 cycles, safe to
+    // poll, and a timer on page $D1 raising IRQ every 25000 cycles
+    struct Machine : Test_machine {
+        BYTE line;
+        int polls;
+        // Cycle of every timer acknowledge
+        std::vector<uint64_t> acks;
+        event_callback_t raster;
+        event_callback_t timer;
+
+        Machine() : line(1), polls(0) {
+            bus.map_device(
+                0xd0, 1,
+                [this](WORD) {
+                    polls++;
+                    return line;
+                },
+                [](WORD, BYTE) {});
+            bus.set_idle_safe(0xd0, 1, true);
+            bus.map_device(
+                0xd1, 1,
+                [this](WORD) {
+                    acks.push_back(cpu.cycles);
+                    cpu.set_irq(0, false);
+                    return BYTE(0);
+                },
+                [](WORD, BYTE) {});
+            raster = [this](uint64_t cycle) {
+                line = (line + 1) % 4;
+                bus.get_scheduler().schedule(cycle + 10000, raster);
+            };
+            timer = [this](uint64_t cycle) {
+                cpu.set_irq(0, true);
+                bus.get_scheduler().schedule(cycle + 25000, timer);
+            };
+        }
+    };
+
+    auto load = [&](Machine &machine) {
+        mem_t &memory = machine.memory;
+        memory.fill(0);
+        memory[0xfffc] = 0x00;
+        memory[0xfffd] = 0x80;
+        memory[0xfffe] = 0x00;
+        memory[0xffff] = 0x90;
+        std::copy(program.begin(), program.end(), memory.begin() + 0x8000);
+        std::copy(irq.begin(), irq.end(), memory.begin() + 0x9000);
+        machine.cpu.reset();
+        Scheduler &events = machine.bus.get_scheduler();
+        events.schedule(10000, machine.raster);
+        events.schedule(25000, machine.timer);
+    };
+
+    Machine reference;
+    load(reference);
+    reference.cpu.run_for_cycles(400000);
+    EXPECT_EQ(reference.memory[0x10], 5);
+
+    auto expect_same = [&](Machine &machine, const char *what) {
+        EXPECT_EQ(machine.cpu.cycles, reference.cpu.cycles) << what;
+        EXPECT_EQ(machine.cpu.pc, reference.cpu.pc) << what;
+        EXPECT_EQ(machine.cpu.a, reference.cpu.a) << what;
+        EXPECT_EQ(machine.cpu.sp, reference.cpu.sp) << what;
+        EXPECT_EQ(machine.cpu.get_p(), reference.cpu.get_p()) << what;
+        EXPECT_TRUE(machine.memory == reference.memory) << what;
+        EXPECT_EQ(machine.acks, reference.acks) << what;
+        // Polls are only made by the probes
+        EXPECT_LT(machine.polls * 20, reference.polls) << what;
+    };
+
+    Machine interpreted;
+    load(interpreted);
+    interpreted.cpu.set_idle_skip(true);
+    interpreted.cpu.run_for_cycles(400000);
+    expect_same(interpreted, "interpreter");
+
+    // run_until stops inside an idle loop as without skipping
+    Machine until;
+    load(until);
+    until.cpu.set_idle_skip(true);
+    until.cpu.run_until(0x8004, 400000);
+    EXPECT_EQ(until.cpu.pc, 0x8004);
+    EXPECT_EQ(until.cpu.cycles, 7 + 2 + 4);
+
+    std::vector<bool> tiers = {false};
+#ifdef MOS6502_JIT
+    tiers.push_back(true);
+#endif
+    for (bool jit : tiers) {
+        Machine cached;
+        load(cached);
+        cached.cpu.set_idle_skip(true);
+        Block_cache cache(cached.cpu);
+#ifdef MOS6502_JIT
+        cache.set_jit(jit);
+#endif
+        cache.run_for_cycles(400000);
+        expect_same(cached, jit ? "jit" : "block cache");
+    }
+}
+
+TEST(TEST_SNAPSHOT, COPY_ON_WRITE) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested
+loop:   INC $10
+        LDA $10
+        STA $0300,X
+        INX
+        JMP loop
+     */
+    std::array<BYTE, 11> program = {
+        0xe6, 0x10,       // INC $10
+        0xa5, 0x10,       // LDA $10
+        0x9d, 0x00, 0x03, // STA $0300,X
+        0xe8,             // INX
+        0x4c, 0x00, 0x80, // JMP loop
+    };
+
+    mem_t memory = {0};
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+    std::copy(program.begin(), program.end(), memory.begin() + start);
+
+    // ROM and device pages are not saved
+    std::array<BYTE, 0x100> rom;
+    rom.fill(0xea);
+    CPU cpu(memory);
+    Bus &bus = cpu.get_bus();
+    bus.map_rom(0xf0, 1, rom.data());
+    bus.map_device(
+        0xd0, 1, [](WORD) { return BYTE(0x00); }, [](WORD, BYTE) {});
+    cpu.reset();
+
+    Snapshot_tracker tracker(cpu);
+    EXPECT_EQ(tracker.dirty_pages(), 0x100 - 2);
+    Snapshot s0 = tracker.take();
+    EXPECT_EQ(tracker.dirty_pages(), 0);
+    EXPECT_EQ(s0.page(0xf0), nullptr);
+    EXPECT_EQ(s0.page(0xd0), nullptr);
+
+    // The first 10 iterations write only the zero page and page 3
+    Block_cache cache(cpu);
+    cache.run_for_cycles(10 * 18);
+    EXPECT_EQ(tracker.dirty_pages(), 2);
+    EXPECT_TRUE(tracker.is_dirty(0x00));
+    EXPECT_TRUE(tracker.is_dirty(0x03));
+
+    Snapshot s1 = tracker.take();
+    EXPECT_NE(s1.page(0x00), s0.page(0x00));
+    EXPECT_NE(s1.page(0x03), s0.page(0x03));
+    EXPECT_EQ(s1.page(0x80), s0.page(0x80));
+    EXPECT_EQ(s1.page(0x04), s0.page(0x04));
+    EXPECT_EQ(s1.page(0x03)[0x09], 0x0a);
+
+    cache.run_for_cycles(1000);
+    BYTE a = cpu.a;
+    uint64_t cycles = cpu.cycles;
+    mem_t after = memory;
+
+    // Back to the start, then replay to the same state
+    tracker.restore(s0);
+    EXPECT_EQ(tracker.dirty_pages(), 0);
+    EXPECT_EQ(memory[0x0010], 0x00);
+    EXPECT_EQ(memory[0x0300], 0x00);
+    EXPECT_EQ(cpu.pc, start);
+    EXPECT_EQ(cpu.cycles, s0.cycles);
+
+    tracker.restore(s1);
+    EXPECT_EQ(memory[0x0010], 0x0a);
+    EXPECT_EQ(cpu.x, 0x0a);
+    cache.run_for_cycles(1000);
+    EXPECT_EQ(cpu.a, a);
+    EXPECT_EQ(cpu.cycles, cycles);
+    EXPECT_TRUE(memory == after);
+
+    // Restoring rewrites code pages through the bus, so blocks compiled
+    // from patched code are dropped
+    tracker.restore(s1);
+    bus.write(start, 0x4c); // JMP loop
+    bus.write(start + 1, 0x00);
+    bus.write(start + 2, 0x80);
+    cache.run_for_cycles(100);
+    EXPECT_TRUE(tracker.is_dirty(0x80));
+    tracker.restore(s1);
+    EXPECT_EQ(memory[start], 0xe6);
+    cache.run_for_cycles(1000);
+    EXPECT_EQ(cpu.a, a);
+    EXPECT_TRUE(memory == after);
+}
+
+TEST(TEST_REPLAY, RECORD_AND_REPLAY) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested: store input from $D001 until a timer
+       interrupts, count interrupts in $11
+        CLI
+loop:   LDA $D001
+        STA $0200,X
+        INX
+        JMP loop
+irq:    PHA             ; $9000
+        LDA $D000       ; acknowledge the timer
+        INC $11
+        PLA
+        RTI
+     */
+    std::array<BYTE, 11> program = {
+        0x58,             // CLI
+        0xad, 0x01, 0xd0, // LDA $D001
+        0x9d, 0x00, 0x02, // STA $0200,X
+        0xe8,             // INX
+        0x4c, 0x01, 0x80, // JMP loop
+    };
+    std::array<BYTE, 8> irq = {
+        0x48,             // PHA
+        0xad, 0x00, 0xd0, // LDA $D000
+        0xe6, 0x11,       // INC $11
+        0x68,             // PLA
+        0x40,             // RTI
+    };
+
+    mem_t memory = {0};
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+    memory[0xfffe] = 0x00;
+    memory[0xffff] = 0x90;
+    std::copy(program.begin(), program.end(), memory.begin() + start);
+    std::copy(irq.begin(), irq.end(), memory.begin() + 0x9000);
+
+    CPU cpu(memory);
+    Scheduler &events = cpu.get_scheduler();
+    cpu.reset();
+    Snapshot_tracker tracker(cpu);
+    Snapshot s0 = tracker.take();
+
+    // Input nothing could reproduce, and a timer raising IRQ every 250
+    // cycles until acknowledged
+    Replay_log log;
+    Replay_recorder recorder(cpu, log);
+    std::mt19937 random(std::random_device{}());
+    recorder.map_device(
+        0xd0, 1,
+        [&](WORD addr) {
+            if (addr == 0xd000) {
+                recorder.set_irq(0, false);
+                return BYTE(0);
+            }
+            return BYTE(random());
+        },
+        [](WORD, BYTE) {});
+    event_callback_t tick = [&](uint64_t cycle) {
+        recorder.set_irq(0, true);
+        events.schedule(cycle + 250, tick);
+    };
+    events.schedule(cpu.cycles + 250, tick);
+    cpu.run_for_cycles(20000);
+
+    Snapshot recorded = tracker.take();
+    mem_t after = memory;
+    EXPECT_GE(memory[0x11], 70);
+    // Far smaller than a trace of every instruction
+    EXPECT_LT(log.size(), cpu.cycles / 8);
+
+    std::stringstream stream;
+    log.write(stream);
+    EXPECT_LT(stream.str().size(), 8 * log.size());
+    Replay_log loaded;
+    EXPECT_TRUE(loaded.read(stream));
+    ASSERT_EQ(loaded.size(), log.size());
+    for (std::size_t i = 0; i < log.size(); i++) {
+        EXPECT_EQ(loaded[i].cycle, log[i].cycle) << i;
+        EXPECT_EQ(loaded[i].kind, log[i].kind) << i;
+        EXPECT_EQ(loaded[i].addr, log[i].addr) << i;
+        EXPECT_EQ(loaded[i].value, log[i].value) << i;
+    }
+
+    // Replays from the snapshot end in the same state, through the
+    // interpreter and the block cache alike
+    for (bool cached : {false, true}) {
+        events.clear();
+        Replay_player player(cpu, loaded);
+        player.map_device(0xd0, 1);
+        tracker.restore(s0);
+        player.start();
+        if (cached) {
+            Block_cache cache(cpu);
+            cache.run_for_cycles(20000);
+        } else {
+            cpu.run_for_cycles(20000);
+        }
+        EXPECT_FALSE(player.diverged()) << cached;
+        EXPECT_TRUE(player.finished()) << cached;
+        EXPECT_EQ(cpu.cycles, recorded.cycles) << cached;
+        EXPECT_EQ(cpu.pc, recorded.pc) << cached;
+        EXPECT_EQ(cpu.a, recorded.a) << cached;
+        EXPECT_EQ(cpu.x, recorded.x) << cached;
+        EXPECT_EQ(cpu.sp, recorded.sp) << cached;
+        EXPECT_EQ(cpu.get_p(), recorded.p) << cached;
+        EXPECT_TRUE(memory == after) << cached;
+    }
+
+    // Reading elsewhere than recorded is caught
+    events.clear();
+    Replay_player player(cpu, loaded);
+    player.map_device(0xd0, 1);
+    tracker.restore(s0);
+    cpu.get_bus().write(start + 2, 0x02); // LDA $D002
+    player.start();
+    cpu.run_for_cycles(20000);
+    EXPECT_TRUE(player.diverged());
+
+    // Truncated logs are rejected
+    std::stringstream truncated(stream.str().substr(0, 20));
+    EXPECT_FALSE(loaded.read(truncated));
+    EXPECT_EQ(loaded.size(), 0);
+}
+
+TEST(TEST_REWIND, SEEK_AND_STEP_BACK) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested
+loop:   INC $10
+        LDA $10
+        STA $0300,X
+        INC $0400,X
+        INX
+        JMP loop
+     */
+    std::array<BYTE, 14> program = {
+        0xe6, 0x10,       // INC $10
+        0xa5, 0x10,       // LDA $10
+        0x9d, 0x00, 0x03, // STA $0300,X
+        0xfe, 0x00, 0x04, // INC $0400,X
+        0xe8,             // INX
+        0x4c, 0x00, 0x80, // JMP loop
+    };
+
+    auto load = [&](mem_t &memory) {
+        memory.fill(0);
+        memory[0xfffc] = start & 0xff;
+        memory[0xfffd] = (start >> 8) & 0xff;
+        std::copy(program.begin(), program.end(), memory.begin() + start);
+    };
+
+    // State after running a fresh machine to the boundary at or after
+    // cycle
+    auto expect_at = [&](CPU &cpu, const mem_t &memory, uint64_t cycle) {
+        mem_t reference_memory;
+        load(reference_memory);
+        CPU reference(reference_memory);
+        reference.reset();
+        reference.run_for_cycles(cycle - reference.cycles);
+        EXPECT_EQ(cpu.cycles, reference.cycles) << cycle;
+        EXPECT_EQ(cpu.pc, reference.pc) << cycle;
+        EXPECT_EQ(cpu.a, reference.a) << cycle;
+        EXPECT_EQ(cpu.x, reference.x) << cycle;
+        EXPECT_EQ(cpu.get_p(), reference.get_p()) << cycle;
+        EXPECT_TRUE(memory == reference_memory) << cycle;
+    };
+
+    mem_t memory;
+    load(memory);
+    CPU cpu(memory);
+    cpu.reset();
+    uint64_t reset_cycles = cpu.cycles;
+
+    Rewind_buffer rewind(cpu, 1000, 1 << 20, 4);
+    cpu.run_for_cycles(50000);
+    uint64_t end = cpu.cycles;
+    mem_t after = memory;
+    EXPECT_EQ(rewind.size(), 51);
+    EXPECT_EQ(rewind.oldest(), reset_cycles);
+    // Deltas hold the few bytes written, not whole pages
+    EXPECT_LT(rewind.bytes(), 51 * 256);
+
+    for (uint64_t cycle : {uint64_t(49000), uint64_t(30001), uint64_t(12345)}) {
+        EXPECT_TRUE(rewind.seek(cycle));
+        expect_at(cpu, memory, cycle);
+    }
+    EXPECT_FALSE(rewind.seek(cpu.cycles + 1));
+    EXPECT_FALSE(rewind.seek(reset_cycles - 1));
+
+    // One instruction back, then forward again
+    uint64_t here = cpu.cycles;
+    BYTE x = cpu.x;
+    mem_t before = memory;
+    EXPECT_TRUE(rewind.step_back());
+    EXPECT_LT(cpu.cycles, here);
+    cpu.run_for_cycles(1);
+    EXPECT_EQ(cpu.cycles, here);
+    EXPECT_EQ(cpu.x, x);
+    EXPECT_TRUE(memory == before);
+
+    // Recording carries on from the seek
+    cpu.run_for_cycles(end - cpu.cycles);
+    EXPECT_EQ(cpu.cycles, end);
+    EXPECT_TRUE(memory == after);
+    EXPECT_TRUE(rewind.seek(20000));
+    expect_at(cpu, memory, 20000);
+
+    // A small budget keeps only the newest frames
+    load(memory);
+    cpu.reset();
+    Rewind_buffer bounded(cpu, 1000, 4096, 4);
+    cpu.run_for_cycles(100000);
+    EXPECT_LE(bounded.bytes(), 4096);
+    EXPECT_GT(bounded.oldest(), cpu.cycles - 100000);
+    EXPECT_FALSE(bounded.seek(bounded.oldest() - 1));
+    EXPECT_TRUE(bounded.seek(bounded.oldest() + 500));
+}
+
+TEST(TEST_BATCH, MATCHES_SERIAL) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested: sum the page at $2000 into $10 forever
+loop:   LDA $10
+        CLC
+        ADC $2000,X
+        STA $10
+        INX
+        JMP loop
+     */
+    std::array<BYTE, 13> program = {
+        0xa5, 0x10,       // LDA $10
+        0x18,             // CLC
+        0x7d, 0x00, 0x20, // ADC $2000,X
+        0x85, 0x10,       // STA $10
+        0xe8,             // INX
+        0x4c, 0x00, 0x80, // JMP loop
+    };
+
+    // Same ROM, different input data per instance
+    std::vector<mem_t> images(37);
+    uint32_t seed = 0x6502;
+    for (mem_t &image : images) {
+        image.fill(0);
+        image[0xfffc] = start & 0xff;
+        image[0xfffd] = (start >> 8) & 0xff;
+        std::copy(program.begin(), program.end(), image.begin() + start);
+        for (int i = 0; i < 0x100; i++) {
+            seed = seed * 1103515245 + 12345;
+            image[0x2000 + i] = (seed >> 16) & 0xff;
+        }
+    }
+
+    // Serial reference
+    std::vector<mem_t> serial = images;
+    std::vector<Batch_result> expected;
+    for (mem_t &image : serial) {
+        CPU cpu(image);
+        cpu.reset();
+        uint64_t instructions = 0;
+        while (cpu.cycles < 7 + 5000) {
+            cpu.execute(cpu.fetch_opcode());
+            instructions++;
+        }
+        expected.push_back(Batch_result{cpu.a, cpu.pc, cpu.sp, cpu.x, cpu.y,
+                                        cpu.get_p(), cpu.cycles, instructions,
+                                        Batch_runner::digest(image)});
+    }
+
+    for (unsigned n_threads : {1u, 3u, 8u}) {
+        Batch_runner runner(n_threads);
+        EXPECT_EQ(runner.size(), n_threads);
+        std::vector<mem_t> batch = images;
+        std::vector<Batch_result> results = runner.run_for_cycles(batch, 5000);
+        ASSERT_EQ(results.size(), images.size());
+        for (std::size_t i = 0; i < images.size(); i++) {
+            EXPECT_EQ(results[i].a, expected[i].a) << i;
+            EXPECT_EQ(results[i].pc, expected[i].pc) << i;
+            EXPECT_EQ(results[i].x, expected[i].x) << i;
+            EXPECT_EQ(results[i].p, expected[i].p) << i;
+            EXPECT_EQ(results[i].cycles, expected[i].cycles) << i;
+            EXPECT_EQ(results[i].instructions, expected[i].instructions) << i;
+            EXPECT_EQ(results[i].memory_digest, expected[i].memory_digest)
+                << i;
+            EXPECT_TRUE(batch[i] == serial[i]) << i;
+        }
+
+        // The pool is reused between jobs
+        batch = images;
+        results = runner.run_for_instructions(batch, 100);
+        for (const Batch_result &result : results) {
+            EXPECT_EQ(result.instructions, 100);
+            // Reset, 16 loop iterations, then LDA CLC ADC STA
+            EXPECT_EQ(result.cycles, 7 + 16 * 17 + 3 + 2 + 4 + 3);
+        }
+    }
+    EXPECT_NE(expected[0].memory_digest, expected[1].memory_digest);
+}
+
+TEST(TEST_LOCKSTEP, MATCHES_SCALAR) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested: the same program on per-lane data, with
+       data-dependent branches, subroutine calls, the stack and indirect
+       modes
+start:  LDX #$00
+loop:   LDA $2000,X
+        JSR classify
+        STA $2100,X
+        INX
+        BNE loop
+        LDY #$00
+        LDA ($40),Y
+        STA ($42,X)
+        JMP ($0044)     ; start or alt, per lane
+classify:
+        PHA
+        AND #$03
+        BEQ zero
+        ASL A
+        ROL $10
+        JMP done
+        NOP
+zero:   LSR $11
+        INC $12
+done:   PLA
+        EOR #$5A
+        CMP #$80
+        ROR A
+        SBC $13
+        RTS
+alt:    PHP
+        PLP
+        LDA $20,X
+        ADC $21,X
+        BIT $14
+        TXA
+        JMP start
+     */
+    std::array<BYTE, 60> program = {
+        0xa2, 0x00,       // LDX #$00
+        0xbd, 0x00, 0x20, // LDA $2000,X
+        0x20, 0x17, 0x80, // JSR classify
+        0x9d, 0x00, 0x21, // STA $2100,X
+        0xe8,             // INX
+        0xd0, 0xf4,       // BNE loop
+        0xa0, 0x00,       // LDY #$00
+        0xb1, 0x40,       // LDA ($40),Y
+        0x81, 0x42,       // STA ($42,X)
+        0x6c, 0x44, 0x00, // JMP ($0044)
+        0x48,             // PHA
+        0x29, 0x03,       // AND #$03
+        0xf0, 0x07,       // BEQ zero
+        0x0a,             // ASL A
+        0x26, 0x10,       // ROL $10
+        0x4c, 0x27, 0x80, // JMP done
+        0xea,             // NOP
+        0x46, 0x11,       // LSR $11
+        0xe6, 0x12,       // INC $12
+        0x68,             // PLA
+        0x49, 0x5a,       // EOR #$5A
+        0xc9, 0x80,       // CMP #$80
+        0x6a,             // ROR A
+        0xe5, 0x13,       // SBC $13
+        0x60,             // RTS
+        0x08,             // PHP
+        0x28,             // PLP
+        0xb5, 0x20,       // LDA $20,X
+        0x75, 0x21,       // ADC $21,X
+        0x24, 0x14,       // BIT $14
+        0x8a,             // TXA
+        0x4c, 0x00, 0x80, // JMP start
+    };
+
+    std::vector<mem_t> images(Lockstep::MAX_LANES);
+    uint32_t seed = 0x6502;
+    for (std::size_t lane = 0; lane < images.size(); lane++) {
+        mem_t &image = images[lane];
+        image.fill(0);
+        image[0xfffc] = start & 0xff;
+        image[0xfffd] = (start >> 8) & 0xff;
+        std::copy(program.begin(), program.end(), image.begin() + start);
+        for (int i = 0; i < 0x100; i++) {
+            seed = seed * 1103515245 + 12345;
+            image[0x2000 + i] = (seed >> 16) & 0xff;
+        }
+        image[0x13] = lane * 3;
+        image[0x14] = lane << 3;
+        image[0x40] = lane * 7;
+        image[0x41] = 0x20;
+        image[0x42] = lane;
+        image[0x43] = 0x30;
+        image[0x44] = lane % 2 ? 0x30 : 0x00;
+        image[0x45] = 0x80;
+    }
+    // One lane runs slightly different code: EOR #$A5
+    images[5][0x8029] = 0xa5;
+
+    Lockstep lockstep;
+    ASSERT_EQ(lockstep.size(), Lockstep::MAX_LANES);
+    for (int lane = 0; lane < lockstep.size(); lane++) {
+        lockstep.load(lane, images[lane]);
+    }
+    lockstep.reset();
+
+    std::vector<std::unique_ptr<CPU>> cpus;
+    for (mem_t &image : images) {
+        cpus.push_back(std::make_unique<CPU>(image));
+        cpus.back()->reset();
+    }
+
+    // Resuming a run continues where the last one stopped
+    for (uint64_t n_cycles : {20000, 3333, 1}) {
+        uint64_t expected = 0;
+        for (std::unique_ptr<CPU> &cpu : cpus) {
+            expected += cpu->run_for_cycles(n_cycles);
+        }
+        EXPECT_EQ(lockstep.run_for_cycles(n_cycles), expected);
+
+        mem_t memory;
+        for (int lane = 0; lane < lockstep.size(); lane++) {
+            CPU &cpu = *cpus[lane];
+            Lane_state state = lockstep.get_lane(lane);
+            EXPECT_EQ(state.a, cpu.a) << lane;
+            EXPECT_EQ(state.pc, cpu.pc) << lane;
+            EXPECT_EQ(state.sp, cpu.sp) << lane;
+            EXPECT_EQ(state.x, cpu.x) << lane;
+            EXPECT_EQ(state.y, cpu.y) << lane;
+            EXPECT_EQ(state.p, cpu.get_p()) << lane;
+            EXPECT_EQ(state.cycles, cpu.cycles) << lane;
+            lockstep.save(lane, memory);
+            EXPECT_TRUE(memory == images[lane]) << lane;
+        }
+    }
+    EXPECT_FALSE(std::equal(images[0].begin() + 0x2100,
+                            images[0].begin() + 0x2200,
+                            images[1].begin() + 0x2100));
+    EXPECT_GT(lockstep.vector_instructions(), lockstep.scalar_instructions());
+}
+
+TEST(TEST_LOADER, FORMATS) {
+    auto write_file = [](const std::string &name,
+                         const std::vector<BYTE> &bytes) {
+        std::string path = ::testing::TempDir() + name;
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(bytes.data()),
+                   bytes.size());
+        return path;
+    };
+    std::string error;
+
+    /* Raw 4 KiB ROM at $F000
+reset:  LDA #$42
+        STA $10
+        LDA $F100
+        STA $11
+        STA $F000
+loop:   JMP loop
+     */
+    std::vector<BYTE> rom(0x1000, 0);
+    std::vector<BYTE> program = {
+        0xa9, 0x42,       // LDA #$42
+        0x85, 0x10,       // STA $10
+        0xad, 0x00, 0xf1, // LDA $F100
+        0x85, 0x11,       // STA $11
+        0x8d, 0x00, 0xf0, // STA $F000
+        0x4c, 0x0c, 0xf0, // JMP loop
+    };
+    std::copy(program.begin(), program.end(), rom.begin());
+    rom[0x100] = 0x37;
+    rom[0xffc] = 0x00;
+    rom[0xffd] = 0xf0;
+    std::string rom_path = write_file("loader_rom.bin", rom);
+
+    Rom_image image;
+    ASSERT_TRUE(image.load(rom_path, Image_format::AUTO, 0xf000, error))
+        << error;
+    EXPECT_EQ(image.size(), 0x1000);
+    EXPECT_EQ(image.decoded_pages(), 0);
+    EXPECT_EQ(image.page(0xef), nullptr);
+
+    // Instances map the same pages; a copy outlives the original
+    std::array<mem_t, 2> memories;
+    std::array<Bus, 2> buses = {Bus(memories[0]), Bus(memories[1])};
+    {
+        Rom_image copy = image;
+        image = Rom_image();
+        for (Bus &bus : buses) {
+            copy.map(bus);
+        }
+        image = copy;
+    }
+    for (int page = 0xf0; page <= 0xff; page++) {
+        EXPECT_EQ(buses[0].read_page_table()[page], image.page(page));
+        EXPECT_EQ(buses[1].read_page_table()[page], image.page(page));
+    }
+    for (std::size_t i = 0; i < buses.size(); i++) {
+        memories[i].fill(0);
+        CPU cpu(buses[i]);
+        cpu.reset();
+        EXPECT_EQ(cpu.pc, 0xf000);
+        cpu.run_for_cycles(100);
+        EXPECT_EQ(memories[i][0x10], 0x42);
+        EXPECT_EQ(memories[i][0x11], 0x37);
+        // ROM writes are dropped
+        EXPECT_EQ(buses[i].peek(0xf000), 0xa9);
+    }
+
+    // Unaligned raw image: the partly covered page is assembled
+    std::vector<BYTE> data(0x180);
+    for (std::size_t i = 0; i < data.size(); i++) {
+        data[i] = i * 7;
+    }
+    std::string data_path = write_file("loader_data.bin", data);
+    ASSERT_TRUE(image.load(data_path, Image_format::RAW, 0x1080, error));
+    EXPECT_EQ(image.decoded_pages(), 1);
+    EXPECT_NE(image.page(0x10), nullptr);
+    EXPECT_NE(image.page(0x11), nullptr);
+    EXPECT_EQ(image.page(0x12), nullptr);
+    Bus bus;
+    image.map(bus);
+    EXPECT_EQ(bus.peek(0x107f), 0x00);
+    EXPECT_EQ(bus.peek(0x1080), 0x00);
+    EXPECT_EQ(bus.peek(0x1081), 0x07);
+    EXPECT_EQ(bus.peek(0x11ff), BYTE(0x17f * 7));
+    EXPECT_EQ(bus.peek(0x1200), 0xff);
+    EXPECT_FALSE(image.load(data_path, Image_format::RAW, 0xff00, error));
+    EXPECT_EQ(image.size(), 0);
+    EXPECT_EQ(image.page(0xff), nullptr);
+
+    // PRG: only the loaded bytes are copied
+    std::string prg_path = write_file(
+        "loader.prg", {0x01, 0x08, 0x0b, 0x08, 0x0a, 0x00, 0x9e, 0x32});
+    ASSERT_TRUE(image.load(prg_path, Image_format::AUTO, 0, error));
+    mem_t memory;
+    memory.fill(0x55);
+    image.copy_to(memory);
+    EXPECT_EQ(memory[0x0800], 0x55);
+    EXPECT_EQ(memory[0x0801], 0x0b);
+    EXPECT_EQ(memory[0x0806], 0x32);
+    EXPECT_EQ(memory[0x0807], 0x55);
+    EXPECT_FALSE(
+        image.load(write_file("short.prg", {0x01}), Image_format::AUTO, 0,
+                   error));
+
+    // Intel HEX, contiguous records merged, digits in either case
+    std::string hex = ":020000040000FA\r\n"
+                      ":10030000101112131415161718191A1B1C1D1E1F75\r\n"
+                      ":03031000A942609F\r\n"
+                      ":02040000dead6f\r\n"
+                      ":00000001FF\r\n";
+    std::string hex_path =
+        write_file("loader.hex", std::vector<BYTE>(hex.begin(), hex.end()));
+    ASSERT_TRUE(image.load(hex_path, Image_format::AUTO, 0, error)) << error;
+    EXPECT_EQ(image.size(), 0x15);
+    memory.fill(0);
+    image.copy_to(memory);
+    EXPECT_EQ(memory[0x0300], 0x10);
+    EXPECT_EQ(memory[0x030f], 0x1f);
+    EXPECT_EQ(memory[0x0311], 0x42);
+    EXPECT_EQ(memory[0x0313], 0x00);
+    EXPECT_EQ(memory[0x0401], 0xad);
+
+    hex[hex.find("9F")] = 'A';
+    hex_path =
+        write_file("bad.hex", std::vector<BYTE>(hex.begin(), hex.end()));
+    EXPECT_FALSE(image.load(hex_path, Image_format::AUTO, 0, error));
+    EXPECT_NE(error.find("line 3: bad checksum"), std::string::npos) << error;
+
+    // Data past an extended linear base of $FFFF0000 must not wrap back
+    // into the 16-bit space
+    hex = ":02000004FFFFFC\r\n"
+          ":02FFFF00AABB9B\r\n"
+          ":00000001FF\r\n";
+    hex_path =
+        write_file("wrap.hex", std::vector<BYTE>(hex.begin(), hex.end()));
+    EXPECT_FALSE(image.load(hex_path, Image_format::AUTO, 0, error));
+    EXPECT_NE(error.find("line 2: data outside"), std::string::npos) << error;
+
+    EXPECT_FALSE(image.load(::testing::TempDir() + "missing.bin",
+                            Image_format::RAW, 0, error));
+}
+
+TEST(TEST_PROFILE, COUNTS) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested
+        LDX #$05
+loop:   DEX
+        BNE loop
+done:   JMP done
+     */
+    std::array<BYTE, 8> program = {
+        0xa2, 0x05,       // LDX #$05
+        0xca,             // DEX
+        0xd0, 0xfd,       // BNE loop
+        0x4c, 0x05, 0x80, // JMP done
+    };
+
+    mem_t memory = {0};
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+    std::copy(program.begin(), program.end(), memory.begin() + start);
+
+    mem_t reference_memory = memory;
+    CPU reference(reference_memory);
+    reference.reset();
+    reference.run_until(0x8005, 1000);
+
+    CPU cpu(memory);
+    cpu.reset();
+    Profile profile;
+    EXPECT_EQ(cpu.run_until(0x8005, 1000, profile), 2 + 5 * 2 + 4 * 3 + 2);
+    EXPECT_EQ(cpu.pc, reference.pc);
+    EXPECT_EQ(cpu.cycles, reference.cycles);
+    EXPECT_EQ(cpu.x, 0);
+
+    EXPECT_EQ(profile.hits(0x8000), 1);
+    EXPECT_EQ(profile.hits(0x8002), 5);
+    EXPECT_EQ(profile.hits(0x8003), 5);
+    EXPECT_EQ(profile.hits(0x8005), 0);
+    EXPECT_EQ(profile.cycles(0x8002), 10);
+    EXPECT_EQ(profile.cycles(0x8003), 4 * 3 + 2);
+    EXPECT_EQ(profile.taken(0x8003), 4);
+    EXPECT_EQ(profile.not_taken(0x8003), 1);
+    EXPECT_EQ(profile.taken(0x8002), 0);
+    EXPECT_EQ(profile.not_taken(0x8002), 0);
+    EXPECT_EQ(profile.opcode_count(0xca), 5);
+    EXPECT_EQ(profile.opcode_cycle_count(0xd0), 14);
+    EXPECT_EQ(profile.instructions(), 11);
+    EXPECT_EQ(profile.total_cycles(), 26);
+
+    // Idle loops are still counted one instruction at a time
+    cpu.set_idle_skip(true);
+    cpu.run_for_cycles(300, profile);
+    EXPECT_EQ(profile.hits(0x8005), 100);
+    EXPECT_EQ(profile.total_cycles(), 26 + 300);
+
+    std::stringstream csv;
+    profile.write_pc_csv(csv);
+    std::string line;
+    std::getline(csv, line);
+    EXPECT_EQ(line, "pc,hits,cycles,taken,not_taken");
+    std::getline(csv, line);
+    EXPECT_EQ(line, "0x8005,100,300,0,0");
+    std::getline(csv, line);
+    EXPECT_EQ(line, "0x8003,5,14,4,1");
+
+    std::stringstream opcodes;
+    profile.write_opcode_csv(opcodes);
+    std::getline(opcodes, line);
+    EXPECT_EQ(line, "opcode,mnemonic,mode,count,cycles");
+    std::getline(opcodes, line);
+    EXPECT_EQ(line, "0x4C,JMP,ABSOLUTE,100,300");
+
+    std::stringstream binary;
+    profile.write(binary);
+    Profile loaded;
+    ASSERT_TRUE(loaded.read(binary));
+    for (WORD pc : {0x8000, 0x8002, 0x8003, 0x8005}) {
+        EXPECT_EQ(loaded.hits(pc), profile.hits(pc));
+        EXPECT_EQ(loaded.cycles(pc), profile.cycles(pc));
+        EXPECT_EQ(loaded.taken(pc), profile.taken(pc));
+        EXPECT_EQ(loaded.not_taken(pc), profile.not_taken(pc));
+    }
+    EXPECT_EQ(loaded.opcode_count(0xd0), 5);
+    EXPECT_EQ(loaded.total_cycles(), profile.total_cycles());
+
+    std::string truncated = binary.str();
+    truncated.pop_back();
+    std::stringstream corrupt(truncated);
+    EXPECT_FALSE(loaded.read(corrupt));
+    EXPECT_EQ(loaded.instructions(), 0);
+
+    /* A taken branch to the next instruction, and one not taken
+        SEC
+        BCS next
+next:   BCC next
+     */
+    std::array<BYTE, 5> zero_offset = {
+        0x38,       // SEC
+        0xb0, 0x00, // BCS next
+        0x90, 0x00, // BCC next
+    };
+    memory.fill(0);
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+    std::copy(zero_offset.begin(), zero_offset.end(), memory.begin() + start);
+    cpu.reset();
+    cpu.set_idle_skip(false);
+    profile.clear();
+    cpu.run_until(0x8005, 1000, profile);
+    EXPECT_EQ(profile.cycles(0x8001), 3);
+    EXPECT_EQ(profile.taken(0x8001), 1);
+    EXPECT_EQ(profile.not_taken(0x8001), 0);
+    EXPECT_EQ(profile.taken(0x8003), 0);
+    EXPECT_EQ(profile.not_taken(0x8003), 1);
+}
+
+TEST(TEST_FUSION, MATCHES_UNFUSED) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested: copy loops under a timer IRQ
+        CLI
+start:  LDX #$08
+outer:  LDY #$00
+copy:   LDA $2000,Y     ; fused pair
+        STA $3000,Y
+        INY             ; fused triple
+        CPY #$40
+        BNE copy
+        LDA $10         ; fused triple
+        CLC
+        ADC #$03
+        STA $10
+        DEX             ; fused pair
+        BNE outer
+        LDA $D000       ; never fused: reads a device
+        STA $0211
+        INC $12
+        JMP start
+irq:    PHA             ; $9000
+        LDA $D000       ; acknowledge the timer
+        INC $13
+        PLA
+        RTI
+     */
+    std::array<BYTE, 37> program = {
+        0x58,             // CLI
+        0xa2, 0x08,       // LDX #$08
+        0xa0, 0x00,       // LDY #$00
+        0xb9, 0x00, 0x20, // LDA $2000,Y
+        0x99, 0x00, 0x30, // STA $3000,Y
+        0xc8,             // INY
+        0xc0, 0x40,       // CPY #$40
+        0xd0, 0xf5,       // BNE copy
+        0xa5, 0x10,       // LDA $10
+        0x18,             // CLC
+        0x69, 0x03,       // ADC #$03
+        0x85, 0x10,       // STA $10
+        0xca,             // DEX
+        0xd0, 0xe9,       // BNE outer
+        0xad, 0x00, 0xd0, // LDA $D000
+        0x8d, 0x11, 0x02, // STA $0211
+        0xe6, 0x12,       // INC $12
+        0x4c, 0x01, 0x80, // JMP start
+    };
+    std::array<BYTE, 8> irq = {
+        0x48,             // PHA
+        0xad, 0x00, 0xd0, // LDA $D000
+        0xe6, 0x13,       // INC $13
+        0x68,             // PLA
+        0x40,             // RTI
+    };
+
+    // A timer on page $D0 raising IRQ every 250 cycles; reads count up
+    struct Machine : Test_machine {
+        BYTE reads;
+        event_callback_t tick;
+
+        Machine(const std::array<BYTE, 37> &program,
+                const std::array<BYTE, 8> &irq, WORD start)
+            : reads(0) {
+            memory[0xfffc] = start & 0xff;
+            memory[0xfffd] = (start >> 8) & 0xff;
+            memory[0xfffe] = 0x00;
+            memory[0xffff] = 0x90;
+            for (int i = 0; i < 0x100; i++) {
+                memory[0x2000 + i] = i * 11;
+            }
+            std::copy(program.begin(), program.end(),
+                      memory.begin() + start);
+            std::copy(irq.begin(), irq.end(), memory.begin() + 0x9000);
+            bus.map_device(
+                0xd0, 1,
+                [this](WORD) {
+                    cpu.set_irq(0, false);
+                    return reads++;
+                },
+                [](WORD, BYTE) {});
+            tick = [this](uint64_t cycle) {
+                cpu.set_irq(0, true);
+                bus.get_scheduler().schedule(cycle + 250, tick);
+            };
+            cpu.reset();
+            bus.get_scheduler().schedule(cpu.cycles + 250, tick);
+        }
+    };
+
+    auto expect_same = [](Machine &machine, Machine &expected) {
+        EXPECT_EQ(machine.cpu.cycles, expected.cpu.cycles);
+        EXPECT_EQ(machine.cpu.pc, expected.cpu.pc);
+        EXPECT_EQ(machine.cpu.a, expected.cpu.a);
+        EXPECT_EQ(machine.cpu.x, expected.cpu.x);
+        EXPECT_EQ(machine.cpu.y, expected.cpu.y);
+        EXPECT_EQ(machine.cpu.sp, expected.cpu.sp);
+        EXPECT_EQ(machine.cpu.get_p(), expected.cpu.get_p());
+        EXPECT_EQ(machine.reads, expected.reads);
+        EXPECT_TRUE(machine.memory == expected.memory);
+    };
+
+    Machine interpreted(program, irq, start);
+    Machine fused(program, irq, start);
+    Block_cache cache(fused.cpu);
+
+    // Odd budgets end runs inside fused sequences
+    for (int i = 0; i < 2000; i++) {
+        EXPECT_EQ(cache.run_for_cycles(37), interpreted.cpu.run_for_cycles(37));
+    }
+    expect_same(fused, interpreted);
+    EXPECT_GT(interpreted.memory[0x13], 0);
+    EXPECT_EQ(interpreted.memory[0x3000 + 0x3f], BYTE(0x3f * 11));
+    // The four in the loops, and more in blocks entered where an
+    // interrupt returned
+    EXPECT_GE(cache.fusions(), 4);
+
+    // Stops inside a fused sequence as well as at its start
+    for (WORD address : {0x800c, 0x800e, 0x8012, 0x8017, 0x801d}) {
+        cache.run_until(address, 100000);
+        interpreted.cpu.run_until(address, 100000);
+        EXPECT_EQ(fused.cpu.pc, address);
+        expect_same(fused, interpreted);
+    }
+
+    // Unfused decoding takes the same path
+    Machine unfused(program, irq, start);
+    Block_cache plain(unfused.cpu);
+    plain.set_fusion(false);
+    Machine reference(program, irq, start);
+    plain.run_for_cycles(50000);
+    reference.cpu.run_for_cycles(50000);
+    expect_same(unfused, reference);
+    EXPECT_EQ(plain.fusions(), 0);
+
+    // A profile of the program ranks its hot sequences first
+    Machine profiled(program, irq, start);
+    Profile profile;
+    profiled.cpu.run_for_cycles(50000, profile);
+    std::vector<Fusion_candidate> candidates =
+        rank_fusions(profile, profiled.bus, 4);
+    ASSERT_EQ(candidates.size(), 4);
+    EXPECT_EQ(candidates[0].rule.length, 3);
+    EXPECT_EQ(candidates[0].rule.opcodes[0], 0xc8);
+    EXPECT_EQ(candidates[0].rule.opcodes[1], 0xc0);
+    EXPECT_EQ(candidates[0].rule.opcodes[2], 0xd0);
+    EXPECT_EQ(candidates[0].saved, 2 * profile.hits(0x800b));
+    for (const Fusion_candidate &candidate : candidates) {
+        EXPECT_TRUE(fusable_prefix(candidate.rule.opcodes[0]));
+        // Reading $D000 is only ranked as the last of a sequence
+        EXPECT_NE(candidate.rule.opcodes[0], 0xad);
+    }
+
+    std::stringstream table;
+    write_fusion_table(table, candidates, "profile.bin");
+    std::string line;
+    std::getline(table, line);
+    EXPECT_EQ(line, "// Generated by mos6502_fusion from profile.bin; do not "
+                    "edit.");
+    EXPECT_NE(table.str().find("std::array<Fusion_rule, 4> fusion_table"),
+              std::string::npos);
+    EXPECT_NE(table.str().find("{{0xc8, 0xc0, 0xd0}, 3}, // INY; CPY "
+                               "IMMEDIATE; BNE RELATIVE"),
+              std::string::npos);
+}
+
+#ifdef MOS6502_JIT
+TEST(TEST_JIT, DIFFERENTIAL) {
+    // Random straight-line loop bodies over the translated subset, with
+    // indexed accesses crossing pages and reaching into a device page
+    const std::array<INSTRUCTION, 35> pool = {
+        INSTRUCTION::ADC, INSTRUCTION::AND, INSTRUCTION::ASL, INSTRUCTION::BIT,
+        INSTRUCTION::CLC, INSTRUCTION::CLV, INSTRUCTION::CMP, INSTRUCTION::CPX,
+        INSTRUCTION::CPY, INSTRUCTION::DEC, INSTRUCTION::DEX, INSTRUCTION::DEY,
+        INSTRUCTION::EOR, INSTRUCTION::INC, INSTRUCTION::INX, INSTRUCTION::INY,
+        INSTRUCTION::LDA, INSTRUCTION::LDX, INSTRUCTION::LDY, INSTRUCTION::LSR,
+        INSTRUCTION::NOP, INSTRUCTION::ORA, INSTRUCTION::ROL, INSTRUCTION::ROR,
+        INSTRUCTION::SBC, INSTRUCTION::SEC, INSTRUCTION::STA, INSTRUCTION::STX,
+        INSTRUCTION::STY, INSTRUCTION::TAX, INSTRUCTION::TAY, INSTRUCTION::TSX,
+        INSTRUCTION::TXA, INSTRUCTION::TXS, INSTRUCTION::TYA,
+    };
+    std::vector<BYTE> opcodes;
+    for (int opcode = 0; opcode < 0x100; opcode++) {
+        const Instruction_info &info = lookup_table[opcode];
+        bool indirect = info.mode == ADDRESSING_MODE::INDIRECT_X ||
+                        info.mode == ADDRESSING_MODE::INDIRECT_Y;
+        if (!indirect && std::find(pool.begin(), pool.end(), info.ins) !=
+                             pool.end()) {
+            opcodes.push_back(opcode);
+        }
+    }
+
+    uint32_t seed = 0x6502;
+    auto random = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) & 0xff;
+    };
+
+    for (int round = 0; round < 16; round++) {
+        WORD start = 0x8000;
+        mem_t memory = {0};
+        memory[0xfffc] = start & 0xff;
+        memory[0xfffd] = (start >> 8) & 0xff;
+        for (int i = 0; i < 0x200; i++) {
+            memory[0x2000 + i] = random();
+        }
+
+        // body: 24 random instructions; DEC $ff; BNE body; JMP body
+        WORD addr = start;
+        for (int i = 0; i < 24; i++) {
+            BYTE opcode = opcodes[random() % opcodes.size()];
+            const Instruction_info &info = lookup_table[opcode];
+            WORD operand = random();
+            if (info.mode == ADDRESSING_MODE::ZEROPAGE ||
+                info.mode == ADDRESSING_MODE::ZEROPAGE_X ||
+                info.mode == ADDRESSING_MODE::ZEROPAGE_Y) {
+                operand &= 0x7f;
+            } else if (info.mode == ADDRESSING_MODE::ABSOLUTE) {
+                operand += 0x2000;
+            } else if (info.mode == ADDRESSING_MODE::ABSOLUTE_X ||
+                       info.mode == ADDRESSING_MODE::ABSOLUTE_Y) {
+                operand += (random() & 1) ? 0x2080 : 0x3f80;
+            }
+            memory[addr++] = opcode;
+            if (info.bytes >= 2) {
+                memory[addr++] = operand & 0xff;
+            }
+            if (info.bytes == 3) {
+                memory[addr++] = operand >> 8;
+            }
+        }
+        for (BYTE byte : {0xc6, 0xff, 0xd0, 0x00, 0x4c, 0x00, 0x80}) {
+            memory[addr++] = byte;
+        }
+        // Branch back over the whole body
+        memory[addr - 4] = start - (addr - 3);
+
+        mem_t expected = memory;
+        mem_t reference_memory = memory;
+
+        // Device page at $4000 reading back the low address byte
+        auto device = [](Bus &bus) {
+            bus.map_device(
+                0x40, 1, [](WORD addr) { return BYTE(addr & 0xff); },
+                [](WORD, BYTE) {});
+        };
+
+        CPU interpreter(expected);
+        device(interpreter.get_bus());
+        interpreter.reset();
+        uint64_t interpreter_cycles = interpreter.run_for_cycles(200000);
+
+        CPU reference(reference_memory);
+        device(reference.get_bus());
+        reference.reset();
+
+        CPU cpu(memory);
+        device(cpu.get_bus());
+        cpu.reset();
+        Block_cache cache(cpu);
+        cache.set_jit(true);
+        cache.set_reference(&reference);
+        uint64_t cycles = cache.run_for_cycles(200000);
+
+        EXPECT_GT(cache.translations(), 0) << "round " << round;
+        EXPECT_EQ(cache.mismatches(), 0) << "round " << round;
+        EXPECT_EQ(cycles, interpreter_cycles) << "round " << round;
+        EXPECT_EQ(cpu.pc, interpreter.pc) << "round " << round;
+        EXPECT_EQ(cpu.a, interpreter.a) << "round " << round;
+        EXPECT_EQ(cpu.x, interpreter.x) << "round " << round;
+        EXPECT_EQ(cpu.y, interpreter.y) << "round " << round;
+        EXPECT_EQ(cpu.sp, interpreter.sp) << "round " << round;
+        EXPECT_EQ(cpu.get_p(), interpreter.get_p()) << "round " << round;
+        EXPECT_TRUE(memory == expected) << "round " << round;
+    }
+}
+
+TEST(TEST_JIT, DEVICE_READ_IRQ) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested
+        CLI
+loop:   INX
+        LDA $4000,X ; device: asserts IRQ on its 300th read
+        STA $20
+        INY
+        INY
+        INY
+        JMP loop
+
+irq:    STY $30     ; Y as the interrupt found it
+        STA $4000   ; releases IRQ
+        RTI
+     */
+    mem_t memory = {0};
+    memory[0xfffc] = start & 0xff;
+    memory[0xfffd] = (start >> 8) & 0xff;
+    memory[0xfffe] = 0x00;
+    memory[0xffff] = 0x90;
+    const std::vector<BYTE> program = {0x58, 0xe8, 0xbd, 0x00, 0x40,
+                                       0x85, 0x20, 0xc8, 0xc8, 0xc8,
+                                       0x4c, 0x01, 0x80};
+    std::copy(program.begin(), program.end(), memory.begin() + start);
+    const std::vector<BYTE> handler = {0x84, 0x30, 0x8d, 0x00, 0x40, 0x40};
+    std::copy(handler.begin(), handler.end(), memory.begin() + 0x9000);
+
+    // IRQ asserted from inside the read, the interrupt entry cycle noted
+    struct Device {
+        int reads = 0;
+        std::vector<uint64_t> entries;
+    };
+    auto device = [](CPU &cpu, Device &state) {
+        cpu.get_bus().map_device(
+            0x40, 1,
+            [&cpu, &state](WORD addr) {
+                if (++state.reads % 300 == 0) {
+                    cpu.set_irq(0, true);
+                }
+                return BYTE(addr);
+            },
+            [&cpu, &state](WORD, BYTE) {
+                state.entries.push_back(cpu.cycles);
+                cpu.set_irq(0, false);
+            });
+    };
+
+    mem_t expected = memory;
+    Device interpreter_device;
+    CPU interpreter(expected);
+    device(interpreter, interpreter_device);
+    interpreter.reset();
+    interpreter.run_for_cycles(100000);
+
+    // No reference CPU: it steps without taking interrupts
+    Device jit_device;
+    CPU cpu(memory);
+    device(cpu, jit_device);
+    cpu.reset();
+    Block_cache cache(cpu);
+    cache.set_jit(true);
+    cache.run_for_cycles(100000);
+
+    EXPECT_GT(cache.translations(), 0);
+    EXPECT_GT(interpreter_device.entries.size(), 2);
+    EXPECT_EQ(jit_device.entries, interpreter_device.entries);
+    EXPECT_EQ(memory[0x0030], expected[0x0030]);
+    EXPECT_EQ(cpu.cycles, interpreter.cycles);
+    EXPECT_EQ(cpu.y, interpreter.y);
+}
+
+TEST(TEST_JIT, SELF_MODIFYING) {
+    WORD start = 0x8000;
+
+    /* Assembly to be tested
+        LDX #$00
+loop:   INX
+        TXA
+        STA $8180,X     ; lands next to the code at $8100 for X < $80
+        CLC
+        ADC #$03
+        JMP check
+        ...
+check:  CPX #$C8        ; $8100
+        BEQ done
+        JMP loop
+done:   JMP done
+     */
+    std::array<BYTE, 13> loop = {
+        0xa2, 0x00,       // LDX #$00
+        0xe8,             // INX
+        0x8a,             // TXA
+        0x9d, 0x80, 0x81, // STA $8180,X
+        0x18,             // CLC
+        0x69, 0x03,       // ADC #$03
+        0x4c, 0x00, 0x81, // JMP $8100
+    };
+    std::array<BYTE, 10> check = {
+        0xe0, 0xc8,       // CPX #$C8
+        0xf0, 0x03,       // BEQ $8107
+        0x4c, 0x02, 0x80, // JMP $8002
+        0x4c, 0x07, 0x81, // JMP $8107
+    };
+    WORD done = 0x8107;
+
+    mem_t expected = {0};
+    mem_t reference_memory = {0};
+    mem_t memory = {0};
+    for (mem_t *m : {&expected, &reference_memory, &memory}) {
+        (*m)[0xfffc] = start & 0xff;
+        (*m)[0xfffd] = (start >> 8) & 0xff;
+        std::copy(loop.begin(), loop.end(), m->begin() + start);
+        std::copy(check.begin(), check.end(), m->begin() + 0x8100);
+    }
+
+    CPU interpreter(expected);
+    interpreter.reset();
+    uint64_t interpreter_cycles = interpreter.run_until(done, 100000);
+
+    CPU reference(reference_memory);
+    reference.reset();
+
+    // The hot loop block is translated, then its store keeps retiring the
+    // block at $8100 and has to leave native code right after it
+    CPU cpu(memory);
+    cpu.reset();
+    Block_cache cache(cpu);
+    cache.set_jit(true);
+    cache.set_reference(&reference);
+    uint64_t cycles = cache.run_until(done, 100000);
+
+    EXPECT_EQ(cpu.a, 0xcb);
+    EXPECT_GT(cache.translations(), 0);
+    EXPECT_EQ(cache.mismatches(), 0);
+    EXPECT_EQ(cycles, interpreter_cycles);
+    EXPECT_EQ(cpu.pc, interpreter.pc);
+    EXPECT_EQ(cpu.a, interpreter.a);
+    EXPECT_EQ(cpu.x, interpreter.x);
+    EXPECT_EQ(cpu.get_p(), interpreter.get_p());
+    EXPECT_TRUE(memory == expected);
+}
+#endif
+
+// Generated by mos6502_aot from test/aot_rom.hex at build time
+extern const Aot_program aot_test_program;
+
+TEST(TEST_AOT, MATCHES_INTERPRETER) {
+    /* test/aot_rom.hex, at $F000: fill $0300-$03FF through a subroutine,
+       checksum it, then jump through a RAM vector to code the generator
+       only knows from --entry, under a timer IRQ and a few NMIs
+
+reset:  LDX #$FF
+        TXS
+        LDA #<target
+        STA $0200
+        LDA #>target
+        STA $0201
+        LDA #$F8
+        STA $20
+        LDA #$02
+        STA $21
+        CLI
+main:   LDY #0
+fill:   TYA
+        JSR mix
+        STA $0300,Y
+        INY
+        BNE fill
+        LDX #0
+        CLC
+sum:    ADC $0300,X
+        ROL $10
+        EOR $03F0,X
+        INX
+        BNE sum
+        STA $11
+        INC $12
+        JMP ($0200)
+target: LDA $12         ; $F037
+        AND #7
+        BNE main
+        SEC
+        SBC $11
+        STA $13
+        BIT $13
+        BVS skip
+        LSR $13
+skip:   PHP
+        PLP
+        LDY $12
+        LDA ($20),Y
+        STA $14
+        DEC $15
+        LDX $15
+        STA $0500,X
+        JMP main
+mix:    ASL A
+        ADC #$37
+        CMP #$80
+        BCC mixd
+        EOR #$5A
+mixd:   RTS
+irq:    PHA
+        LDA $D000       ; acknowledge the timer
+        INC $16
+        PLA
+        RTI
+nmi:    INC $17
+        RTI
+     */
+    struct Machine : Test_machine {
+        int fired;
+        event_callback_t tick;
+
+        Machine() : fired(0) {
+            for (std::size_t i = 0; i < aot_test_program.n_pages; i++) {
+                const Aot_page &page = aot_test_program.pages[i];
+                bus.map_rom(page.page, 1, page.data);
+            }
+            bus.map_device(
+                0xd0, 1,
+                [this](WORD) {
+                    cpu.set_irq(0, false);
+                    return BYTE(0);
+                },
+                [](WORD, BYTE) {});
+            tick = [this](uint64_t cycle) {
+                cpu.set_irq(0, true);
+                fired++;
+                bus.get_scheduler().schedule(cycle + 250, tick);
+            };
+            cpu.reset();
+            Scheduler &events = bus.get_scheduler();
+            events.schedule(cpu.cycles + 250, tick);
+            for (uint64_t cycle : {5003, 77777, 150001}) {
+                events.schedule(cycle, [this](uint64_t) { cpu.nmi(); });
+            }
+        }
+    };
+
+    auto expect_same = [](Machine &machine, Machine &expected) {
+        EXPECT_EQ(machine.cpu.cycles, expected.cpu.cycles);
+        EXPECT_EQ(machine.cpu.pc, expected.cpu.pc);
+        EXPECT_EQ(machine.cpu.a, expected.cpu.a);
+        EXPECT_EQ(machine.cpu.x, expected.cpu.x);
+        EXPECT_EQ(machine.cpu.y, expected.cpu.y);
+        EXPECT_EQ(machine.cpu.sp, expected.cpu.sp);
+        EXPECT_EQ(machine.cpu.get_p(), expected.cpu.get_p());
+        EXPECT_EQ(machine.fired, expected.fired);
+        EXPECT_TRUE(machine.memory == expected.memory);
+    };
+
+    Machine interpreted;
+    interpreted.cpu.run_for_cycles(200000);
+    // The checksum loop ran, and the IRQ and NMI handlers too
+    EXPECT_GT(interpreted.memory[0x12], 0);
+    EXPECT_GT(interpreted.memory[0x16], 0);
+    EXPECT_EQ(interpreted.memory[0x17], 3);
+
+    Machine recompiled;
+    Aot_runner runner(recompiled.cpu, aot_test_program);
+    EXPECT_TRUE(runner.active());
+    runner.run_for_cycles(200000);
+    expect_same(recompiled, interpreted);
+
+    // Stops on the first instruction at the address, which recompiled
+    // code only reaches through JMP ($0200)
+    interpreted.cpu.run_until(0xf037, 100000);
+    runner.run_until(0xf037, 100000);
+    EXPECT_EQ(recompiled.cpu.pc, 0xf037);
+    expect_same(recompiled, interpreted);
+
+    // Once the ROM is copied into RAM it may change, so the interpreter
+    // takes over
+    for (std::size_t i = 0; i < aot_test_program.n_pages; i++) {
+        const Aot_page &page = aot_test_program.pages[i];
+        for (Machine *machine : {&interpreted, &recompiled}) {
+            std::copy(page.data, page.data + 0x100,
+                      machine->memory.begin() + (page.page << 8));
+            machine->bus.map_ram(page.page, 1,
+                                 &machine->memory[page.page << 8]);
+        }
+    }
+    EXPECT_FALSE(runner.active());
+    interpreted.cpu.run_for_cycles(20000);
+    runner.run_for_cycles(20000);
+    expect_same(recompiled, interpreted);
+}
+
+TEST(TEST_THREADED, MATCHES_STEP) {
+    // The AOT test ROM under two timer IRQs and an NMI, through the run
+    // loops and through step() one instruction at a time. A timer firing
+    // inside the handler leaves an IRQ due right after RTI.
+    struct Machine : Test_machine {
+        int fired;
+        event_callback_t tick;
+        event_callback_t tock;
+
+        Machine() : fired(0) {
+            for (std::size_t i = 0; i < aot_test_program.n_pages; i++) {
+                const Aot_page &page = aot_test_program.pages[i];
+                bus.map_rom(page.page, 1, page.data);
+            }
+            bus.map_device(
+                0xd0, 1,
+                [this](WORD) {
+                    cpu.set_irq(0, false);
+                    cpu.set_irq(1, false);
+                    return BYTE(0);
+                },
+                [](WORD, BYTE) {});
+            tick = [this](uint64_t cycle) {
+                cpu.set_irq(0, true);
+                fired++;
+                bus.get_scheduler().schedule(cycle + 173, tick);
+            };
+            tock = [this](uint64_t cycle) {
+                cpu.set_irq(1, true);
+                fired++;
+                bus.get_scheduler().schedule(cycle + 97, tock);
+            };
+            cpu.reset();
+            Scheduler &events = bus.get_scheduler();
+            events.schedule(cpu.cycles + 173, tick);
+            events.schedule(cpu.cycles + 97, tock);
+            events.schedule(40001, [this](uint64_t) { cpu.nmi(); });
+        }
+
+        // What run_for_cycles() and run_until() do, one step at a time
+        void step_until(uint64_t end, int address) {
+            Scheduler &events = bus.get_scheduler();
+            while (cpu.cycles < end && cpu.pc != address) {
+                if (events.next_cycle() <= cpu.cycles) {
+                    events.run_due(cpu.cycles);
+                } else {
+                    cpu.step();
+                }
+            }
+            events.run_due(cpu.cycles);
+        }
+    };
+
+    Machine run;
+    Machine stepped;
+    // Odd budgets stop the threaded loop at every kind of handler
+    for (int i = 0; i < 3000; i++) {
+        run.cpu.run_for_cycles(29);
+        stepped.step_until(stepped.cpu.cycles + 29, -1);
+        ASSERT_EQ(run.cpu.cycles, stepped.cpu.cycles);
+        ASSERT_EQ(run.cpu.pc, stepped.cpu.pc);
+    }
+    for (WORD address : {0xf037, 0xf063, 0xf064}) {
+        run.cpu.run_until(address, 100000);
+        stepped.step_until(stepped.cpu.cycles + 100000, address);
+        EXPECT_EQ(run.cpu.pc, address);
+    }
+    EXPECT_EQ(run.cpu.cycles, stepped.cpu.cycles);
+    EXPECT_EQ(run.cpu.a, stepped.cpu.a);
+    EXPECT_EQ(run.cpu.x, stepped.cpu.x);
+    EXPECT_EQ(run.cpu.y, stepped.cpu.y);
+    EXPECT_EQ(run.cpu.sp, stepped.cpu.sp);
+    EXPECT_EQ(run.cpu.get_p(), stepped.cpu.get_p());
+    EXPECT_EQ(run.fired, stepped.fired);
+    EXPECT_GT(run.memory[0x16], 0);
+    EXPECT_EQ(run.memory[0x17], 1);
+    EXPECT_TRUE(run.memory == stepped.memory);
+}
+
+namespace {
+// Run image from start until it traps in an instruction jumping or
+// branching to itself, once on each engine: the interpreter, the block
+// cache and, when built in, its native tier. Expects the trap at pass;
+// describe() adds the image's own account of a failure.
+template <typename Describe>
+void expect_functional_pass(const mem_t &image, WORD start, WORD pass,
+                            Describe describe) {
+    static const char *const engines[] = {
+        "interpreter",
+        "block cache",
+#ifdef MOS6502_JIT
+        "native tier",
+#endif
+    };
+    for (std::size_t engine = 0; engine < std::size(engines); engine++) {
+        auto memory = std::make_unique<mem_t>(image);
+        CPU cpu(*memory);
+        cpu.reset();
+        cpu.pc = start;
+        Block_cache cache(cpu);
+#ifdef MOS6502_JIT
+        cache.set_jit(engine == 2);
+#endif
+        auto run = [&](uint64_t n_cycles) {
+            if (engine == 0) {
+                cpu.run_for_cycles(n_cycles);
+            } else {
+                cache.run_for_cycles(n_cycles);
+            }
+        };
+
+        int trap = -1;
+        while (trap < 0 && cpu.cycles < 1000000000) {
+            run(10000);
+            WORD at = cpu.pc;
+            run(1);
+            if (cpu.pc == at) {
+                trap = at;
+            }
+        }
+        EXPECT_EQ(trap, pass)
+            << engines[engine] << ": trapped at $" << std::hex << trap
+            << std::dec << " after " << cpu.cycles << " cycles, "
+            << describe(*memory, cpu);
+    }
+}
+} // namespace
+
+#ifdef MOS6502_FUNCTIONAL_TESTS_DIR
+TEST(TEST_FUNCTIONAL, KLAUS_DORMANN) {
+    // 6502_functional_test.bin from the suite's bin_files: a full 64 KiB
+    // image, or one loading at $000A. Starts at $0400 and traps at
+    // MOS6502_FUNCTIONAL_TESTS_SUCCESS once every test passed, or
+    // elsewhere with the failing test's number at $0200.
+    std::string path = std::string(MOS6502_FUNCTIONAL_TESTS_DIR) +
+                       "/6502_functional_test.bin";
+    Rom_image image;
+    std::string error;
+    ASSERT_TRUE(image.load(path, Image_format::RAW, 0x0000, error)) << error;
+    if (image.size() < 0x10000) {
+        ASSERT_TRUE(image.load(path, Image_format::RAW, 0x000a, error))
+            << error;
+    }
+    auto memory = std::make_unique<mem_t>();
+    memory->fill(0);
+    image.copy_to(*memory);
+
+    expect_functional_pass(*memory, 0x0400, MOS6502_FUNCTIONAL_TESTS_SUCCESS,
+                           [](const mem_t &memory, const CPU &) {
+                               return "test case " +
+                                      std::to_string(memory[0x0200]);
+                           });
+}
+#endif
+
+TEST(TEST_FUNCTIONAL, DECIMAL) {
+    /* test/decimal_rom.hex, at $0200: Bruce Clark's exhaustive decimal
+       mode test from "Decimal Mode" appendix B, checking A, N, V, Z and C
+       of ADC and SBC against his 6502 predictions for every N1, N2 and
+       carry. Traps at $020A when they all match, at $020D otherwise, with
+       the failing operands in N1, N2 and Y.
+
+N1      = $00
+N2      = $01
+HA      = $02
+HNVZC   = $03
+DA      = $04
+DNVZC   = $05
+AR      = $06
+NF      = $07
+VF      = $08
+ZF      = $09
+CF      = $0A
+ERROR   = $0B
+N1L     = $0C
+N1H     = $0D
+N2L     = $0E
+N2H     = $0F           ; and $10
+
+start:  LDX #$FF
+        TXS
+        JSR test
+        LDA ERROR
+        BNE fail
+pass:   JMP pass
+fail:   JMP fail
+test:   LDY #1          ; carry in, 1 then 0
+        STY ERROR
+        LDA #0
+        STA N1
+        STA N2
+loop1:  LDA N2
+        AND #$0F
+        STA N2L
+        LDA N2
+        AND #$F0
+        STA N2H
+        ORA #$0F
+        STA N2H+1
+loop2:  LDA N1
+        AND #$0F
+        STA N1L
+        LDA N1
+        AND #$F0
+        STA N1H
+        JSR add
+        JSR a6502
+        JSR compare
+        BNE done
+        JSR sub
+        JSR s6502
+        JSR compare
+        BNE done
+        INC N1
+        BNE loop2
+        INC N2
+        BNE loop1
+        DEY
+        BPL loop1
+        LDA #0
+        STA ERROR
+done:   RTS
+add:    SED             ; actual decimal result and flags
+        CPY #1
+        LDA N1
+        ADC N2
+        STA DA
+        PHP
+        PLA
+        STA DNVZC
+        CLD             ; binary result and flags
+        CPY #1
+        LDA N1
+        ADC N2
+        STA HA
+        PHP
+        PLA
+        STA HNVZC
+        CPY #1          ; predicted: adjust the low digit...
+        LDA N1L
+        ADC N2L
+        CMP #$0A
+        LDX #0
+        BCC a1
+        INX
+        ADC #5
+        AND #$0F
+        SEC
+a1:     ORA N1H         ; ...then add the high digits, N and V from here
+        ADC N2H,X
+        PHP
+        BCS a2
+        CMP #$A0
+        BCC a3
+a2:     ADC #$5F
+        SEC
+a3:     STA AR
+        PHP
+        PLA
+        STA CF
+        PLA
+        STA VF
+        RTS
+sub:    SED
+        CPY #1
+        LDA N1
+        SBC N2
+        STA DA
+        PHP
+        PLA
+        STA DNVZC
+        CLD
+        CPY #1
+        LDA N1
+        SBC N2
+        STA HA
+        PHP
+        PLA
+        STA HNVZC
+        RTS
+sub1:   CPY #1          ; predicted SBC result
+        LDA N1L
+        SBC N2L
+        LDX #0
+        BCS s11
+        INX
+        SBC #5
+        AND #$0F
+        CLC
+s11:    ORA N1H
+        SBC N2H,X
+        BCS s12
+        SBC #$5F
+s12:    STA AR
+        RTS
+compare:
+        LDA DA
+        CMP AR
+        BNE c1
+        LDA DNVZC
+        EOR NF
+        AND #$80
+        BNE c1
+        LDA DNVZC
+        EOR VF
+        AND #$40
+        BNE c1
+        LDA DNVZC
+        EOR ZF
+        AND #2
+        BNE c1
+        LDA DNVZC
+        EOR CF
+        AND #1
+c1:     RTS
+a6502:  LDA VF          ; N with V, Z from the binary sum
+        STA NF
+        LDA HNVZC
+        STA ZF
+        RTS
+s6502:  JSR sub1        ; N, V, Z and C from the binary difference
+        LDA HNVZC
+        STA NF
+        STA VF
+        STA ZF
+        STA CF
+        RTS
+     */
+    Rom_image image;
+    std::string error;
+    ASSERT_TRUE(image.load(MOS6502_DECIMAL_ROM, Image_format::INTEL_HEX, 0,
+                           error))
+        << error;
+    auto memory = std::make_unique<mem_t>();
+    memory->fill(0);
+    image.copy_to(*memory);
+
+    expect_functional_pass(*memory, 0x0200, 0x020a,
+                           [](const mem_t &memory, const CPU &cpu) {
+                               return "N1 " + std::to_string(memory[0x00]) +
+                                      ", N2 " + std::to_string(memory[0x01]) +
+                                      ", carry " + std::to_string(cpu.y);
+                           });
+}
@@ -0,0 +1,476 @@
+#include <Loader.hpp>
+#include <Opcodes.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace mos6502;
+
+namespace {
+// Instructions per block at most, so a block fits most cycle budgets
+constexpr int MAX_BLOCK_LENGTH = 32;
+
+void usage(const char *program) {
+    std::cerr
+        << "Usage: " << program
+        << " [--format raw|hex|prg] [--origin ADDR] [--entry ADDR]...\n"
+        << "       [--name NAME] <rom_file> <output.cpp>\n"
+        << "  --origin  load address of a raw image, default 0\n"
+        << "  --entry   extra code address, beyond the NMI, RESET and IRQ "
+           "vectors\n"
+        << "  --name    name of the Aot_program to define, default "
+           "aot_program\n";
+}
+
+bool parse_address(const char *text, WORD &address) {
+    char *end;
+    unsigned long value = std::strtoul(text, &end, 0);
+    if (*end != '\0' || value > 0xffff) {
+        return false;
+    }
+    address = value;
+    return true;
+}
+
+std::string hex(unsigned value, int digits) {
+    char text[8];
+    std::snprintf(text, sizeof(text), "%0*x", digits, value);
+    return text;
+}
+
+class Recompiler {
+  private:
+    const Rom_image &image;
+
+    // Decoded instructions by address, and the addresses blocks start at
+    std::set<WORD> decoded;
+    std::set<WORD> leaders;
+
+    bool covered(uint32_t addr) const {
+        return addr <= 0xffff && image.page(addr >> 8) != nullptr;
+    }
+
+    BYTE byte(WORD addr) const { return image.page(addr >> 8)[addr & 0xff]; }
+
+    WORD word(WORD addr) const {
+        return byte(addr) | (byte(WORD(addr + 1)) << 8);
+    }
+
+    // Whole instruction at addr, in the image and documented
+    bool valid(WORD addr) const {
+        if (!covered(addr)) {
+            return false;
+        }
+        const Instruction_info &info = lookup_table[byte(addr)];
+        return info.ins != INSTRUCTION::INVALID &&
+               covered(addr + info.bytes - 1);
+    }
+
+    WORD operand(WORD addr) const {
+        switch (lookup_table[byte(addr)].bytes) {
+        case 2:
+            return byte(addr + 1);
+        case 3:
+            return word(addr + 1);
+        default:
+            return 0x0000;
+        }
+    }
+
+    static bool is_branch(INSTRUCTION ins);
+    static bool ends_block(INSTRUCTION ins);
+
+    // Addresses control can pass to after the instruction at addr, other
+    // than by falling through
+    std::vector<WORD> targets(WORD addr) const;
+
+    std::string disassemble(WORD addr) const;
+
+    // Whether a memory access or a change to I can make an interrupt due
+    static bool may_raise(const Instruction_info &info);
+
+    // Instructions of the block at leader
+    std::vector<WORD> block(WORD leader) const;
+
+  public:
+    explicit Recompiler(const Rom_image &image) : image(image) {}
+
+    // Follow control flow from entry
+    void trace(WORD entry);
+
+    // Start a block at every address a block cut at the length limit
+    // continues at
+    void split_long_blocks();
+
+    void emit(std::ostream &os, const std::string &name,
+              const std::string &source) const;
+
+    std::size_t instructions() const { return decoded.size(); }
+    std::size_t blocks() const { return leaders.size(); }
+};
+
+bool Recompiler::is_branch(INSTRUCTION ins) {
+    switch (ins) {
+    case INSTRUCTION::BCC:
+    case INSTRUCTION::BCS:
+    case INSTRUCTION::BEQ:
+    case INSTRUCTION::BMI:
+    case INSTRUCTION::BNE:
+    case INSTRUCTION::BPL:
+    case INSTRUCTION::BVC:
+    case INSTRUCTION::BVS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Recompiler::ends_block(INSTRUCTION ins) {
+    switch (ins) {
+    case INSTRUCTION::BRK:
+    case INSTRUCTION::JMP:
+    case INSTRUCTION::JSR:
+    case INSTRUCTION::RTI:
+    case INSTRUCTION::RTS:
+        return true;
+    default:
+        return is_branch(ins);
+    }
+}
+
+std::vector<WORD> Recompiler::targets(WORD addr) const {
+    const Instruction_info &info = lookup_table[byte(addr)];
+    WORD next = addr + info.bytes;
+    WORD value = operand(addr);
+    if (is_branch(info.ins)) {
+        return {WORD(next + static_cast<int8_t>(value))};
+    }
+    switch (info.ins) {
+    case INSTRUCTION::JMP:
+        if (info.mode == ADDRESSING_MODE::ABSOLUTE) {
+            return {value};
+        }
+        // A pointer in the image is taken to stay put; one in RAM is
+        // left to the interpreter at run time
+        {
+            WORD hi_addr = (value & 0xff00) | ((value + 1) & 0x00ff);
+            if (covered(value) && covered(hi_addr)) {
+                return {WORD(byte(value) | (byte(hi_addr) << 8))};
+            }
+        }
+        return {};
+    case INSTRUCTION::JSR:
+        // RTS comes back after the JSR
+        return {value, next};
+    default:
+        return {};
+    }
+}
+
+bool Recompiler::may_raise(const Instruction_info &info) {
+    switch (info.ins) {
+    case INSTRUCTION::CLI:
+    case INSTRUCTION::PLP:
+    case INSTRUCTION::PHA:
+    case INSTRUCTION::PHP:
+    case INSTRUCTION::PLA:
+        return true;
+    default:
+        return info.mode != ADDRESSING_MODE::IMPLICIT &&
+               info.mode != ADDRESSING_MODE::ACCUMULATOR &&
+               info.mode != ADDRESSING_MODE::IMMEDIATE &&
+               info.mode != ADDRESSING_MODE::RELATIVE &&
+               !(info.ins == INSTRUCTION::JMP &&
+                 info.mode == ADDRESSING_MODE::ABSOLUTE);
+    }
+}
+
+void Recompiler::trace(WORD entry) {
+    std::deque<WORD> work = {entry};
+    while (!work.empty()) {
+        WORD addr = work.front();
+        work.pop_front();
+        if (!valid(addr)) {
+            continue;
+        }
+        leaders.insert(addr);
+        // Walk straight-line code until it leaves or joins code seen
+        while (valid(addr)) {
+            if (!decoded.insert(addr).second) {
+                // Code seen before now starts a block of its own
+                leaders.insert(addr);
+                break;
+            }
+            const Instruction_info &info = lookup_table[byte(addr)];
+            for (WORD target : targets(addr)) {
+                work.push_back(target);
+            }
+            if (ends_block(info.ins)) {
+                if (is_branch(info.ins)) {
+                    work.push_back(addr + info.bytes);
+                }
+                break;
+            }
+            addr += info.bytes;
+        }
+    }
+}
+
+std::vector<WORD> Recompiler::block(WORD leader) const {
+    std::vector<WORD> instructions;
+    uint32_t addr = leader;
+    while (instructions.size() < MAX_BLOCK_LENGTH && addr <= 0xffff &&
+           valid(addr) &&
+           (instructions.empty() || leaders.count(addr) == 0)) {
+        instructions.push_back(addr);
+        const Instruction_info &info = lookup_table[byte(addr)];
+        if (ends_block(info.ins)) {
+            break;
+        }
+        addr += info.bytes;
+    }
+    return instructions;
+}
+
+void Recompiler::split_long_blocks() {
+    std::deque<WORD> work(leaders.begin(), leaders.end());
+    while (!work.empty()) {
+        std::vector<WORD> instructions = block(work.front());
+        work.pop_front();
+        WORD last = instructions.back();
+        const Instruction_info &info = lookup_table[byte(last)];
+        WORD next = last + info.bytes;
+        if (instructions.size() == MAX_BLOCK_LENGTH &&
+            !ends_block(info.ins) && valid(next) &&
+            leaders.insert(next).second) {
+            work.push_back(next);
+        }
+    }
+}
+
+std::string Recompiler::disassemble(WORD addr) const {
+    const Instruction_info &info = lookup_table[byte(addr)];
+    WORD value = operand(addr);
+    std::string text = info.mnemonic;
+    switch (info.mode) {
+    case ADDRESSING_MODE::ACCUMULATOR:
+        return text + " A";
+    case ADDRESSING_MODE::IMMEDIATE:
+        return text + " #$" + hex(value, 2);
+    case ADDRESSING_MODE::ZEROPAGE:
+        return text + " $" + hex(value, 2);
+    case ADDRESSING_MODE::ZEROPAGE_X:
+        return text + " $" + hex(value, 2) + ",X";
+    case ADDRESSING_MODE::ZEROPAGE_Y:
+        return text + " $" + hex(value, 2) + ",Y";
+    case ADDRESSING_MODE::RELATIVE:
+        return text + " $" +
+               hex(WORD(addr + 2 + static_cast<int8_t>(value)), 4);
+    case ADDRESSING_MODE::ABSOLUTE:
+        return text + " $" + hex(value, 4);
+    case ADDRESSING_MODE::ABSOLUTE_X:
+        return text + " $" + hex(value, 4) + ",X";
+    case ADDRESSING_MODE::ABSOLUTE_Y:
+        return text + " $" + hex(value, 4) + ",Y";
+    case ADDRESSING_MODE::INDIRECT:
+        return text + " ($" + hex(value, 4) + ")";
+    case ADDRESSING_MODE::INDIRECT_X:
+        return text + " ($" + hex(value, 2) + ",X)";
+    case ADDRESSING_MODE::INDIRECT_Y:
+        return text + " ($" + hex(value, 2) + "),Y";
+    default:
+        return text;
+    }
+}
+
+void Recompiler::emit(std::ostream &os, const std::string &name,
+                      const std::string &source) const {
+    os << "// Generated by mos6502_aot from " << source
+       << "; do not edit.\n"
+       << "#include <Aot.hpp>\n\n"
+       << "namespace {\n"
+       << "using mos6502::Aot_context;\n"
+       << "using mos6502::Aot_registers;\n";
+
+    // Base cycles plus every penalty, for each block
+    std::map<WORD, std::pair<WORD, int>> table;
+    for (WORD leader : leaders) {
+        std::vector<WORD> instructions = block(leader);
+        int max_cycles = 0;
+        for (WORD addr : instructions) {
+            const Instruction_info &info = lookup_table[byte(addr)];
+            max_cycles += info.cycles;
+            if (is_branch(info.ins)) {
+                max_cycles += 2;
+            } else if ((info.mode == ADDRESSING_MODE::ABSOLUTE_X ||
+                        info.mode == ADDRESSING_MODE::ABSOLUTE_Y ||
+                        info.mode == ADDRESSING_MODE::INDIRECT_Y) &&
+                       info.ins != INSTRUCTION::STA &&
+                       info.ins != INSTRUCTION::ASL &&
+                       info.ins != INSTRUCTION::LSR &&
+                       info.ins != INSTRUCTION::ROL &&
+                       info.ins != INSTRUCTION::ROR &&
+                       info.ins != INSTRUCTION::INC &&
+                       info.ins != INSTRUCTION::DEC) {
+                max_cycles += 1;
+            }
+        }
+        WORD last = instructions.back();
+        table[leader] = {last, max_cycles};
+
+        // A block that can jump back to its own start loops in place
+        // while the next pass fits the budget
+        std::vector<WORD> back = targets(last);
+        bool loops =
+            std::find(back.begin(), back.end(), leader) != back.end() &&
+            lookup_table[byte(last)].ins != INSTRUCTION::JSR;
+        std::string indent = loops ? "        " : "    ";
+
+        os << "\nvoid block_" << hex(leader, 4) << "(Aot_context &ctx) {\n"
+           << "    Aot_registers r = ctx.load();\n";
+        if (loops) {
+            os << "    do {\n";
+        }
+        for (WORD addr : instructions) {
+            const Instruction_info &info = lookup_table[byte(addr)];
+            os << indent << "// $" << hex(addr, 4) << ": " << disassemble(addr)
+               << "\n"
+               << indent << "ctx.op<0x" << hex(byte(addr), 2) << ">(r, 0x"
+               << hex(WORD(addr + info.bytes), 4) << ", 0x"
+               << hex(operand(addr), 4) << ");\n";
+            if (may_raise(info) && (addr != last || loops)) {
+                os << indent << "if (ctx.leave(r)) {\n"
+                   << indent << "    return;\n"
+                   << indent << "}\n";
+            }
+        }
+        if (loops) {
+            os << "    } while (r.pc == 0x" << hex(leader, 4)
+               << " && ctx.again(r, " << max_cycles << "));\n";
+        }
+        os << "    ctx.store(r);\n"
+           << "}\n";
+    }
+
+    std::vector<int> pages;
+    for (int page = 0; page < 0x100; page++) {
+        if (image.page(page) == nullptr) {
+            continue;
+        }
+        pages.push_back(page);
+        os << "\nconst mos6502::BYTE page_" << hex(page, 2) << "[0x100] = {";
+        for (int offset = 0; offset < 0x100; offset++) {
+            os << (offset % 12 == 0 ? "\n    " : " ") << "0x"
+               << hex(image.page(page)[offset], 2) << ",";
+        }
+        os << "\n};\n";
+    }
+
+    os << "\nconst mos6502::Aot_block blocks[] = {\n";
+    for (const auto &entry : table) {
+        os << "    {0x" << hex(entry.first, 4) << ", 0x"
+           << hex(entry.second.first, 4) << ", " << entry.second.second
+           << ", block_" << hex(entry.first, 4) << "},\n";
+    }
+    os << "};\n\nconst mos6502::Aot_page pages[] = {\n";
+    for (int page : pages) {
+        os << "    {0x" << hex(page, 2) << ", page_" << hex(page, 2)
+           << "},\n";
+    }
+    os << "};\n"
+       << "} // namespace\n\n"
+       << "extern const mos6502::Aot_program " << name << " = {\n"
+       << "    blocks, sizeof(blocks) / sizeof(blocks[0]),\n"
+       << "    pages, sizeof(pages) / sizeof(pages[0])};\n";
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Image_format format = Image_format::AUTO;
+    WORD origin = 0;
+    std::vector<WORD> entries;
+    std::string name = "aot_program";
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--format" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value == "raw") {
+                format = Image_format::RAW;
+            } else if (value == "hex") {
+                format = Image_format::INTEL_HEX;
+            } else if (value == "prg") {
+                format = Image_format::PRG;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--origin" && i + 1 < argc) {
+            if (!parse_address(argv[++i], origin)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--entry" && i + 1 < argc) {
+            WORD entry;
+            if (!parse_address(argv[++i], entry)) {
+                usage(argv[0]);
+                return 1;
+            }
+            entries.push_back(entry);
+        } else if (arg == "--name" && i + 1 < argc) {
+            name = argv[++i];
+        } else if (arg[0] != '-') {
+            paths.push_back(arg);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (paths.size() != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Rom_image image;
+    std::string error;
+    if (!image.load(paths[0], format, origin, error)) {
+        std::cerr << "Failed to load rom: " << error << "\n";
+        return 1;
+    }
+
+    Recompiler recompiler(image);
+    // Vectors held by the image: NMI, RESET and IRQ/BRK
+    for (WORD vector : {0xfffa, 0xfffc, 0xfffe}) {
+        const BYTE *page = image.page(0xff);
+        if (page != nullptr) {
+            entries.push_back(page[vector & 0xff] |
+                              (page[(vector & 0xff) + 1] << 8));
+        }
+    }
+    for (WORD entry : entries) {
+        recompiler.trace(entry);
+    }
+    recompiler.split_long_blocks();
+
+    std::ostringstream code;
+    recompiler.emit(code, name, paths[0]);
+    std::ofstream out(paths[1]);
+    if (!(out << code.str()) || !out.flush()) {
+        std::cerr << "Failed to write " << paths[1] << "\n";
+        return 1;
+    }
+    std::cout << recompiler.instructions() << " instructions in "
+              << recompiler.blocks() << " blocks\n";
+    return 0;
+}
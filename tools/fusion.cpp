@@ -0,0 +1,118 @@
+#include <Bus.hpp>
+#include <Fusion.hpp>
+#include <Loader.hpp>
+#include <Profile.hpp>
+#include <Types.hpp>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace mos6502;
+
+namespace {
+void usage(const char *program) {
+    std::cerr << "Usage: " << program
+              << " [--format raw|hex|prg] [--origin ADDR] [--rules N]\n"
+              << "       <profile> <rom_file> <output.hpp>\n"
+              << "  profile   written by Profile::write() while running the "
+                 "image\n"
+              << "  --origin  load address of a raw image, default 0\n"
+              << "  --rules   sequences to keep, default 32\n";
+}
+
+bool parse_number(const char *text, unsigned long max, unsigned long &value) {
+    char *end;
+    value = std::strtoul(text, &end, 0);
+    return *end == '\0' && value <= max;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Image_format format = Image_format::AUTO;
+    unsigned long origin = 0;
+    unsigned long rules = 32;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--format" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value == "raw") {
+                format = Image_format::RAW;
+            } else if (value == "hex") {
+                format = Image_format::INTEL_HEX;
+            } else if (value == "prg") {
+                format = Image_format::PRG;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--origin" && i + 1 < argc) {
+            if (!parse_number(argv[++i], 0xffff, origin)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--rules" && i + 1 < argc) {
+            if (!parse_number(argv[++i], 0x10000, rules)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg[0] != '-') {
+            paths.push_back(arg);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (paths.size() != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Profile profile;
+    std::ifstream profile_file(paths[0], std::ios::binary);
+    if (!profile.read(profile_file)) {
+        std::cerr << "Not a profile: " << paths[0] << "\n";
+        return 1;
+    }
+
+    Rom_image image;
+    std::string error;
+    if (!image.load(paths[1], format, origin, error)) {
+        std::cerr << "Failed to load rom: " << error << "\n";
+        return 1;
+    }
+
+    // The image over zeroed RAM, as the profiled code saw it
+    auto memory = std::make_unique<mem_t>();
+    memory->fill(0);
+    Bus bus(*memory);
+    for (int page = 0; page < 0x100; page++) {
+        if (image.page(page) != nullptr) {
+            bus.map_rom(page, 1, image.page(page));
+        }
+    }
+
+    std::vector<Fusion_candidate> candidates =
+        rank_fusions(profile, bus, rules);
+
+    std::ostringstream code;
+    write_fusion_table(code, candidates, paths[0]);
+    std::ofstream out(paths[2]);
+    if (!(out << code.str()) || !out.flush()) {
+        std::cerr << "Failed to write " << paths[2] << "\n";
+        return 1;
+    }
+    uint64_t saved = 0;
+    for (const Fusion_candidate &candidate : candidates) {
+        saved += candidate.saved;
+    }
+    std::cout << candidates.size() << " sequences, up to " << saved << " of "
+              << profile.instructions() << " dispatches saved\n";
+    return 0;
+}
@@ -0,0 +1,34 @@
+#include <Trace.hpp>
+#include <TraceFile.hpp>
+#include <Types.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " <trace_file> [first [count]]\n";
+        return 1;
+    }
+
+    mos6502::Trace_reader reader(argv[1]);
+    if (!reader.valid()) {
+        std::cerr << "Not a trace file: " << argv[1] << "\n";
+        return 1;
+    }
+
+    uint64_t first = argc > 2 ? std::strtoull(argv[2], nullptr, 0) : 0;
+    uint64_t count = argc > 3 ? std::strtoull(argv[3], nullptr, 0) : 20;
+
+    std::cout << reader.size() << " instructions\n";
+    for (uint64_t index = first; index < first + count; index++) {
+        mos6502::Trace_record record;
+        if (!reader.read(index, record)) {
+            break;
+        }
+        std::cout << index << "\t" << mos6502::Trace_buffer::format(record)
+                  << "\n";
+    }
+    return 0;
+}